@@ -0,0 +1,74 @@
+//
+// Checks that deterministic mode gives bit-identical runs on any number of threads, and
+// measures what it costs compared to fast mode.
+//
+// The same seeded scene is simulated with 1 to 64 threads in both execution modes. For every
+// run we print the state hash, the kinetic energy and the time per frame. The program fails
+// if two deterministic runs disagree.
+// Run with: ./determinism_check [particles] [frames] [seed]
+//
+
+#include "Simulation.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+namespace {
+
+struct RunResult {
+    uint64_t hash;
+    double energy;
+    double msPerFrame;
+};
+
+RunResult run(ExecutionMode mode, unsigned threads, int particleCount, int frames, uint64_t seed) {
+    std::unique_ptr<ThreadPool> pool(threads > 1 ? new ThreadPool(threads) : nullptr);
+
+    Simulation simulation;
+    simulation.setSeed(seed);
+    simulation.setExecutionMode(mode);
+    simulation.setThreadPool(pool.get());
+    simulation.addRandomParticles(particleCount);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        simulation.simulate(0.01f);
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    return RunResult{simulation.stateHash(), double(simulation.kineticEnergy()), ms / frames};
+}
+
+}
+
+int main(int argc, char **argv) {
+    int particleCount = argc > 1 ? std::atoi(argv[1]) : 1000;
+    int frames = argc > 2 ? std::atoi(argv[2]) : 200;
+    uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 42;
+
+    std::printf("%d particles, %d frames, seed %llu\n\n", particleCount, frames, (unsigned long long) seed);
+    std::printf("%7s  %-13s  %-18s  %-22s  %9s\n", "threads", "mode", "state hash", "kinetic energy", "ms/frame");
+
+    bool reproducible = true;
+    uint64_t reference = 0;
+    for (unsigned threads = 1; threads <= 64; threads *= 2) {
+        RunResult fast = run(ExecutionMode::Fast, threads, particleCount, frames, seed);
+        RunResult exact = run(ExecutionMode::Deterministic, threads, particleCount, frames, seed);
+        if (threads == 1) {
+            reference = exact.hash;
+        } else if (exact.hash != reference) {
+            reproducible = false;
+        }
+
+        std::printf("%7u  %-13s  %016llx  %22.17g  %9.3f\n", threads, "fast",
+                    (unsigned long long) fast.hash, fast.energy, fast.msPerFrame);
+        std::printf("%7u  %-13s  %016llx  %22.17g  %9.3f  (%+.1f%%)\n", threads, "deterministic",
+                    (unsigned long long) exact.hash, exact.energy, exact.msPerFrame,
+                    100.0 * (exact.msPerFrame / fast.msPerFrame - 1.0));
+    }
+
+    std::printf("\ndeterministic runs %s\n", reproducible ? "are bit-identical" : "DIFFER");
+    return reproducible ? 0 : 1;
+}
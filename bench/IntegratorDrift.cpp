@@ -0,0 +1,110 @@
+//
+// Energy-drift benchmark for the integrator policies.
+//
+// Every integrator advances the same set of particles in a harmonic well (a = -k x, no walls)
+// over a sweep of timesteps. For each timestep we report the worst relative energy error seen
+// during the run, and for each integrator the largest timestep whose error stays within the
+// tolerance. Run with: ./integrator_bench [tolerance]
+//
+
+#include "Integrator.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <vector>
+
+namespace {
+
+const int kParticles = 256;
+const float kStiffness = 1.0f;
+const float kDuration = 60.0f; // About ten periods of the well
+
+struct DriftResult {
+    double maxRelativeError;
+    double nsPerParticleStep;
+};
+
+double totalEnergy(const std::vector<glm::vec3> &x, const std::vector<glm::vec3> &v) {
+    double energy = 0.0;
+    for (size_t i = 0; i < x.size(); ++i) {
+        energy += 0.5 * glm::dot(v[i], v[i]) + 0.5 * kStiffness * glm::dot(x[i], x[i]);
+    }
+    return energy;
+}
+
+template <typename Integrator>
+DriftResult measure(float dt) {
+    HarmonicField<glm::vec3> field{kStiffness};
+    std::vector<glm::vec3> x(kParticles), v(kParticles), a(kParticles);
+    for (int i = 0; i < kParticles; ++i) {
+        float phase = 6.2831853f * float(i) / float(kParticles);
+        x[i] = glm::vec3(std::cos(phase), std::sin(phase), 0.0f);
+        v[i] = glm::vec3(-std::sin(phase), 0.5f * std::cos(phase), 0.0f);
+        primeAcceleration(x[i], a[i], field);
+    }
+
+    const double initial = totalEnergy(x, v);
+    const int steps = int(kDuration / dt);
+    const float noWalls = std::numeric_limits<float>::infinity();
+    double worst = 0.0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; ++s) {
+        integrateParticles<Integrator>(x.data(), v.data(), a.data(), x.size(), dt, noWalls, field);
+        if (s % 16 == 15 || s == steps - 1) {
+            double error = std::abs(totalEnergy(x, v) - initial) / initial;
+            if (!(error <= worst)) {
+                worst = error; // Also catches NaN from a blown-up run
+            }
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    return DriftResult{worst, elapsed / (double(steps) * kParticles)};
+}
+
+template <typename Integrator>
+void report(const std::vector<float> &timesteps, double tolerance) {
+    std::printf("\n%s\n", Integrator::name());
+    std::printf("  %10s  %14s  %12s\n", "dt", "max |dE|/E0", "ns/particle");
+
+    float largestStable = 0.0f;
+    bool stillStable = true;
+    for (float dt : timesteps) {
+        DriftResult result = measure<Integrator>(dt);
+        std::printf("  %10.5f  %14.6e  %12.2f\n", dt, result.maxRelativeError, result.nsPerParticleStep);
+        if (stillStable && result.maxRelativeError <= tolerance) {
+            largestStable = dt;
+        } else {
+            stillStable = false;
+        }
+    }
+
+    if (largestStable > 0.0f) {
+        std::printf("  largest stable dt (|dE|/E0 <= %g): %g\n", tolerance, largestStable);
+    } else {
+        std::printf("  no timestep in the sweep keeps |dE|/E0 <= %g\n", tolerance);
+    }
+}
+
+}
+
+int main(int argc, char **argv) {
+    double tolerance = argc > 1 ? std::atof(argv[1]) : 0.01;
+
+    // Geometric sweep from 1e-4 up to just under the symplectic stability limit of 2/omega.
+    std::vector<float> timesteps;
+    for (float dt = 1e-4f; dt < 2.0f; dt *= 1.5f) {
+        timesteps.push_back(dt);
+    }
+
+    std::printf("Harmonic well, k = %g, %d particles, %g s per run\n", kStiffness, kParticles, kDuration);
+    report<ExplicitEuler>(timesteps, tolerance);
+    report<SemiImplicitEuler>(timesteps, tolerance);
+    report<VelocityVerlet>(timesteps, tolerance);
+    report<Leapfrog>(timesteps, tolerance);
+    return 0;
+}
@@ -0,0 +1,342 @@
+//
+// Microbenchmarks of the simulation and render kernels in isolation, as JSON.
+//
+// Every kernel runs on a random planar scene whose box grows with the particle count, so the
+// density, and with it the number of contacts per particle, stays the same from 10^2 to 10^7
+// particles. Each measurement repeats until it has run for --min-time seconds (at least three
+// times) and reports the median. Kernels that change particles work on copies restored between
+// repetitions, outside the timed region.
+// Run with: ./kernel_bench [--min 100] [--max 10000000] [--threads N] [--min-time 0.25]
+//                          [--label name] [--out results.json]
+//
+
+#include "Simulation.hpp"
+#include "Integrator.hpp"
+#include "Replay.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define KERNEL_BENCH_STRING(x) #x
+#define KERNEL_BENCH_EXPAND(x) KERNEL_BENCH_STRING(x)
+
+namespace {
+
+typedef Simulation::Real Real;
+typedef Simulation::Vec Vec;
+typedef Simulation::Position Position;
+typedef Simulation::Storage Storage;
+
+const Real kRadius = Real(0.05);
+const double kAreaFraction = 0.25; // Share of the box covered by particles
+const std::size_t kCellsPerBlock = 256; // As in Simulation::handleCollisions
+const std::size_t kAllPairsLimit = 10000; // The quadratic reference stops here
+
+struct Measurement {
+    std::string kernel;
+    std::size_t particles = 0;
+    std::size_t repetitions = 0;
+    double median = 0.0; // Seconds
+    double fastest = 0.0;
+    double pairs = 0.0; // Pairs handled per repetition, 0 if not a pair kernel
+    double bytes = 0.0; // Bytes read and written per repetition, 0 if not meaningful
+};
+
+/**
+ * Times body until it has run for minSeconds and at least three times; prepare runs untimed
+ * before every repetition.
+ */
+Measurement measure(const std::string &kernel, std::size_t particles, double minSeconds,
+                    const std::function<void()> &prepare, const std::function<void()> &body) {
+    std::vector<double> times;
+    double total = 0.0;
+    while ((total < minSeconds || times.size() < 3) && times.size() < 1000) {
+        prepare();
+        const auto start = std::chrono::steady_clock::now();
+        body();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        times.push_back(seconds);
+        total += seconds;
+    }
+    std::sort(times.begin(), times.end());
+    Measurement result;
+    result.kernel = kernel;
+    result.particles = particles;
+    result.repetitions = times.size();
+    result.median = times[times.size() / 2];
+    result.fastest = times.front();
+    return result;
+}
+
+/**
+ * A random planar scene of the given size at constant density.
+ */
+struct Scene {
+    Real halfExtent;
+    std::vector<glm::vec<3, Real> > positions;
+    std::vector<glm::vec<3, Real> > velocities;
+    std::vector<Real> masses;
+    std::vector<glm::vec3> colors;
+
+    explicit Scene(std::size_t count) {
+        halfExtent = Real(double(kRadius) * std::sqrt(double(count) * 3.141592653589793 / kAreaFraction) / 2.0);
+        std::mt19937_64 generator(count);
+        std::uniform_real_distribution<double> unit(-1.0, 1.0);
+        positions.resize(count);
+        velocities.resize(count);
+        masses.resize(count);
+        colors.resize(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            positions[i] = glm::vec<3, Real>(Real(halfExtent * unit(generator)), Real(halfExtent * unit(generator)), Real(0));
+            velocities[i] = glm::vec<3, Real>(Real(unit(generator)), Real(unit(generator)), Real(0));
+            masses[i] = Real(1.5 + 0.5 * unit(generator));
+            colors[i] = glm::vec3(0.5f);
+        }
+    }
+
+    ParticleArrays<Real> arrays() const {
+        ParticleArrays<Real> view;
+        view.count = positions.size();
+        view.positions = positions.data();
+        view.velocities = velocities.data();
+        view.masses = masses.data();
+        view.colors = colors.data();
+        return view;
+    }
+};
+
+void benchmarkSize(std::size_t count, ThreadPool *pool, double minSeconds, std::vector<Measurement> &results) {
+    const Scene scene(count);
+    const ParticleArrays<Real> arrays = scene.arrays();
+    auto nothing = []() {};
+
+    // Spawning: the random path of addRandomParticles and the bulk path of addParticles.
+    {
+        std::unique_ptr<Simulation> fresh;
+        auto reset = [&]() {
+            fresh.reset();
+            fresh.reset(new Simulation());
+            fresh->setThreadPool(pool);
+        };
+        Measurement random = measure("spawn_random", count, minSeconds, reset, [&]() { fresh->addRandomParticles(int(count)); });
+        random.bytes = double(count) * double(Storage::bytesPerParticle());
+        results.push_back(random);
+        Measurement bulk = measure("spawn_bulk", count, minSeconds, reset, [&]() { fresh->addParticles(arrays); });
+        bulk.bytes = double(count) * (double(Storage::bytesPerParticle()) + sizeof(glm::vec<3, Real>) * 2 + sizeof(Real) +
+                                      sizeof(glm::vec3));
+        results.push_back(bulk);
+    }
+
+    Simulation simulation;
+    simulation.setThreadPool(pool);
+    simulation.setBoundary(scene.halfExtent);
+    simulation.addParticles(arrays);
+    const Storage &particles = simulation.getParticles();
+    const std::vector<Position> basePositions(particles.positions.begin(), particles.positions.end());
+    const std::vector<Vec> baseVelocities(particles.velocities.begin(), particles.velocities.end());
+    const std::vector<Vec> baseAccelerations(particles.accelerations.begin(), particles.accelerations.end());
+    const Real *masses = particles.masses.data();
+    std::vector<Position> positions = basePositions;
+    std::vector<Vec> velocities = baseVelocities;
+    std::vector<Vec> accelerations = baseAccelerations;
+    auto restore = [&]() {
+        std::copy(basePositions.begin(), basePositions.end(), positions.begin());
+        std::copy(baseVelocities.begin(), baseVelocities.end(), velocities.begin());
+        std::copy(baseAccelerations.begin(), baseAccelerations.end(), accelerations.begin());
+    };
+
+    // Broad phases.
+    UniformGrid<SIM_DIMENSION, Position> grid;
+    Measurement build = measure("grid_build", count, minSeconds, nothing, [&]() {
+        grid.build(basePositions.data(), count, 2.0 * double(kRadius));
+    });
+    build.bytes = double(count) * (sizeof(Position) + 3 * sizeof(uint32_t));
+    results.push_back(build);
+
+    std::size_t candidates = 0;
+    Measurement serial = measure("grid_pairs_serial", count, minSeconds, [&]() { candidates = 0; }, [&]() {
+        grid.forEachCandidatePair([&](uint32_t, uint32_t) { ++candidates; });
+    });
+    serial.pairs = double(candidates);
+    results.push_back(serial);
+
+    const Real reach = Real(4) * kRadius * kRadius;
+    const std::size_t cells = grid.cellCount();
+    const std::size_t blocks = (cells + kCellsPerBlock - 1) / kCellsPerBlock;
+    std::vector<std::vector<Contact> > lists(pool != nullptr ? pool->size() : 1);
+    Measurement gather = measure("grid_pairs_parallel", count, minSeconds, [&]() {
+        for (std::vector<Contact> &list : lists) {
+            list.clear();
+        }
+    }, [&]() {
+        parallelFor(pool, blocks, 1, [&](std::size_t first, std::size_t last, unsigned thread) {
+            for (std::size_t block = first; block < last; ++block) {
+                grid.forEachCandidatePair(block * kCellsPerBlock, std::min(cells, (block + 1) * kCellsPerBlock),
+                                          [&](uint32_t i, uint32_t j) {
+                    Vec diff = Vec(basePositions[i] - basePositions[j]);
+                    if (glm::dot(diff, diff) < reach) {
+                        lists[thread].push_back(Contact{i, j});
+                    }
+                });
+            }
+        });
+    });
+    gather.pairs = double(candidates);
+    results.push_back(gather);
+
+    if (count <= kAllPairsLimit) {
+        std::size_t touching = 0;
+        Measurement allPairs = measure("all_pairs", count, minSeconds, [&]() { touching = 0; }, [&]() {
+            for (std::size_t i = 0; i < count; ++i) {
+                for (std::size_t j = i + 1; j < count; ++j) {
+                    Vec diff = Vec(basePositions[i] - basePositions[j]);
+                    touching += glm::dot(diff, diff) < reach ? 1 : 0;
+                }
+            }
+        });
+        allPairs.pairs = double(count) * double(count - 1) / 2.0;
+        results.push_back(allPairs);
+    }
+
+    // Narrow phase over the contacts the broad phase found.
+    std::vector<Contact> contacts;
+    for (const std::vector<Contact> &list : lists) {
+        contacts.insert(contacts.end(), list.begin(), list.end());
+    }
+    Measurement narrow = measure("narrow_phase", count, minSeconds, restore, [&]() {
+        for (const Contact &contact : contacts) {
+            resolveContact(positions.data(), velocities.data(), masses, contact.i, contact.j, kRadius);
+        }
+    });
+    narrow.pairs = double(contacts.size());
+    narrow.bytes = double(contacts.size()) * 2.0 * (sizeof(Position) + sizeof(Vec) + sizeof(Real));
+    results.push_back(narrow);
+
+    // Boundary reflection and integration, as one pass of Simulation::simulate does them.
+    const UniformField<Vec> field{Vec(Real(0))};
+    Measurement integrate = measure("integrate", count, minSeconds, restore, [&]() {
+        parallelFor(pool, count, 4096, [&](std::size_t begin, std::size_t end, unsigned) {
+            integrateParticles<ActiveIntegrator>(positions.data() + begin, velocities.data() + begin,
+                                                 accelerations.data() + begin, end - begin, Real(0.001),
+                                                 scene.halfExtent, field);
+        });
+    });
+    integrate.bytes = double(count) * 2.0 * (sizeof(Position) + 2 * sizeof(Vec));
+    results.push_back(integrate);
+
+    // Packing the vertex buffer the renderer draws from.
+    const std::vector<SnapshotColumn> columns = simulation.describeParticles(~0u);
+    std::vector<VertexData> vertices;
+    frameVertices(count, columns, vertices);
+    Measurement pack = measure("render_pack", count, minSeconds, nothing, [&]() { frameVertices(count, columns, vertices); });
+    pack.bytes = double(count) * (sizeof(Position) + sizeof(Vec) + sizeof(Real) + sizeof(glm::vec3) + sizeof(VertexData));
+    results.push_back(pack);
+}
+
+std::string quoted(const std::string &text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string json(const std::vector<Measurement> &results, const std::string &label, unsigned threads) {
+    std::ostringstream out;
+    out.precision(9);
+    out << "{\n  \"benchmark\": \"kernel_bench\",\n  \"version\": 1,\n  \"label\": " << quoted(label) << ",\n"
+        << "  \"config\": {\"dimension\": " << SIM_DIMENSION << ", \"scalar\": \"" << KERNEL_BENCH_EXPAND(SIM_SCALAR)
+        << "\", \"integrator\": \"" << ActiveIntegrator::name() << "\", \"threads\": " << threads << "},\n"
+        << "  \"results\": [";
+    for (std::size_t r = 0; r < results.size(); ++r) {
+        const Measurement &m = results[r];
+        out << (r == 0 ? "\n" : ",\n") << "    {\"kernel\": \"" << m.kernel << "\", \"particles\": " << m.particles
+            << ", \"repetitions\": " << m.repetitions << ", \"seconds_median\": " << m.median
+            << ", \"seconds_min\": " << m.fastest << ", \"ns_per_particle\": " << m.median * 1e9 / double(m.particles);
+        out << ", \"pairs_per_second\": ";
+        if (m.pairs > 0.0) {
+            out << m.pairs / m.median;
+        } else {
+            out << "null";
+        }
+        out << ", \"bytes_per_second\": ";
+        if (m.bytes > 0.0) {
+            out << m.bytes / m.median;
+        } else {
+            out << "null";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::size_t smallest = 100;
+    std::size_t largest = 10000000;
+    unsigned threads = 1;
+    double minSeconds = 0.25;
+    std::string label;
+    std::string output;
+    for (int a = 1; a + 1 < argc; a += 2) {
+        const std::string option = argv[a];
+        const char *value = argv[a + 1];
+        if (option == "--min") {
+            smallest = std::size_t(std::atof(value));
+        } else if (option == "--max") {
+            largest = std::size_t(std::atof(value));
+        } else if (option == "--threads") {
+            threads = unsigned(std::atoi(value));
+        } else if (option == "--min-time") {
+            minSeconds = std::atof(value);
+        } else if (option == "--label") {
+            label = value;
+        } else if (option == "--out") {
+            output = value;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    ThreadPool pool(threads);
+    std::vector<Measurement> results;
+    for (std::size_t count = std::max<std::size_t>(smallest, 2); count <= largest; count *= 10) {
+        const std::size_t first = results.size();
+        benchmarkSize(count, &pool, minSeconds, results);
+        for (std::size_t r = first; r < results.size(); ++r) {
+            std::fprintf(stderr, "%-20s %10zu  %10.2f ns/particle\n", results[r].kernel.c_str(), count,
+                         results[r].median * 1e9 / double(count));
+        }
+    }
+
+    const std::string report = json(results, label, pool.size());
+    if (output.empty()) {
+        std::cout << report;
+    } else {
+        std::ofstream file(output, std::ios::trunc);
+        file << report;
+        if (!file) {
+            std::cerr << "Cannot write " << output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
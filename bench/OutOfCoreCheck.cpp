@@ -0,0 +1,186 @@
+//
+// Checks the out-of-core simulation against the in-memory one on the same seeded scene, and
+// reports what streaming the tiles costs.
+//
+// A built-in scenario is loaded into a Simulation and into an OutOfCoreSimulation whose tiles
+// live in a fresh temporary directory, and both are stepped the same number of frames. Particles
+// are stored in different orders, so the states are compared through order-free summaries: the
+// particle count, kinetic energy, momentum, centre of mass and the sorted coordinates along each
+// axis. Contacts across the outer edge of a tile's halo are not seen (see OutOfCore.hpp), and a
+// contact resolved differently sends its particles elsewhere, a difference that grows with every
+// frame; so coordinates, in particle radii, are only reported. The program fails if a particle was
+// lost or the energy, momentum or centre of mass differs by more than the relative tolerance.
+// Run with: ./out_of_core_check [scenario] [particles] [frames] [tiles per axis] [seed] [tolerance]
+//
+
+#include "Simulation.hpp"
+#include "OutOfCore.hpp"
+#include "Scenario.hpp"
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace {
+
+typedef Simulation::Real Real;
+typedef Simulation::Storage Storage;
+
+struct Summary {
+    std::size_t count = 0;
+    double energy = 0.0;
+    glm::dvec3 momentum = glm::dvec3(0.0);
+    glm::dvec3 centre = glm::dvec3(0.0);
+    std::vector<double> sorted[SIM_DIMENSION]; // Coordinates along each axis, ascending
+};
+
+Summary summarize(const Storage &particles) {
+    Summary summary;
+    summary.count = particles.size();
+    double mass = 0.0;
+    for (int d = 0; d < SIM_DIMENSION; ++d) {
+        summary.sorted[d].resize(particles.size());
+    }
+    for (std::size_t i = 0; i < particles.size(); ++i) {
+        const double m = double(particles.masses[i]);
+        const glm::dvec3 v(toVec3(particles.velocities[i]));
+        const glm::dvec3 p(toVec3(asVector(particles.positions[i])));
+        summary.energy += 0.5 * m * glm::dot(v, v);
+        summary.momentum += m * v;
+        summary.centre += m * p;
+        mass += m;
+        for (int d = 0; d < SIM_DIMENSION; ++d) {
+            summary.sorted[d][i] = p[d];
+        }
+    }
+    summary.centre /= std::max(mass, 1e-300);
+    for (int d = 0; d < SIM_DIMENSION; ++d) {
+        std::sort(summary.sorted[d].begin(), summary.sorted[d].end());
+    }
+    return summary;
+}
+
+/**
+ * Returns the largest difference between matching order statistics of the two states.
+ */
+double coordinateDifference(const Summary &a, const Summary &b) {
+    double largest = 0.0;
+    for (int d = 0; d < SIM_DIMENSION; ++d) {
+        for (std::size_t i = 0; i < std::min(a.sorted[d].size(), b.sorted[d].size()); ++i) {
+            largest = std::max(largest, std::fabs(a.sorted[d][i] - b.sorted[d][i]));
+        }
+    }
+    return largest;
+}
+
+void removeDirectory(const std::string &directory) {
+    if (DIR *listing = ::opendir(directory.c_str())) {
+        while (dirent *entry = ::readdir(listing)) {
+            const std::string name = entry->d_name;
+            if (name != "." && name != "..") {
+                ::unlink((directory + "/" + name).c_str());
+            }
+        }
+        ::closedir(listing);
+    }
+    ::rmdir(directory.c_str());
+}
+
+}
+
+int main(int argc, char **argv) {
+    const std::string scenario = argc > 1 ? argv[1] : "dilute_gas";
+    const std::size_t particleCount = argc > 2 ? std::size_t(std::atof(argv[2])) : 20000;
+    const int frames = argc > 3 ? std::atoi(argv[3]) : 50;
+    const unsigned tilesPerAxis = argc > 4 ? unsigned(std::atoi(argv[4])) : 4;
+    const uint64_t seed = argc > 5 ? std::strtoull(argv[5], nullptr, 10) : 42;
+    const double tolerance = argc > 6 ? std::atof(argv[6]) : 1e-3;
+
+    ScenarioSetup<Real> setup;
+    try {
+        setup = buildScenario<Real>(scenarioNamed(scenario), particleCount, seed, Simulation::maxBoundary());
+    } catch (const std::exception &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+
+    char pattern[] = "/tmp/out_of_core_check.XXXXXX";
+    if (::mkdtemp(pattern) == nullptr) {
+        std::fprintf(stderr, "Cannot create a temporary directory\n");
+        return 1;
+    }
+    const std::string directory = pattern;
+
+    Simulation memory;
+    memory.setSeed(seed);
+    loadScenario(memory, setup);
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        memory.simulate(setup.dt);
+    }
+    const double memorySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Storage streamed;
+    double streamedSeconds = 0.0;
+    OutOfCoreStats stats;
+    TileCacheStats cacheStats;
+    try {
+        OutOfCoreOptions options;
+        options.directory = directory;
+        options.tilesPerAxis = tilesPerAxis;
+        OutOfCoreSimulation outOfCore(options, setup.particleRadius, setup.boundary);
+        outOfCore.setGravity(setup.gravity);
+        outOfCore.addParticles(setup.particles.arrays());
+        start = std::chrono::steady_clock::now();
+        for (int frame = 0; frame < frames; ++frame) {
+            outOfCore.simulate(setup.dt);
+        }
+        streamedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (std::size_t tile = 0; tile < outOfCore.getTileCount(); ++tile) {
+            outOfCore.readTile(tile, streamed);
+        }
+        stats = outOfCore.getStats();
+        cacheStats = outOfCore.getCacheStats();
+    } catch (const std::exception &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        removeDirectory(directory);
+        return 1;
+    }
+    removeDirectory(directory);
+
+    const Summary a = summarize(memory.getParticles());
+    const Summary b = summarize(streamed);
+    const double energyError = std::fabs(a.energy - b.energy) / std::max(a.energy, 1e-300);
+    const double momentumError = glm::length(a.momentum - b.momentum) /
+                                 std::max(std::sqrt(2.0 * a.energy * double(a.count)), 1e-300);
+    const double centreError = glm::length(a.centre - b.centre) / double(setup.boundary);
+    const double coordinateError = coordinateDifference(a, b) / double(setup.particleRadius);
+
+    std::printf("%s, %zu particles, %d frames, %u^%d tiles, seed %llu\n\n", scenario.c_str(), a.count, frames,
+                tilesPerAxis, SIM_DIMENSION, (unsigned long long) seed);
+    std::printf("%-12s  %10s  %22s  %9s\n", "", "particles", "kinetic energy", "ms/frame");
+    std::printf("%-12s  %10zu  %22.17g  %9.3f\n", "in memory", a.count, a.energy, 1e3 * memorySeconds / frames);
+    std::printf("%-12s  %10zu  %22.17g  %9.3f\n\n", "out of core", b.count, b.energy, 1e3 * streamedSeconds / frames);
+    std::printf("relative differences: energy %.3g, momentum %.3g, centre %.3g; coordinates %.3g radii\n",
+                energyError, momentumError, centreError, coordinateError);
+    std::printf("streaming: %llu ghosts and %llu migrants per frame, %.1f MiB written per frame\n",
+                (unsigned long long) (stats.ghostsLoaded / std::max(frames, 1)),
+                (unsigned long long) (stats.particlesMigrated / std::max(frames, 1)),
+                double(stats.bytesWritten) / std::max(frames, 1) / (1024.0 * 1024.0));
+    std::printf("tile cache: %llu hits, %llu misses, %llu prefetched, %llu evicted, %.3f s waiting\n\n",
+                (unsigned long long) cacheStats.hits, (unsigned long long) cacheStats.misses,
+                (unsigned long long) cacheStats.prefetched, (unsigned long long) cacheStats.evicted,
+                cacheStats.waitSeconds);
+
+    const bool agree = a.count == b.count && energyError <= tolerance && momentumError <= tolerance &&
+                       centreError <= tolerance;
+    std::printf("out-of-core run %s the in-memory run within %g\n", agree ? "matches" : "DIFFERS FROM", tolerance);
+    return agree ? 0 : 1;
+}
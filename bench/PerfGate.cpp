@@ -0,0 +1,489 @@
+//
+// Performance regression gate: runs scenario_bench and compares it with a committed baseline.
+//
+// Both runs repeat every configuration several times. A configuration regresses when the median
+// time per step grows by more than --tolerance of the baseline and by more than --noise times the
+// combined spread of the two runs (median absolute deviation, scaled to a standard deviation), or
+// when its peak memory grows by more than --memory-tolerance. A table of every configuration is
+// printed, and any regression fails the gate; a baseline built with another dimension, scalar or
+// integrator skips the check (exit code 77). Configurations that regress in time are measured
+// again --retries times before the gate fails. --update replaces the baseline with the new run.
+// Run with: ./perf_gate --bench ./scenario_bench --baseline ../bench/baselines/scenario_bench.json
+//                       [--sizes 1000,10000] [--threads 1,2] [--steps 40] [--repeats 5]
+//                       [--tolerance 0.15] [--noise 3] [--memory-tolerance 0.25]
+//                       [--retries 1] [--out current.json] [--update]
+//
+
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace {
+
+const int kSkipped = 77; // CTest SKIP_RETURN_CODE
+const double kMadToDeviation = 1.4826; // MAD of a normal distribution times this is its deviation
+const double kMemorySlack = 1024.0 * 1024.0; // Peak memory changes below a MiB are noise
+
+/**
+ * Just enough JSON for benchmark reports: objects, arrays, strings without escapes beyond \" and
+ * \\, numbers, true, false and null.
+ */
+struct JsonValue {
+    enum Type { Null, Boolean, Number, String, Array, Object };
+
+    Type type = Null;
+    double number = 0.0;
+    std::string text;
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue> > members;
+
+    const JsonValue &operator[](const std::string &name) const {
+        static const JsonValue missing;
+        for (const auto &member : members) {
+            if (member.first == name) {
+                return member.second;
+            }
+        }
+        return missing;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string &text) : text(text) {}
+
+    JsonValue parse() {
+        JsonValue value = parseValue();
+        skipSpace();
+        if (at != text.size()) {
+            fail();
+        }
+        return value;
+    }
+
+private:
+    const std::string &text;
+    std::size_t at = 0;
+
+    [[noreturn]] void fail() const {
+        throw std::runtime_error("ERROR::PERF_GATE::BAD_JSON at byte " + std::to_string(at));
+    }
+
+    void skipSpace() {
+        while (at < text.size() && (text[at] == ' ' || text[at] == '\n' || text[at] == '\r' || text[at] == '\t')) {
+            ++at;
+        }
+    }
+
+    bool consume(const char *word) {
+        const std::string expected(word);
+        if (text.compare(at, expected.size(), expected) == 0) {
+            at += expected.size();
+            return true;
+        }
+        return false;
+    }
+
+    std::string parseString() {
+        std::string out;
+        ++at; // Opening quote
+        while (at < text.size() && text[at] != '"') {
+            if (text[at] == '\\' && at + 1 < text.size()) {
+                ++at;
+            }
+            out += text[at++];
+        }
+        if (at == text.size()) {
+            fail();
+        }
+        ++at;
+        return out;
+    }
+
+    JsonValue parseValue() {
+        skipSpace();
+        if (at == text.size()) {
+            fail();
+        }
+        JsonValue value;
+        const char c = text[at];
+        if (c == '{') {
+            value.type = JsonValue::Object;
+            ++at;
+            skipSpace();
+            if (at < text.size() && text[at] == '}') {
+                ++at;
+                return value;
+            }
+            while (true) {
+                skipSpace();
+                if (at == text.size() || text[at] != '"') {
+                    fail();
+                }
+                std::string name = parseString();
+                skipSpace();
+                if (!consume(":")) {
+                    fail();
+                }
+                value.members.emplace_back(name, parseValue());
+                skipSpace();
+                if (consume("}")) {
+                    return value;
+                }
+                if (!consume(",")) {
+                    fail();
+                }
+            }
+        }
+        if (c == '[') {
+            value.type = JsonValue::Array;
+            ++at;
+            skipSpace();
+            if (consume("]")) {
+                return value;
+            }
+            while (true) {
+                value.items.push_back(parseValue());
+                skipSpace();
+                if (consume("]")) {
+                    return value;
+                }
+                if (!consume(",")) {
+                    fail();
+                }
+            }
+        }
+        if (c == '"') {
+            value.type = JsonValue::String;
+            value.text = parseString();
+        } else if (consume("null")) {
+            value.type = JsonValue::Null;
+        } else if (consume("true")) {
+            value.type = JsonValue::Boolean;
+            value.number = 1.0;
+        } else if (consume("false")) {
+            value.type = JsonValue::Boolean;
+        } else {
+            const char *begin = text.c_str() + at;
+            char *end = nullptr;
+            value.type = JsonValue::Number;
+            value.number = std::strtod(begin, &end);
+            if (end == begin) {
+                fail();
+            }
+            at += std::size_t(end - begin);
+        }
+        return value;
+    }
+};
+
+JsonValue readJson(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("ERROR::PERF_GATE::CANNOT_READ " + path);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    const std::string text = contents.str();
+    return JsonParser(text).parse();
+}
+
+typedef std::tuple<std::string, double, double> RunKey; // Scenario, particles, threads
+
+struct RunSamples {
+    std::vector<double> stepSeconds; // Seconds per step of each repetition
+    double peakBytes = 0.0;
+};
+
+double median(std::vector<double> values) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    const std::size_t half = values.size() / 2;
+    return values.size() % 2 == 1 ? values[half] : 0.5 * (values[half - 1] + values[half]);
+}
+
+double medianAbsoluteDeviation(const std::vector<double> &values) {
+    const double centre = median(values);
+    std::vector<double> deviations;
+    for (double value : values) {
+        deviations.push_back(std::fabs(value - centre));
+    }
+    return median(deviations);
+}
+
+std::map<RunKey, RunSamples> runsOf(const JsonValue &report) {
+    std::map<RunKey, RunSamples> runs;
+    for (const JsonValue &result : report["results"].items) {
+        RunSamples &samples =
+                runs[RunKey(result["scenario"].text, result["particles"].number, result["threads"].number)];
+        const double steps = std::max(1.0, result["steps"].number);
+        for (const JsonValue &seconds : result["seconds"].items) {
+            samples.stepSeconds.push_back(seconds.number / steps);
+        }
+        if (samples.stepSeconds.empty()) {
+            samples.stepSeconds.push_back(result["seconds_median"].number / steps);
+        }
+        samples.peakBytes = result["peak_memory_bytes"].number;
+    }
+    return runs;
+}
+
+/**
+ * Describes the build a report comes from; reports of different builds are not comparable.
+ */
+std::string buildOf(const JsonValue &report) {
+    const JsonValue &config = report["config"];
+    std::ostringstream out;
+    out << config["dimension"].number << "D " << config["scalar"].text << ' ' << config["integrator"].text;
+    return out.str();
+}
+
+std::string quotedArgument(const std::string &text) {
+    std::string out = "'";
+    for (char c : text) {
+        out += c == '\'' ? std::string("'\\''") : std::string(1, c);
+    }
+    return out + "'";
+}
+
+std::string formatSteps(double seconds) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.1f", 1.0 / seconds);
+    return text;
+}
+
+std::string formatPercent(double fraction) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%+.1f%%", 100.0 * fraction);
+    return text;
+}
+
+struct Thresholds {
+    double tolerance = 0.15; // Relative growth of the time per step always allowed
+    double noise = 3.0; // Growth allowed in units of the combined deviation of both runs
+    double memory = 0.25; // Relative growth of peak memory allowed
+};
+
+struct Row {
+    RunKey key;
+    std::string metric;
+    std::string baseline;
+    std::string current;
+    std::string change;
+    std::string allowed;
+    std::string status;
+    bool regressed = false;
+};
+
+/**
+ * Compares every baseline configuration with the current run, two rows per configuration.
+ */
+std::vector<Row> compare(const std::map<RunKey, RunSamples> &before, const std::map<RunKey, RunSamples> &after,
+                         const Thresholds &thresholds) {
+    std::vector<Row> rows;
+    for (const auto &entry : before) {
+        Row speed;
+        speed.key = entry.first;
+        speed.metric = "steps/s";
+        const auto found = after.find(entry.first);
+        if (found == after.end()) {
+            speed.status = "MISSING";
+            speed.regressed = true;
+            rows.push_back(speed);
+            continue;
+        }
+        const RunSamples &old = entry.second;
+        const RunSamples &now = found->second;
+
+        // Time per step: the median must not grow beyond both the tolerance and the noise.
+        const double oldMedian = median(old.stepSeconds);
+        const double newMedian = median(now.stepSeconds);
+        const double oldSpread = kMadToDeviation * medianAbsoluteDeviation(old.stepSeconds);
+        const double newSpread = kMadToDeviation * medianAbsoluteDeviation(now.stepSeconds);
+        const double allowedGrowth = std::max(thresholds.tolerance * oldMedian,
+                                              thresholds.noise * std::sqrt(oldSpread * oldSpread + newSpread * newSpread));
+        speed.baseline = formatSteps(oldMedian);
+        speed.current = formatSteps(newMedian);
+        speed.change = formatPercent(oldMedian / newMedian - 1.0);
+        speed.allowed = formatPercent(oldMedian / (oldMedian + allowedGrowth) - 1.0);
+        speed.regressed = newMedian - oldMedian > allowedGrowth;
+        speed.status = speed.regressed ? "REGRESSED" : oldMedian - newMedian > allowedGrowth ? "faster" : "ok";
+        rows.push_back(speed);
+
+        Row memory;
+        memory.key = entry.first;
+        memory.metric = "peak MiB";
+        char text[32];
+        std::snprintf(text, sizeof(text), "%.1f", old.peakBytes / kMemorySlack);
+        memory.baseline = text;
+        std::snprintf(text, sizeof(text), "%.1f", now.peakBytes / kMemorySlack);
+        memory.current = text;
+        memory.change = formatPercent(old.peakBytes > 0.0 ? now.peakBytes / old.peakBytes - 1.0 : 0.0);
+        memory.allowed = formatPercent(thresholds.memory);
+        memory.regressed = now.peakBytes > old.peakBytes * (1.0 + thresholds.memory) &&
+                           now.peakBytes - old.peakBytes > kMemorySlack;
+        memory.status = memory.regressed ? "REGRESSED" : "ok";
+        rows.push_back(memory);
+    }
+    return rows;
+}
+
+void printTable(const std::vector<Row> &rows) {
+    std::printf("%-20s %9s %7s  %-12s %12s %12s %9s %9s  %s\n", "scenario", "particles", "threads", "metric",
+                "baseline", "current", "change", "allowed", "status");
+    for (const Row &row : rows) {
+        std::printf("%-20s %9ld %7d  %-12s %12s %12s %9s %9s  %s\n", std::get<0>(row.key).c_str(),
+                    long(std::get<1>(row.key)), int(std::get<2>(row.key)), row.metric.c_str(), row.baseline.c_str(),
+                    row.current.c_str(), row.change.c_str(), row.allowed.c_str(), row.status.c_str());
+    }
+}
+
+/**
+ * Runs the benchmark with the given arguments and reads its report.
+ */
+JsonValue runBenchmark(const std::string &bench, const std::string &arguments, const std::string &output) {
+    const std::string command = quotedArgument(bench) + arguments + " --label perf_gate --out " + quotedArgument(output);
+    std::cerr << command << std::endl;
+    const int status = std::system(command.c_str());
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("ERROR::PERF_GATE::BENCHMARK_FAILED " + command);
+    }
+    return readJson(output);
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::string bench;
+    std::string baselinePath;
+    std::string output = "perf_gate_current.json";
+    std::string sizes = "1000,10000";
+    std::string threads = "1,2";
+    std::string steps = "40"; // Fixed, so that both runs time the same stretch of every scene
+    std::string repeats = "5";
+    int retries = 1;
+    Thresholds thresholds;
+    bool update = false;
+    for (int a = 1; a < argc; ++a) {
+        const std::string option = argv[a];
+        if (option == "--update") {
+            update = true;
+            continue;
+        }
+        if (a + 1 >= argc) {
+            std::cerr << "Missing value for " << option << std::endl;
+            return 1;
+        }
+        const char *value = argv[++a];
+        if (option == "--bench") {
+            bench = value;
+        } else if (option == "--baseline") {
+            baselinePath = value;
+        } else if (option == "--out") {
+            output = value;
+        } else if (option == "--sizes") {
+            sizes = value;
+        } else if (option == "--threads") {
+            threads = value;
+        } else if (option == "--steps") {
+            steps = value;
+        } else if (option == "--repeats") {
+            repeats = value;
+        } else if (option == "--retries") {
+            retries = std::max(0, std::atoi(value));
+        } else if (option == "--tolerance") {
+            thresholds.tolerance = std::atof(value);
+        } else if (option == "--noise") {
+            thresholds.noise = std::atof(value);
+        } else if (option == "--memory-tolerance") {
+            thresholds.memory = std::atof(value);
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+    if (bench.empty() || baselinePath.empty()) {
+        std::cerr << "Usage: perf_gate --bench path/to/scenario_bench --baseline baseline.json [options]" << std::endl;
+        return 1;
+    }
+
+    try {
+        const std::string common = " --steps " + quotedArgument(steps) + " --repeats " + quotedArgument(repeats);
+        const JsonValue current = runBenchmark(bench, " --sizes " + quotedArgument(sizes) + " --threads " +
+                                                      quotedArgument(threads) + common, output);
+        if (update) {
+            std::ifstream from(output, std::ios::binary);
+            std::ofstream to(baselinePath, std::ios::binary | std::ios::trunc);
+            to << from.rdbuf();
+            if (!to) {
+                throw std::runtime_error("ERROR::PERF_GATE::CANNOT_WRITE " + baselinePath);
+            }
+            std::printf("Baseline %s updated (%s, %zu runs)\n", baselinePath.c_str(), buildOf(current).c_str(),
+                        current["results"].items.size());
+            return 0;
+        }
+
+        const JsonValue baseline = readJson(baselinePath);
+        if (buildOf(baseline) != buildOf(current)) {
+            std::printf("Baseline is for %s but this build is %s; skipping\n", buildOf(baseline).c_str(),
+                        buildOf(current).c_str());
+            return kSkipped;
+        }
+
+        const std::map<RunKey, RunSamples> before = runsOf(baseline);
+        std::map<RunKey, RunSamples> after = runsOf(current);
+        std::vector<Row> rows = compare(before, after, thresholds);
+
+        // A slow outlier run is more likely than a real regression on a busy machine: measure the
+        // configurations that regressed in time again, and judge them on all their samples.
+        for (int retry = 0; retry < retries; ++retry) {
+            std::vector<RunKey> suspects;
+            for (const Row &row : rows) {
+                if (row.regressed && row.metric == "steps/s" && after.count(row.key) != 0) {
+                    suspects.push_back(row.key);
+                }
+            }
+            if (suspects.empty()) {
+                break;
+            }
+            for (const RunKey &key : suspects) {
+                std::ostringstream arguments;
+                arguments << " --scenarios " << quotedArgument(std::get<0>(key)) << " --sizes "
+                          << long(std::get<1>(key)) << " --threads " << int(std::get<2>(key)) << common;
+                const std::map<RunKey, RunSamples> again = runsOf(runBenchmark(bench, arguments.str(), output + ".retry"));
+                for (const auto &entry : again) {
+                    std::vector<double> &samples = after[entry.first].stepSeconds;
+                    samples.insert(samples.end(), entry.second.stepSeconds.begin(), entry.second.stepSeconds.end());
+                }
+            }
+            rows = compare(before, after, thresholds);
+        }
+
+        printTable(rows);
+        const long regressions = std::count_if(rows.begin(), rows.end(), [](const Row &row) { return row.regressed; });
+        if (regressions > 0) {
+            std::printf("\n%ld regression(s) against %s\n", regressions, baselinePath.c_str());
+            std::printf("If the change is intended, rerun with --update to record a new baseline.\n");
+            return 1;
+        }
+        std::printf("\nNo regressions in %zu configurations against %s\n", before.size(), baselinePath.c_str());
+        return 0;
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,82 @@
+//
+// Throughput and memory benchmark for every precision and dimension of BasicSimulation.
+//
+// Each instantiation simulates the same number of random particles for a fixed number of
+// frames; we report the time per particle update and the bytes of particle state. A second
+// check applies one set of displacements in two different orders, showing which position
+// types integrate order-independently.
+// Run with: ./precision_bench [particles] [frames]
+//
+
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+namespace {
+
+template <int Dim, typename Scalar>
+void benchmark(const char *name, int particleCount, int frames) {
+    typedef BasicSimulation<Dim, Scalar> Sim;
+
+    Sim simulation;
+    simulation.addRandomParticles(particleCount);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int frame = 0; frame < frames; ++frame) {
+        simulation.simulate(typename Sim::Real(0.01));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // simulate() runs five collision and integration passes per frame.
+    double updates = double(particleCount) * frames * 5.0;
+    std::size_t bytes = Sim::Storage::bytesPerParticle();
+    std::printf("%-16s  %12.2f  %12.1f  %10zu  %10.2f\n", name, seconds * 1e9 / updates,
+                frames / seconds, bytes, double(bytes) * particleCount / (1024.0 * 1024.0));
+}
+
+/**
+ * Applies the same displacements to a position forwards and backwards and reports whether the
+ * two results are bit-identical.
+ */
+template <typename Position>
+bool orderIndependent(const std::vector<glm::vec2> &displacements) {
+    Position forward(glm::vec2(0.25f, -0.5f));
+    Position backward = forward;
+    for (size_t i = 0; i < displacements.size(); ++i) {
+        forward += displacements[i];
+        backward += displacements[displacements.size() - 1 - i];
+    }
+    return forward == backward;
+}
+
+}
+
+int main(int argc, char **argv) {
+    int particleCount = argc > 1 ? std::atoi(argv[1]) : 1000;
+    int frames = argc > 2 ? std::atoi(argv[2]) : 200;
+
+    std::printf("%d particles, %d frames\n\n", particleCount, frames);
+    std::printf("%-16s  %12s  %12s  %10s  %10s\n", "instantiation", "ns/update", "frames/s", "B/particle", "MiB");
+    benchmark<2, float>("2D float", particleCount, frames);
+    benchmark<2, double>("2D double", particleCount, frames);
+    benchmark<2, FixedPoint32<> >("2D fixed32", particleCount, frames);
+    benchmark<3, float>("3D float", particleCount, frames);
+    benchmark<3, double>("3D double", particleCount, frames);
+    benchmark<3, FixedPoint32<> >("3D fixed32", particleCount, frames);
+
+    std::mt19937 generator(1234);
+    std::uniform_real_distribution<float> step(-1e-3f, 1e-3f);
+    std::vector<glm::vec2> displacements(100000);
+    for (glm::vec2 &d : displacements) {
+        d = glm::vec2(step(generator), step(generator));
+    }
+    std::printf("\nSame %zu displacements applied in reverse order give identical positions:\n", displacements.size());
+    std::printf("  float:   %s\n", orderIndependent<glm::vec2>(displacements) ? "yes" : "no");
+    std::printf("  fixed32: %s\n", orderIndependent<FixedVec<2, 20> >(displacements) ? "yes" : "no");
+    return 0;
+}
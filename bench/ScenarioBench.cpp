@@ -0,0 +1,287 @@
+//
+// End-to-end headless benchmark of the built-in scenarios, as JSON.
+//
+// Every scenario runs at each size and thread count: a fresh simulation is loaded, stepped a few
+// times to warm up, then timed over --steps steps, or over enough steps to last --min-time
+// seconds; this repeats --repeats times and the median is reported. Parallel efficiency is the
+// speedup over one thread divided by the thread count. Peak memory is the resident set high-water
+// mark of one configuration (reset between configurations where the kernel allows it). With
+// --counters 1 the timed steps also count hardware events per simulation phase and thread (see
+// PerfCounters.hpp).
+// Run with: ./scenario_bench [--scenarios dilute_gas,...] [--sizes 1000,10000,100000]
+//                            [--threads 1,2,4] [--min-time 1] [--steps N] [--repeats 3]
+//                            [--counters 1] [--label name] [--out results.json]
+//
+
+#include "Simulation.hpp"
+#include "Integrator.hpp"
+#include "PerfCounters.hpp"
+#include "Scenario.hpp"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#define SCENARIO_BENCH_STRING(x) #x
+#define SCENARIO_BENCH_EXPAND(x) SCENARIO_BENCH_STRING(x)
+
+namespace {
+
+typedef Simulation::Real Real;
+
+const uint64_t kSeed = 12345;
+const int kWarmupSteps = 5;
+
+struct Run {
+    std::string scenario;
+    std::size_t particles = 0;
+    unsigned threads = 0;
+    uint64_t steps = 0; // Timed steps per repetition
+    std::vector<double> seconds; // Per repetition, sorted
+    double efficiency = -1.0; // Negative when there is no one-thread run to compare with
+    long peakBytes = 0;
+    bool counted = false;
+    PhaseCounters counters; // Over the timed steps of every repetition
+
+    double median() const { return seconds[seconds.size() / 2]; }
+    double stepsPerSecond() const { return double(steps) / median(); }
+};
+
+/**
+ * Starts a new peak-memory window: clears the kernel's resident set high-water mark.
+ * @return Whether the mark could be cleared; if not, peaks are those of the whole process.
+ */
+bool resetPeakMemory() {
+    std::ofstream clear("/proc/self/clear_refs");
+    clear << "5";
+    clear.flush();
+    return bool(clear);
+}
+
+/**
+ * Returns the resident set high-water mark in bytes.
+ */
+long peakMemory() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::atol(line.c_str() + 6) * 1024;
+        }
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return long(usage.ru_maxrss) * 1024;
+}
+
+std::vector<std::string> split(const std::string &text) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, ',')) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+/**
+ * Runs one scenario at one size on one thread count.
+ */
+Run runScenario(const ScenarioSetup<Real> &setup, unsigned threads, double minSeconds, uint64_t steps, int repeats,
+                bool counters) {
+    Run run;
+    run.counted = counters;
+    run.steps = steps;
+    run.scenario = setup.name;
+    run.particles = setup.particles.size();
+    run.threads = threads;
+    resetPeakMemory();
+    ThreadPool pool(threads);
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+        Simulation simulation;
+        simulation.setThreadPool(&pool);
+        loadScenario(simulation, setup);
+        auto start = std::chrono::steady_clock::now();
+        for (int step = 0; step < kWarmupSteps; ++step) {
+            simulation.simulate(setup.dt);
+        }
+        if (run.steps == 0) {
+            // The warm-up of the first repetition sizes the timed runs.
+            const double perStep = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() /
+                                   kWarmupSteps;
+            run.steps = uint64_t(std::max(1.0, std::ceil(minSeconds / std::max(perStep, 1e-9))));
+        }
+        simulation.setPhaseCounters(counters ? &run.counters : nullptr);
+        start = std::chrono::steady_clock::now();
+        for (uint64_t step = 0; step < run.steps; ++step) {
+            simulation.simulate(setup.dt);
+        }
+        run.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(run.seconds.begin(), run.seconds.end());
+    run.peakBytes = peakMemory();
+    return run;
+}
+
+std::string quoted(const std::string &text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out + "\"";
+}
+
+std::string json(const std::vector<Run> &runs, const std::string &label, bool peakReset, bool countersSupported) {
+    std::ostringstream out;
+    out.precision(9);
+    out << "{\n  \"benchmark\": \"scenario_bench\",\n  \"version\": 1,\n  \"label\": " << quoted(label) << ",\n"
+        << "  \"config\": {\"dimension\": " << SIM_DIMENSION << ", \"scalar\": \"" << SCENARIO_BENCH_EXPAND(SIM_SCALAR)
+        << "\", \"integrator\": \"" << ActiveIntegrator::name() << "\", \"hardware_threads\": "
+        << std::thread::hardware_concurrency() << ", \"peak_memory\": \""
+        << (peakReset ? "per_run" : "process") << "\", \"counters_supported\": "
+        << (countersSupported ? "true" : "false") << "},\n"
+        << "  \"results\": [";
+    for (std::size_t r = 0; r < runs.size(); ++r) {
+        const Run &run = runs[r];
+        out << (r == 0 ? "\n" : ",\n") << "    {\"scenario\": \"" << run.scenario << "\", \"particles\": " << run.particles
+            << ", \"threads\": " << run.threads << ", \"steps\": " << run.steps << ", \"repetitions\": "
+            << run.seconds.size() << ", \"seconds_median\": " << run.median() << ", \"seconds\": [";
+        for (std::size_t s = 0; s < run.seconds.size(); ++s) {
+            out << (s == 0 ? "" : ", ") << run.seconds[s];
+        }
+        out << "], \"steps_per_second\": " << run.stepsPerSecond()
+            << ", \"particle_steps_per_second\": " << run.stepsPerSecond() * double(run.particles)
+            << ", \"parallel_efficiency\": ";
+        if (run.efficiency >= 0.0) {
+            out << run.efficiency;
+        } else {
+            out << "null";
+        }
+        out << ", \"peak_memory_bytes\": " << run.peakBytes << ", \"counters\": ";
+        if (run.counted) {
+            run.counters.writeJson(out);
+        } else {
+            out << "null";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return out.str();
+}
+
+}
+
+int main(int argc, char **argv) {
+    std::vector<ScenarioKind> scenarios = allScenarios();
+    std::vector<std::size_t> sizes = {1000, 10000, 100000};
+    std::vector<unsigned> threadCounts;
+    for (unsigned threads = 1; threads < std::max(1u, std::thread::hardware_concurrency()); threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(std::max(1u, std::thread::hardware_concurrency()));
+    double minSeconds = 1.0;
+    uint64_t steps = 0; // Zero to size the timed runs from --min-time
+    int repeats = 3;
+    bool counters = false;
+    std::string label;
+    std::string output;
+    try {
+        for (int a = 1; a + 1 < argc; a += 2) {
+            const std::string option = argv[a];
+            const char *value = argv[a + 1];
+            if (option == "--scenarios") {
+                scenarios.clear();
+                for (const std::string &name : split(value)) {
+                    scenarios.push_back(scenarioNamed(name));
+                }
+            } else if (option == "--sizes") {
+                sizes.clear();
+                for (const std::string &size : split(value)) {
+                    sizes.push_back(std::size_t(std::atof(size.c_str())));
+                }
+            } else if (option == "--threads") {
+                threadCounts.clear();
+                for (const std::string &threads : split(value)) {
+                    threadCounts.push_back(unsigned(std::max(1, std::atoi(threads.c_str()))));
+                }
+            } else if (option == "--min-time") {
+                minSeconds = std::atof(value);
+            } else if (option == "--steps") {
+                steps = uint64_t(std::max(0.0, std::atof(value)));
+            } else if (option == "--repeats") {
+                repeats = std::max(1, std::atoi(value));
+            } else if (option == "--counters") {
+                counters = std::atoi(value) != 0;
+            } else if (option == "--label") {
+                label = value;
+            } else if (option == "--out") {
+                output = value;
+            } else {
+                std::cerr << "Unknown option " << option << std::endl;
+                return 1;
+            }
+        }
+    } catch (const std::exception &error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+
+    const bool peakReset = resetPeakMemory();
+    if (counters && !PhaseCounters::supported()) {
+        std::cerr << "No performance counters available (perf_event_paranoid or a virtual machine); counting nothing"
+                  << std::endl;
+    }
+    std::vector<Run> runs;
+    for (ScenarioKind kind : scenarios) {
+        for (std::size_t size : sizes) {
+            const ScenarioSetup<Real> setup = buildScenario<Real>(kind, size, kSeed, Simulation::maxBoundary());
+            double serialRate = -1.0;
+            for (unsigned threads : threadCounts) {
+                Run run = runScenario(setup, threads, minSeconds, steps, repeats, counters);
+                if (threads == 1) {
+                    serialRate = run.stepsPerSecond();
+                }
+                if (serialRate > 0.0) {
+                    run.efficiency = run.stepsPerSecond() / (double(run.threads) * serialRate);
+                }
+                std::fprintf(stderr, "%-20s %8zu particles %3u threads  %10.1f steps/s  %6.2f efficiency  %8.1f MiB\n",
+                             run.scenario.c_str(), run.particles, run.threads, run.stepsPerSecond(),
+                             run.efficiency >= 0.0 ? run.efficiency : 0.0, double(run.peakBytes) / (1024.0 * 1024.0));
+                if (counters) {
+                    run.counters.writeTable(std::cerr);
+                }
+                runs.push_back(run);
+            }
+        }
+    }
+
+    const std::string report = json(runs, label, peakReset, counters && PhaseCounters::supported());
+    if (output.empty()) {
+        std::cout << report;
+    } else {
+        std::ofstream file(output, std::ios::trunc);
+        file << report;
+        if (!file) {
+            std::cerr << "Cannot write " << output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
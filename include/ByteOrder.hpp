@@ -0,0 +1,68 @@
+//
+// Little-endian encoding of integers and floats in file formats.
+//
+
+#ifndef PART1_BYTEORDER_HPP
+#define PART1_BYTEORDER_HPP
+
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Stores value at out in little-endian byte order, whatever the host byte order.
+ */
+inline void put32(unsigned char *out, uint32_t value) {
+    for (int i = 0; i < 4; ++i) {
+        out[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+inline void put64(unsigned char *out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+inline void putDouble(unsigned char *out, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    put64(out, bits);
+}
+
+/**
+ * Loads a little-endian value from in, whatever the host byte order.
+ */
+inline uint32_t get32(const unsigned char *in) {
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= uint32_t(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline uint64_t get64(const unsigned char *in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        value |= uint64_t(in[i]) << (8 * i);
+    }
+    return value;
+}
+
+inline double getDouble(const unsigned char *in) {
+    uint64_t bits = get64(in);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Returns true if the host stores integers least significant byte first.
+ */
+inline bool hostIsLittleEndian() {
+    const uint32_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+#endif //PART1_BYTEORDER_HPP
@@ -0,0 +1,116 @@
+//
+// Periodic checkpoints written by a forked child from a copy-on-write image of the process.
+//
+
+#ifndef PART1_CHECKPOINT_HPP
+#define PART1_CHECKPOINT_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <sys/types.h>
+
+/**
+ * When and where a Checkpointer writes checkpoints.
+ */
+struct CheckpointOptions {
+    std::string directory = "."; // Where checkpoint files go
+    std::string prefix = "checkpoint"; // Files are named <prefix>-<step>.snap
+    uint64_t interval = 1000; // Calls to simulate() between checkpoints
+    unsigned retention = 3; // Completed checkpoints kept on disk, older ones are deleted; 0 keeps all
+};
+
+/**
+ * What checkpointing has cost so far.
+ */
+struct CheckpointStats {
+    uint64_t started = 0;
+    uint64_t completed = 0;
+    uint64_t failed = 0;
+    uint64_t skipped = 0; // Due while the previous checkpoint was still being written
+    double lastPauseSeconds = 0.0; // Time the simulation thread spent in fork()
+    double maxPauseSeconds = 0.0;
+    uint64_t lastExtraBytes = 0; // Memory duplicated by copy-on-write while the child ran
+    uint64_t maxExtraBytes = 0;
+};
+
+/**
+ * Writes checkpoints without stopping the simulation.
+ *
+ * checkpoint() forks the process. The child sees the particle arrays as they were at the fork,
+ * through pages shared copy-on-write with the parent, writes them to a temporary file, renames
+ * it into place and exits; the parent returns straight away and keeps simulating. The pause is
+ * therefore only the fork itself, which copies page tables but not pages. Pages the parent
+ * modifies while the child is writing are duplicated; the child measures how many and reports it
+ * back through a pipe.
+ *
+ * Only the forking thread exists in the child, so the write function must not use thread pools
+ * or locks other threads might have held. At most one checkpoint is in flight; checkpoints that
+ * fall due while one is being written are skipped.
+ */
+class Checkpointer {
+public:
+    typedef std::function<void(const std::string &)> WriteFunction;
+
+    /**
+     * @param options When and where to write checkpoints.
+     */
+    explicit Checkpointer(const CheckpointOptions &options = CheckpointOptions());
+
+    /**
+     * Waits for a checkpoint still being written.
+     */
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer &) = delete;
+    Checkpointer &operator=(const Checkpointer &) = delete;
+
+    /**
+     * Returns true if a checkpoint is due after the given step.
+     */
+    bool due(uint64_t step) const { return options.interval > 0 && step % options.interval == 0; }
+
+    /**
+     * Forks a child that calls write with the checkpoint path, then returns without waiting.
+     * @param step The number of calls to simulate() so far, used in the file name.
+     * @param write Writes the state to the given path; runs in the child.
+     * @return False if the checkpoint was skipped or fork() failed.
+     */
+    bool checkpoint(uint64_t step, const WriteFunction &write);
+
+    /**
+     * Collects a finished child, if any, without blocking, and deletes checkpoints beyond the
+     * retention limit.
+     */
+    void poll();
+
+    /**
+     * Waits until no checkpoint is being written.
+     */
+    void wait();
+
+    /**
+     * Returns true while a child is writing a checkpoint.
+     */
+    bool busy() const { return child > 0; }
+
+    const CheckpointStats &getStats() const { return stats; }
+
+    /**
+     * Returns the completed checkpoints still on disk, oldest first.
+     */
+    const std::deque<std::string> &getCheckpoints() const { return kept; }
+
+private:
+    CheckpointOptions options;
+    CheckpointStats stats;
+    pid_t child = -1;
+    int reportPipe = -1; // Read end of the pipe the child reports its extra memory through
+    std::string pendingPath;
+    std::deque<std::string> kept;
+
+    void collect(int status);
+};
+
+#endif //PART1_CHECKPOINT_HPP
@@ -0,0 +1,64 @@
+//
+// Narrow phase collision response between pairs of particles.
+//
+
+#ifndef PART1_COLLISION_HPP
+#define PART1_COLLISION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/glm/glm.hpp>
+
+/**
+ * A pair of particles found overlapping by the broad phase, with i < j.
+ */
+struct Contact {
+    uint32_t i;
+    uint32_t j;
+};
+
+/**
+ * Resolves a potential contact between particles i and j: if they overlap and approach each
+ * other, they are pushed apart along the contact normal and exchange an elastic impulse.
+ *
+ * @param positions Particle positions (floating point vectors or FixedVec).
+ * @param velocities Particle velocities.
+ * @param masses Particle masses.
+ * @param i Index of the first particle.
+ * @param j Index of the second particle.
+ * @param particleRadius The radius shared by all particles.
+ * @return True if the pair was in contact and was resolved.
+ */
+template <typename Position, typename Vec>
+inline bool resolveContact(Position *positions, Vec *velocities, const typename Vec::value_type *masses,
+                           std::size_t i, std::size_t j, typename Vec::value_type particleRadius) {
+    typedef typename Vec::value_type Real;
+
+    Vec diff = positions[i] - positions[j];
+    Real distance = glm::length(diff);
+    if (distance >= Real(2) * particleRadius) {
+        return false;
+    }
+
+    Real overlap = Real(2) * particleRadius - distance;
+
+    Vec normal = glm::normalize(diff);
+    Vec relativeVelocity = velocities[i] - velocities[j];
+    Real impulse = glm::dot(relativeVelocity, normal);
+    if (impulse >= Real(0)) {
+        return false;
+    }
+
+    positions[i] += overlap / Real(2) * normal;
+    positions[j] -= overlap / Real(2) * normal;
+
+    Real totalMass = masses[i] + masses[j];
+    Real impulseI = Real(2) * masses[j] / totalMass * impulse;
+    Real impulseJ = Real(2) * masses[i] / totalMass * impulse;
+
+    velocities[i] -= impulseI * normal;
+    velocities[j] += impulseJ * normal;
+    return true;
+}
+
+#endif //PART1_COLLISION_HPP
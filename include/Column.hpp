@@ -0,0 +1,139 @@
+//
+// A growable array that can also borrow memory it does not own.
+//
+
+#ifndef PART1_COLUMN_HPP
+#define PART1_COLUMN_HPP
+
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/**
+ * One attribute array of the particle storage.
+ *
+ * A column normally owns its elements like a std::vector. It can instead view elements that live
+ * elsewhere, e.g. in a memory-mapped snapshot, kept alive by a shared owner. Views can be read and
+ * written in place; the first operation that needs more room copies the elements into owned memory.
+ */
+template <typename T>
+class Column {
+    static_assert(std::is_trivially_copyable<T>::value, "Column elements are copied and mapped as raw bytes");
+
+public:
+    typedef T value_type;
+
+    Column() = default;
+
+    // Copies always own their elements, so two columns never write to the same borrowed memory.
+    Column(const Column &other) : owned(other.begin(), other.end()) {}
+
+    Column(Column &&other) noexcept
+            : owned(std::move(other.owned)), view(other.view), viewSize(other.viewSize),
+              keepAlive(std::move(other.keepAlive)) {
+        other.view = nullptr;
+        other.viewSize = 0;
+    }
+
+    Column &operator=(const Column &other) {
+        if (this != &other) {
+            std::vector<T> copy(other.begin(), other.end());
+            clear();
+            owned.swap(copy);
+        }
+        return *this;
+    }
+
+    Column &operator=(Column &&other) noexcept {
+        if (this != &other) {
+            owned = std::move(other.owned);
+            view = other.view;
+            viewSize = other.viewSize;
+            keepAlive = std::move(other.keepAlive);
+            other.view = nullptr;
+            other.viewSize = 0;
+        }
+        return *this;
+    }
+
+    /**
+     * Makes the column a view of `count` elements at `elements`, kept valid by `owner`.
+     */
+    void borrow(T *elements, std::size_t count, std::shared_ptr<void> owner) {
+        owned.clear();
+        owned.shrink_to_fit();
+        view = elements;
+        viewSize = count;
+        keepAlive = std::move(owner);
+    }
+
+    /**
+     * Returns true if the elements are borrowed rather than owned.
+     */
+    bool isView() const { return view != nullptr; }
+
+    std::size_t size() const { return view != nullptr ? viewSize : owned.size(); }
+    bool empty() const { return size() == 0; }
+
+    T *data() { return view != nullptr ? view : owned.data(); }
+    const T *data() const { return view != nullptr ? view : owned.data(); }
+
+    T &operator[](std::size_t i) { return data()[i]; }
+    const T &operator[](std::size_t i) const { return data()[i]; }
+
+    T *begin() { return data(); }
+    T *end() { return data() + size(); }
+    const T *begin() const { return data(); }
+    const T *end() const { return data() + size(); }
+
+    void reserve(std::size_t count) {
+        if (view != nullptr && count <= viewSize) {
+            return;
+        }
+        own();
+        owned.reserve(count);
+    }
+
+    void resize(std::size_t count) { resize(count, T()); }
+
+    void resize(std::size_t count, const T &value) {
+        if (view != nullptr && count <= viewSize) {
+            viewSize = count;
+            return;
+        }
+        own();
+        owned.resize(count, value);
+    }
+
+    void push_back(const T &value) {
+        own();
+        owned.push_back(value);
+    }
+
+    void clear() {
+        view = nullptr;
+        viewSize = 0;
+        keepAlive.reset();
+        owned.clear();
+    }
+
+private:
+    std::vector<T> owned;
+    T *view = nullptr;
+    std::size_t viewSize = 0;
+    std::shared_ptr<void> keepAlive;
+
+    // Copies borrowed elements into owned memory and releases the view.
+    void own() {
+        if (view == nullptr) {
+            return;
+        }
+        owned.assign(view, view + viewSize);
+        view = nullptr;
+        viewSize = 0;
+        keepAlive.reset();
+    }
+};
+
+#endif //PART1_COLUMN_HPP
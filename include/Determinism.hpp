@@ -0,0 +1,93 @@
+//
+// Execution modes, reductions and state hashing for reproducible runs.
+//
+
+#ifndef PART1_DETERMINISM_HPP
+#define PART1_DETERMINISM_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ThreadPool.hpp"
+
+/**
+ * How a simulation uses its thread pool.
+ *
+ * Fast: contacts are resolved in the order threads happen to find them and reductions sum
+ * per-thread partials, so results depend on thread count and scheduling.
+ *
+ * Deterministic: contacts are resolved in a canonical order and reductions use a fixed tree,
+ * so the same seed gives bit-identical states on any number of threads.
+ */
+enum class ExecutionMode {
+    Fast,
+    Deterministic
+};
+
+// Number of elements summed sequentially before partial sums are combined.
+const std::size_t kReductionBlock = 4096;
+
+/**
+ * Sums term(i) over [0, count).
+ *
+ * In deterministic mode the range is cut into blocks of kReductionBlock elements whatever the
+ * thread count, and the block sums are combined pairwise in a fixed tree. In fast mode every
+ * thread accumulates its own partial sum.
+ */
+template <typename T, typename Term>
+T reduceSum(ThreadPool *pool, std::size_t count, ExecutionMode mode, Term term) {
+    if (mode == ExecutionMode::Deterministic) {
+        std::size_t blocks = (count + kReductionBlock - 1) / kReductionBlock;
+        if (blocks == 0) {
+            return T(0);
+        }
+        std::vector<T> partial(blocks, T(0));
+        parallelFor(pool, blocks, 1, [&](std::size_t first, std::size_t last, unsigned) {
+            for (std::size_t b = first; b < last; ++b) {
+                std::size_t end = std::min(count, (b + 1) * kReductionBlock);
+                T sum = T(0);
+                for (std::size_t i = b * kReductionBlock; i < end; ++i) {
+                    sum += term(i);
+                }
+                partial[b] = sum;
+            }
+        });
+        for (std::size_t width = 1; width < blocks; width *= 2) {
+            for (std::size_t b = 0; b + width < blocks; b += 2 * width) {
+                partial[b] += partial[b + width];
+            }
+        }
+        return partial[0];
+    }
+
+    std::vector<T> perThread(pool != nullptr ? pool->size() : 1, T(0));
+    parallelFor(pool, count, kReductionBlock, [&](std::size_t begin, std::size_t end, unsigned thread) {
+        T sum = T(0);
+        for (std::size_t i = begin; i < end; ++i) {
+            sum += term(i);
+        }
+        perThread[thread] += sum;
+    });
+    T total = T(0);
+    for (T sum : perThread) {
+        total += sum;
+    }
+    return total;
+}
+
+/**
+ * Folds raw bytes into a 64-bit FNV-1a hash, for comparing simulation states bit for bit.
+ * @param data The bytes to hash.
+ * @param size Number of bytes.
+ * @param hash The hash of the preceding data, or the FNV offset basis to start.
+ */
+inline uint64_t hashBytes(const void *data, std::size_t size, uint64_t hash = 14695981039346656037ull) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif //PART1_DETERMINISM_HPP
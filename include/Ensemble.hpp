@@ -0,0 +1,86 @@
+//
+// Many small independent simulations run side by side, e.g. for parameter sweeps.
+//
+
+#ifndef PART1_ENSEMBLE_HPP
+#define PART1_ENSEMBLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "ThreadPool.hpp"
+
+/**
+ * The parameters of one member of an ensemble.
+ *
+ * A member starts with particles at random positions in the z = 0 square [-1, 1]^2 with small
+ * random velocities, drawn from its seed. Every second particle has massRatio times the mass of
+ * the others.
+ */
+struct EnsembleMember {
+    uint64_t seed = 1;
+    std::size_t particles = 17;
+    double dt = 0.01;
+    uint32_t steps = 1000;
+    double massRatio = 1.0;
+    double particleRadius = 0.05;
+    double boundary = 1.2;
+    int iterations = 5;
+    glm::dvec3 gravity = glm::dvec3(0.0);
+};
+
+/**
+ * What one member ended with.
+ */
+struct EnsembleResult {
+    std::size_t member; // Index into the members given to runEnsemble
+    EnsembleMember parameters;
+    std::size_t particleCount;
+    uint64_t steps;
+    double simulatedTime;
+    double initialEnergy; // Kinetic energy before the first step
+    double finalEnergy;
+    uint64_t stateHash;
+    double seconds; // Wall time of the member, on its thread
+};
+
+/**
+ * Builds the cartesian product of the given values, seedsPerPoint members per combination, with
+ * every other parameter from base. Seeds are derived from base.seed and the member index.
+ */
+std::vector<EnsembleMember> ensembleGrid(const EnsembleMember &base, const std::vector<std::size_t> &particleCounts,
+                                         const std::vector<double> &timesteps, const std::vector<double> &massRatios,
+                                         unsigned seedsPerPoint);
+
+/**
+ * Runs every member to completion and returns their results in member order.
+ *
+ * Each member is simulated on a single thread and members are spread over the pool, largest
+ * first, so throughput scales with the number of cores even when members are far too small to
+ * parallelise themselves. Only as many members as there are threads are alive at once.
+ *
+ * In lockstep mode, members of up to 128 particles that share dt, steps and iterations
+ * are also packed into the SIMD lanes of a BasicSceneBatch, a batch per task. Their results then
+ * come from the batch kernels (all-pairs collisions in a fixed order) rather than Simulation, so
+ * they are as reproducible but not bit-identical to the other mode.
+ * @param members The members to run.
+ * @param pool Threads to run members on, or null to run them one after another.
+ * @param lockstep Whether to run small members in lockstep batches.
+ */
+std::vector<EnsembleResult> runEnsemble(const std::vector<EnsembleMember> &members, ThreadPool *pool,
+                                        bool lockstep = false);
+
+/**
+ * Writes one CSV row per member. Throws std::runtime_error if the file cannot be written.
+ */
+void writeEnsembleResults(const std::string &path, const std::vector<EnsembleResult> &results);
+
+/**
+ * Writes one CSV row per combination of particle count, dt and mass ratio, with the mean and
+ * standard deviation over its seeds. Throws std::runtime_error if the file cannot be written.
+ */
+void writeEnsembleSummary(const std::string &path, const std::vector<EnsembleResult> &results);
+
+#endif //PART1_ENSEMBLE_HPP
@@ -0,0 +1,121 @@
+//
+// Binary VTK, VTU and PLY files of the particle state for ParaView and other visualisation tools.
+//
+
+#ifndef PART1_EXPORT_HPP
+#define PART1_EXPORT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "Snapshot.hpp"
+#include "ThreadPool.hpp"
+#include "Trajectory.hpp"
+
+/**
+ * File formats particles can be exported to. Every format stores the particles as points, with
+ * the chosen attributes as per-point data.
+ */
+enum class ExportFormat {
+    Vtk, // Legacy binary VTK PolyData (.vtk), big-endian with one vertex cell per particle
+    Vtu, // XML VTK UnstructuredGrid (.vtu) with raw appended data in host byte order
+    Ply // Binary PLY point cloud (.ply) in host byte order
+};
+
+/**
+ * Returns the format matching the extension of path (.vtk, .vtu or .ply). Throws
+ * std::runtime_error for any other extension.
+ */
+ExportFormat exportFormatFor(const std::string &path);
+
+/**
+ * What an export file contains.
+ */
+struct ExportOptions {
+    ExportFormat format = ExportFormat::Vtu;
+    // Attributes stored besides positions, as trajectoryAttribute bits of velocity, color and mass
+    uint32_t attributes = trajectoryAttribute(SnapshotColumnId::Velocity) |
+                          trajectoryAttribute(SnapshotColumnId::Color) |
+                          trajectoryAttribute(SnapshotColumnId::Mass);
+    bool doublePrecision = false; // Store positions, velocities and masses as doubles, not floats
+};
+
+/**
+ * Writes particles to an export file, replacing any existing file at path.
+ *
+ * Positions and velocities are widened to three components (z = 0 in 2D); colors are stored as
+ * 8-bit RGB. The particles are split into chunks that the pool encodes in parallel, each into its
+ * own buffer, and the header and all buffers are written in order with pwritev.
+ *
+ * Throws std::runtime_error if the columns have no positions or the file cannot be written.
+ * @param path The file to write.
+ * @param particleCount The number of particles.
+ * @param columns The particle attributes in host byte order, e.g. from a simulation or a decoded
+ *                TrajectoryFrame. Attributes the options do not ask for are ignored.
+ * @param options The format and the attributes to store.
+ * @param pool Threads to encode with, or null to encode on the calling thread.
+ */
+void exportParticles(const std::string &path, uint64_t particleCount, const std::vector<SnapshotColumn> &columns,
+                     const ExportOptions &options, ThreadPool *pool);
+
+/**
+ * A time series of VTU files indexed by a ParaView .pvd collection, so a whole run opens as one
+ * animated dataset.
+ *
+ * Frames are written to <directory>/<prefix>_<step>.vtu. The index <directory>/<prefix>.pvd is
+ * rewritten after every frame through a temporary file and a rename, so it is complete and
+ * readable at any moment while the run goes on.
+ */
+class ExportSeries {
+public:
+    /**
+     * @param directory Where the frames and the index go.
+     * @param prefix The name of the index and the start of the frame names.
+     * @param options The attributes to store; the format is always VTU.
+     * @param stride Export after every stride-th call to simulate().
+     */
+    ExportSeries(const std::string &directory, const std::string &prefix,
+                 const ExportOptions &options = ExportOptions(), unsigned stride = 1);
+
+    /**
+     * Returns true if the state after the given step should be exported.
+     */
+    bool wants(uint64_t step) const { return stride > 0 && step % stride == 0; }
+
+    /**
+     * Returns the trajectoryAttribute bits of the attributes exported, positions included.
+     */
+    uint32_t getAttributes() const { return options.attributes | trajectoryAttribute(SnapshotColumnId::Position); }
+
+    /**
+     * Writes one frame and adds it to the index.
+     * @param step The number of calls to simulate() so far, used in the file name.
+     * @param time The simulated time, used as the frame's time in the index.
+     * @param particleCount The number of particles.
+     * @param columns The particle attributes, as for exportParticles.
+     * @param pool Threads to encode with, or null.
+     * @return The path of the frame.
+     */
+    std::string write(uint64_t step, double time, uint64_t particleCount, const std::vector<SnapshotColumn> &columns,
+                      ThreadPool *pool);
+
+    /**
+     * Returns the path of the .pvd index.
+     */
+    std::string getIndexPath() const { return directory + "/" + prefix + ".pvd"; }
+
+    std::size_t getFrameCount() const { return frames.size(); }
+
+private:
+    std::string directory;
+    std::string prefix;
+    ExportOptions options;
+    unsigned stride;
+    std::vector<std::pair<double, std::string> > frames; // Time and file name of every frame
+
+    void writeIndex() const;
+};
+
+#endif //PART1_EXPORT_HPP
@@ -0,0 +1,116 @@
+//
+// 32-bit fixed-point positions.
+//
+
+#ifndef PART1_FIXEDPOINT_HPP
+#define PART1_FIXEDPOINT_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <glm/glm/glm.hpp>
+
+/**
+ * Scalar tag selecting 32-bit fixed-point positions with the given number of fraction bits.
+ * Velocities, accelerations and masses of such a simulation stay in float.
+ *
+ * Positions cover +-2^(31 - FractionBits) units: +-2048 with the default 20 fraction bits, at a
+ * resolution of about 1e-6, which is finer than float spacing anywhere outside the unit box.
+ * Simulations reject boundaries outside that range (see PositionRange).
+ */
+template <int FractionBits = 20>
+struct FixedPoint32 {
+    static_assert(FractionBits > 0 && FractionBits < 31, "FixedPoint32 needs between 1 and 30 fraction bits");
+};
+
+/**
+ * The coordinates positions of a scalar type can hold: limit() is the first magnitude out of
+ * range, infinite for floating point.
+ */
+template <typename Scalar>
+struct PositionRange {
+    static double limit() { return std::numeric_limits<double>::infinity(); }
+};
+
+template <int FractionBits>
+struct PositionRange<FixedPoint32<FractionBits> > {
+    static double limit() { return double(int64_t(1) << (31 - FractionBits)); }
+};
+
+/**
+ * A Dim-dimensional position stored as 32-bit fixed-point integers.
+ *
+ * Every displacement is rounded to the fixed grid once and then added as an integer, so
+ * integration is bit-exact and independent of the order in which displacements are applied.
+ * Quantising a position to a grid cell of 2^k raw units is a single arithmetic shift.
+ *
+ * Sums and differences are taken in 64 bits, so the difference of any two positions in range is
+ * exact; a value beyond the range saturates at its edge instead of wrapping around, and NaN
+ * becomes 0.
+ */
+template <int Dim, int FractionBits>
+struct FixedVec {
+    typedef glm::vec<Dim, float> Vec;
+    typedef glm::vec<Dim, int32_t> Raw;
+    typedef glm::vec<Dim, int64_t> Wide;
+
+    Raw raw;
+
+    static float scale() { return float(int32_t(1) << FractionBits); }
+    static float resolution() { return 1.0f / scale(); }
+
+    FixedVec() : raw(0) {}
+
+    explicit FixedVec(const Vec &v) : raw(quantize(v)) {}
+
+    /**
+     * Converts a real vector to raw fixed-point units, rounding to the nearest representable value.
+     */
+    static Raw quantize(const Vec &v) {
+        Raw raw;
+        for (int d = 0; d < Dim; ++d) {
+            const double scaled = std::round(double(v[d]) * double(scale()));
+            // Out of range saturates; NaN, which fails every comparison, becomes 0
+            raw[d] = scaled >= double(INT32_MIN) && scaled <= double(INT32_MAX) ? int32_t(scaled)
+                     : scaled > 0.0 ? INT32_MAX : scaled < 0.0 ? INT32_MIN : 0;
+        }
+        return raw;
+    }
+
+    /**
+     * Returns the position as a float vector.
+     */
+    Vec toVec() const { return Vec(raw) * resolution(); }
+
+    FixedVec &operator+=(const Vec &displacement) {
+        raw = saturate(Wide(raw) + Wide(quantize(displacement)));
+        return *this;
+    }
+
+    FixedVec &operator-=(const Vec &displacement) {
+        raw = saturate(Wide(raw) - Wide(quantize(displacement)));
+        return *this;
+    }
+
+    /**
+     * The difference of two positions is exact in fixed point and only rounded once, on conversion.
+     */
+    Vec operator-(const FixedVec &other) const { return Vec(Wide(raw) - Wide(other.raw)) * resolution(); }
+
+    bool operator==(const FixedVec &other) const { return raw == other.raw; }
+    bool operator!=(const FixedVec &other) const { return raw != other.raw; }
+
+private:
+    static Raw saturate(const Wide &wide) { return Raw(glm::clamp(wide, Wide(INT32_MIN), Wide(INT32_MAX))); }
+};
+
+/**
+ * Views a position as a floating point vector, whatever its storage.
+ */
+template <int Dim, typename T>
+inline const glm::vec<Dim, T> &asVector(const glm::vec<Dim, T> &v) { return v; }
+
+template <int Dim, int FractionBits>
+inline glm::vec<Dim, float> asVector(const FixedVec<Dim, FractionBits> &v) { return v.toVec(); }
+
+#endif //PART1_FIXEDPOINT_HPP
@@ -0,0 +1,103 @@
+//
+// In-window performance overlay: frame-time graph, timing split and simulation statistics.
+//
+
+#ifndef PART1_HUD_HPP
+#define PART1_HUD_HPP
+
+#include "Shader.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm/glm.hpp>
+
+/**
+ * Where the time of one frame went, in seconds.
+ */
+struct FrameTimes {
+    double simulate = 0.0; // Stepping the simulation, or advancing a replay
+    double render = 0.0;   // Drawing the particles and the overlay
+    double swap = 0.0;     // SDL_GL_SwapWindow, which includes waiting for vsync and the GPU
+
+    double total() const { return simulate + render + swap; }
+};
+
+/**
+ * The simulation statistics shown by the overlay. A grid of zero cells hides the broad-phase line.
+ */
+struct HudStats {
+    std::size_t particles = 0;
+    std::size_t contacts = 0;    // Contacts resolved by the last step
+    std::size_t gridCells = 0;   // Cells of the broad-phase grid
+    double cellSize = 0.0;       // Cell width of the grid
+    int searchedCells = 0;       // Cells searched around each particle
+};
+
+/**
+ * Vertex of the overlay: screen position in pixels, atlas coordinate and color.
+ */
+struct HudVertex {
+    glm::vec2 position;
+    glm::vec2 uv;
+    uint8_t color[4]; // RGBA
+};
+
+/**
+ * Draws the overlay in one batch: every glyph, bar and panel is a textured quad in a single
+ * vertex buffer, drawn with one call against a small glyph atlas; solid shapes sample an opaque
+ * texel of the same atlas. The buffers are sized once, so a frame allocates nothing.
+ */
+class Hud {
+public:
+    /**
+     * Builds the glyph atlas and the overlay shader. Needs a current OpenGL context.
+     * @param vertexPath File path for the overlay vertex shader.
+     * @param fragmentPath File path for the overlay fragment shader.
+     */
+    Hud(const char *vertexPath = "./shaders/hud_vert.glsl", const char *fragmentPath = "./shaders/hud_frag.glsl");
+
+    /**
+     * Deletes the atlas and buffers.
+     */
+    ~Hud();
+
+    Hud(const Hud &) = delete;
+    Hud &operator=(const Hud &) = delete;
+
+    /**
+     * Appends a finished frame to the history the graph and averages are drawn from.
+     */
+    void recordFrame(const FrameTimes &times);
+
+    /**
+     * Draws the overlay over the current viewport, in its top left corner.
+     */
+    void draw(const HudStats &stats);
+
+private:
+    static const int kHistory = 180; // Frames in the graph
+    static const int kMaxQuads = 1024;
+
+    Shader shader;
+    unsigned int VAO, VBO, EBO, atlas;
+    FrameTimes history[kHistory];
+    int next = 0; // Slot of the next frame
+    int recorded = 0;
+    std::vector<HudVertex> vertices;
+
+    /**
+     * Returns the frame n frames before the newest one.
+     */
+    const FrameTimes &ago(int n) const { return history[(next - 1 - n + kHistory) % kHistory]; }
+
+    // Colors are 0xRRGGBBAA
+    void quad(float x0, float y0, float x1, float y1, glm::vec2 uv0, glm::vec2 uv1, uint32_t color);
+    void rect(float x0, float y0, float x1, float y1, uint32_t color);
+
+    /**
+     * Adds a line of text and returns the x coordinate after it.
+     */
+    float text(float x, float y, const char *line, uint32_t color);
+};
+
+#endif //PART1_HUD_HPP
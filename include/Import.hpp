@@ -0,0 +1,88 @@
+//
+// Loading initial conditions from CSV and raw binary files.
+//
+
+#ifndef PART1_IMPORT_HPP
+#define PART1_IMPORT_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "ParticleStorage.hpp"
+#include "Snapshot.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * Particle attributes loaded from a file, one array per attribute. Arrays of attributes the file
+ * does not have are empty.
+ */
+template <typename Real>
+struct ParticleTable {
+    std::vector<glm::vec<3, Real> > positions;
+    std::vector<glm::vec<3, Real> > velocities;
+    std::vector<Real> masses;
+    std::vector<glm::vec3> colors;
+
+    std::size_t size() const { return positions.size(); }
+
+    /**
+     * Returns the table as arrays for BasicSimulation::addParticles.
+     */
+    ParticleArrays<Real> arrays() const {
+        ParticleArrays<Real> view;
+        view.count = positions.size();
+        view.positions = positions.data();
+        view.velocities = velocities.empty() ? nullptr : velocities.data();
+        view.masses = masses.empty() ? nullptr : masses.data();
+        view.colors = colors.empty() ? nullptr : colors.data();
+        return view;
+    }
+};
+
+/**
+ * Parses a decimal floating-point number such as "-1.25e-3" at p, stopping at end, and advances
+ * p past it. Numbers of up to 19 significant digits with a decimal exponent within +-22 are
+ * converted with a single exact multiply or divide; anything else falls back to strtod. Either
+ * way the result is correctly rounded.
+ * @return False, leaving p unchanged, if no number starts at p.
+ */
+bool parseNumber(const char *&p, const char *end, double &value);
+
+/**
+ * Loads particles from a text file with one particle per line.
+ *
+ * Fields are separated by commas, semicolons, tabs or spaces. An optional first line names the
+ * fields (x, y, z, vx, vy, vz, mass, r, g, b; others are ignored); without it the fields are
+ * x y z vx vy vz mass in that order. x and y are required. Blank lines and lines starting with #
+ * are skipped.
+ *
+ * The file is mapped and split into chunks at line boundaries. A first parallel pass counts the
+ * records of every chunk, the arrays are allocated once, and a second parallel pass parses every
+ * chunk straight into its slice of them.
+ *
+ * Throws std::runtime_error, naming the line, if the file cannot be read or a record is malformed.
+ * @param path The file.
+ * @param pool Threads to parse with, or null to parse on the calling thread.
+ */
+template <typename Real>
+ParticleTable<Real> importCsv(const std::string &path, ThreadPool *pool);
+
+/**
+ * Loads particles from a headerless binary file of fixed-size little-endian records.
+ * Throws std::runtime_error if the file cannot be read or is not a whole number of records.
+ * @param path The file.
+ * @param fields The fields of a record in order, named as in importCsv and separated by commas or
+ *               spaces; "_" skips one value.
+ * @param scalar Float32 or Float64, the type of every value.
+ * @param pool Threads to convert with, or null to convert on the calling thread.
+ */
+template <typename Real>
+ParticleTable<Real> importRaw(const std::string &path, const std::string &fields, ScalarCode scalar, ThreadPool *pool);
+
+extern template ParticleTable<float> importCsv<float>(const std::string &, ThreadPool *);
+extern template ParticleTable<double> importCsv<double>(const std::string &, ThreadPool *);
+extern template ParticleTable<float> importRaw<float>(const std::string &, const std::string &, ScalarCode, ThreadPool *);
+extern template ParticleTable<double> importRaw<double>(const std::string &, const std::string &, ScalarCode, ThreadPool *);
+
+#endif //PART1_IMPORT_HPP
@@ -0,0 +1,145 @@
+//
+// Integrator policies used to advance particle state by one timestep.
+//
+
+#ifndef PART1_INTEGRATOR_HPP
+#define PART1_INTEGRATOR_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <glm/glm/glm.hpp>
+#include "FixedPoint.hpp"
+
+/**
+ * A force field that applies the same acceleration everywhere, e.g. gravity.
+ */
+template <typename Vec>
+struct UniformField {
+    Vec acceleration;
+
+    template <typename Position>
+    Vec operator()(const Position &) const { return acceleration; }
+};
+
+/**
+ * A harmonic well pulling every particle towards the origin: a(x) = -k * x.
+ */
+template <typename Vec>
+struct HarmonicField {
+    typename Vec::value_type stiffness;
+
+    template <typename Position>
+    Vec operator()(const Position &x) const { return -stiffness * Vec(asVector(x)); }
+};
+
+/**
+ * Forward (explicit) Euler. First order and not symplectic: energy grows every step
+ * in any oscillating system, whatever the timestep.
+ */
+struct ExplicitEuler {
+    static const char *name() { return "ExplicitEuler"; }
+
+    template <typename Position, typename Vec, typename Field>
+    static void step(Position &x, Vec &v, Vec &a, const Field &field, typename Vec::value_type dt) {
+        a = field(x);
+        x += v * dt;
+        v += a * dt;
+    }
+};
+
+/**
+ * Semi-implicit (symplectic) Euler: kick the velocity first, then drift with the new velocity.
+ * Same cost as explicit Euler, but the energy error stays bounded.
+ */
+struct SemiImplicitEuler {
+    static const char *name() { return "SemiImplicitEuler"; }
+
+    template <typename Position, typename Vec, typename Field>
+    static void step(Position &x, Vec &v, Vec &a, const Field &field, typename Vec::value_type dt) {
+        a = field(x);
+        v += a * dt;
+        x += v * dt;
+    }
+};
+
+/**
+ * Velocity Verlet (kick-drift-kick). Second order and symplectic. The acceleration of the
+ * previous step is carried in `a`, so there is one field evaluation per step.
+ */
+struct VelocityVerlet {
+    static const char *name() { return "VelocityVerlet"; }
+
+    template <typename Position, typename Vec, typename Field>
+    static void step(Position &x, Vec &v, Vec &a, const Field &field, typename Vec::value_type dt) {
+        typedef typename Vec::value_type T;
+        v += a * (dt * T(0.5));
+        x += v * dt;
+        a = field(x);
+        v += a * (dt * T(0.5));
+    }
+};
+
+/**
+ * Leapfrog in drift-kick-drift form. Second order and symplectic. It needs no stored
+ * acceleration, which makes it the cheapest second order scheme here.
+ */
+struct Leapfrog {
+    static const char *name() { return "Leapfrog"; }
+
+    template <typename Position, typename Vec, typename Field>
+    static void step(Position &x, Vec &v, Vec &a, const Field &field, typename Vec::value_type dt) {
+        typedef typename Vec::value_type T;
+        x += v * (dt * T(0.5));
+        a = field(x);
+        v += a * dt;
+        x += v * (dt * T(0.5));
+    }
+};
+
+/**
+ * Initialises the stored acceleration of a particle so the first Verlet step is consistent.
+ * Must be called when a particle is created or teleported.
+ */
+template <typename Position, typename Vec, typename Field>
+inline void primeAcceleration(const Position &x, Vec &a, const Field &field) {
+    a = field(x);
+}
+
+/**
+ * Advances every particle by one timestep in a single pass: the boundary reflection and the
+ * integrator step are fused so each particle is loaded and stored once.
+ *
+ * @param positions Particle positions (floating point vectors or FixedVec).
+ * @param velocities Particle velocities.
+ * @param accelerations Accelerations from the previous step (updated in place).
+ * @param count Number of particles.
+ * @param dt The timestep, in seconds.
+ * @param boundary Half-extent of the box; a velocity component is mirrored when the particle is outside.
+ * @param field The force field, called as field(position) and returning an acceleration.
+ */
+template <typename Integrator, typename Position, typename Vec, typename Field>
+void integrateParticles(Position *positions, Vec *velocities, Vec *accelerations, std::size_t count,
+                        typename Vec::value_type dt, typename Vec::value_type boundary, const Field &field) {
+    for (std::size_t p = 0; p < count; ++p) {
+        Position &x = positions[p];
+        Vec &v = velocities[p];
+
+        const Vec position = Vec(asVector(x));
+        for (int i = 0; i < Vec::length(); ++i) {
+            if (std::abs(position[i]) > boundary) {
+                v[i] = -v[i];
+            }
+        }
+
+        Integrator::step(x, v, accelerations[p], field, dt);
+    }
+}
+
+// The integrator used by Simulation, chosen at compile time (see SIM_INTEGRATOR in CMakeLists.txt).
+#ifndef SIM_INTEGRATOR
+#define SIM_INTEGRATOR VelocityVerlet
+#endif
+
+typedef SIM_INTEGRATOR ActiveIntegrator;
+
+#endif //PART1_INTEGRATOR_HPP
@@ -0,0 +1,171 @@
+//
+// Live metrics in the Prometheus text exposition format, served over HTTP on localhost.
+//
+
+#ifndef PART1_METRICS_HPP
+#define PART1_METRICS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A monotonically increasing count. Updates are relaxed atomic adds, so hot paths on any thread
+ * can update it without ordering or locking.
+ */
+class MetricCounter {
+public:
+    void add(uint64_t amount = 1) { value.fetch_add(amount, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value{0};
+};
+
+/**
+ * A value that goes up and down, stored as the bits of a double.
+ */
+class MetricGauge {
+public:
+    void set(double value);
+    void add(double amount);
+    double get() const;
+
+private:
+    std::atomic<uint64_t> bits{0};
+};
+
+/**
+ * Counts of observations in fixed buckets, with their sum. The bucket bounds are set once, so
+ * observe() is a short search and two relaxed atomic adds.
+ */
+class MetricHistogram {
+public:
+    /**
+     * @param upperBounds Inclusive upper bounds of the buckets, ascending; a final bucket takes
+     *                    everything above the last.
+     */
+    explicit MetricHistogram(const std::vector<double> &upperBounds);
+
+    void observe(double value);
+
+    const std::vector<double> &getBounds() const { return bounds; }
+
+    /**
+     * Returns the observations in bucket b, which holds values above bound b - 1 up to bound b;
+     * bucket getBounds().size() holds the rest.
+     */
+    uint64_t bucket(std::size_t b) const { return buckets[b].load(std::memory_order_relaxed); }
+
+    double sum() const;
+
+private:
+    std::vector<double> bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> buckets;
+    std::atomic<uint64_t> sumBits{0};
+};
+
+/**
+ * Named metrics with their help text. Registering is cheap but takes a lock, so it belongs in
+ * setup code; the returned metrics stay valid as long as the registry and are updated lock-free.
+ */
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    MetricsRegistry(const MetricsRegistry &) = delete;
+    MetricsRegistry &operator=(const MetricsRegistry &) = delete;
+
+    /**
+     * Returns the counter of the given name, registering it first if needed. Throws
+     * std::runtime_error if the name is not a valid metric name or belongs to another kind of metric.
+     */
+    MetricCounter &counter(const std::string &name, const std::string &help);
+    MetricGauge &gauge(const std::string &name, const std::string &help);
+    MetricHistogram &histogram(const std::string &name, const std::string &help, const std::vector<double> &upperBounds);
+
+    /**
+     * Registers a gauge whose value is computed by read() whenever the metrics are exposed, on the
+     * exposing thread; for values such as the resident set that are too costly to keep current.
+     */
+    void callbackGauge(const std::string &name, const std::string &help, std::function<double()> read);
+
+    /**
+     * Returns every metric in the text exposition format, version 0.0.4.
+     */
+    std::string expose() const;
+
+private:
+    struct Family;
+
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Family> > families;
+
+    Family &family(const std::string &name, const std::string &help, int kind);
+};
+
+/**
+ * Serves a registry over HTTP from a background thread: GET /metrics answers with expose(), any
+ * other path with 404. Scrapes only read the metrics, so they never wait for the simulation.
+ */
+class MetricsServer {
+public:
+    /**
+     * Starts listening. Throws std::runtime_error if the address cannot be bound.
+     * @param registry The metrics to serve; it must outlive the server.
+     * @param port The TCP port, or 0 for any free one (see getPort).
+     * @param address The IPv4 address to bind, loopback by default.
+     */
+    MetricsServer(const MetricsRegistry &registry, uint16_t port, const std::string &address = "127.0.0.1");
+
+    /**
+     * Stops and joins the server thread.
+     */
+    ~MetricsServer();
+
+    MetricsServer(const MetricsServer &) = delete;
+    MetricsServer &operator=(const MetricsServer &) = delete;
+
+    uint16_t getPort() const { return port; }
+
+private:
+    const MetricsRegistry &registry;
+    int listener = -1;
+    int wake[2] = {-1, -1}; // Self-pipe that the destructor writes to
+    uint16_t port = 0;
+    std::thread thread;
+
+    void serve();
+    void answer(int client);
+};
+
+/**
+ * The metrics a simulation updates after every call to simulate(); attach them with
+ * BasicSimulation::setMetrics.
+ */
+struct SimulationMetrics {
+    /**
+     * Registers the simulation metrics, and the resident set of the process, in a registry.
+     */
+    explicit SimulationMetrics(MetricsRegistry &registry);
+
+    MetricCounter &steps; // Calls to simulate()
+    MetricCounter &iterations; // Collision and integration passes
+    MetricCounter &contacts; // Contacts resolved
+    MetricHistogram &stepSeconds; // Wall time of simulate()
+    MetricGauge &particles;
+    MetricGauge &stepContacts; // Contacts resolved by the last call to simulate()
+    MetricGauge &restingFraction; // Share of particles slower than restSpeed
+    MetricGauge &particleBytes; // Memory of the particle arrays
+
+    double restSpeed = 1e-2; // Speed below which a particle counts as resting
+};
+
+#endif //PART1_METRICS_HPP
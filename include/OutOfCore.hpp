@@ -0,0 +1,175 @@
+//
+// Simulation of more particles than fit in memory, streamed tile by tile through mapped files.
+//
+
+#ifndef PART1_OUTOFCORE_HPP
+#define PART1_OUTOFCORE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "ParticleStorage.hpp"
+#include "ThreadPool.hpp"
+#include "TileCache.hpp"
+#include "UniformGrid.hpp"
+
+/**
+ * How an out-of-core simulation splits and streams its domain.
+ */
+struct OutOfCoreOptions {
+    std::string directory = "."; // Where the tile files go
+    unsigned tilesPerAxis = 8; // The box is split into tilesPerAxis^Dim tiles
+    std::size_t cachedTiles = 0; // Tiles kept mapped; 0 keeps enough for one sweep (see below)
+    unsigned prefetchDepth = 2; // Tiles ahead of the current one whose neighbourhoods are prefetched
+    double haloWidth = 0.0; // Depth of the neighbour particles simulated with a tile; 0 means 4 radii
+};
+
+/**
+ * What streaming the tiles has cost so far.
+ */
+struct OutOfCoreStats {
+    uint64_t tilesProcessed = 0;
+    uint64_t ghostsLoaded = 0; // Neighbour particles simulated alongside a tile
+    uint64_t particlesMigrated = 0; // Particles that moved to another tile
+    uint64_t bytesWritten = 0;
+    double computeSeconds = 0.0; // Collisions and integration
+};
+
+/**
+ * A simulation whose particles live in files rather than in memory, so its size is bounded by
+ * disk space instead of RAM.
+ *
+ * The box is split into a regular grid of tiles. Every tile is a file of particle records, and
+ * there are two sets of files: simulate() reads every tile from one set and writes it to the
+ * other, then swaps them. A tile is simulated in memory together with a halo of ghosts, the
+ * particles of its neighbour tiles within haloWidth of its edges, so contacts across tile edges
+ * are resolved; ghosts are simulated too but only the tile's own particles are written back.
+ * Particles that leave their tile are appended to the tile they entered once the sweep is over.
+ *
+ * Tiles are swept in row-major order. Input tiles are mapped through a TileCache, which keeps the
+ * recently used ones mapped, since every tile is needed again as a neighbour of the tiles after
+ * it, and which prefetches the neighbourhoods of the next tiles on its own thread while the
+ * current tile is being simulated.
+ *
+ * Memory: the cache maps at most cachedTiles tiles. The default, three slabs of tiles plus the
+ * prefetched neighbourhoods, is about 3 / tilesPerAxis of the data, since every tile is then read
+ * from disk once per sweep; on a coarse tiling that is most of the data, so for scenes larger than
+ * RAM choose tilesPerAxis so that a slab is small, or set cachedTiles lower and accept rereads.
+ * Besides the cache, a tile's records and ghosts are held in memory while it is simulated, and
+ * the particles migrating to other tiles until the sweep ends.
+ *
+ * The halo must be wider than two particle radii plus the distance a particle travels in one call
+ * to simulate(); a ghost near the outer edge of the halo does not see its own neighbours, so
+ * results match an in-memory simulation only up to contacts across that edge. Tile files hold raw
+ * records in host byte order and are not meant to be portable.
+ */
+template <int Dim, typename Scalar>
+class BasicOutOfCoreSimulation {
+public:
+    typedef BasicParticleStorage<Dim, Scalar> Storage;
+    typedef typename Storage::Real Real;
+    typedef typename Storage::Vec Vec;
+    typedef typename Storage::Position Position;
+
+private:
+    typedef glm::vec<Dim, int> Tile;
+
+    OutOfCoreOptions options;
+    Real particleRadius;
+    Real boundary; // Half-extent of the box
+    Real tileSize;
+    Real halo;
+    int numIterations = 5;
+    Vec gravity = Vec(Real(0));
+    double time = 0.0;
+    uint64_t stepCount = 0;
+    uint64_t particleCount = 0;
+    unsigned current = 0; // The file set holding the current state
+    ThreadPool* pool = nullptr;
+    TileCache cache;
+    Storage working; // The tile being simulated, its own particles first, then its ghosts
+    UniformGrid<Dim, Position> grid;
+    std::vector<std::vector<unsigned char> > migrants; // Records leaving their tile, per destination
+    std::vector<unsigned char> records; // Staging for the records of one tile
+    OutOfCoreStats stats;
+
+    std::string tilePath(unsigned set, std::size_t tile) const;
+    std::size_t tileIndex(const Tile& tile) const;
+    Tile tileCoordinates(std::size_t tile) const;
+    std::size_t tileOf(const Position& position) const;
+
+    template <typename Visitor>
+    void forEachNeighbour(std::size_t tile, Visitor&& visit) const;
+
+    const unsigned char* tileRecords(const MappedTile& file, std::size_t tile, std::size_t& count) const;
+    static void appendRecords(Storage& to, const unsigned char* const* records, std::size_t count);
+    static void packRecord(const Position& position, const Vec& velocity, const Vec& acceleration,
+                           const glm::vec3& color, Real mass, unsigned char* out);
+    void writeTile(unsigned set, std::size_t tile, const unsigned char* records, std::size_t count, bool append);
+    void simulateTile(std::size_t tile, Real dt);
+
+public:
+    /**
+     * Creates empty tile files in the options' directory, replacing any there.
+     * Throws std::runtime_error if the files cannot be created, the tiles are narrower than the
+     * halo or the boundary is beyond the range of Scalar positions (see PositionRange).
+     * @param options How to split and stream the domain.
+     * @param particleRadius The radius shared by all particles.
+     * @param boundary Half-extent of the box the particles are kept in.
+     */
+    BasicOutOfCoreSimulation(const OutOfCoreOptions& options, Real particleRadius, Real boundary);
+
+    /**
+     * Adds particles, appending each to the file of the tile it lies in. Scenes larger than memory
+     * are added in batches.
+     * @param arrays The attributes of the new particles.
+     * @return The number of particles added.
+     */
+    std::size_t addParticles(const ParticleArrays<Real>& arrays);
+
+    /**
+     * Advances every tile over the specified time interval, in numIterations collision and
+     * integration passes like BasicSimulation::simulate.
+     * @param dt The time interval of one pass, in seconds.
+     */
+    void simulate(Real dt);
+
+    /**
+     * Appends the particles of one tile to out, e.g. to export or inspect the state.
+     * @param tile The tile, in [0, getTileCount()).
+     * @return The number of particles appended.
+     */
+    std::size_t readTile(std::size_t tile, Storage& out);
+
+    /**
+     * Sets the threads used to integrate a tile, or null to run on the calling thread.
+     */
+    void setThreadPool(ThreadPool* threads) { pool = threads; }
+
+    /**
+     * Sets the uniform acceleration applied to particles added afterwards and during simulate().
+     */
+    void setGravity(const glm::vec<3, Real>& acceleration) { gravity = fromVec3<Dim>(acceleration); }
+
+    void setIterations(int iterations) { numIterations = iterations; }
+
+    std::size_t getTileCount() const;
+    uint64_t getParticleCount() const { return particleCount; }
+    double getTime() const { return time; }
+    uint64_t getStepCount() const { return stepCount; }
+    const OutOfCoreStats& getStats() const { return stats; }
+    TileCacheStats getCacheStats() const { return cache.getStats(); }
+};
+
+extern template class BasicOutOfCoreSimulation<2, float>;
+extern template class BasicOutOfCoreSimulation<3, float>;
+extern template class BasicOutOfCoreSimulation<2, double>;
+extern template class BasicOutOfCoreSimulation<3, double>;
+extern template class BasicOutOfCoreSimulation<2, FixedPoint32<> >;
+extern template class BasicOutOfCoreSimulation<3, FixedPoint32<> >;
+
+typedef BasicOutOfCoreSimulation<SIM_DIMENSION, SIM_SCALAR> OutOfCoreSimulation;
+
+#endif //PART1_OUTOFCORE_HPP
@@ -8,8 +8,15 @@
 #include <string>
 #include "Render.hpp"
 
-class Particle {
+/**
+ * A single particle, used to describe particles added to a simulation.
+ * Real is the floating point type of its kinematic attributes (float or double).
+ */
+template <typename Real>
+class BasicParticle {
 public:
+    typedef glm::vec<3, Real> Vec;
+
     /**
      * Constructs a new Particle object with the given parameters.
      *
@@ -18,14 +25,14 @@ public:
      * @param color The color of the particle.
      * @param mass The mass of the particle.
      */
-    Particle(glm::vec3 position, glm::vec3 velocity, glm::vec3 color, float mass);
+    BasicParticle(Vec position, Vec velocity, glm::vec3 color, Real mass);
 
     /**
      * Updates the particle's position based on its velocity and the elapsed time.
      *
      * @param dt The time elapsed since the last update, in seconds.
      */
-    void update(float dt);
+    void update(Real dt);
 
     /**
      * Renders the particle using the given renderer and shader.
@@ -36,20 +43,26 @@ public:
     void render(Render &renderer, Shader &shader) const;
 
     // Getter methods
-    glm::vec3 getPosition() const { return position; }
-    glm::vec3 getVelocity() const { return velocity; }
-    float getMass() const { return mass; }
+    Vec getPosition() const { return position; }
+    Vec getVelocity() const { return velocity; }
+    glm::vec3 getColor() const { return color; }
+    Real getMass() const { return mass; }
 
     // Setter methods
-    void setPosition(const glm::vec3 &pos) { position = pos; }
-    void setVelocity(const glm::vec3 &vel) { velocity = vel; }
+    void setPosition(const Vec &pos) { position = pos; }
+    void setVelocity(const Vec &vel) { velocity = vel; }
 
 private:
-    glm::vec3 position;
-    glm::vec3 velocity;
+    Vec position;
+    Vec velocity;
     glm::vec3 color;
-    float mass;
+    Real mass;
 };
 
+extern template class BasicParticle<float>;
+extern template class BasicParticle<double>;
+
+typedef BasicParticle<float> Particle;
+
 
 #endif //PART1_PARTICLE_HPP
@@ -0,0 +1,141 @@
+//
+// Structure-of-arrays storage for the particles of a simulation.
+//
+
+#ifndef PART1_PARTICLESTORAGE_HPP
+#define PART1_PARTICLESTORAGE_HPP
+
+#include <cstddef>
+#include <glm/glm/glm.hpp>
+#include "Column.hpp"
+#include "FixedPoint.hpp"
+
+// Number of spatial dimensions simulated (2 or 3), chosen at compile time (see SIM_DIMENSION in CMakeLists.txt).
+#ifndef SIM_DIMENSION
+#define SIM_DIMENSION 3
+#endif
+
+// Scalar type of the simulation: float, double or FixedPoint32<> (see SIM_SCALAR in CMakeLists.txt).
+#ifndef SIM_SCALAR
+#define SIM_SCALAR float
+#endif
+
+/**
+ * The types a Dim-dimensional simulation over Scalar is made of. For float and double every
+ * attribute uses Scalar; fixed-point simulations store positions as FixedVec and everything
+ * else as float.
+ */
+template <int Dim, typename Scalar>
+struct ParticleTypes {
+    typedef Scalar Real;
+    typedef glm::vec<Dim, Real> Vec;
+    typedef Vec Position;
+};
+
+template <int Dim, int FractionBits>
+struct ParticleTypes<Dim, FixedPoint32<FractionBits> > {
+    typedef float Real;
+    typedef glm::vec<Dim, Real> Vec;
+    typedef FixedVec<Dim, FractionBits> Position;
+};
+
+/**
+ * Stores every particle attribute in its own contiguous array, so kernels that only need
+ * positions and velocities do not drag colors and masses through the cache. Arrays can borrow
+ * memory, e.g. from a mapped snapshot (see Column).
+ * Kinematic attributes are Dim-wide; colors are always RGB floats.
+ */
+template <int Dim, typename Scalar = float>
+struct BasicParticleStorage {
+    typedef typename ParticleTypes<Dim, Scalar>::Real Real;
+    typedef typename ParticleTypes<Dim, Scalar>::Vec Vec;
+    typedef typename ParticleTypes<Dim, Scalar>::Position Position;
+
+    Column<Position> positions;
+    Column<Vec> velocities;
+    Column<Vec> accelerations;
+    Column<glm::vec3> colors;
+    Column<Real> masses;
+
+    /**
+     * Returns the number of bytes one particle occupies across all arrays.
+     */
+    static std::size_t bytesPerParticle() {
+        return sizeof(Position) + 2 * sizeof(Vec) + sizeof(glm::vec3) + sizeof(Real);
+    }
+
+    /**
+     * Returns the number of stored particles.
+     */
+    std::size_t size() const { return positions.size(); }
+
+    /**
+     * Reserves room for the given number of particles in every array.
+     * @param count The number of particles.
+     */
+    void reserve(std::size_t count) {
+        positions.reserve(count);
+        velocities.reserve(count);
+        accelerations.reserve(count);
+        colors.reserve(count);
+        masses.reserve(count);
+    }
+
+    /**
+     * Grows or shrinks every array to the given number of particles; new particles are zeroed.
+     * @param count The number of particles.
+     */
+    void resize(std::size_t count) {
+        positions.resize(count, Position(Vec(Real(0))));
+        velocities.resize(count, Vec(Real(0)));
+        accelerations.resize(count, Vec(Real(0)));
+        colors.resize(count, glm::vec3(0.0f));
+        masses.resize(count, Real(0));
+    }
+
+    /**
+     * Appends a particle.
+     */
+    void add(const Position &position, const Vec &velocity, const Vec &acceleration,
+             const glm::vec3 &color, Real mass) {
+        positions.push_back(position);
+        velocities.push_back(velocity);
+        accelerations.push_back(acceleration);
+        colors.push_back(color);
+        masses.push_back(mass);
+    }
+};
+
+typedef BasicParticleStorage<SIM_DIMENSION, SIM_SCALAR> ParticleStorage;
+
+/**
+ * Particle attributes as whole arrays with one element per particle, for adding many particles
+ * at once. Positions are required; any other array may be null to take its default.
+ */
+template <typename Real>
+struct ParticleArrays {
+    std::size_t count = 0;
+    const glm::vec<3, Real> *positions = nullptr;
+    const glm::vec<3, Real> *velocities = nullptr; // Default zero
+    const Real *masses = nullptr; // Default 1
+    const glm::vec3 *colors = nullptr; // Default black
+};
+
+/**
+ * Drops the components of a 3D vector that a Dim-dimensional simulation does not use.
+ */
+template <int Dim, typename T>
+inline glm::vec<Dim, T> fromVec3(const glm::vec<3, T> &v) {
+    return glm::vec<Dim, T>(v);
+}
+
+/**
+ * Widens a simulation vector back to 3D, with z = 0 in 2D.
+ */
+template <typename T>
+inline glm::vec<3, T> toVec3(const glm::vec<2, T> &v) { return glm::vec<3, T>(v, T(0)); }
+
+template <typename T>
+inline glm::vec<3, T> toVec3(const glm::vec<3, T> &v) { return v; }
+
+#endif //PART1_PARTICLESTORAGE_HPP
@@ -0,0 +1,157 @@
+//
+// Hardware performance counters per simulation phase and thread, through Linux perf_event.
+//
+
+#ifndef PART1_PERFCOUNTERS_HPP
+#define PART1_PERFCOUNTERS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+/**
+ * The counted events. Each is optional: events the kernel or the (virtual) machine does not
+ * provide are left out, and reported as unavailable.
+ */
+enum class CounterEvent {
+    Cycles,
+    Instructions,
+    LlcMisses,      // Last-level cache misses
+    BranchMisses,
+    StalledCycles,  // Cycles the back end made no progress
+    TaskClock       // Nanoseconds on a CPU (a software event, so usually available)
+};
+
+const int kCounterEvents = 6;
+
+/**
+ * Event totals, in events (nanoseconds for TaskClock). Counts of multiplexed events are scaled to
+ * the whole time they were enabled.
+ */
+struct CounterValues {
+    double counts[kCounterEvents] = {};
+    uint32_t available = 0; // Bit e set when event e was counted
+
+    bool has(CounterEvent event) const { return (available >> int(event)) & 1u; }
+    double operator[](CounterEvent event) const { return counts[int(event)]; }
+
+    CounterValues &operator+=(const CounterValues &other);
+};
+
+/**
+ * Counters of the calling thread: user-space cycles, instructions, LLC misses, branch misses
+ * and stalled cycles in one group, so they are scheduled together, plus the task clock. They
+ * count from the first use on a thread until it exits; read() returns running totals.
+ */
+class ThreadCounters {
+public:
+    /**
+     * Returns the counters of the calling thread, opening them on first use.
+     */
+    static ThreadCounters &current();
+
+    ~ThreadCounters();
+
+    ThreadCounters(const ThreadCounters &) = delete;
+    ThreadCounters &operator=(const ThreadCounters &) = delete;
+
+    /**
+     * Returns the totals so far; events that could not be opened are absent.
+     */
+    CounterValues read() const;
+
+private:
+    int group = -1; // Leader of the hardware group, or -1
+    int members[kCounterEvents]; // Descriptor per event, or -1
+    int order[kCounterEvents]; // Events of the group in the order the kernel reports them
+    int groupSize = 0;
+    int clock = -1; // Task clock descriptor, or -1
+
+    ThreadCounters();
+};
+
+/**
+ * The instrumented phases of BasicSimulation::simulate.
+ */
+enum class SimulationPhase {
+    BuildGrid,       // Broad phase: binning the particles into the uniform grid
+    FindContacts,    // Walking candidate pairs; also resolves them on the serial fast path
+    ResolveContacts, // Resolving the contacts found in parallel
+    Integrate        // Boundary reflection and integration
+};
+
+const int kSimulationPhases = 4;
+
+const char *phaseName(SimulationPhase phase);
+
+/**
+ * Counter totals of a simulation per phase and per pool thread. Attach it with
+ * BasicSimulation::setPhaseCounters; every phase then reads the counters of the threads it runs on
+ * when it starts and ends, which costs a few system calls per parallel chunk.
+ */
+class PhaseCounters {
+public:
+    /**
+     * Counts one phase on one thread from construction to destruction; does nothing without
+     * counters.
+     */
+    class Scope {
+    public:
+        Scope(PhaseCounters *counters, SimulationPhase phase, unsigned thread);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        PhaseCounters *counters;
+        SimulationPhase phase;
+        unsigned thread;
+        CounterValues start;
+    };
+
+    /**
+     * Makes room for the given number of threads. Called by simulate() before any phase runs.
+     */
+    void prepare(unsigned threadCount);
+
+    /**
+     * Clears all totals.
+     */
+    void reset();
+
+    unsigned threadCount() const { return unsigned(perThread.size()); }
+
+    /**
+     * Returns whether any event could be counted on the calling thread.
+     */
+    static bool supported();
+
+    const CounterValues &get(SimulationPhase phase, unsigned thread) const;
+
+    /**
+     * Returns the totals of a phase over all threads.
+     */
+    CounterValues total(SimulationPhase phase) const;
+
+    /**
+     * Writes the totals and rates of every phase, and of every thread within it, as a JSON
+     * object. Unavailable events and rates are null.
+     */
+    void writeJson(std::ostream &out) const;
+
+    /**
+     * Writes one line per phase with its instructions per cycle and miss rates.
+     */
+    void writeTable(std::ostream &out) const;
+
+private:
+    struct ThreadTotals {
+        CounterValues phases[kSimulationPhases];
+    };
+
+    std::vector<ThreadTotals> perThread;
+};
+
+#endif //PART1_PERFCOUNTERS_HPP
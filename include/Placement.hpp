@@ -0,0 +1,272 @@
+//
+// Non-overlapping initial placement of particles.
+//
+
+#ifndef PART1_PLACEMENT_HPP
+#define PART1_PLACEMENT_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "Random.hpp"
+#include "ThreadPool.hpp"
+
+/**
+ * How initial particle positions are chosen.
+ */
+enum class PlacementMode {
+    Uniform,         // Independent uniform positions; particles may overlap
+    JitteredLattice, // A randomly jittered grid; fastest relaxed placement
+    PoissonDisk      // Blue-noise dart throwing; no lattice structure
+};
+
+/**
+ * Keeps `count` of the given points, chosen at random but reproducibly, in their original order.
+ * Any subset of a well-spaced set is still well spaced.
+ */
+template <typename Point>
+void keepRandomSubset(std::vector<Point> &points, std::size_t count, uint64_t seed) {
+    if (points.size() <= count) {
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t> > keys(points.size());
+    float unit[1][kRandomLanes];
+    for (std::size_t base = 0; base < points.size(); base += kRandomLanes) {
+        itemUniforms<float, 1>(seed ^ 0x5bd1e995ull, PlacementStream, base, unit);
+        for (std::size_t lane = 0; lane < kRandomLanes && base + lane < points.size(); ++lane) {
+            keys[base + lane] = std::make_pair(uint32_t(unit[0][lane] * 16777216.0f), uint32_t(base + lane));
+        }
+    }
+    std::nth_element(keys.begin(), keys.begin() + count, keys.end());
+    keys.resize(count);
+    std::sort(keys.begin(), keys.end(), [](const std::pair<uint32_t, uint32_t> &a, const std::pair<uint32_t, uint32_t> &b) {
+        return a.second < b.second;
+    });
+
+    std::vector<Point> kept(count);
+    for (std::size_t k = 0; k < count; ++k) {
+        kept[k] = points[keys[k].second];
+    }
+    points.swap(kept);
+}
+
+/**
+ * Places up to `count` points in the box [lower, upper] on a jittered lattice.
+ *
+ * The lattice spacing is as wide as the box allows for `count` points but at least minSpacing.
+ * Each point moves at most (spacing - minSpacing) / 2 from its site along every axis, so any
+ * two points are at least minSpacing apart. Sites are independent, so points are generated in
+ * parallel; a random subset of sites is kept when the lattice has more than `count`.
+ *
+ * @return The points; fewer than `count` if the box cannot hold that many at minSpacing.
+ */
+template <int Dim, typename Real>
+std::vector<glm::vec<Dim, Real> > jitteredLattice(ThreadPool *pool, uint64_t seed, std::size_t count,
+                                                  const glm::vec<Dim, Real> &lower, const glm::vec<Dim, Real> &upper,
+                                                  Real minSpacing) {
+    typedef glm::vec<Dim, Real> Vec;
+
+    std::vector<Vec> points;
+    if (count == 0) {
+        return points;
+    }
+
+    const Vec extent = glm::max(upper - lower, Vec(Real(0)));
+    double volume = 1.0;
+    int spanned = 0; // Axes along which the box has a width; the others hold a single layer
+    for (int d = 0; d < Dim; ++d) {
+        if (extent[d] > Real(0)) {
+            volume *= double(extent[d]);
+            ++spanned;
+        }
+    }
+
+    // Shrink the spacing from the ideal value until the lattice has enough sites.
+    double spacing = spanned > 0 ? std::max(std::pow(volume / double(count), 1.0 / spanned), double(minSpacing))
+                                 : double(minSpacing);
+    glm::vec<Dim, int> sites;
+    std::size_t total;
+    for (;;) {
+        total = 1;
+        for (int d = 0; d < Dim; ++d) {
+            sites[d] = extent[d] > Real(0) ? int(std::floor(double(extent[d]) / spacing)) + 1 : 1;
+            total *= std::size_t(sites[d]);
+        }
+        if (total >= count || spacing <= double(minSpacing)) {
+            break;
+        }
+        spacing = std::max(spacing * 0.98, double(minSpacing));
+    }
+
+    Vec pitch;
+    Vec jitter;
+    for (int d = 0; d < Dim; ++d) {
+        pitch[d] = sites[d] > 1 ? extent[d] / Real(sites[d] - 1) : Real(0);
+        jitter[d] = sites[d] > 1 ? std::max(Real(0), (pitch[d] - minSpacing) * Real(0.5)) : Real(0);
+    }
+
+    points.resize(total);
+    parallelFor(pool, total, 16384, [&](std::size_t begin, std::size_t end, unsigned) {
+        Real unit[Dim][kRandomLanes];
+        for (std::size_t base = begin; base < end; base += kRandomLanes) {
+            itemUniforms<Real, Dim>(seed, PlacementStream, base, unit);
+            for (std::size_t lane = 0; lane < kRandomLanes && base + lane < end; ++lane) {
+                std::size_t site = base + lane;
+                Vec point;
+                for (int d = 0; d < Dim; ++d) {
+                    std::size_t k = site % std::size_t(sites[d]);
+                    site /= std::size_t(sites[d]);
+                    Real centre = sites[d] > 1 ? lower[d] + pitch[d] * Real(k) : (lower[d] + upper[d]) * Real(0.5);
+                    point[d] = centre + jitter[d] * (Real(2) * unit[d][lane] - Real(1));
+                }
+                points[base + lane] = glm::clamp(point, lower, upper);
+            }
+        }
+    });
+
+    keepRandomSubset(points, count, seed);
+    return points;
+}
+
+/**
+ * Places up to `count` points in the box [lower, upper] by grid-accelerated dart throwing, with
+ * every pair at least minSpacing apart (Poisson-disk / blue-noise sampling).
+ *
+ * Cells of width minSpacing / sqrt(Dim) hold at most one point, and a dart only conflicts with
+ * points up to two cells away. Cells whose coordinates agree modulo 3 are therefore independent,
+ * so the 3^Dim phases are processed one after another with all cells of a phase in parallel.
+ * Darts come from counter-based random numbers, so the result does not depend on threading.
+ *
+ * @return The points; fewer than `count` if dart throwing saturates before reaching it.
+ */
+template <int Dim, typename Real>
+std::vector<glm::vec<Dim, Real> > poissonDisk(ThreadPool *pool, uint64_t seed, std::size_t count,
+                                              const glm::vec<Dim, Real> &lower, const glm::vec<Dim, Real> &upper,
+                                              Real minSpacing) {
+    typedef glm::vec<Dim, Real> Vec;
+    typedef glm::vec<Dim, int> Cell;
+
+    const int attempts = 30; // Darts per cell and round
+    const int rounds = 2;    // The second round only runs if the first one placed too few points
+
+    const Vec extent = glm::max(upper - lower, Vec(Real(0)));
+    const Real cellSize = minSpacing / std::sqrt(Real(Dim));
+    Cell resolution;
+    std::size_t cellCount = 1;
+    for (int d = 0; d < Dim; ++d) {
+        resolution[d] = std::max(1, int(std::ceil(extent[d] / cellSize)));
+        cellCount *= std::size_t(resolution[d]);
+    }
+
+    std::vector<Vec> samples(cellCount);
+    std::vector<uint8_t> occupied(cellCount, 0);
+    const Real minSquared = minSpacing * minSpacing;
+
+    auto linear = [&](const Cell &cell) {
+        std::size_t index = 0;
+        for (int d = Dim - 1; d >= 0; --d) {
+            index = index * std::size_t(resolution[d]) + std::size_t(cell[d]);
+        }
+        return index;
+    };
+
+    auto fits = [&](const Cell &cell, const Vec &candidate) {
+        Cell low = glm::max(cell - Cell(2), Cell(0));
+        Cell high = glm::min(cell + Cell(2), resolution - Cell(1));
+        Cell other = low;
+        for (;;) {
+            std::size_t index = linear(other);
+            if (occupied[index]) {
+                Vec diff = samples[index] - candidate;
+                if (glm::dot(diff, diff) < minSquared) {
+                    return false;
+                }
+            }
+            int d = 0;
+            while (d < Dim && other[d] == high[d]) {
+                other[d] = low[d];
+                ++d;
+            }
+            if (d == Dim) {
+                return true;
+            }
+            ++other[d];
+        }
+    };
+
+    int phases = 1;
+    for (int d = 0; d < Dim; ++d) {
+        phases *= 3;
+    }
+
+    std::size_t placed = 0;
+    for (int round = 0; round < rounds && placed < count; ++round) {
+        for (int phase = 0; phase < phases; ++phase) {
+            Cell offset;
+            Cell phaseCells;
+            std::size_t phaseCount = 1;
+            for (int d = 0, p = phase; d < Dim; ++d, p /= 3) {
+                offset[d] = p % 3;
+                phaseCells[d] = std::max(0, (resolution[d] - offset[d] + 2) / 3);
+                phaseCount *= std::size_t(phaseCells[d]);
+            }
+
+            parallelFor(pool, phaseCount, 256, [&](std::size_t begin, std::size_t end, unsigned) {
+                for (std::size_t k = begin; k < end; ++k) {
+                    Cell cell;
+                    std::size_t rest = k;
+                    for (int d = 0; d < Dim; ++d) {
+                        cell[d] = offset[d] + 3 * int(rest % std::size_t(phaseCells[d]));
+                        rest /= std::size_t(phaseCells[d]);
+                    }
+                    std::size_t index = linear(cell);
+                    if (occupied[index]) {
+                        continue;
+                    }
+
+                    for (int attempt = 0; attempt < attempts; ++attempt) {
+                        uint64_t dart = (uint64_t(round) * attempts + uint64_t(attempt)) * cellCount + index;
+                        PhiloxLanes<1> philox;
+                        philox.x0[0] = uint32_t(dart);
+                        philox.x1[0] = uint32_t(dart >> 32);
+                        philox.x2[0] = 0x706f6973u; // Keeps darts apart from the lattice jitter counters
+                        philox.x3[0] = PlacementStream;
+                        philox.generate(uint32_t(seed), uint32_t(seed >> 32));
+                        const uint32_t words[4] = {philox.x0[0], philox.x1[0], philox.x2[0], philox.x3[0]};
+
+                        Vec candidate;
+                        for (int d = 0; d < Dim; ++d) {
+                            candidate[d] = extent[d] > Real(0)
+                                           ? lower[d] + (Real(cell[d]) + Real(unitFloat(words[d]))) * cellSize
+                                           : lower[d];
+                        }
+                        candidate = glm::min(candidate, upper);
+                        if (fits(cell, candidate)) {
+                            samples[index] = candidate;
+                            occupied[index] = 1;
+                            break;
+                        }
+                    }
+                }
+            });
+        }
+        placed = std::size_t(std::count(occupied.begin(), occupied.end(), uint8_t(1)));
+    }
+
+    std::vector<Vec> points;
+    points.reserve(std::min(count, cellCount));
+    for (std::size_t c = 0; c < cellCount; ++c) {
+        if (occupied[c]) {
+            points.push_back(samples[c]);
+        }
+    }
+    keepRandomSubset(points, count, seed);
+    return points;
+}
+
+#endif //PART1_PLACEMENT_HPP
@@ -0,0 +1,175 @@
+//
+// Counter-based random numbers for reproducible, parallel particle spawning.
+//
+
+#ifndef PART1_RANDOM_HPP
+#define PART1_RANDOM_HPP
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Independent random streams of a simulation seed. Values drawn from different streams never
+ * overlap, so adding a new consumer does not change the numbers existing ones see.
+ */
+enum RandomStream : uint32_t {
+    SpawnStream = 1,     // Initial particle state of addRandomParticles
+    PlacementStream = 2, // Jitter and darts of the relaxed placements
+    ScenarioStream = 3,  // Built-in scenarios
+    EnsembleStream = 4   // Initial state of ensemble members
+};
+
+/**
+ * Finalising mix of SplitMix64: a bijection that spreads every input bit over the output.
+ */
+inline uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+/**
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3") evaluated for Lanes
+ * counters at once. The output is a pure function of (counter, key): there is no state to share
+ * or advance, so any thread can produce any value. Each word of the state lives in its own
+ * lane array, so the rounds compile to SIMD multiplies.
+ */
+template <std::size_t Lanes>
+struct PhiloxLanes {
+    uint32_t x0[Lanes];
+    uint32_t x1[Lanes];
+    uint32_t x2[Lanes];
+    uint32_t x3[Lanes];
+
+    /**
+     * Replaces the counters in x0..x3 by their random images under the given key.
+     */
+    void generate(uint32_t key0, uint32_t key1) {
+        for (int round = 0; round < 10; ++round) {
+            for (std::size_t lane = 0; lane < Lanes; ++lane) {
+                uint64_t product0 = uint64_t(0xD2511F53u) * x0[lane];
+                uint64_t product1 = uint64_t(0xCD9E8D57u) * x2[lane];
+                uint32_t y0 = uint32_t(product1 >> 32) ^ x1[lane] ^ key0;
+                uint32_t y1 = uint32_t(product1);
+                uint32_t y2 = uint32_t(product0 >> 32) ^ x3[lane] ^ key1;
+                uint32_t y3 = uint32_t(product0);
+                x0[lane] = y0;
+                x1[lane] = y1;
+                x2[lane] = y2;
+                x3[lane] = y3;
+            }
+            key0 += 0x9E3779B9u;
+            key1 += 0xBB67AE85u;
+        }
+    }
+};
+
+/**
+ * Maps random bits to a uniform number in [0, 1): 24 bits for float, 53 bits for double.
+ */
+inline float unitFloat(uint32_t bits) { return float(bits >> 8) * (1.0f / 16777216.0f); }
+
+inline double unitDouble(uint32_t high, uint32_t low) {
+    return double((uint64_t(high) << 21) ^ (low >> 11)) * (1.0 / 9007199254740992.0);
+}
+
+template <typename Real>
+struct UnitUniform;
+
+template <>
+struct UnitUniform<float> {
+    static const int words = 1;
+    static float from(const uint32_t *w) { return unitFloat(w[0]); }
+};
+
+template <>
+struct UnitUniform<double> {
+    static const int words = 2;
+    static double from(const uint32_t *w) { return unitDouble(w[0], w[1]); }
+};
+
+/**
+ * Number of particles whose random values are generated together.
+ */
+const std::size_t kRandomLanes = 16;
+
+/**
+ * Draws Values uniform numbers in [0, 1) for each of kRandomLanes consecutive items.
+ * out[v][lane] is value v of item firstItem + lane and depends only on (seed, stream, item, v),
+ * never on how items are grouped or which thread draws them.
+ *
+ * @param seed The simulation seed, used as the Philox key.
+ * @param stream The stream to draw from (see RandomStream).
+ * @param firstItem Index of the item in lane 0.
+ * @param out Values per lane.
+ */
+template <typename Real, int Values>
+void itemUniforms(uint64_t seed, uint32_t stream, uint64_t firstItem, Real (&out)[Values][kRandomLanes]) {
+    const int wordsPerValue = UnitUniform<Real>::words;
+    const int blocks = (Values * wordsPerValue + 3) / 4;
+
+    uint32_t words[blocks * 4][kRandomLanes];
+    for (int b = 0; b < blocks; ++b) {
+        PhiloxLanes<kRandomLanes> philox;
+        for (std::size_t lane = 0; lane < kRandomLanes; ++lane) {
+            uint64_t item = firstItem + lane;
+            philox.x0[lane] = uint32_t(item);
+            philox.x1[lane] = uint32_t(item >> 32);
+            philox.x2[lane] = uint32_t(b);
+            philox.x3[lane] = stream;
+        }
+        philox.generate(uint32_t(seed), uint32_t(seed >> 32));
+        for (std::size_t lane = 0; lane < kRandomLanes; ++lane) {
+            words[4 * b + 0][lane] = philox.x0[lane];
+            words[4 * b + 1][lane] = philox.x1[lane];
+            words[4 * b + 2][lane] = philox.x2[lane];
+            words[4 * b + 3][lane] = philox.x3[lane];
+        }
+    }
+
+    for (int v = 0; v < Values; ++v) {
+        for (std::size_t lane = 0; lane < kRandomLanes; ++lane) {
+            uint32_t w[2] = {words[v * wordsPerValue][lane], words[v * wordsPerValue + wordsPerValue - 1][lane]};
+            out[v][lane] = UnitUniform<Real>::from(w);
+        }
+    }
+}
+
+/**
+ * Fills out[0, count) with uniform numbers in [low, high). Element k is counter firstCounter + k of
+ * the stream, so any sub-range can be filled independently and gives the same numbers.
+ */
+template <typename Real>
+void fillUniform(uint64_t seed, uint32_t stream, uint64_t firstCounter, Real *out, std::size_t count,
+                 Real low, Real high) {
+    Real unit[1][kRandomLanes];
+    for (std::size_t base = 0; base < count; base += kRandomLanes) {
+        itemUniforms<Real, 1>(seed, stream, firstCounter + base, unit);
+        std::size_t lanes = count - base < kRandomLanes ? count - base : kRandomLanes;
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            out[base + lane] = low + (high - low) * unit[0][lane];
+        }
+    }
+}
+
+/**
+ * Fills out[0, count) with normally distributed numbers using the Box-Muller transform.
+ * Element k depends only on counter firstCounter + k of the stream.
+ */
+template <typename Real>
+void fillNormal(uint64_t seed, uint32_t stream, uint64_t firstCounter, Real *out, std::size_t count,
+                Real mean, Real deviation) {
+    const Real twoPi = Real(6.283185307179586);
+    Real unit[2][kRandomLanes];
+    for (std::size_t base = 0; base < count; base += kRandomLanes) {
+        itemUniforms<Real, 2>(seed, stream, firstCounter + base, unit);
+        std::size_t lanes = count - base < kRandomLanes ? count - base : kRandomLanes;
+        for (std::size_t lane = 0; lane < lanes; ++lane) {
+            Real radius = std::sqrt(Real(-2) * std::log(Real(1) - unit[0][lane]));
+            out[base + lane] = mean + deviation * radius * std::cos(twoPi * unit[1][lane]);
+        }
+    }
+}
+
+#endif //PART1_RANDOM_HPP
@@ -5,7 +5,9 @@
 #ifndef PART1_RENDER_HPP
 #define PART1_RENDER_HPP
 
+#include "Hud.hpp"
 #include "Shader.hpp"
+#include <memory>
 #include <vector>
 #include <glm/glm/glm.hpp>
 #include <SDL2/SDL.h>
@@ -26,6 +28,7 @@ private:
     SDL_GLContext glContext;
     glm::mat4 viewMatrix;
     glm::mat4 projectionMatrix;
+    std::unique_ptr<Hud> hud; // Performance overlay, or null when it is off
 
 public:
     /**
@@ -47,6 +50,24 @@ public:
     */
     void draw(Shader &shader, const std::vector<VertexData> &vertices);
 
+    /**
+     * Turns the performance overlay on or off. The overlay's shader, atlas and buffers exist only
+     * while it is on, so a disabled overlay costs nothing.
+     */
+    void setHudEnabled(bool enabled);
+
+    bool isHudEnabled() const { return hud != nullptr; }
+
+    /**
+     * Adds a finished frame to the overlay's graph; does nothing when the overlay is off.
+     */
+    void recordFrame(const FrameTimes &times);
+
+    /**
+     * Draws the overlay over the frame; does nothing when the overlay is off.
+     */
+    void drawHud(const HudStats &stats);
+
     /**
      * Returns the window in which rendering takes place.
      *
@@ -0,0 +1,124 @@
+//
+// Plays recorded trajectories back through the render path without simulating.
+//
+
+#ifndef PART1_REPLAY_HPP
+#define PART1_REPLAY_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Render.hpp"
+#include "Trajectory.hpp"
+
+/**
+ * Streams the frames of a trajectory file in order, decoded ahead of time on a prefetch thread.
+ *
+ * Playback follows a clock: advance() moves it by elapsed wall time times the playback rate and
+ * returns the newest frame recorded up to then, so a rate above 1 plays faster than real time and
+ * skips frames the display cannot keep up with. seek() jumps anywhere through the frame index.
+ * Analysis hooks see every frame handed out, exactly as they would see a live simulation.
+ */
+class ReplaySource {
+public:
+    typedef std::function<void(const TrajectoryFrame &)> AnalysisHook;
+
+    /**
+     * Opens a trajectory and starts prefetching from its first frame. Throws std::runtime_error if
+     * the file is not a readable trajectory.
+     * @param path The trajectory file.
+     * @param readAhead The number of decoded frames kept ready.
+     */
+    explicit ReplaySource(const std::string &path, std::size_t readAhead = 8);
+
+    /**
+     * Stops the prefetch thread.
+     */
+    ~ReplaySource();
+
+    ReplaySource(const ReplaySource &) = delete;
+    ReplaySource &operator=(const ReplaySource &) = delete;
+
+    const TrajectoryReader &getReader() const { return reader; }
+    std::size_t getFrameCount() const { return reader.getFrameCount(); }
+
+    /**
+     * Sets how many seconds of simulated time play per second of wall time.
+     * @param rate The playback rate; 0 or less hands out every frame, as fast as they decode.
+     */
+    void setPlaybackRate(double rate) { playbackRate = rate; }
+
+    /**
+     * Registers a function called with every frame handed out by next() or advance().
+     */
+    void addAnalysisHook(const AnalysisHook &hook) { hooks.push_back(hook); }
+
+    /**
+     * Continues playback from the given frame; prefetched frames are discarded.
+     * @param frame The index of the frame next() returns next.
+     */
+    void seek(std::size_t frame);
+
+    /**
+     * Continues playback from the last frame recorded at or before the given simulated time.
+     */
+    void seekTime(double time) { seek(reader.findFrame(time)); }
+
+    /**
+     * Returns the next frame in file order, waiting for the prefetch thread if necessary.
+     * @param out Receives the frame; its previous contents are recycled as a prefetch buffer.
+     * @return False at the end of the trajectory.
+     */
+    bool next(TrajectoryFrame &out);
+
+    /**
+     * Advances the playback clock and returns the newest frame recorded up to it. Frames passed
+     * over are still shown to the analysis hooks. With a rate of 0 or less this is next().
+     * @param wallSeconds Wall time since the previous call.
+     * @param out Receives the frame, if there is a new one.
+     * @return False if no new frame is due yet or the trajectory has ended.
+     */
+    bool advance(double wallSeconds, TrajectoryFrame &out);
+
+    /**
+     * Returns true once every frame has been handed out.
+     */
+    bool finished() const;
+
+private:
+    TrajectoryReader reader;
+    const std::size_t readAhead;
+    double playbackRate = 1.0;
+    double clock = 0.0; // Simulated time playback has reached
+    std::vector<AnalysisHook> hooks;
+
+    mutable std::mutex lock;
+    std::condition_variable changed;
+    std::deque<TrajectoryFrame> ready; // Decoded frames in file order
+    std::vector<TrajectoryFrame> spare; // Buffers to decode into
+    std::size_t cursor = 0; // Next frame the prefetch thread decodes
+    unsigned generation = 0; // Bumped by seek so stale decodes are thrown away
+    bool stopping = false;
+    std::thread prefetcher;
+
+    void prefetchLoop();
+    void deliver(TrajectoryFrame &frame);
+};
+
+/**
+ * Converts a frame to the vertices Render::draw takes; attributes the frame lacks are zero.
+ */
+void frameVertices(const TrajectoryFrame &frame, std::vector<VertexData> &vertices);
+
+/**
+ * Converts particle columns in host byte order, e.g. a SharedFrame, to the vertices Render::draw
+ * takes; attributes the columns lack are zero.
+ */
+void frameVertices(uint64_t particleCount, const std::vector<SnapshotColumn> &columns, std::vector<VertexData> &vertices);
+
+#endif //PART1_REPLAY_HPP
@@ -0,0 +1,107 @@
+//
+// In-memory history of recent simulation states for rewinding and scrubbing.
+//
+
+#ifndef PART1_REWIND_HPP
+#define PART1_REWIND_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include "Snapshot.hpp"
+#include "Trajectory.hpp"
+
+/**
+ * How much history a RewindBuffer keeps and how it is laid out.
+ */
+struct RewindOptions {
+    std::size_t memoryBudget = std::size_t(256) << 20; // Bytes of history; the oldest is dropped first
+    unsigned keyframeInterval = 32; // Recorded frames from one keyframe to the next
+    unsigned stride = 1; // Record every stride-th call to simulate()
+};
+
+/**
+ * A ring of recent states: periodic full keyframes, each followed by deltas that hold only the
+ * particles that changed since the frame before. Particles at rest cost nothing in a delta.
+ *
+ * Seeking decodes one keyframe and applies at most keyframeInterval - 1 deltas. A keyframe is
+ * also started early when the deltas of the current one have grown as large as a keyframe, so a
+ * busy scene never costs more than storing every frame in full. When the history exceeds the
+ * memory budget, the oldest keyframe and its deltas are dropped together.
+ *
+ * Recording a step at or before the newest recorded step discards the history from that step on,
+ * so resuming after a rewind continues a single consistent timeline.
+ */
+class RewindBuffer {
+public:
+    /**
+     * @param options The memory budget and keyframe spacing.
+     */
+    explicit RewindBuffer(const RewindOptions &options = RewindOptions());
+
+    /**
+     * Returns true if the state after the given step should be recorded.
+     */
+    bool wants(uint64_t step) const { return step % options.stride == 0; }
+
+    /**
+     * Adds a state to the history.
+     * @param step The number of calls to simulate() so far.
+     * @param time The simulated time.
+     * @param particleCount The number of particles.
+     * @param columns Every particle attribute; their data is copied.
+     */
+    void record(uint64_t step, double time, uint64_t particleCount, const std::vector<SnapshotColumn> &columns);
+
+    /**
+     * Reconstructs the newest recorded state at or before the given step.
+     * @param step The step to go back to.
+     * @param out Receives the state.
+     * @return False if the step is older than the history kept.
+     */
+    bool seek(uint64_t step, TrajectoryFrame &out) const;
+
+    /**
+     * Returns true if nothing has been recorded.
+     */
+    bool empty() const { return segments.empty(); }
+
+    uint64_t getOldestStep() const { return segments.empty() ? 0 : segments.front().keyframe.step; }
+    uint64_t getNewestStep() const { return newestStep; }
+    std::size_t getFrameCount() const;
+
+    /**
+     * Returns the bytes the history currently occupies.
+     */
+    std::size_t getMemoryUsed() const { return memoryUsed; }
+
+private:
+    // The particles that changed in one frame: their indices as gaps in LEB128 varints, then the
+    // new elements of each column for those particles.
+    struct Delta {
+        uint64_t step;
+        double time;
+        std::vector<unsigned char> bytes;
+    };
+
+    struct Segment {
+        TrajectoryFrame keyframe;
+        std::vector<Delta> deltas;
+        std::size_t deltaBytes = 0;
+    };
+
+    RewindOptions options;
+    std::deque<Segment> segments;
+    TrajectoryFrame latest; // Copy of the newest recorded state, to diff the next frame against
+    bool latestValid = false;
+    uint64_t newestStep = 0;
+    std::size_t memoryUsed = 0;
+
+    void truncateFrom(uint64_t step);
+    void encodeDelta(const std::vector<SnapshotColumn> &columns, uint64_t particleCount, Delta &delta) const;
+    static void applyDelta(const Delta &delta, TrajectoryFrame &frame);
+    void enforceBudget();
+};
+
+#endif //PART1_REWIND_HPP
@@ -0,0 +1,86 @@
+//
+// Built-in parametric scenes, for comparing releases on the same representative workloads.
+//
+
+#ifndef PART1_SCENARIO_HPP
+#define PART1_SCENARIO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "Import.hpp"
+
+/**
+ * The built-in scenes. All are planar (z = 0) and scale with the particle count: the box grows
+ * so that the density, and with it the work per particle, stays the same.
+ */
+enum class ScenarioKind {
+    DiluteGas,         // Sparse uniform gas with thermal velocities; few contacts
+    DensePackedBox,    // A half-coverage lattice in the lower 60% of the box, settling under gravity
+    CollapsingCluster, // A disc of particles falling inwards towards its centre
+    TwoStream,         // Two blocks of gas flying into each other head on
+    MixedMasses,       // Moderately dense gas with masses spread over two decades
+    SparseHalo         // A dense core inside a wide sparse halo; stresses uniform grids
+};
+
+/**
+ * A scene ready to be loaded into a simulation.
+ */
+template <typename Real>
+struct ScenarioSetup {
+    std::string name;
+    Real particleRadius;
+    Real boundary; // Half-extent of the box
+    glm::vec<3, Real> gravity;
+    Real dt; // Suggested timestep
+    ParticleTable<Real> particles;
+};
+
+/**
+ * Returns every built-in scenario, in declaration order.
+ */
+std::vector<ScenarioKind> allScenarios();
+
+/**
+ * Returns the name of a scenario, e.g. "dilute_gas".
+ */
+const char *scenarioName(ScenarioKind kind);
+
+/**
+ * Finds a scenario by name. Throws std::runtime_error if there is none.
+ */
+ScenarioKind scenarioNamed(const std::string &name);
+
+/**
+ * Builds a scenario. The same kind, count and seed always give the same scene.
+ * Scenes whose box would reach maxBoundary are packed more densely to stay inside it; pass
+ * Simulation::maxBoundary() so that fixed-point builds can hold every size. Throws
+ * std::runtime_error if the scene cannot fit.
+ * @param kind The scene.
+ * @param count The number of particles.
+ * @param seed Seed of the ScenarioStream draws.
+ * @param maxBoundary The bound the half-extent of the box must stay below.
+ */
+template <typename Real>
+ScenarioSetup<Real> buildScenario(ScenarioKind kind, std::size_t count, uint64_t seed,
+                                  double maxBoundary = std::numeric_limits<double>::infinity());
+
+/**
+ * Sets up a simulation for a scenario: radius, box, gravity and particles.
+ * @return The number of particles added.
+ */
+template <typename Sim>
+std::size_t loadScenario(Sim &simulation, const ScenarioSetup<typename Sim::Real> &setup) {
+    simulation.setParticleRadius(setup.particleRadius);
+    simulation.setBoundary(setup.boundary);
+    simulation.setGravity(setup.gravity);
+    return simulation.addParticles(setup.particles.arrays());
+}
+
+extern template ScenarioSetup<float> buildScenario<float>(ScenarioKind, std::size_t, uint64_t, double);
+extern template ScenarioSetup<double> buildScenario<double>(ScenarioKind, std::size_t, uint64_t, double);
+
+#endif //PART1_SCENARIO_HPP
@@ -0,0 +1,157 @@
+//
+// Many tiny scenes simulated in lockstep, one scene per SIMD lane.
+//
+
+#ifndef PART1_SCENEBATCH_HPP
+#define PART1_SCENEBATCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "ParticleStorage.hpp"
+
+/**
+ * One value per lane. The arithmetic is written as plain loops over the lanes, which compilers
+ * turn into SIMD instructions, and it is all the integrator policies need: a LanePack can stand
+ * in for one component of a vector in Integrator::step.
+ */
+template <typename Real, int Lanes>
+struct LanePack {
+    typedef Real value_type;
+
+    Real lane[Lanes];
+
+    static LanePack broadcast(Real value) {
+        LanePack pack;
+        for (int l = 0; l < Lanes; ++l) {
+            pack.lane[l] = value;
+        }
+        return pack;
+    }
+
+    LanePack &operator+=(const LanePack &other) {
+        for (int l = 0; l < Lanes; ++l) {
+            lane[l] += other.lane[l];
+        }
+        return *this;
+    }
+
+    LanePack &operator-=(const LanePack &other) {
+        for (int l = 0; l < Lanes; ++l) {
+            lane[l] -= other.lane[l];
+        }
+        return *this;
+    }
+
+    friend LanePack operator*(const LanePack &pack, Real factor) {
+        LanePack product;
+        for (int l = 0; l < Lanes; ++l) {
+            product.lane[l] = pack.lane[l] * factor;
+        }
+        return product;
+    }
+
+    friend LanePack operator*(Real factor, const LanePack &pack) { return pack * factor; }
+};
+
+/**
+ * Up to Lanes independent scenes of a few particles each, stored so that particle i of every
+ * scene shares one LanePack: collisions, boundary reflections and integration then run all scenes
+ * at once, with per-lane masks instead of branches.
+ *
+ * Meant for sweeps over scenes of 10 to about 100 particles, where a scene on its own is too small
+ * for threads or a grid to pay off; beyond that the all-pairs collision test loses to a grid.
+ * Collisions test every pair, in (i, j) order, with the same response as resolveContact; the
+ * boundary and the integrator are those of Simulation. All scenes share the timestep and the
+ * number of iterations; radius, boundary, gravity and masses are per scene. Positions are
+ * floating point.
+ *
+ * A scene's results are reproducible and equal to those of running it alone in a Simulation
+ * within tolerance, not bit-identical: contacts are resolved in a different order than the grid
+ * finds them, so rounding differs (see runEnsemble).
+ */
+template <int Dim, typename Real, int Lanes>
+class BasicSceneBatch {
+public:
+    typedef LanePack<Real, Lanes> Pack;
+    typedef glm::vec<Dim, Real> Vec;
+
+    /**
+     * @param capacity The largest number of particles a scene can have.
+     */
+    explicit BasicSceneBatch(std::size_t capacity);
+
+    static int lanes() { return Lanes; }
+
+    /**
+     * Puts a scene into a lane, replacing what it held. Throws std::runtime_error if the scene
+     * has more particles than the capacity.
+     * @param lane The lane, in [0, Lanes).
+     * @param particles The particles; components beyond Dim are ignored.
+     * @param particleRadius The radius of the scene's particles.
+     * @param boundary The half-extent of the scene's box.
+     * @param gravity The scene's uniform acceleration.
+     */
+    void setScene(int lane, const ParticleArrays<Real> &particles, Real particleRadius, Real boundary,
+                  const glm::vec<3, Real> &gravity);
+
+    /**
+     * Empties a lane.
+     */
+    void clearScene(int lane);
+
+    void setIterations(int iterations) { numIterations = iterations; }
+
+    /**
+     * Advances every scene over the time interval, in the same passes as Simulation::simulate.
+     * @param dt The time interval of one pass, in seconds.
+     */
+    void simulate(Real dt);
+
+    std::size_t getParticleCount(int lane) const { return counts[lane]; }
+    double getTime() const { return time; }
+    uint64_t getStepCount() const { return stepCount; }
+
+    Real kineticEnergy(int lane) const;
+
+    /**
+     * Copies a scene's positions and velocities out, each getParticleCount(lane) long.
+     */
+    void getState(int lane, Vec *positions, Vec *velocities) const;
+
+    /**
+     * Returns a hash of a scene's positions and velocities, equal to Simulation::stateHash for
+     * the same state.
+     */
+    uint64_t stateHash(int lane) const;
+
+private:
+    std::size_t capacity;
+    std::size_t counts[Lanes]; // Particles per scene
+    std::size_t active = 0; // Largest count: particles beyond it are absent in every lane
+    int numIterations = 5;
+    double time = 0.0;
+    uint64_t stepCount = 0;
+    std::vector<Pack> positions; // Component c of particle i at c * capacity + i
+    std::vector<Pack> velocities;
+    std::vector<Pack> accelerations;
+    std::vector<Pack> masses;
+    std::vector<Pack> present; // 1 where the lane has particle i, else 0
+    Pack radius;
+    Pack boundary;
+    Pack gravity[Dim];
+
+    void handleCollisions();
+};
+
+extern template class BasicSceneBatch<2, float, 8>;
+extern template class BasicSceneBatch<3, float, 8>;
+extern template class BasicSceneBatch<2, double, 8>;
+extern template class BasicSceneBatch<3, double, 8>;
+extern template class BasicSceneBatch<2, float, 16>;
+extern template class BasicSceneBatch<3, float, 16>;
+extern template class BasicSceneBatch<2, double, 16>;
+extern template class BasicSceneBatch<3, double, 16>;
+
+#endif //PART1_SCENEBATCH_HPP
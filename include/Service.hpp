@@ -0,0 +1,269 @@
+//
+// A simulation daemon on a Unix domain socket, and the client side of its protocol.
+//
+
+#ifndef PART1_SERVICE_HPP
+#define PART1_SERVICE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "ParticleStorage.hpp"
+#include "SharedState.hpp"
+#include "Simulation.hpp"
+#include "ThreadPool.hpp"
+
+/*
+ * Protocol, version 1. Integers and floats are little-endian; particle state is in the server's
+ * byte order, like shared state, since both ends are on one machine.
+ *
+ * A client sends batches of commands and the server answers every batch with one batch of
+ * replies, in order. Clients may send further batches without waiting for the replies to earlier
+ * ones.
+ *
+ *   Batch:   u32 magic ("PSRQ" for commands, "PSRS" for replies), u32 entry count,
+ *            u64 bytes of the entries that follow
+ *   Command: u32 opcode, u32 reserved, u64 body bytes, body
+ *   Reply:   u32 opcode, u32 status, u64 body bytes, body; on failure the body is the message
+ *
+ * A reply batch has one reply per command, except that a command running past the end of its
+ * batch ends it with a Malformed reply. A batch whose count exceeds its bytes / 16 is not answered;
+ * the connection is closed.
+ *
+ * Bodies (command -> reply):
+ *   CreateScene     f64 radius, f64 boundary, u32 iterations, u32 reserved, f64 gravity[3], u64 seed
+ *                   -> u32 scene; fixed-point builds reject a boundary of 2048 or more
+ *   DestroyScene    u32 scene -> empty
+ *   SpawnRandom     u32 scene, u32 reserved, u64 count -> u64 particle count
+ *   SpawnParticles  u32 scene, u32 fields (trajectoryAttribute bits of velocity, mass and color),
+ *                   u64 count, f32 positions[3 count], then for each field in that order
+ *                   f32 velocities[3 count], masses[count], colors[3 count] -> u64 particle count
+ *   Step            u32 scene, u32 steps, f64 dt -> u64 step count, f64 time
+ *   QueryRegion     u32 scene, u32 max results, f64 lower[3], f64 upper[3]
+ *                   -> u64 matches, u32 returned, u32 indices[returned]
+ *   FetchState      u32 scene, u32 attributes (trajectoryAttribute bits), u32 shared memory, u32 reserved
+ *                   -> u64 step, f64 time, u64 particle count, u32 column count, u32 shared memory,
+ *                      then with shared memory: u32 name length, name, u64 frame of a SharedStateWriter
+ *                      region, otherwise per column: u32 id, u32 scalar, u32 components,
+ *                      u32 fraction bits, u64 bytes, data
+ *   SceneInfo       u32 scene -> u64 particle count, u64 step count, f64 time
+ */
+
+enum class ServiceOp : uint32_t {
+    CreateScene = 1,
+    DestroyScene = 2,
+    SpawnRandom = 3,
+    SpawnParticles = 4,
+    Step = 5,
+    QueryRegion = 6,
+    FetchState = 7,
+    SceneInfo = 8
+};
+
+enum class ServiceStatus : uint32_t {
+    Ok = 0,
+    UnknownScene = 1,
+    Malformed = 2,
+    UnknownCommand = 3,
+    Failed = 4
+};
+
+/**
+ * Reads the fields of a message body in order, failing once it runs past the end.
+ */
+class ServiceCursor {
+public:
+    ServiceCursor(const unsigned char *data, uint64_t bytes) : at(data), end(data + bytes) {}
+
+    bool u32(uint32_t &value);
+    bool u64(uint64_t &value);
+    bool f64(double &value);
+
+    /**
+     * Points data at the next count bytes and skips them.
+     */
+    bool bytes(uint64_t count, const unsigned char *&data);
+
+    uint64_t remaining() const { return uint64_t(end - at); }
+
+private:
+    const unsigned char *at;
+    const unsigned char *end;
+};
+
+/**
+ * A batch of commands being built by a client.
+ */
+class ServiceRequest {
+public:
+    ServiceRequest();
+
+    void createScene(double radius, double boundary, uint32_t iterations, const glm::dvec3 &gravity, uint64_t seed);
+    void destroyScene(uint32_t scene);
+    void spawnRandom(uint32_t scene, uint64_t count);
+
+    /**
+     * Adds particles with the attributes the arrays have; the others take their defaults.
+     */
+    void spawnParticles(uint32_t scene, const ParticleArrays<float> &arrays);
+
+    void step(uint32_t scene, uint32_t steps, double dt);
+    void queryRegion(uint32_t scene, const glm::dvec3 &lower, const glm::dvec3 &upper, uint32_t maxResults);
+
+    /**
+     * Asks for particle attributes, inline or, for large states, through a shared memory region
+     * the client maps (see ServiceClient::sharedState).
+     */
+    void fetchState(uint32_t scene, uint32_t attributes, bool sharedMemory);
+
+    void sceneInfo(uint32_t scene);
+
+    uint32_t size() const { return count; }
+    const std::vector<unsigned char> &bytes() const { return buffer; }
+
+    /**
+     * Removes every command, keeping the buffer.
+     */
+    void clear();
+
+private:
+    std::vector<unsigned char> buffer;
+    uint32_t count = 0;
+
+    std::size_t begin(ServiceOp op);
+    void end(std::size_t command);
+};
+
+/**
+ * One reply; its body points into the ServiceReplies it came in.
+ */
+struct ServiceReply {
+    ServiceOp op;
+    ServiceStatus status;
+    const unsigned char *body;
+    uint64_t bodyBytes;
+
+    bool ok() const { return status == ServiceStatus::Ok; }
+    ServiceCursor cursor() const { return ServiceCursor(body, bodyBytes); }
+
+    /**
+     * Returns the failure message of a failed reply.
+     */
+    std::string message() const { return ok() ? std::string() : std::string(reinterpret_cast<const char *>(body), bodyBytes); }
+};
+
+/**
+ * A batch of replies, in the order of the commands.
+ */
+struct ServiceReplies {
+    std::vector<unsigned char> buffer;
+    std::vector<ServiceReply> replies;
+};
+
+/**
+ * A connection to a SimulationService.
+ */
+class ServiceClient {
+public:
+    /**
+     * Connects to the service. Throws std::runtime_error if it cannot.
+     * @param path The socket path the service listens on.
+     */
+    explicit ServiceClient(const std::string &path);
+
+    ~ServiceClient();
+
+    ServiceClient(const ServiceClient &) = delete;
+    ServiceClient &operator=(const ServiceClient &) = delete;
+
+    /**
+     * Sends a batch without waiting for its replies. The service keeps reading while it holds
+     * replies back, so any number of batches can be in flight. Throws std::runtime_error on failure.
+     */
+    void send(const ServiceRequest &request);
+
+    /**
+     * Waits for the replies to the oldest batch not yet received. Throws std::runtime_error on
+     * failure.
+     */
+    void receive(ServiceReplies &out);
+
+    /**
+     * Maps the shared memory region a FetchState reply names and points frame at the state.
+     * @return False if the reply is not a shared memory state or the frame is gone.
+     */
+    bool sharedState(const ServiceReply &reply, SharedFrame &frame);
+
+private:
+    int fd = -1;
+    std::map<std::string, std::unique_ptr<SharedStateReader> > readers;
+};
+
+/**
+ * Serves simulations to other processes over a Unix domain socket.
+ *
+ * A single thread multiplexes every connection with poll(): it reads whatever has arrived,
+ * executes each complete batch in order and queues the replies, so clients can pipeline batches
+ * of thousands of commands per round trip. Scenes are shared by all connections and step on the
+ * given thread pool. Large states can be fetched through a shared memory region per connection
+ * instead of the socket.
+ */
+class SimulationService {
+public:
+    /**
+     * Creates the socket, replacing a stale one at path. Throws std::runtime_error if it cannot.
+     * @param path The socket path.
+     * @param pool Threads the scenes simulate on, or null.
+     */
+    SimulationService(const std::string &path, ThreadPool *pool);
+
+    /**
+     * Closes every connection and removes the socket.
+     */
+    ~SimulationService();
+
+    SimulationService(const SimulationService &) = delete;
+    SimulationService &operator=(const SimulationService &) = delete;
+
+    /**
+     * Serves until stop() is called.
+     */
+    void run();
+
+    /**
+     * Makes run() return; safe to call from another thread or a signal handler.
+     */
+    void stop();
+
+private:
+    struct Connection {
+        int fd;
+        uint32_t id;
+        std::vector<unsigned char> input;
+        std::vector<unsigned char> output;
+        std::size_t written = 0; // Bytes of output already sent
+        bool inputClosed = false; // The client has shut down its sending side
+        std::unique_ptr<SharedStateWriter> sharedState; // Side channel, created on first use
+    };
+
+    std::string path;
+    ThreadPool *pool;
+    int listener = -1;
+    int wake[2] = {-1, -1}; // Self-pipe that stop() writes to
+    uint32_t nextConnection = 1;
+    uint32_t nextScene = 1;
+    std::vector<std::unique_ptr<Connection> > connections;
+    std::map<uint32_t, std::unique_ptr<Simulation> > scenes;
+
+    bool wantsInput(const Connection &connection) const;
+    bool readInput(Connection &connection);
+    bool writeOutput(Connection &connection);
+    bool executeBatches(Connection &connection);
+    void execute(ServiceOp op, ServiceCursor &body, Connection &connection);
+};
+
+#endif //PART1_SERVICE_HPP
@@ -0,0 +1,181 @@
+//
+// Live particle state in POSIX shared memory, for viewers and analysis tools in other processes.
+//
+
+#ifndef PART1_SHAREDSTATE_HPP
+#define PART1_SHAREDSTATE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Snapshot.hpp"
+#include "Trajectory.hpp"
+
+/*
+ * Shared region layout, version 1, in host byte order since both sides run on the same machine.
+ *
+ *   0     char[8]  magic "PSIMSHM1"
+ *   8     u32      format version
+ *   12    u32      dimension of the simulation
+ *   16    u32      number of slots
+ *   20    u32      retired: non-zero once the writer has replaced the region with a larger one
+ *   24    u64      bytes per slot
+ *   32    u64      total region bytes
+ *   64    u64      frames published so far (atomic); frame n lives in slot n % slots
+ *   128   u64[]    sequence number of every slot (atomic), one per 64-byte line: odd while the
+ *                  slot is being written
+ *   4096  slots
+ *
+ * A slot starts with a 4096-byte header, then its columns, each 64-byte aligned:
+ *
+ *   0     u64      frame number
+ *   8     u64      step
+ *   16    f64      simulated time
+ *   24    u64      particle count
+ *   32    u32      number of columns
+ *   64    column table, 32 bytes per column as in snapshots, offsets from the slot start
+ */
+
+/**
+ * How the shared region is laid out and what is published.
+ */
+struct SharedStateOptions {
+    unsigned slots = 3; // Frames kept; a reader has slots - 1 publishes to use a frame before it is reused
+    unsigned stride = 1; // Publish after every stride-th call to simulate()
+    uint32_t attributes = trajectoryAttribute(SnapshotColumnId::Position) | // trajectoryAttribute bits
+                          trajectoryAttribute(SnapshotColumnId::Velocity) |
+                          trajectoryAttribute(SnapshotColumnId::Color) |
+                          trajectoryAttribute(SnapshotColumnId::Mass);
+};
+
+/**
+ * Publishes frames of particle state into a ring of slots in a named POSIX shared memory object.
+ *
+ * Every slot is guarded by a sequence number, seqlock style: it is odd while the writer fills the
+ * slot and even once the slot is complete. The writer never waits for readers, and readers take
+ * no locks: they read a slot in place and check afterwards that its sequence number has not
+ * moved. The region grows when a frame no longer fits; the old region is then marked retired and
+ * readers reopen the name.
+ */
+class SharedStateWriter {
+public:
+    /**
+     * Creates the shared memory object, replacing any left over under the same name.
+     * Throws std::runtime_error if it cannot be created.
+     * @param name The object's name, e.g. "/psim"; a leading slash is added if missing.
+     * @param dimension The dimension of the published positions.
+     * @param options The number of slots and what to publish.
+     */
+    SharedStateWriter(const std::string &name, uint32_t dimension, const SharedStateOptions &options = SharedStateOptions());
+
+    /**
+     * Unmaps and removes the shared memory object. Readers that still map it keep their mapping.
+     */
+    ~SharedStateWriter();
+
+    SharedStateWriter(const SharedStateWriter &) = delete;
+    SharedStateWriter &operator=(const SharedStateWriter &) = delete;
+
+    /**
+     * Returns true if the state after the given step should be published.
+     */
+    bool wants(uint64_t step) const { return options.stride > 0 && step % options.stride == 0; }
+
+    uint32_t getAttributes() const { return options.attributes; }
+
+    /**
+     * Copies a frame into the next slot and makes it the latest.
+     * @param step The number of calls to simulate() so far.
+     * @param time The simulated time.
+     * @param particleCount The number of particles.
+     * @param columns The attributes to publish, in host byte order.
+     */
+    void publish(uint64_t step, double time, uint64_t particleCount, const std::vector<SnapshotColumn> &columns);
+
+    uint64_t getPublished() const { return published; }
+
+private:
+    std::string name;
+    uint32_t dimension;
+    SharedStateOptions options;
+    unsigned char *region = nullptr;
+    std::size_t regionBytes = 0;
+    std::size_t slotBytes = 0;
+    uint64_t published = 0;
+
+    void create(std::size_t bytesPerSlot);
+    void release(bool retire);
+};
+
+/**
+ * A frame read in place from a shared region. Column data points into the shared memory and stays
+ * readable until the writer comes round to the frame's slot again; SharedStateReader::valid tells
+ * whether it has.
+ */
+struct SharedFrame {
+    uint64_t frame = 0; // Frame number, counting from 1; 0 if none has been read
+    uint64_t step = 0;
+    double time = 0.0;
+    uint64_t particleCount = 0;
+    std::vector<SnapshotColumn> columns;
+    uint32_t slot = 0;
+    uint64_t sequence = 0; // The slot's sequence number when the frame was read
+
+    /**
+     * Returns the column with the given id, or null if the frame does not have it.
+     */
+    const SnapshotColumn *find(SnapshotColumnId id) const {
+        for (const SnapshotColumn &column : columns) {
+            if (column.id == id) {
+                return &column;
+            }
+        }
+        return nullptr;
+    }
+};
+
+/**
+ * Maps a shared region read-only and hands out its latest frame without copying.
+ */
+class SharedStateReader {
+public:
+    /**
+     * @param name The object's name, as given to the writer. It need not exist yet.
+     */
+    explicit SharedStateReader(const std::string &name);
+
+    ~SharedStateReader();
+
+    SharedStateReader(const SharedStateReader &) = delete;
+    SharedStateReader &operator=(const SharedStateReader &) = delete;
+
+    /**
+     * Points out at the latest complete frame if it is newer than the frame out holds. Opens or
+     * reopens the region as needed; when the writer has replaced the region, out is cleared
+     * because its data lived in the old one.
+     * @return False if there is no region or no newer frame.
+     */
+    bool latest(SharedFrame &out);
+
+    /**
+     * Returns true if the frame's slot has not been written since the frame was read, i.e. the
+     * data read through it so far is consistent.
+     */
+    bool valid(const SharedFrame &frame) const;
+
+    /**
+     * Returns the dimension of the published positions, or 0 before the region is open.
+     */
+    uint32_t getDimension() const;
+
+private:
+    std::string name;
+    const unsigned char *region = nullptr;
+    std::size_t regionBytes = 0;
+
+    bool open();
+    void close();
+};
+
+#endif //PART1_SHAREDSTATE_HPP
@@ -5,46 +5,117 @@
 #ifndef PART1_SIMULATION_HPP
 #define PART1_SIMULATION_HPP
 
+#include <cstdint>
+#include <stdexcept>
+#include <string>
 #include <vector>
 #include <glm/glm/glm.hpp>
+#include "Checkpoint.hpp"
+#include "Collision.hpp"
+#include "Determinism.hpp"
+#include "Export.hpp"
+#include "Metrics.hpp"
 #include "Particle.hpp"
+#include "PerfCounters.hpp"
+#include "Placement.hpp"
+#include "ParticleStorage.hpp"
+#include "Rewind.hpp"
+#include "SharedState.hpp"
+#include "UniformGrid.hpp"
 #include "Render.hpp"
 #include "Shader.hpp"
+#include "ThreadPool.hpp"
+#include "Trajectory.hpp"
 
 /**
  * The Simulation class is responsible for managing and updating a collection of particles.
+ *
+ * Dim is the number of simulated dimensions (2 or 3) and Scalar the precision of the state:
+ * float, double or FixedPoint32<> (fixed-point positions with float velocities).
+ * The supported combinations are instantiated in Simulation.cpp.
  */
-class Simulation {
+template <int Dim, typename Scalar>
+class BasicSimulation {
+public:
+    typedef BasicParticleStorage<Dim, Scalar> Storage;
+    typedef typename Storage::Real Real; // Floating point type of velocities, masses and timesteps
+    typedef typename Storage::Vec Vec; // Dim-wide vector used for velocities and accelerations
+    typedef typename Storage::Position Position; // Dim-wide position, floating or fixed point
+    typedef BasicParticle<Real> ParticleType;
+
 private:
-    const float particleRadius = 0.05f;
-    std::vector<Particle> particles; // A list of particles in the simulation
-    Render& renderer; // The renderer to use for drawing the particles
-    Shader& shader; // The shader to use for the particles
+    Real particleRadius = Real(0.05);
+    Real boundary = Real(1.2); // Half-extent of the box the particles bounce around in
+    int numIterations = 5; // Collision and integration passes per call to simulate()
+    double time = 0.0; // Simulated time, in seconds
+    uint64_t stepCount = 0; // Number of calls to simulate()
+    std::size_t contactCount = 0; // Contacts resolved by the last call to simulate()
+    Storage particles; // The particles in the simulation, one array per attribute
+    UniformGrid<Dim, Position> grid; // Broad phase used to find colliding pairs
+    Vec gravity = Vec(Real(0)); // Uniform acceleration applied to every particle
+    Render* renderer; // The renderer to use for drawing the particles, or null when headless
+    Shader* shader; // The shader to use for the particles, or null when headless
+    ThreadPool* pool = nullptr; // Threads used by the kernels, or null to run on the calling thread
+    ExecutionMode mode = ExecutionMode::Fast;
+    uint64_t seed; // Seed of the per-particle random streams
+    std::vector<std::vector<Contact> > contactLists; // Contacts found per cell block or per thread
+    TrajectoryRecorder* recorder = nullptr; // Receives frames after simulate(), or null
+    Checkpointer* checkpointer = nullptr; // Writes periodic checkpoints after simulate(), or null
+    RewindBuffer* rewind = nullptr; // Keeps recent states after simulate(), or null
+    ExportSeries* exporter = nullptr; // Writes VTU frames after simulate(), or null
+    SharedStateWriter* sharedState = nullptr; // Publishes frames to other processes after simulate(), or null
+    PhaseCounters* phaseCounters = nullptr; // Counts hardware events per phase during simulate(), or null
+    SimulationMetrics* metrics = nullptr; // Updated after simulate(), or null
 
     /**
      * Handles the collisions between the particles in the simulation.
      */
     void handleCollisions();
 
+    /**
+     * Publishes the state after a call to simulate() to the attached metrics.
+     */
+    void updateMetrics(double stepSeconds, std::size_t resting);
+
+    /**
+     * Appends count particles with random velocities and masses.
+     * @param count The number of particles to add.
+     * @param placed Their positions, or null for uniform random positions in the z = 0 plane.
+     */
+    void spawnParticles(std::size_t count, const glm::vec<3, Real>* placed);
+
 public:
     /**
      * Constructs a new simulation.
      * @param renderer The renderer to use for drawing the particles.
      * @param shader The shader to use for the particles.
      */
-    Simulation(Render& renderer, Shader& shader);
+    BasicSimulation(Render& renderer, Shader& shader);
+
+    /**
+     * Constructs a headless simulation, for which render() does nothing.
+     */
+    BasicSimulation();
 
     /**
      * Adds a particle to the simulation.
      * @param particle The particle to add.
      */
-    void addParticle(const Particle& particle);
+    void addParticle(const ParticleType& particle);
+
+    /**
+     * Adds many particles at once, e.g. a scene loaded with importCsv, growing the particle
+     * arrays once and filling them in parallel.
+     * @param arrays The attributes of the new particles.
+     * @return The number of particles added.
+     */
+    std::size_t addParticles(const ParticleArrays<Real>& arrays);
 
     /**
      * Updates the state of the simulation over the specified time interval.
      * @param dt The time interval to simulate, in seconds.
      */
-    void simulate(float dt);
+    void simulate(Real dt);
 
     /**
      * Renders the particles in the simulation.
@@ -56,6 +127,231 @@ public:
      * @param num The number of particles to add.
      */
     void addRandomParticles(int num);
+
+    /**
+     * Adds particles at least one particle diameter apart, so the simulation starts relaxed.
+     * @param num The number of particles to add.
+     * @param placement JitteredLattice (fastest) or PoissonDisk (no lattice structure).
+     * @param lower The lower corner of the box to fill; a box flat in z gives a planar scene.
+     * @param upper The upper corner of the box to fill.
+     * @return The number of particles added, less than num if the box cannot hold them.
+     */
+    std::size_t addPlacedParticles(int num, PlacementMode placement,
+                                   const glm::vec<3, Real>& lower = glm::vec<3, Real>(-1, -1, 0),
+                                   const glm::vec<3, Real>& upper = glm::vec<3, Real>(1, 1, 0));
+
+    /**
+     * Sets the uniform acceleration (e.g. gravity) applied to every particle.
+     * @param acceleration The acceleration, in units per second squared.
+     */
+    void setGravity(const glm::vec<3, Real>& acceleration);
+
+    /**
+     * Sets the threads used to find contacts and integrate particles.
+     * @param threads The pool to use, or null to run everything on the calling thread.
+     */
+    void setThreadPool(ThreadPool* threads) { pool = threads; }
+
+    /**
+     * Chooses between the fastest parallel execution and bit-reproducible execution.
+     * @param executionMode See ExecutionMode.
+     */
+    void setExecutionMode(ExecutionMode executionMode) { mode = executionMode; }
+
+    /**
+     * Sets the seed of the counter-based random numbers used by addRandomParticles. Particle i
+     * always draws from the counters of (seed, i), so a seed reproduces a scene exactly.
+     * @param value The seed.
+     */
+    void setSeed(uint64_t value) { seed = value; }
+
+    /**
+     * Sets the radius shared by all particles.
+     * @param radius The radius.
+     */
+    void setParticleRadius(Real radius) { particleRadius = radius; }
+
+    /**
+     * Sets the half-extent of the box the particles are kept in. Throws std::runtime_error if
+     * positions of this Scalar cannot reach it (see maxBoundary()).
+     * @param halfExtent The boundary; particles bounce off |x| = halfExtent along every axis.
+     */
+    void setBoundary(Real halfExtent) {
+        if (!(double(halfExtent) < maxBoundary())) {
+            throw std::runtime_error("ERROR::SIMULATION::BOUNDARY_OUT_OF_RANGE");
+        }
+        boundary = halfExtent;
+    }
+
+    /**
+     * Returns the bound every boundary must stay below: the range of fixed-point positions, or
+     * infinity for floating point ones.
+     */
+    static double maxBoundary() { return PositionRange<Scalar>::limit(); }
+
+    /**
+     * Sets the number of collision and integration passes per call to simulate().
+     * @param iterations The number of passes, each advancing by dt.
+     */
+    void setIterations(int iterations) { numIterations = iterations; }
+
+    /**
+     * Records a frame after every stride-th call to simulate(). Recording runs on the recorder's
+     * own thread; simulate() only copies the recorded arrays.
+     * @param trajectory The recorder, or null to stop recording. It must outlive the simulation
+     *                   or be detached first.
+     */
+    void setRecorder(TrajectoryRecorder* trajectory) { recorder = trajectory; }
+
+    /**
+     * Writes a snapshot checkpoint whenever the checkpointer's interval of calls to simulate() has
+     * passed. The snapshot is written by a forked child, so simulate() only pauses for the fork.
+     * @param checkpoints The checkpointer, or null to stop checkpointing. It must outlive the
+     *                    simulation or be detached first.
+     */
+    void setCheckpointer(Checkpointer* checkpoints) { checkpointer = checkpoints; }
+
+    /**
+     * Keeps the recent states in a rewind history after every stride-th call to simulate().
+     * @param history The history, or null to stop keeping one. It must outlive the simulation or
+     *                be detached first.
+     */
+    void setRewindBuffer(RewindBuffer* history) { rewind = history; }
+
+    /**
+     * Exports the particles to a VTU file and its .pvd index after every stride-th call to
+     * simulate(), for opening the run in ParaView.
+     * @param series The series, or null to stop exporting. It must outlive the simulation or be
+     *               detached first.
+     */
+    void setExportSeries(ExportSeries* series) { exporter = series; }
+
+    /**
+     * Publishes the particles to shared memory after every stride-th call to simulate(), so a
+     * viewer or analysis process can follow the run without slowing it down.
+     * @param writer The shared region, or null to stop publishing. It must outlive the simulation
+     *               or be detached first.
+     */
+    void setSharedState(SharedStateWriter* writer) { sharedState = writer; }
+
+    /**
+     * Counts hardware events (cycles, instructions, cache and branch misses) of every phase of
+     * simulate() on every thread it runs on.
+     * @param counters The totals to add to, or null to stop counting. They must outlive the
+     *                 simulation or be detached first.
+     */
+    void setPhaseCounters(PhaseCounters* counters) { phaseCounters = counters; }
+
+    /**
+     * Updates live metrics (step time, particles, contacts, iterations, resting share, memory)
+     * after every call to simulate(), for a MetricsServer to expose.
+     * @param live The metrics, or null to stop updating them. They must outlive the simulation
+     *             or be detached first.
+     */
+    void setMetrics(SimulationMetrics* live) { metrics = live; }
+
+    /**
+     * Restores the newest state in the rewind history at or before the given step. Simulating on
+     * from there discards the history after it.
+     * @param step The step to go back to.
+     * @return False if there is no rewind buffer or the step is older than its history.
+     */
+    bool rewindTo(uint64_t step);
+
+    /**
+     * Writes every particle attribute and the simulation parameters to a snapshot file (see
+     * Snapshot.hpp). Throws std::runtime_error if the file cannot be written.
+     * @param path The file to write.
+     */
+    void saveSnapshot(const std::string& path) const;
+
+    /**
+     * Writes the particles to a binary VTK, VTU or PLY file for visualisation tools (see
+     * Export.hpp). Throws std::runtime_error if the file cannot be written.
+     * @param path The file to write.
+     * @param options The format and the attributes to store.
+     */
+    void exportParticles(const std::string& path, const ExportOptions& options) const;
+
+    /**
+     * Replaces the particles and parameters with those of a snapshot file. The file is mapped and,
+     * when its columns have the layout of this simulation, used in place as the particle arrays
+     * without copying. Other snapshots (e.g. saved with another precision or dimension) are
+     * converted. Throws std::runtime_error if the file is missing or not a valid snapshot.
+     * @param path The file to read.
+     */
+    void loadSnapshot(const std::string& path);
+
+    /**
+     * Returns the total kinetic energy, reduced according to the execution mode.
+     */
+    Real kineticEnergy() const;
+
+    /**
+     * Returns a hash of the bits of all positions and velocities, for comparing runs.
+     */
+    uint64_t stateHash() const;
+
+    /**
+     * Returns the particle arrays of the simulation.
+     */
+    const Storage& getParticles() const { return particles; }
+
+    /**
+     * Describes the chosen particle arrays as columns, in column id order. The columns point into
+     * the particle arrays and stay valid until the particles next change.
+     * @param attributes A mask of trajectoryAttribute bits; ~0u for every attribute.
+     */
+    std::vector<SnapshotColumn> describeParticles(uint32_t attributes) const;
+
+    /**
+     * Returns the number of particles in the simulation.
+     */
+    std::size_t getParticleCount() const { return particles.size(); }
+
+    /**
+     * Returns the radius shared by all particles.
+     */
+    Real getParticleRadius() const { return particleRadius; }
+
+    /**
+     * Returns the half-extent of the box the particles are kept in.
+     */
+    Real getBoundary() const { return boundary; }
+
+    /**
+     * Returns the number of collision and integration passes per call to simulate().
+     */
+    int getIterations() const { return numIterations; }
+
+    /**
+     * Returns the simulated time, in seconds.
+     */
+    double getTime() const { return time; }
+
+    /**
+     * Returns the number of calls to simulate() so far.
+     */
+    uint64_t getStepCount() const { return stepCount; }
+
+    /**
+     * Returns the number of contacts resolved by the last call to simulate().
+     */
+    std::size_t getContactCount() const { return contactCount; }
+
+    /**
+     * Returns the broad-phase grid as built by the last call to simulate().
+     */
+    const UniformGrid<Dim, Position> &getGrid() const { return grid; }
 };
 
+extern template class BasicSimulation<2, float>;
+extern template class BasicSimulation<3, float>;
+extern template class BasicSimulation<2, double>;
+extern template class BasicSimulation<3, double>;
+extern template class BasicSimulation<2, FixedPoint32<> >;
+extern template class BasicSimulation<3, FixedPoint32<> >;
+
+typedef BasicSimulation<SIM_DIMENSION, SIM_SCALAR> Simulation;
+
 #endif //PART1_SIMULATION_HPP
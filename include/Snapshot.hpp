@@ -0,0 +1,151 @@
+//
+// Binary snapshot files of a simulation's particle state.
+//
+
+#ifndef PART1_SNAPSHOT_HPP
+#define PART1_SNAPSHOT_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm/glm.hpp>
+
+/*
+ * Snapshot file layout, version 2. All integers and floats are little-endian.
+ *
+ *   0   char[8]  magic "PSIMSNAP"
+ *   8   u32      format version
+ *   12  u32      dimension of the simulation (2 or 3)
+ *   16  u32      header size in bytes, including the column table
+ *   20  u32      number of columns
+ *   24  u64      particle count
+ *   32  f64      particle radius
+ *   40  f64      boundary half-extent
+ *   48  f64      simulated time, in seconds
+ *   56  u32      solver iterations per frame
+ *   60  u32      reserved, zero
+ *   64  u64      random seed
+ *   72  f64[3]   gravity
+ *   96  u64      step count (calls to simulate())
+ *   104 column table, 32 bytes per column:
+ *         u32 column id, u32 scalar code, u32 components per element, u32 fraction bits (fixed point),
+ *         u64 file offset, u64 size in bytes
+ *
+ * Every column starts on a 4096-byte boundary, so a mapped file can be used in place as the
+ * particle arrays when the element layout matches the simulation. Version 1 files, which have no
+ * step count and their column table at 96, are still read, with a step count of zero.
+ */
+
+/**
+ * Attributes stored in a snapshot, one column each.
+ */
+enum class SnapshotColumnId : uint32_t {
+    Position = 1,
+    Velocity = 2,
+    Acceleration = 3,
+    Color = 4,
+    Mass = 5
+};
+
+/**
+ * Encoding of every component of a column.
+ */
+enum class ScalarCode : uint32_t {
+    Float32 = 1,
+    Float64 = 2,
+    Fixed32 = 3 // Signed 32-bit integer with `fractionBits` fraction bits
+};
+
+/**
+ * Simulation parameters recorded with the particles.
+ */
+struct SnapshotHeader {
+    uint32_t dimension = 3;
+    uint64_t particleCount = 0;
+    double particleRadius = 0.0;
+    double boundary = 0.0;
+    double time = 0.0;
+    uint32_t iterations = 0;
+    uint64_t seed = 0;
+    glm::dvec3 gravity = glm::dvec3(0.0);
+    uint64_t stepCount = 0;
+};
+
+/**
+ * Describes one column: where its elements are and how they are encoded.
+ */
+struct SnapshotColumn {
+    SnapshotColumnId id;
+    ScalarCode scalar;
+    uint32_t components;
+    uint32_t fractionBits;
+    const void *data; // Elements to write, or the mapped elements of a loaded snapshot
+    uint64_t bytes;
+
+    /**
+     * Returns the number of bytes of one element.
+     */
+    uint64_t elementBytes() const { return uint64_t(components) * (scalar == ScalarCode::Float64 ? 8u : 4u); }
+
+    /**
+     * Returns component `component` of element `index` as a double.
+     */
+    double component(std::size_t index, uint32_t component) const;
+};
+
+/**
+ * Writes a snapshot file, replacing any existing file at path. The file is written next to path
+ * and renamed over it, so a failed write leaves the old file intact and snapshots mapped from it
+ * stay valid. Throws std::runtime_error if the file cannot be written.
+ * @param path Where to write the snapshot.
+ * @param header The simulation parameters; particleCount must match the columns.
+ * @param columns The columns to store.
+ */
+void writeSnapshot(const std::string &path, const SnapshotHeader &header, const std::vector<SnapshotColumn> &columns);
+
+/**
+ * A snapshot file mapped into memory.
+ *
+ * The mapping is private and writable: columns can be handed to the simulation as its arrays and
+ * modified in place, and pages are only copied when they are first written. Nothing is ever
+ * written back to the file.
+ */
+class MappedSnapshot {
+public:
+    /**
+     * Maps and validates a snapshot file. Throws std::runtime_error if it cannot be read or is not
+     * a valid snapshot.
+     * @param path The snapshot file.
+     */
+    explicit MappedSnapshot(const std::string &path);
+
+    ~MappedSnapshot();
+
+    MappedSnapshot(const MappedSnapshot &) = delete;
+    MappedSnapshot &operator=(const MappedSnapshot &) = delete;
+
+    /**
+     * Returns the simulation parameters of the snapshot.
+     */
+    const SnapshotHeader &getHeader() const { return header; }
+
+    /**
+     * Returns the column with the given id, or null if the snapshot does not have it.
+     */
+    const SnapshotColumn *find(SnapshotColumnId id) const;
+
+    /**
+     * Returns the writable mapped elements of a column of this snapshot.
+     */
+    void *mutableData(const SnapshotColumn &column) const { return const_cast<void *>(column.data); }
+
+private:
+    void *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    SnapshotHeader header;
+    std::vector<SnapshotColumn> columns;
+};
+
+#endif //PART1_SNAPSHOT_HPP
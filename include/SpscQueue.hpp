@@ -0,0 +1,80 @@
+//
+// A bounded lock-free queue between one producer thread and one consumer thread.
+//
+
+#ifndef PART1_SPSCQUEUE_HPP
+#define PART1_SPSCQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+/**
+ * A fixed-capacity ring buffer for exactly one pushing and one popping thread.
+ *
+ * Neither side ever blocks or takes a lock: push fails when the ring is full and pop fails when
+ * it is empty. The head and tail indices live on separate cache lines so the two threads do not
+ * bounce a line between them on every operation.
+ */
+template <typename T>
+class SpscQueue {
+public:
+    /**
+     * Creates an empty queue.
+     * @param capacity The maximum number of queued elements; rounded up to a power of two.
+     */
+    explicit SpscQueue(std::size_t capacity) {
+        std::size_t size = 2;
+        while (size < capacity) {
+            size *= 2;
+        }
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    /**
+     * Appends value; producer thread only.
+     * @return False, leaving the queue unchanged, if the queue is full.
+     */
+    bool push(const T &value) {
+        const std::size_t tail = tailIndex.load(std::memory_order_relaxed);
+        if (tail - headIndex.load(std::memory_order_acquire) > mask) {
+            return false;
+        }
+        slots[tail & mask] = value;
+        tailIndex.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the oldest element into value; consumer thread only.
+     * @return False if the queue is empty.
+     */
+    bool pop(T &value) {
+        const std::size_t head = headIndex.load(std::memory_order_relaxed);
+        if (head == tailIndex.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = slots[head & mask];
+        headIndex.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Returns true if nothing is queued. Exact only on the consumer thread.
+     */
+    bool empty() const {
+        return headIndex.load(std::memory_order_acquire) == tailIndex.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    std::size_t mask;
+    alignas(64) std::atomic<std::size_t> headIndex{0}; // Next slot to pop, written by the consumer
+    alignas(64) std::atomic<std::size_t> tailIndex{0}; // Next slot to push, written by the producer
+};
+
+#endif //PART1_SPSCQUEUE_HPP
@@ -0,0 +1,102 @@
+//
+// A small fixed-size pool of worker threads for data-parallel loops.
+//
+
+#ifndef PART1_THREADPOOL_HPP
+#define PART1_THREADPOOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs chunked loops on a fixed set of threads. The calling thread takes part in every loop
+ * as thread 0, so a pool of size 1 has no workers and runs everything inline.
+ *
+ * Chunks are claimed dynamically, so which thread runs which chunk changes from run to run.
+ * Code that needs reproducible results must not depend on that mapping (see ExecutionMode).
+ */
+class ThreadPool {
+public:
+    /**
+     * Starts the pool.
+     * @param threadCount Number of threads including the caller; 0 picks the hardware concurrency.
+     */
+    explicit ThreadPool(unsigned threadCount = 0);
+
+    /**
+     * Stops and joins the worker threads.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    /**
+     * Returns the number of threads, including the calling thread.
+     */
+    unsigned size() const { return unsigned(workers.size()) + 1; }
+
+    /**
+     * Calls task(chunk, thread) once for every chunk in [0, chunkCount) and waits for all of them.
+     * Calls from several threads at once are serialised. A call made from inside a task of this
+     * pool runs its chunks inline on the calling thread, with that thread's index, instead of
+     * waiting for the pool it occupies. If chunks throw, the chunks not yet started are skipped
+     * and the first exception is rethrown here once all threads are done.
+     * @param chunkCount Number of chunks.
+     * @param task The work for one chunk; thread is in [0, size()).
+     */
+    void run(std::size_t chunkCount, const std::function<void(std::size_t, unsigned)> &task);
+
+    /**
+     * Splits [0, count) into ranges of at most grain elements and calls body(begin, end, thread) for each.
+     */
+    template <typename Body>
+    void parallelFor(std::size_t count, std::size_t grain, Body &&body) {
+        grain = std::max<std::size_t>(grain, 1);
+        std::size_t chunks = (count + grain - 1) / grain;
+        run(chunks, [&](std::size_t chunk, unsigned thread) {
+            std::size_t begin = chunk * grain;
+            body(begin, std::min(count, begin + grain), thread);
+        });
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex runMutex; // Serialises run() calls
+    std::mutex stateMutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(std::size_t, unsigned)> *currentTask = nullptr;
+    std::size_t currentChunks = 0;
+    std::atomic<std::size_t> nextChunk{0};
+    unsigned generation = 0;
+    unsigned busyWorkers = 0;
+    bool stopping = false;
+    std::exception_ptr failure; // First exception thrown by the current task
+
+    void workerLoop(unsigned thread);
+    void drain(unsigned thread);
+};
+
+/**
+ * Runs body(begin, end, thread) over [0, count) on the pool, or inline as thread 0 without one.
+ */
+template <typename Body>
+inline void parallelFor(ThreadPool *pool, std::size_t count, std::size_t grain, Body &&body) {
+    if (pool == nullptr || pool->size() == 1 || count <= grain) {
+        if (count > 0) {
+            body(std::size_t(0), count, 0u);
+        }
+        return;
+    }
+    pool->parallelFor(count, grain, body);
+}
+
+#endif //PART1_THREADPOOL_HPP
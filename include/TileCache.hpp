@@ -0,0 +1,131 @@
+//
+// Least-recently-used cache of memory-mapped tile files with a background prefetcher.
+//
+
+#ifndef PART1_TILECACHE_HPP
+#define PART1_TILECACHE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+/**
+ * A whole file mapped read-only. Its pages are clean and file-backed, so the kernel can drop them
+ * under memory pressure and read them again on the next touch.
+ */
+class MappedTile {
+public:
+    /**
+     * Maps a file. Throws std::runtime_error if it cannot be opened or mapped.
+     * @param path The file.
+     * @param populate Whether to read every page in now rather than on first touch.
+     */
+    explicit MappedTile(const std::string &path, bool populate = false);
+
+    ~MappedTile();
+
+    MappedTile(const MappedTile &) = delete;
+    MappedTile &operator=(const MappedTile &) = delete;
+
+    const unsigned char *data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+private:
+    const unsigned char *bytes = nullptr;
+    std::size_t length = 0;
+};
+
+/**
+ * How well a TileCache hid disk reads.
+ */
+struct TileCacheStats {
+    uint64_t hits = 0; // Tiles found mapped, whether by an earlier acquire() or by the prefetcher
+    uint64_t misses = 0; // Tiles acquire() had to map itself
+    uint64_t prefetched = 0; // Tiles mapped by the prefetcher
+    uint64_t evicted = 0;
+    uint64_t bytesMapped = 0;
+    double waitSeconds = 0.0; // Time acquire() spent mapping or waiting for the prefetcher
+};
+
+/**
+ * Keeps up to a fixed number of tile files mapped, dropping the least recently used first.
+ *
+ * A prefetch thread maps the files named by prefetch() ahead of time, reading their pages in, so
+ * that disk reads for the next tiles overlap with computing on the current one. acquire() returns
+ * a tile at once when it is cached and otherwise maps it itself, without reading it ahead, or
+ * waits for the prefetcher if it is already mapping it. Tiles stay valid while a caller holds
+ * them, even after eviction.
+ *
+ * Memory: at most capacity tiles, plus those callers still hold, are mapped at a time, so the
+ * resident set is bounded by that many tile files. Only pages that were prefetched or touched are
+ * resident, and all of them are reclaimable page cache rather than anonymous memory.
+ */
+class TileCache {
+public:
+    /**
+     * @param capacity The number of tiles kept mapped.
+     */
+    explicit TileCache(std::size_t capacity);
+
+    /**
+     * Stops the prefetch thread.
+     */
+    ~TileCache();
+
+    TileCache(const TileCache &) = delete;
+    TileCache &operator=(const TileCache &) = delete;
+
+    /**
+     * Returns the mapped file at path, mapping it if necessary. Throws std::runtime_error if it
+     * cannot be mapped.
+     */
+    std::shared_ptr<const MappedTile> acquire(const std::string &path);
+
+    /**
+     * Asks the prefetch thread to map the file at path unless it is cached already.
+     */
+    void prefetch(const std::string &path);
+
+    /**
+     * Discards pending prefetches and every cached tile, e.g. because the files are about to be
+     * rewritten. Waits for a tile being prefetched.
+     */
+    void clear();
+
+    /**
+     * Changes the number of tiles kept mapped.
+     */
+    void setCapacity(std::size_t tiles);
+
+    TileCacheStats getStats() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const MappedTile> tile;
+        std::list<std::string>::iterator use;
+    };
+
+    std::size_t capacity;
+    mutable std::mutex lock;
+    std::condition_variable changed;
+    std::unordered_map<std::string, Entry> entries;
+    std::list<std::string> recency; // Most recently used first
+    std::deque<std::string> requests; // Paths waiting to be prefetched
+    std::set<std::string> loading; // Paths being mapped by the prefetcher
+    TileCacheStats stats;
+    bool stopping = false;
+    std::thread prefetcher;
+
+    void insert(const std::string &path, const std::shared_ptr<const MappedTile> &tile);
+    void prefetchLoop();
+};
+
+#endif //PART1_TILECACHE_HPP
@@ -0,0 +1,302 @@
+//
+// Compressed trajectory files, written in the background while a simulation runs.
+//
+
+#ifndef PART1_TRAJECTORY_HPP
+#define PART1_TRAJECTORY_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Snapshot.hpp"
+#include "SpscQueue.hpp"
+
+/*
+ * Trajectory file layout, version 1. All integers and floats are little-endian.
+ *
+ * File header, 32 bytes:
+ *   0   char[8]  magic "PSIMTRAJ"
+ *   8   u32      format version
+ *   12  u32      dimension of the simulation
+ *   16  u32      frame stride, in calls to simulate()
+ *   20  u32      frames per chunk
+ *   24  u32      recorded attributes, a mask of trajectoryAttribute bits
+ *   28  u32      reserved, zero
+ *
+ * Frames follow back to back, each a 48-byte header, a 32-byte entry per column and the encoded
+ * columns in the same order:
+ *   0   char[4]  marker "FRME"
+ *   4   u32      flags; bit 0 marks a keyframe
+ *   8   u64      step, the number of calls to simulate() so far
+ *   16  f64      simulated time, in seconds
+ *   24  u64      particle count
+ *   32  u32      number of columns
+ *   36  u32      reserved, zero
+ *   40  u64      size of the whole frame in bytes
+ *   column entry: u32 column id, u32 scalar code, u32 components, u32 fraction bits,
+ *                 u64 decoded size in bytes, u64 encoded size in bytes
+ *
+ * A chunk is a keyframe and the delta frames after it. Keyframes are encoded on their own; other
+ * frames encode each column against the same column of the previous frame, so a reader can start
+ * decoding at any keyframe.
+ */
+
+/**
+ * Returns the bit of an attribute in TrajectoryOptions::attributes.
+ */
+inline uint32_t trajectoryAttribute(SnapshotColumnId id) { return 1u << uint32_t(id); }
+
+/**
+ * What a TrajectoryRecorder records and how much it buffers.
+ */
+struct TrajectoryOptions {
+    unsigned stride = 1; // Record every stride-th call to simulate()
+    uint32_t attributes = trajectoryAttribute(SnapshotColumnId::Position) |
+                          trajectoryAttribute(SnapshotColumnId::Velocity);
+    unsigned framesPerChunk = 64; // Frames from one keyframe to the next
+    unsigned queueDepth = 4; // Frames buffered between the simulation and the writer thread
+};
+
+/**
+ * One frame of a trajectory: the recorded attributes of every particle at one step.
+ * Frames are moved or swapped rather than copied, since the columns point into bytes.
+ */
+struct TrajectoryFrame {
+    std::size_t index = 0; // Position of the frame in its file, set when read
+    uint64_t step = 0;
+    double time = 0.0;
+    uint64_t particleCount = 0;
+    bool keyframe = false;
+    std::vector<SnapshotColumn> columns; // data points into bytes
+    std::vector<unsigned char> bytes;
+
+    TrajectoryFrame() = default;
+    TrajectoryFrame(TrajectoryFrame &&) = default;
+    TrajectoryFrame &operator=(TrajectoryFrame &&) = default;
+    TrajectoryFrame(const TrajectoryFrame &) = delete;
+    TrajectoryFrame &operator=(const TrajectoryFrame &) = delete;
+
+    /**
+     * Returns the column with the given id, or null if the frame does not have it.
+     */
+    const SnapshotColumn *find(SnapshotColumnId id) const {
+        for (const SnapshotColumn &column : columns) {
+            if (column.id == id) {
+                return &column;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Sets the columns to the given layouts and points them at consecutive ranges of bytes,
+     * reusing the buffer when it is large enough.
+     */
+    void layout(const std::vector<SnapshotColumn> &layouts) {
+        columns = layouts;
+        std::size_t total = 0;
+        for (const SnapshotColumn &column : columns) {
+            total += std::size_t(column.bytes);
+        }
+        bytes.resize(total);
+        std::size_t offset = 0;
+        for (SnapshotColumn &column : columns) {
+            column.data = bytes.data() + offset;
+            offset += std::size_t(column.bytes);
+        }
+    }
+};
+
+/**
+ * Appends the lossless encoding of a column to out.
+ *
+ * Each word is predicted from the same word of the previous frame: floats are XORed with it and
+ * fixed-point values are replaced by their zigzagged difference, so slowly moving particles give
+ * words whose high bytes are zero. The bytes are then shuffled into planes (all lowest bytes
+ * first, all highest bytes last) and runs of zero bytes are collapsed.
+ * @param column The column to encode; data holds its elements in host byte order.
+ * @param previous The same column in the previous frame, or null to encode a keyframe.
+ * @param out Receives the encoded bytes.
+ */
+void encodeTrajectoryColumn(const SnapshotColumn &column, const void *previous, std::vector<unsigned char> &out);
+
+/**
+ * Decodes a column written by encodeTrajectoryColumn. Throws std::runtime_error if the encoded
+ * bytes do not decode to column.bytes bytes.
+ * @param column The layout and decoded size of the column; data is ignored.
+ * @param encoded The encoded bytes.
+ * @param encodedBytes The number of encoded bytes.
+ * @param previous The decoded column of the previous frame, or null for a keyframe.
+ * @param out Receives column.bytes bytes in host byte order; may be the same memory as previous.
+ */
+void decodeTrajectoryColumn(const SnapshotColumn &column, const unsigned char *encoded, std::size_t encodedBytes,
+                            const void *previous, void *out);
+
+/**
+ * Writes trajectory frames on a background thread.
+ *
+ * capture() copies the particle arrays into a free frame buffer and hands it to the writer thread
+ * through a lock-free queue; encoding and file output happen on the writer thread. When the writer
+ * falls behind and no buffer is free, the frame is dropped and counted rather than waited for, so
+ * the simulation thread never blocks on the disk.
+ */
+class TrajectoryRecorder {
+public:
+    /**
+     * Creates the trajectory file and starts the writer thread. Throws std::runtime_error if the
+     * file cannot be created.
+     * @param path The file to write.
+     * @param dimension The dimension of the recorded simulation.
+     * @param options What to record.
+     */
+    TrajectoryRecorder(const std::string &path, uint32_t dimension, const TrajectoryOptions &options = TrajectoryOptions());
+
+    /**
+     * Writes all captured frames and closes the file.
+     */
+    ~TrajectoryRecorder();
+
+    TrajectoryRecorder(const TrajectoryRecorder &) = delete;
+    TrajectoryRecorder &operator=(const TrajectoryRecorder &) = delete;
+
+    /**
+     * Returns true if the state after the given step should be recorded.
+     */
+    bool wants(uint64_t step) const { return step % options.stride == 0; }
+
+    /**
+     * Returns true if the given attribute is recorded.
+     */
+    bool records(SnapshotColumnId id) const { return (options.attributes & trajectoryAttribute(id)) != 0; }
+
+    /**
+     * Returns the recorded attributes as a mask of trajectoryAttribute bits.
+     */
+    uint32_t getAttributes() const { return options.attributes; }
+
+    /**
+     * Queues a frame; simulation thread only. Never blocks.
+     * @param step The number of calls to simulate() so far.
+     * @param time The simulated time.
+     * @param particleCount The number of particles.
+     * @param columns The recorded attributes; their data is copied before capture returns.
+     * @return False if the frame was dropped because the writer is behind or has failed.
+     */
+    bool capture(uint64_t step, double time, uint64_t particleCount, const std::vector<SnapshotColumn> &columns);
+
+    /**
+     * Waits until every captured frame is written, then closes the file. Further captures are
+     * dropped. Called by the destructor.
+     */
+    void finish();
+
+    /**
+     * Returns true if writing failed, e.g. because the disk is full.
+     */
+    bool hasFailed() const { return failed.load(std::memory_order_relaxed); }
+
+    uint64_t getFramesWritten() const { return framesWritten.load(std::memory_order_relaxed); }
+    uint64_t getFramesDropped() const { return framesDropped.load(std::memory_order_relaxed); }
+    // Size of the recorded attributes before encoding, and of the file written so far.
+    uint64_t getRawBytes() const { return rawBytes.load(std::memory_order_relaxed); }
+    uint64_t getBytesWritten() const { return bytesWritten.load(std::memory_order_relaxed); }
+
+private:
+    TrajectoryOptions options;
+    std::ofstream file;
+    std::vector<std::unique_ptr<TrajectoryFrame> > frames; // Every frame buffer, owned here
+    SpscQueue<TrajectoryFrame *> freeFrames; // Buffers returned by the writer
+    SpscQueue<TrajectoryFrame *> fullFrames; // Captured frames waiting to be written
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    std::atomic<bool> stopping{false};
+    std::atomic<bool> failed{false};
+    std::thread writer;
+
+    // Writer thread state
+    TrajectoryFrame previous; // Last written frame, the reference for the next delta frame
+    unsigned framesSinceKeyframe = 0;
+    std::vector<unsigned char> encoded;
+
+    std::atomic<uint64_t> framesWritten{0};
+    std::atomic<uint64_t> framesDropped{0};
+    std::atomic<uint64_t> rawBytes{0};
+    std::atomic<uint64_t> bytesWritten{0};
+
+    void writerLoop();
+    void writeFrame(TrajectoryFrame &frame);
+};
+
+/**
+ * Where a frame is in a trajectory file and what it holds, without decoding it.
+ */
+struct TrajectoryFrameInfo {
+    uint64_t offset; // Start of the frame in the file
+    uint64_t step;
+    double time;
+    std::size_t keyframe; // Index of the keyframe its chunk starts with
+};
+
+/**
+ * Random access to the frames of a trajectory file.
+ *
+ * The file is mapped read-only and its frame headers are scanned once into an index, so any frame
+ * can be found by position or time. Reading a frame decodes from the keyframe of its chunk, or
+ * only the one frame when the destination already holds the frame before it. A file cut short
+ * while recording is read up to its last complete frame.
+ */
+class TrajectoryReader {
+public:
+    /**
+     * Maps a trajectory file and indexes its frames. Throws std::runtime_error if the file cannot
+     * be read or is not a trajectory.
+     * @param path The trajectory file.
+     */
+    explicit TrajectoryReader(const std::string &path);
+
+    ~TrajectoryReader();
+
+    TrajectoryReader(const TrajectoryReader &) = delete;
+    TrajectoryReader &operator=(const TrajectoryReader &) = delete;
+
+    uint32_t getDimension() const { return dimension; }
+    uint32_t getAttributes() const { return attributes; }
+    std::size_t getFrameCount() const { return index.size(); }
+    const TrajectoryFrameInfo &getFrameInfo(std::size_t frame) const { return index[frame]; }
+
+    /**
+     * Returns the last frame recorded at or before the given time, or 0 if there is none.
+     */
+    std::size_t findFrame(double time) const;
+
+    /**
+     * Decodes a frame. Throws std::runtime_error if the frame is corrupt.
+     * @param frame The index of the frame, less than getFrameCount().
+     * @param out Receives the frame; if it holds frame - 1 of this file, only one frame is decoded.
+     */
+    void read(std::size_t frame, TrajectoryFrame &out) const;
+
+    /**
+     * Asks the kernel to read the bytes of frames [first, last) into the page cache.
+     */
+    void willNeed(std::size_t first, std::size_t last) const;
+
+private:
+    unsigned char *mapping = nullptr;
+    std::size_t mappingSize = 0;
+    uint32_t dimension = 0;
+    uint32_t attributes = 0;
+    std::vector<TrajectoryFrameInfo> index;
+
+    // Decodes the frame at index frame into out, using out as the previous frame unless it is a keyframe.
+    void decodeInto(std::size_t frame, TrajectoryFrame &out) const;
+};
+
+#endif //PART1_TRAJECTORY_HPP
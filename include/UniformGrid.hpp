@@ -0,0 +1,340 @@
+//
+// Uniform grid broad phase for particle collisions.
+//
+
+#ifndef PART1_UNIFORMGRID_HPP
+#define PART1_UNIFORMGRID_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <glm/glm/glm.hpp>
+#include "FixedPoint.hpp"
+
+/**
+ * Maps floating point positions to integer cell coordinates: floor((p - origin) / cellSize).
+ *
+ * Components that are NaN or infinite are left out of the bounds and fall in the first cell along
+ * their axis, and cells past the last one are clamped to it, so that a particle that blew up can
+ * neither stretch the grid nor make a cell coordinate overflow.
+ */
+template <int Dim, typename Position>
+class CellQuantizer {
+public:
+    typedef glm::vec<Dim, int> Cell;
+    typedef typename Position::value_type Real;
+
+    /**
+     * Chooses the origin and the cell size so the grid covers all finite positions with at most
+     * maxCells cells.
+     * @return The number of cells along each axis.
+     */
+    Cell fit(const Position *positions, std::size_t count, double minCellSize, std::size_t maxCells) {
+        Position lower = positions[0];
+        Position upper = positions[0];
+        for (std::size_t i = 1; i < count; ++i) {
+            lower = glm::min(lower, positions[i]);
+            upper = glm::max(upper, positions[i]);
+        }
+        if (!finite(lower) || !finite(upper)) {
+            finiteBounds(positions, count, lower, upper);
+        }
+
+        // Widen the cells when particles are spread so thinly that a fine grid would mostly be empty.
+        // Extents are divided in double and compared before converting, so no cell count overflows.
+        const double cellLimit = double(std::min(maxCells, std::size_t(kMaxCells)));
+        Cell resolution;
+        double size = minCellSize;
+        for (;;) {
+            double total = 1.0;
+            for (int d = 0; d < Dim; ++d) {
+                total *= std::floor((double(upper[d]) - double(lower[d])) / size) + 1.0;
+            }
+            if (total <= cellLimit) {
+                break;
+            }
+            size *= 2.0;
+        }
+        for (int d = 0; d < Dim; ++d) {
+            resolution[d] = int(std::floor((double(upper[d]) - double(lower[d])) / size)) + 1;
+        }
+        origin = lower;
+        inverseCellSize = Real(1) / Real(size);
+        lastCell = Position(resolution - Cell(1));
+        return resolution;
+    }
+
+    Cell operator()(const Position &p) const {
+        // Clamped before converting; max(0, NaN) is 0 because std::max returns its first argument
+        // unless it compares less than the second
+        const Position scaled = glm::floor((p - origin) * inverseCellSize);
+        return Cell(glm::min(lastCell, glm::max(Position(Real(0)), scaled)));
+    }
+
+    double cellSize() const { return 1.0 / double(inverseCellSize); }
+
+private:
+    static const std::size_t kMaxCells = std::size_t(1) << 30;
+
+    static bool finite(const Position &p) {
+        for (int d = 0; d < Dim; ++d) {
+            if (!std::isfinite(p[d])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Recomputes the bounds over finite components only; an axis without any is bounded by 0.
+     */
+    static void finiteBounds(const Position *positions, std::size_t count, Position &lower, Position &upper) {
+        lower = Position(std::numeric_limits<Real>::infinity());
+        upper = Position(-std::numeric_limits<Real>::infinity());
+        for (std::size_t i = 0; i < count; ++i) {
+            for (int d = 0; d < Dim; ++d) {
+                const Real x = positions[i][d];
+                if (std::isfinite(x)) {
+                    lower[d] = std::min(lower[d], x);
+                    upper[d] = std::max(upper[d], x);
+                }
+            }
+        }
+        for (int d = 0; d < Dim; ++d) {
+            if (lower[d] > upper[d]) {
+                lower[d] = upper[d] = Real(0);
+            }
+        }
+    }
+
+    Position origin = Position(Real(0));
+    Real inverseCellSize = Real(1);
+    Position lastCell = Position(Real(0)); // Coordinates of the last cell along each axis
+};
+
+/**
+ * Fixed-point positions use cells of 2^shift raw units, so quantising is a subtraction and a shift.
+ */
+template <int Dim, int FractionBits>
+class CellQuantizer<Dim, FixedVec<Dim, FractionBits> > {
+public:
+    typedef glm::vec<Dim, int> Cell;
+    typedef FixedVec<Dim, FractionBits> Position;
+    typedef typename Position::Raw Raw;
+
+    Cell fit(const Position *positions, std::size_t count, double minCellSize, std::size_t maxCells) {
+        Raw lower = positions[0].raw;
+        Raw upper = positions[0].raw;
+        for (std::size_t i = 1; i < count; ++i) {
+            lower = glm::min(lower, positions[i].raw);
+            upper = glm::max(upper, positions[i].raw);
+        }
+
+        shift = 0;
+        while (double(int64_t(1) << shift) < minCellSize * Position::scale()) {
+            ++shift;
+        }
+
+        Cell resolution;
+        for (;;) {
+            std::size_t total = 1;
+            for (int d = 0; d < Dim; ++d) {
+                resolution[d] = int((int64_t(upper[d]) - int64_t(lower[d])) >> shift) + 1;
+                total *= std::size_t(resolution[d]);
+            }
+            if (total <= maxCells) {
+                break;
+            }
+            ++shift;
+        }
+        origin = lower;
+        return resolution;
+    }
+
+    Cell operator()(const Position &p) const {
+        Cell cell;
+        for (int d = 0; d < Dim; ++d) {
+            cell[d] = int((int64_t(p.raw[d]) - int64_t(origin[d])) >> shift);
+        }
+        return cell;
+    }
+
+    double cellSize() const { return double(int64_t(1) << shift) / Position::scale(); }
+
+private:
+    Raw origin = Raw(0);
+    int shift = 0;
+};
+
+/**
+ * Bins particles into cubic cells at least one particle diameter wide, so every colliding pair
+ * lies in the same or an adjacent cell. In Dim dimensions each particle only has to be tested
+ * against the 3^Dim cells around it: 9 in 2D, 27 in 3D.
+ *
+ * The grid is rebuilt from scratch with a counting sort, which keeps particles of a cell
+ * contiguous in memory and in ascending index order. Position may be any glm vector or a FixedVec.
+ */
+template <int Dim, typename Position = glm::vec<Dim, float> >
+class UniformGrid {
+public:
+    typedef glm::vec<Dim, int> Cell;
+
+    /**
+     * Number of cells searched around each particle.
+     */
+    static int neighbourhoodSize() {
+        int cells = 1;
+        for (int d = 0; d < Dim; ++d) {
+            cells *= 3;
+        }
+        return cells;
+    }
+
+    /**
+     * Sorts the given particles into cells.
+     * @param positions Particle positions.
+     * @param count Number of particles.
+     * @param minCellSize The smallest allowed cell width, normally the particle diameter.
+     */
+    void build(const Position *positions, std::size_t count, double minCellSize) {
+        particleCount = count;
+        if (count == 0) {
+            cellStart.assign(2, 0);
+            resolution = Cell(1);
+            return;
+        }
+
+        resolution = quantizer.fit(positions, count, minCellSize, std::max<std::size_t>(64, 4 * count));
+
+        std::size_t totalCells = 1;
+        for (int d = 0; d < Dim; ++d) {
+            totalCells *= std::size_t(resolution[d]);
+        }
+
+        particleCell.resize(count);
+        cellStart.assign(totalCells + 1, 0);
+        for (std::size_t i = 0; i < count; ++i) {
+            uint32_t cell = linearIndex(cellOf(positions[i]));
+            particleCell[i] = cell;
+            ++cellStart[cell + 1];
+        }
+        for (std::size_t c = 0; c < totalCells; ++c) {
+            cellStart[c + 1] += cellStart[c];
+        }
+
+        sortedIndices.resize(count);
+        std::vector<uint32_t> cursor(cellStart.begin(), cellStart.end() - 1);
+        for (std::size_t i = 0; i < count; ++i) {
+            sortedIndices[cursor[particleCell[i]]++] = uint32_t(i);
+        }
+    }
+
+    /**
+     * Calls visit(i, j) once for every pair of particles i < j in the same or adjacent cells.
+     * Pairs are visited cell by cell, in a fixed order that only depends on the positions.
+     */
+    template <typename Visitor>
+    void forEachCandidatePair(Visitor &&visit) const {
+        forEachCandidatePair(0, cellCount(), visit);
+    }
+
+    /**
+     * Like forEachCandidatePair(visit), restricted to the pairs whose lower-index particle lies in
+     * cells [firstCell, lastCell). Disjoint cell ranges never visit the same pair, so ranges can be
+     * searched concurrently.
+     */
+    template <typename Visitor>
+    void forEachCandidatePair(std::size_t firstCell, std::size_t lastCell, Visitor &&visit) const {
+        if (particleCount == 0) {
+            return;
+        }
+
+        const int neighbours = neighbourhoodSize();
+        for (std::size_t c = firstCell; c < lastCell; ++c) {
+            if (cellStart[c] == cellStart[c + 1]) {
+                continue;
+            }
+            Cell home = cellFromLinear(uint32_t(c));
+
+            for (int n = 0; n < neighbours; ++n) {
+                Cell other = home + neighbourOffset(n);
+                if (!inside(other)) {
+                    continue;
+                }
+                uint32_t o = linearIndex(other);
+
+                for (uint32_t a = cellStart[c]; a < cellStart[c + 1]; ++a) {
+                    uint32_t i = sortedIndices[a];
+                    for (uint32_t b = cellStart[o]; b < cellStart[o + 1]; ++b) {
+                        uint32_t j = sortedIndices[b];
+                        if (j > i) {
+                            visit(i, j);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * Returns the number of cells of the last build.
+     */
+    std::size_t cellCount() const { return cellStart.empty() ? 0 : cellStart.size() - 1; }
+
+    /**
+     * Returns the cell width of the last build.
+     */
+    double getCellSize() const { return quantizer.cellSize(); }
+
+private:
+    CellQuantizer<Dim, Position> quantizer;
+    Cell resolution = Cell(1);
+    std::size_t particleCount = 0;
+    std::vector<uint32_t> cellStart;     // Prefix sum: particles of cell c are sortedIndices[cellStart[c], cellStart[c + 1])
+    std::vector<uint32_t> sortedIndices; // Particle indices ordered by cell
+    std::vector<uint32_t> particleCell;  // Linear cell index of every particle
+
+    Cell cellOf(const Position &p) const {
+        return glm::clamp(quantizer(p), Cell(0), resolution - Cell(1));
+    }
+
+    bool inside(const Cell &cell) const {
+        for (int d = 0; d < Dim; ++d) {
+            if (cell[d] < 0 || cell[d] >= resolution[d]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    uint32_t linearIndex(const Cell &cell) const {
+        uint32_t index = 0;
+        for (int d = Dim - 1; d >= 0; --d) {
+            index = index * uint32_t(resolution[d]) + uint32_t(cell[d]);
+        }
+        return index;
+    }
+
+    Cell cellFromLinear(uint32_t index) const {
+        Cell cell;
+        for (int d = 0; d < Dim; ++d) {
+            cell[d] = int(index % uint32_t(resolution[d]));
+            index /= uint32_t(resolution[d]);
+        }
+        return cell;
+    }
+
+    static Cell neighbourOffset(int n) {
+        Cell offset;
+        for (int d = 0; d < Dim; ++d) {
+            offset[d] = n % 3 - 1;
+            n /= 3;
+        }
+        return offset;
+    }
+};
+
+#endif //PART1_UNIFORMGRID_HPP
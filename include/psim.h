@@ -0,0 +1,128 @@
+/*
+ * C interface to the simulation, for foreign function interfaces such as Python ctypes/cffi and
+ * Julia ccall.
+ */
+
+#ifndef PART1_PSIM_H
+#define PART1_PSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define PSIM_API __declspec(dllexport)
+#else
+#define PSIM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Version of this interface. Functions and enumerators are only ever added, and structs only grow
+ * at the end: callers state the size of the structs they pass in.
+ */
+#define PSIM_ABI_VERSION 1
+
+typedef struct psim_simulation psim_simulation;
+
+typedef enum psim_status {
+    PSIM_OK = 0,
+    PSIM_INVALID_ARGUMENT = 1,
+    PSIM_OUT_OF_MEMORY = 2,
+    PSIM_FAILED = 3
+} psim_status;
+
+/* Particle attributes; the values match the column ids of snapshots. */
+typedef enum psim_attribute {
+    PSIM_POSITION = 1,
+    PSIM_VELOCITY = 2,
+    PSIM_ACCELERATION = 3,
+    PSIM_COLOR = 4,
+    PSIM_MASS = 5
+} psim_attribute;
+
+typedef enum psim_scalar {
+    PSIM_FLOAT32 = 1,
+    PSIM_FLOAT64 = 2,
+    PSIM_FIXED32 = 3 /* int32 with fraction_bits fractional bits */
+} psim_scalar;
+
+/* Parameters of a new simulation; fill in with psim_config_init before changing any. */
+typedef struct psim_config {
+    uint32_t struct_size; /* sizeof(psim_config) as the caller compiled it */
+    uint32_t threads; /* Worker threads; 0 for one per core, 1 to run on the calling thread */
+    double particle_radius;
+    double boundary; /* Half-extent of the box; below 2048 in fixed-point builds */
+    int32_t iterations; /* Collision and integration passes per step */
+    int32_t deterministic; /* Non-zero for results that do not depend on the thread count */
+    double gravity[3];
+    uint64_t seed;
+} psim_config;
+
+/*
+ * A particle attribute array in place, e.g. numpy.ndarray(shape=(length, components),
+ * strides=(stride, component_stride)). The data belongs to the simulation, is read-only and
+ * stays valid until particles are next added or the simulation is destroyed; stepping updates it
+ * in place.
+ */
+typedef struct psim_view {
+    const void *data;
+    uint64_t length; /* Particles */
+    uint32_t components; /* Elements per particle: the dimension for vectors, 3 for colors, 1 for masses */
+    uint32_t scalar; /* psim_scalar of every element */
+    uint32_t fraction_bits; /* For PSIM_FIXED32 */
+    uint32_t element_bytes;
+    int64_t stride; /* Bytes from one particle to the next */
+    int64_t component_stride; /* Bytes from one component to the next */
+} psim_view;
+
+/* Returns PSIM_ABI_VERSION of the library, which may be newer than the header's. */
+PSIM_API uint32_t psim_abi_version(void);
+
+/* Returns the number of simulated dimensions the library was built for (2 or 3). */
+PSIM_API uint32_t psim_dimension(void);
+
+/* Returns the message of the last failure on the calling thread, or "" if there was none. */
+PSIM_API const char *psim_last_error(void);
+
+PSIM_API void psim_config_init(psim_config *config);
+
+/* Creates a headless simulation; config may be null for the defaults. */
+PSIM_API psim_status psim_create(const psim_config *config, psim_simulation **out);
+
+PSIM_API void psim_destroy(psim_simulation *simulation);
+
+/* Adds count particles at random positions with random velocities and masses. */
+PSIM_API psim_status psim_spawn_random(psim_simulation *simulation, uint64_t count);
+
+/*
+ * Adds count particles. positions holds 3 doubles per particle; velocities (3 per particle),
+ * masses and colors (3 per particle, 0 to 1) may be null for zero velocity, unit mass and black.
+ * Components a 2D simulation does not use are ignored.
+ */
+PSIM_API psim_status psim_spawn(psim_simulation *simulation, uint64_t count, const double *positions,
+                                const double *velocities, const double *masses, const double *colors);
+
+/* Advances the simulation by steps steps of dt seconds each. */
+PSIM_API psim_status psim_step(psim_simulation *simulation, double dt, uint32_t steps);
+
+/*
+ * Advances count simulations by steps steps of dt each, in one call. Stops at the first failure,
+ * and returns its status.
+ */
+PSIM_API psim_status psim_step_many(psim_simulation *const *simulations, size_t count, double dt, uint32_t steps);
+
+/* Describes an attribute array without copying it. */
+PSIM_API psim_status psim_view_attribute(const psim_simulation *simulation, psim_attribute attribute, psim_view *out);
+
+PSIM_API uint64_t psim_particle_count(const psim_simulation *simulation);
+PSIM_API uint64_t psim_step_count(const psim_simulation *simulation);
+PSIM_API double psim_time(const psim_simulation *simulation);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PART1_PSIM_H */
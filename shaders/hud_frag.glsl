@@ -0,0 +1,16 @@
+#version 410 core
+
+// Variables received from the vertex shader
+in vec2 uv;
+in vec4 color;
+
+// Glyph coverage, one channel; texture unit 0
+uniform sampler2D atlas;
+
+// Output color
+out vec4 FragColor;
+
+void main()
+{
+    FragColor = vec4(color.rgb, color.a * texture(atlas, uv).r);
+}
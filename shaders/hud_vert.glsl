@@ -0,0 +1,20 @@
+#version 410 core
+
+// Vertex input: screen position in pixels, atlas coordinate, color
+layout (location = 0) in vec2 aPos;
+layout (location = 1) in vec2 aUv;
+layout (location = 2) in vec4 aColor;
+
+// Maps pixels to clip space
+uniform mat4 projection;
+
+// Variables to be passed to the fragment shader
+out vec2 uv;
+out vec4 color;
+
+void main()
+{
+    gl_Position = projection * vec4(aPos, 0.0, 1.0);
+    uv = aUv;
+    color = aColor;
+}
@@ -0,0 +1,236 @@
+//
+// C interface to the simulation, for foreign function interfaces.
+//
+
+#include "psim.h"
+#include "Simulation.hpp"
+#include "ThreadPool.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct psim_simulation {
+    std::unique_ptr<ThreadPool> pool; // Null when running on the calling thread
+    Simulation simulation;
+};
+
+namespace {
+
+typedef Simulation::Real Real;
+
+thread_local std::string lastError;
+
+psim_status fail(psim_status status, const char *message) {
+    lastError = message;
+    return status;
+}
+
+/**
+ * Runs body, turning exceptions into status codes so that none crosses the C boundary.
+ */
+template <typename Body>
+psim_status guarded(Body body) {
+    try {
+        body();
+        lastError.clear();
+        return PSIM_OK;
+    } catch (const std::bad_alloc &) {
+        return fail(PSIM_OUT_OF_MEMORY, "ERROR::PSIM::OUT_OF_MEMORY");
+    } catch (const std::exception &error) {
+        return fail(PSIM_FAILED, error.what());
+    } catch (...) {
+        return fail(PSIM_FAILED, "ERROR::PSIM::UNKNOWN_EXCEPTION");
+    }
+}
+
+uint32_t scalarBytes(ScalarCode scalar) {
+    return scalar == ScalarCode::Float64 ? 8 : 4;
+}
+
+}
+
+uint32_t psim_abi_version(void) {
+    return PSIM_ABI_VERSION;
+}
+
+uint32_t psim_dimension(void) {
+    return SIM_DIMENSION;
+}
+
+const char *psim_last_error(void) {
+    return lastError.c_str();
+}
+
+void psim_config_init(psim_config *config) {
+    if (config == nullptr) {
+        return;
+    }
+    std::memset(config, 0, sizeof(*config));
+    config->struct_size = sizeof(psim_config);
+    config->threads = 1;
+    config->particle_radius = 0.05;
+    config->boundary = 1.2;
+    config->iterations = 5;
+    config->seed = 0x9E3779B97F4A7C15ull;
+}
+
+psim_status psim_create(const psim_config *config, psim_simulation **out) {
+    if (out == nullptr) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::NULL_OUTPUT");
+    }
+    *out = nullptr;
+    // Copy only the part of the config the caller knows about; the rest keeps its defaults.
+    psim_config settings;
+    psim_config_init(&settings);
+    if (config != nullptr) {
+        if (config->struct_size < offsetof(psim_config, seed) + sizeof(config->seed)) {
+            return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::CONFIG_TOO_SMALL");
+        }
+        std::memcpy(&settings, config, std::min<std::size_t>(config->struct_size, sizeof(settings)));
+    }
+    if (!(settings.particle_radius > 0.0) || !(settings.boundary > settings.particle_radius) || settings.iterations < 1) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_CONFIG");
+    }
+    if (!(settings.boundary < Simulation::maxBoundary())) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BOUNDARY_OUT_OF_RANGE");
+    }
+
+    return guarded([&]() {
+        std::unique_ptr<psim_simulation> created(new psim_simulation());
+        if (settings.threads != 1) {
+            created->pool.reset(new ThreadPool(settings.threads));
+        }
+        Simulation &simulation = created->simulation;
+        simulation.setThreadPool(created->pool.get());
+        simulation.setParticleRadius(Real(settings.particle_radius));
+        simulation.setBoundary(Real(settings.boundary));
+        simulation.setIterations(settings.iterations);
+        simulation.setExecutionMode(settings.deterministic != 0 ? ExecutionMode::Deterministic : ExecutionMode::Fast);
+        simulation.setGravity(glm::vec<3, Real>(Real(settings.gravity[0]), Real(settings.gravity[1]), Real(settings.gravity[2])));
+        simulation.setSeed(settings.seed);
+        *out = created.release();
+    });
+}
+
+void psim_destroy(psim_simulation *simulation) {
+    delete simulation;
+}
+
+psim_status psim_spawn_random(psim_simulation *simulation, uint64_t count) {
+    if (simulation == nullptr || count > uint64_t(INT_MAX)) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_SPAWN");
+    }
+    return guarded([&]() { simulation->simulation.addRandomParticles(int(count)); });
+}
+
+psim_status psim_spawn(psim_simulation *simulation, uint64_t count, const double *positions,
+                       const double *velocities, const double *masses, const double *colors) {
+    if (simulation == nullptr || (positions == nullptr && count > 0)) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_SPAWN");
+    }
+    return guarded([&]() {
+        const std::size_t n = std::size_t(count);
+        std::vector<glm::vec<3, Real> > placed(n);
+        std::vector<glm::vec<3, Real> > moving;
+        std::vector<Real> weights;
+        std::vector<glm::vec3> tints;
+        ParticleArrays<Real> arrays;
+        arrays.count = n;
+        for (std::size_t i = 0; i < n; ++i) {
+            placed[i] = glm::vec<3, Real>(Real(positions[3 * i]), Real(positions[3 * i + 1]), Real(positions[3 * i + 2]));
+        }
+        arrays.positions = placed.data();
+        if (velocities != nullptr) {
+            moving.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                moving[i] = glm::vec<3, Real>(Real(velocities[3 * i]), Real(velocities[3 * i + 1]), Real(velocities[3 * i + 2]));
+            }
+            arrays.velocities = moving.data();
+        }
+        if (masses != nullptr) {
+            weights.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                weights[i] = Real(masses[i]);
+            }
+            arrays.masses = weights.data();
+        }
+        if (colors != nullptr) {
+            tints.resize(n);
+            for (std::size_t i = 0; i < n; ++i) {
+                tints[i] = glm::vec3(float(colors[3 * i]), float(colors[3 * i + 1]), float(colors[3 * i + 2]));
+            }
+            arrays.colors = tints.data();
+        }
+        simulation->simulation.addParticles(arrays);
+    });
+}
+
+psim_status psim_step(psim_simulation *simulation, double dt, uint32_t steps) {
+    if (simulation == nullptr || !(dt > 0.0)) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_STEP");
+    }
+    return guarded([&]() {
+        for (uint32_t s = 0; s < steps; ++s) {
+            simulation->simulation.simulate(Real(dt));
+        }
+    });
+}
+
+psim_status psim_step_many(psim_simulation *const *simulations, size_t count, double dt, uint32_t steps) {
+    if (simulations == nullptr && count > 0) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_STEP");
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const psim_status status = psim_step(simulations[i], dt, steps);
+        if (status != PSIM_OK) {
+            return status;
+        }
+    }
+    return PSIM_OK;
+}
+
+psim_status psim_view_attribute(const psim_simulation *simulation, psim_attribute attribute, psim_view *out) {
+    if (simulation == nullptr || out == nullptr || attribute < PSIM_POSITION || attribute > PSIM_MASS) {
+        return fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_VIEW");
+    }
+    const SnapshotColumnId id = SnapshotColumnId(attribute);
+    bool described = true;
+    const psim_status status = guarded([&]() {
+        const std::vector<SnapshotColumn> columns = simulation->simulation.describeParticles(trajectoryAttribute(id));
+        if (columns.size() != 1 || columns[0].id != id) {
+            described = false;
+            return;
+        }
+        // Columns are arrays of packed elements, so the strides follow from the element size.
+        const SnapshotColumn &column = columns[0];
+        const uint32_t elementBytes = scalarBytes(column.scalar);
+        out->data = column.data;
+        out->length = simulation->simulation.getParticleCount();
+        out->components = column.components;
+        out->scalar = uint32_t(column.scalar);
+        out->fraction_bits = column.fractionBits;
+        out->element_bytes = elementBytes;
+        out->stride = int64_t(elementBytes) * column.components;
+        out->component_stride = elementBytes;
+    });
+    return described ? status : fail(PSIM_INVALID_ARGUMENT, "ERROR::PSIM::BAD_VIEW");
+}
+
+uint64_t psim_particle_count(const psim_simulation *simulation) {
+    return simulation != nullptr ? simulation->simulation.getParticleCount() : 0;
+}
+
+uint64_t psim_step_count(const psim_simulation *simulation) {
+    return simulation != nullptr ? simulation->simulation.getStepCount() : 0;
+}
+
+double psim_time(const psim_simulation *simulation) {
+    return simulation != nullptr ? simulation->simulation.getTime() : 0.0;
+}
@@ -0,0 +1,156 @@
+//
+// Periodic checkpoints written by a forked child from a copy-on-write image of the process.
+//
+
+#include "Checkpoint.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * Returns the memory only this process maps, i.e. the pages it no longer shares with the process
+ * it was forked from, or 0 if the kernel does not report it.
+ */
+static uint64_t privateBytes() {
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string key;
+    uint64_t kilobytes;
+    uint64_t total = 0;
+    while (rollup >> key) {
+        if (key == "Private_Clean:" || key == "Private_Dirty:") {
+            if (rollup >> kilobytes) {
+                total += kilobytes * 1024;
+            }
+        }
+    }
+    return total;
+}
+
+/**
+ * @param options When and where to write checkpoints.
+ */
+Checkpointer::Checkpointer(const CheckpointOptions &options) : options(options) {
+}
+
+/**
+ * Waits for a checkpoint still being written.
+ */
+Checkpointer::~Checkpointer() {
+    wait();
+}
+
+/**
+ * Forks a child that calls write with the checkpoint path, then returns without waiting.
+ * @param step The number of calls to simulate() so far, used in the file name.
+ * @param write Writes the state to the given path; runs in the child.
+ * @return False if the checkpoint was skipped or fork() failed.
+ */
+bool Checkpointer::checkpoint(uint64_t step, const WriteFunction &write) {
+    poll();
+    if (busy()) {
+        ++stats.skipped;
+        return false;
+    }
+
+    char name[64];
+    std::snprintf(name, sizeof(name), "-%010llu.snap", (unsigned long long) step);
+    const std::string path = options.directory + "/" + options.prefix + name;
+    const std::string temporary = path + ".tmp";
+
+    int fds[2];
+    if (::pipe(fds) != 0) {
+        ++stats.failed;
+        return false;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        // Child: write from the copy-on-write image, report what it cost and leave without
+        // running destructors or atexit handlers that belong to the parent.
+        ::close(fds[0]);
+        int code = 0;
+        try {
+            write(temporary);
+            if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+                code = 1;
+            }
+        } catch (...) {
+            code = 1;
+        }
+        uint64_t extra = privateBytes();
+        ssize_t written = ::write(fds[1], &extra, sizeof(extra));
+        (void) written;
+        ::_exit(code);
+    }
+    double pause = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    ::close(fds[1]);
+    if (pid < 0) {
+        ::close(fds[0]);
+        ++stats.failed;
+        return false;
+    }
+
+    child = pid;
+    reportPipe = fds[0];
+    pendingPath = path;
+    ++stats.started;
+    stats.lastPauseSeconds = pause;
+    stats.maxPauseSeconds = std::max(stats.maxPauseSeconds, pause);
+    return true;
+}
+
+/**
+ * Collects a finished child, if any, without blocking.
+ */
+void Checkpointer::poll() {
+    int status;
+    if (child > 0 && ::waitpid(child, &status, WNOHANG) == child) {
+        collect(status);
+    }
+}
+
+/**
+ * Waits until no checkpoint is being written.
+ */
+void Checkpointer::wait() {
+    int status;
+    if (child > 0 && ::waitpid(child, &status, 0) == child) {
+        collect(status);
+    }
+}
+
+/**
+ * Records the outcome of the finished child and applies the retention limit.
+ * @param status The status reported by waitpid.
+ */
+void Checkpointer::collect(int status) {
+    uint64_t extra = 0;
+    if (::read(reportPipe, &extra, sizeof(extra)) != ssize_t(sizeof(extra))) {
+        extra = 0;
+    }
+    ::close(reportPipe);
+    reportPipe = -1;
+    child = -1;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        ++stats.failed;
+        std::remove((pendingPath + ".tmp").c_str());
+        return;
+    }
+
+    ++stats.completed;
+    stats.lastExtraBytes = extra;
+    stats.maxExtraBytes = std::max(stats.maxExtraBytes, extra);
+    kept.push_back(pendingPath);
+    while (options.retention > 0 && kept.size() > options.retention) {
+        std::remove(kept.front().c_str());
+        kept.pop_front();
+    }
+}
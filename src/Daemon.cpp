@@ -0,0 +1,38 @@
+//
+// Serves headless simulations to other processes over a Unix domain socket.
+//
+
+#include "Service.hpp"
+#include "ThreadPool.hpp"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static SimulationService* service = nullptr;
+
+static void stopService(int) {
+    if (service != nullptr) {
+        service->stop();
+    }
+}
+
+// Usage: part1_service [socket] [threads], serving until interrupted.
+int main(int argc, char** argv) {
+    const std::string path = argc >= 2 ? argv[1] : "/tmp/psim.sock";
+    ThreadPool pool(argc >= 3 ? unsigned(std::atoi(argv[2])) : 0u);
+
+    try {
+        SimulationService server(path, &pool);
+        service = &server;
+        std::signal(SIGINT, stopService);
+        std::signal(SIGTERM, stopService);
+        std::cout << "Serving simulations on " << path << " with " << pool.size() << " threads" << std::endl;
+        server.run();
+        service = nullptr;
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
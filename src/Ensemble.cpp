@@ -0,0 +1,268 @@
+//
+// Many small independent simulations run side by side, e.g. for parameter sweeps.
+//
+
+#include "Ensemble.hpp"
+#include "Import.hpp"
+#include "Random.hpp"
+#include "SceneBatch.hpp"
+#include "Simulation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <tuple>
+
+namespace {
+
+typedef Simulation::Real Real;
+
+// Members of up to this many particles run in lockstep batches, one cache line of lanes wide.
+const std::size_t kLockstepParticles = 128;
+const int kLockstepLanes = int(64 / sizeof(Real));
+typedef BasicSceneBatch<SIM_DIMENSION, Real, kLockstepLanes> Batch;
+
+/**
+ * Draws a member's initial particles from its seed; element k of every array depends only on k.
+ */
+ParticleTable<Real> memberParticles(const EnsembleMember &member) {
+    const std::size_t n = member.particles;
+    ParticleTable<Real> table;
+    table.positions.resize(n, glm::vec<3, Real>(Real(0)));
+    table.velocities.resize(n, glm::vec<3, Real>(Real(0)));
+    table.masses.resize(n);
+
+    // Position x, y and velocity x, y, each from its own range of counters.
+    std::vector<Real> values(n);
+    for (int component = 0; component < 4; ++component) {
+        const bool position = component < 2;
+        fillUniform<Real>(member.seed, EnsembleStream, uint64_t(component) * n, values.data(), n,
+                          position ? Real(-1) : Real(-0.01), position ? Real(1) : Real(0.01));
+        for (std::size_t i = 0; i < n; ++i) {
+            (position ? table.positions[i] : table.velocities[i])[component % 2] = values[i];
+        }
+    }
+    for (std::size_t i = 0; i < n; ++i) {
+        table.masses[i] = i % 2 == 0 ? Real(1) : Real(member.massRatio);
+    }
+    return table;
+}
+
+EnsembleResult runMember(std::size_t index, const EnsembleMember &member) {
+    const auto start = std::chrono::steady_clock::now();
+    Simulation simulation;
+    simulation.setSeed(member.seed);
+    simulation.setParticleRadius(Real(member.particleRadius));
+    simulation.setBoundary(Real(member.boundary));
+    simulation.setIterations(member.iterations);
+    simulation.setGravity(glm::vec<3, Real>(Real(member.gravity.x), Real(member.gravity.y), Real(member.gravity.z)));
+    simulation.addParticles(memberParticles(member).arrays());
+
+    EnsembleResult result;
+    result.member = index;
+    result.parameters = member;
+    result.initialEnergy = double(simulation.kineticEnergy());
+    for (uint32_t step = 0; step < member.steps; ++step) {
+        simulation.simulate(Real(member.dt));
+    }
+    result.particleCount = simulation.getParticleCount();
+    result.steps = simulation.getStepCount();
+    result.simulatedTime = simulation.getTime();
+    result.finalEnergy = double(simulation.kineticEnergy());
+    result.stateHash = simulation.stateHash();
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+/**
+ * Runs members that share dt, steps and iterations together, one per lane.
+ */
+void runBatch(const std::vector<std::size_t> &lanes, const std::vector<EnsembleMember> &members,
+              std::vector<EnsembleResult> &results) {
+    const auto start = std::chrono::steady_clock::now();
+    std::size_t capacity = 0;
+    for (std::size_t m : lanes) {
+        capacity = std::max(capacity, members[m].particles);
+    }
+    Batch batch(capacity);
+    const EnsembleMember &first = members[lanes[0]];
+    batch.setIterations(first.iterations);
+    for (std::size_t l = 0; l < lanes.size(); ++l) {
+        const EnsembleMember &member = members[lanes[l]];
+        batch.setScene(int(l), memberParticles(member).arrays(), Real(member.particleRadius), Real(member.boundary),
+                       glm::vec<3, Real>(Real(member.gravity.x), Real(member.gravity.y), Real(member.gravity.z)));
+        results[lanes[l]].initialEnergy = double(batch.kineticEnergy(int(l)));
+    }
+    for (uint32_t step = 0; step < first.steps; ++step) {
+        batch.simulate(Real(first.dt));
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (std::size_t l = 0; l < lanes.size(); ++l) {
+        EnsembleResult &result = results[lanes[l]];
+        result.member = lanes[l];
+        result.parameters = members[lanes[l]];
+        result.particleCount = batch.getParticleCount(int(l));
+        result.steps = batch.getStepCount();
+        result.simulatedTime = batch.getTime();
+        result.finalEnergy = double(batch.kineticEnergy(int(l)));
+        result.stateHash = batch.stateHash(int(l));
+        result.seconds = seconds / double(lanes.size());
+    }
+}
+
+std::ofstream openCsv(const std::string &path) {
+    std::ofstream file(path, std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("ERROR::ENSEMBLE::CANNOT_WRITE " + path);
+    }
+    file.precision(17);
+    return file;
+}
+
+}
+
+/**
+ * Builds the cartesian product of the given values, seedsPerPoint members per combination.
+ */
+std::vector<EnsembleMember> ensembleGrid(const EnsembleMember &base, const std::vector<std::size_t> &particleCounts,
+                                         const std::vector<double> &timesteps, const std::vector<double> &massRatios,
+                                         unsigned seedsPerPoint) {
+    std::vector<EnsembleMember> members;
+    for (std::size_t particles : particleCounts) {
+        for (double dt : timesteps) {
+            for (double massRatio : massRatios) {
+                for (unsigned s = 0; s < seedsPerPoint; ++s) {
+                    EnsembleMember member = base;
+                    member.particles = particles;
+                    member.dt = dt;
+                    member.massRatio = massRatio;
+                    member.seed = mix64(base.seed + members.size());
+                    members.push_back(member);
+                }
+            }
+        }
+    }
+    return members;
+}
+
+/**
+ * Runs every member to completion and returns their results in member order.
+ * @param members The members to run.
+ * @param pool Threads to run members on, or null to run them one after another.
+ */
+std::vector<EnsembleResult> runEnsemble(const std::vector<EnsembleMember> &members, ThreadPool *pool, bool lockstep) {
+    // A task is one member, or in lockstep mode a batch of up to kLockstepLanes small members
+    // sorted by size, so that lanes of one batch do similar amounts of work.
+    std::vector<std::size_t> order(members.size());
+    std::iota(order.begin(), order.end(), std::size_t(0));
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        const EnsembleMember &x = members[a];
+        const EnsembleMember &y = members[b];
+        return std::make_tuple(x.dt, x.steps, x.iterations, x.particles) <
+               std::make_tuple(y.dt, y.steps, y.iterations, y.particles);
+    });
+    std::vector<std::vector<std::size_t> > tasks;
+    for (std::size_t m : order) {
+        const EnsembleMember &member = members[m];
+        if (lockstep && member.particles <= kLockstepParticles && !tasks.empty() &&
+            tasks.back().size() < std::size_t(kLockstepLanes) && members[tasks.back()[0]].particles <= kLockstepParticles) {
+            const EnsembleMember &first = members[tasks.back()[0]];
+            if (first.dt == member.dt && first.steps == member.steps && first.iterations == member.iterations) {
+                tasks.back().push_back(m);
+                continue;
+            }
+        }
+        tasks.push_back(std::vector<std::size_t>(1, m));
+    }
+
+    // Longest tasks first: threads claim tasks dynamically, so the short ones at the end fill the
+    // gaps the long ones leave.
+    auto cost = [&](const std::vector<std::size_t> &task) {
+        const EnsembleMember &member = members[task.back()];
+        const bool batched = lockstep && member.particles <= kLockstepParticles;
+        return double(member.particles) * member.steps * member.iterations * (batched ? double(member.particles) : 1.0);
+    };
+    std::stable_sort(tasks.begin(), tasks.end(), [&](const std::vector<std::size_t> &a, const std::vector<std::size_t> &b) {
+        return cost(a) > cost(b);
+    });
+
+    std::vector<EnsembleResult> results(members.size());
+    auto runTask = [&](const std::vector<std::size_t> &task) {
+        if (lockstep && members[task[0]].particles <= kLockstepParticles) {
+            runBatch(task, members, results);
+        } else {
+            results[task[0]] = runMember(task[0], members[task[0]]);
+        }
+    };
+    if (pool == nullptr || pool->size() == 1) {
+        for (const std::vector<std::size_t> &task : tasks) {
+            runTask(task);
+        }
+    } else {
+        pool->run(tasks.size(), [&](std::size_t chunk, unsigned) { runTask(tasks[chunk]); });
+    }
+    return results;
+}
+
+/**
+ * Writes one CSV row per member.
+ */
+void writeEnsembleResults(const std::string &path, const std::vector<EnsembleResult> &results) {
+    std::ofstream file = openCsv(path);
+    file << "member,seed,particles,dt,mass_ratio,steps,time,initial_energy,final_energy,state_hash,seconds\n";
+    for (const EnsembleResult &result : results) {
+        const EnsembleMember &member = result.parameters;
+        file << result.member << ',' << member.seed << ',' << result.particleCount << ',' << member.dt << ','
+             << member.massRatio << ',' << result.steps << ',' << result.simulatedTime << ',' << result.initialEnergy
+             << ',' << result.finalEnergy << ',' << result.stateHash << ',' << result.seconds << '\n';
+    }
+    if (!file) {
+        throw std::runtime_error("ERROR::ENSEMBLE::CANNOT_WRITE " + path);
+    }
+}
+
+/**
+ * Writes one CSV row per combination of particle count, dt and mass ratio.
+ */
+void writeEnsembleSummary(const std::string &path, const std::vector<EnsembleResult> &results) {
+    struct Group {
+        std::size_t members = 0;
+        double energy = 0.0, energySquares = 0.0;
+        double ratio = 0.0, ratioSquares = 0.0; // Final over initial kinetic energy
+        double seconds = 0.0;
+    };
+    std::map<std::tuple<std::size_t, double, double>, Group> groups;
+    for (const EnsembleResult &result : results) {
+        Group &group = groups[std::make_tuple(result.parameters.particles, result.parameters.dt, result.parameters.massRatio)];
+        const double ratio = result.initialEnergy > 0.0 ? result.finalEnergy / result.initialEnergy : 0.0;
+        ++group.members;
+        group.energy += result.finalEnergy;
+        group.energySquares += result.finalEnergy * result.finalEnergy;
+        group.ratio += ratio;
+        group.ratioSquares += ratio * ratio;
+        group.seconds += result.seconds;
+    }
+
+    auto deviation = [](double sum, double squares, std::size_t n) {
+        const double mean = sum / double(n);
+        return n > 1 ? std::sqrt(std::max(0.0, (squares - double(n) * mean * mean) / double(n - 1))) : 0.0;
+    };
+    std::ofstream file = openCsv(path);
+    file << "particles,dt,mass_ratio,members,final_energy_mean,final_energy_stddev,energy_ratio_mean,"
+            "energy_ratio_stddev,seconds_mean\n";
+    for (const auto &entry : groups) {
+        const Group &group = entry.second;
+        const double n = double(group.members);
+        file << std::get<0>(entry.first) << ',' << std::get<1>(entry.first) << ',' << std::get<2>(entry.first) << ','
+             << group.members << ',' << group.energy / n << ',' << deviation(group.energy, group.energySquares, group.members)
+             << ',' << group.ratio / n << ',' << deviation(group.ratio, group.ratioSquares, group.members) << ','
+             << group.seconds / n << '\n';
+    }
+    if (!file) {
+        throw std::runtime_error("ERROR::ENSEMBLE::CANNOT_WRITE " + path);
+    }
+}
@@ -0,0 +1,486 @@
+//
+// Binary VTK, VTU and PLY files of the particle state for ParaView and other visualisation tools.
+//
+
+#include "Export.hpp"
+#include "ByteOrder.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <climits>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+// Particles encoded as one unit of parallel work.
+const std::size_t kExportGrain = 65536;
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// What one property of a point is and how it is stored.
+enum class PropertyKind {
+    Vector, // Three floats from a column of up to three components
+    Scalar, // One float
+    Color, // Three unsigned bytes
+    LegacyVertex, // Legacy VTK vertex cell: int32 1, int32 index
+    Connectivity, // Int64 index
+    Offset, // Int64 index + 1
+    CellType // UInt8 1, VTK_VERTEX
+};
+
+struct Property {
+    PropertyKind kind;
+    const SnapshotColumn *column = nullptr;
+};
+
+// One part of the file: fixed bytes, then elementBytes per particle made of properties.
+struct Section {
+    std::string text;
+    std::vector<Property> properties;
+    std::size_t elementBytes = 0;
+};
+
+// How values are written.
+struct Encoding {
+    bool wide; // Float64 rather than Float32
+    bool bigEndian;
+};
+
+/**
+ * Reads component k of element i of a column in host byte order.
+ */
+double hostComponent(const SnapshotColumn &column, std::size_t i, uint32_t k) {
+    const unsigned char *p = static_cast<const unsigned char *>(column.data) + i * column.elementBytes();
+    switch (column.scalar) {
+        case ScalarCode::Float32: {
+            float value;
+            std::memcpy(&value, p + 4 * k, sizeof(value));
+            return value;
+        }
+        case ScalarCode::Float64: {
+            double value;
+            std::memcpy(&value, p + 8 * k, sizeof(value));
+            return value;
+        }
+        case ScalarCode::Fixed32: {
+            int32_t value;
+            std::memcpy(&value, p + 4 * k, sizeof(value));
+            return double(value) / double(uint64_t(1) << column.fractionBits);
+        }
+    }
+    return 0.0;
+}
+
+unsigned char *putBits(unsigned char *out, uint64_t bits, int bytes, bool bigEndian) {
+    for (int b = 0; b < bytes; ++b) {
+        out[bigEndian ? bytes - 1 - b : b] = (unsigned char) (bits >> (8 * b));
+    }
+    return out + bytes;
+}
+
+unsigned char *putReal(unsigned char *out, double value, const Encoding &encoding) {
+    if (encoding.wide) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return putBits(out, bits, 8, encoding.bigEndian);
+    }
+    float single = float(value);
+    uint32_t bits;
+    std::memcpy(&bits, &single, sizeof(bits));
+    return putBits(out, bits, 4, encoding.bigEndian);
+}
+
+std::size_t propertyBytes(PropertyKind kind, const Encoding &encoding) {
+    const std::size_t real = encoding.wide ? 8 : 4;
+    switch (kind) {
+        case PropertyKind::Vector: return 3 * real;
+        case PropertyKind::Scalar: return real;
+        case PropertyKind::Color: return 3;
+        case PropertyKind::LegacyVertex: return 8;
+        case PropertyKind::Connectivity: return 8;
+        case PropertyKind::Offset: return 8;
+        case PropertyKind::CellType: return 1;
+    }
+    return 0;
+}
+
+unsigned char *encodeProperty(const Property &property, std::size_t i, const Encoding &encoding, unsigned char *out) {
+    switch (property.kind) {
+        case PropertyKind::Vector:
+            for (uint32_t k = 0; k < 3; ++k) {
+                out = putReal(out, k < property.column->components ? hostComponent(*property.column, i, k) : 0.0, encoding);
+            }
+            return out;
+        case PropertyKind::Scalar:
+            return putReal(out, hostComponent(*property.column, i, 0), encoding);
+        case PropertyKind::Color:
+            for (uint32_t k = 0; k < 3; ++k) {
+                double channel = k < property.column->components ? hostComponent(*property.column, i, k) : 0.0;
+                *out++ = (unsigned char) std::lround(std::min(1.0, std::max(0.0, channel)) * 255.0);
+            }
+            return out;
+        case PropertyKind::LegacyVertex:
+            out = putBits(out, 1, 4, encoding.bigEndian);
+            return putBits(out, uint64_t(i), 4, encoding.bigEndian);
+        case PropertyKind::Connectivity:
+            return putBits(out, uint64_t(i), 8, encoding.bigEndian);
+        case PropertyKind::Offset:
+            return putBits(out, uint64_t(i + 1), 8, encoding.bigEndian);
+        case PropertyKind::CellType:
+            *out = 1;
+            return out + 1;
+    }
+    return out;
+}
+
+Section section(const std::string &text, std::vector<Property> properties, const Encoding &encoding) {
+    Section result;
+    result.text = text;
+    result.properties = std::move(properties);
+    for (const Property &property : result.properties) {
+        result.elementBytes += propertyBytes(property.kind, encoding);
+    }
+    return result;
+}
+
+// The attribute columns an export stores; null where absent or not asked for.
+struct Attributes {
+    const SnapshotColumn *position = nullptr;
+    const SnapshotColumn *velocity = nullptr;
+    const SnapshotColumn *mass = nullptr;
+    const SnapshotColumn *color = nullptr;
+};
+
+Attributes chooseAttributes(const std::vector<SnapshotColumn> &columns, uint32_t mask) {
+    Attributes chosen;
+    for (const SnapshotColumn &column : columns) {
+        const bool wanted = (mask & trajectoryAttribute(column.id)) != 0;
+        switch (column.id) {
+            case SnapshotColumnId::Position: chosen.position = &column; break;
+            case SnapshotColumnId::Velocity: chosen.velocity = wanted ? &column : nullptr; break;
+            case SnapshotColumnId::Mass: chosen.mass = wanted ? &column : nullptr; break;
+            case SnapshotColumnId::Color: chosen.color = wanted ? &column : nullptr; break;
+            default: break;
+        }
+    }
+    if (chosen.position == nullptr) {
+        throw std::runtime_error("ERROR::EXPORT::MISSING_POSITIONS");
+    }
+    return chosen;
+}
+
+std::vector<Section> legacySections(uint64_t count, const Attributes &attributes, const Encoding &encoding) {
+    if (count > uint64_t(INT32_MAX) / 2) {
+        throw std::runtime_error("ERROR::EXPORT::TOO_MANY_POINTS_FOR_LEGACY_VTK");
+    }
+    const std::string real = encoding.wide ? "double" : "float";
+    const std::string n = std::to_string(count);
+    std::vector<Section> sections;
+    sections.push_back(section("# vtk DataFile Version 3.0\nparticles\nBINARY\nDATASET POLYDATA\nPOINTS " + n + " " + real + "\n",
+                               {{PropertyKind::Vector, attributes.position}}, encoding));
+    sections.push_back(section("\nVERTICES " + n + " " + std::to_string(2 * count) + "\n",
+                               {{PropertyKind::LegacyVertex}}, encoding));
+    std::string pointData = "\nPOINT_DATA " + n + "\n";
+    if (attributes.velocity != nullptr) {
+        sections.push_back(section(pointData + "VECTORS velocity " + real + "\n",
+                                   {{PropertyKind::Vector, attributes.velocity}}, encoding));
+        pointData = "\n";
+    }
+    if (attributes.mass != nullptr) {
+        sections.push_back(section(pointData + "SCALARS mass " + real + " 1\nLOOKUP_TABLE default\n",
+                                   {{PropertyKind::Scalar, attributes.mass}}, encoding));
+        pointData = "\n";
+    }
+    if (attributes.color != nullptr) {
+        sections.push_back(section(pointData + "COLOR_SCALARS color 3\n",
+                                   {{PropertyKind::Color, attributes.color}}, encoding));
+    }
+    sections.push_back(section("\n", {}, encoding));
+    return sections;
+}
+
+std::vector<Section> vtuSections(uint64_t count, const Attributes &attributes, const Encoding &encoding) {
+    struct Array {
+        const char *group;
+        const char *type;
+        const char *name;
+        int components;
+        Property property;
+    };
+    const char *real = encoding.wide ? "Float64" : "Float32";
+    std::vector<Array> arrays;
+    arrays.push_back({"Points", real, "position", 3, {PropertyKind::Vector, attributes.position}});
+    if (attributes.velocity != nullptr) {
+        arrays.push_back({"PointData", real, "velocity", 3, {PropertyKind::Vector, attributes.velocity}});
+    }
+    if (attributes.mass != nullptr) {
+        arrays.push_back({"PointData", real, "mass", 1, {PropertyKind::Scalar, attributes.mass}});
+    }
+    if (attributes.color != nullptr) {
+        arrays.push_back({"PointData", "UInt8", "color", 3, {PropertyKind::Color, attributes.color}});
+    }
+    arrays.push_back({"Cells", "Int64", "connectivity", 1, {PropertyKind::Connectivity}});
+    arrays.push_back({"Cells", "Int64", "offsets", 1, {PropertyKind::Offset}});
+    arrays.push_back({"Cells", "UInt8", "types", 1, {PropertyKind::CellType}});
+
+    // Every appended array is a UInt64 byte count followed by the bytes.
+    std::vector<uint64_t> offsets;
+    uint64_t offset = 0;
+    for (const Array &array : arrays) {
+        offsets.push_back(offset);
+        offset += 8 + count * propertyBytes(array.property.kind, encoding);
+    }
+
+    std::ostringstream xml;
+    xml << "<?xml version=\"1.0\"?>\n"
+        << "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\""
+        << (encoding.bigEndian ? "BigEndian" : "LittleEndian") << "\" header_type=\"UInt64\">\n"
+        << "  <UnstructuredGrid>\n"
+        << "    <Piece NumberOfPoints=\"" << count << "\" NumberOfCells=\"" << count << "\">\n";
+    for (const char *group : {"PointData", "Points", "Cells"}) {
+        xml << "      <" << group << ">\n";
+        for (std::size_t a = 0; a < arrays.size(); ++a) {
+            if (std::strcmp(arrays[a].group, group) == 0) {
+                xml << "        <DataArray type=\"" << arrays[a].type << "\" Name=\"" << arrays[a].name
+                    << "\" NumberOfComponents=\"" << arrays[a].components
+                    << "\" format=\"appended\" offset=\"" << offsets[a] << "\"/>\n";
+            }
+        }
+        xml << "      </" << group << ">\n";
+    }
+    xml << "    </Piece>\n"
+        << "  </UnstructuredGrid>\n"
+        << "  <AppendedData encoding=\"raw\">\n"
+        << "   _";
+
+    std::vector<Section> sections;
+    for (std::size_t a = 0; a < arrays.size(); ++a) {
+        unsigned char size[8];
+        putBits(size, count * propertyBytes(arrays[a].property.kind, encoding), 8, encoding.bigEndian);
+        std::string text = a == 0 ? xml.str() : std::string();
+        text.append(reinterpret_cast<const char *>(size), sizeof(size));
+        sections.push_back(section(text, {arrays[a].property}, encoding));
+    }
+    sections.push_back(section("\n  </AppendedData>\n</VTKFile>\n", {}, encoding));
+    return sections;
+}
+
+std::vector<Section> plySections(uint64_t count, const Attributes &attributes, const Encoding &encoding) {
+    const std::string real = encoding.wide ? "double" : "float";
+    std::string header = std::string("ply\nformat ") + (encoding.bigEndian ? "binary_big_endian" : "binary_little_endian") +
+                         " 1.0\nelement vertex " + std::to_string(count) + "\n";
+    std::vector<Property> record;
+    header += "property " + real + " x\nproperty " + real + " y\nproperty " + real + " z\n";
+    record.push_back({PropertyKind::Vector, attributes.position});
+    if (attributes.velocity != nullptr) {
+        header += "property " + real + " vx\nproperty " + real + " vy\nproperty " + real + " vz\n";
+        record.push_back({PropertyKind::Vector, attributes.velocity});
+    }
+    if (attributes.mass != nullptr) {
+        header += "property " + real + " mass\n";
+        record.push_back({PropertyKind::Scalar, attributes.mass});
+    }
+    if (attributes.color != nullptr) {
+        header += "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+        record.push_back({PropertyKind::Color, attributes.color});
+    }
+    header += "end_header\n";
+    return {section(header, record, encoding)};
+}
+
+/**
+ * Writes every buffer in order from the start of the file, in as few pwritev calls as the
+ * system's iovec limit allows.
+ */
+void writeGathered(int fd, std::vector<struct iovec> &buffers, const std::string &path) {
+    std::size_t next = 0;
+    off_t offset = 0;
+    while (next < buffers.size()) {
+        const int batch = int(std::min<std::size_t>(buffers.size() - next, IOV_MAX));
+        ssize_t written = ::pwritev(fd, &buffers[next], batch, offset);
+        if (written < 0) {
+            throw std::runtime_error("ERROR::EXPORT::WRITE_FAILED " + path);
+        }
+        offset += written;
+        // Skip what was written, including part of a buffer after a short write.
+        std::size_t remaining = std::size_t(written);
+        while (next < buffers.size() && remaining >= buffers[next].iov_len) {
+            remaining -= buffers[next].iov_len;
+            ++next;
+        }
+        if (next < buffers.size()) {
+            buffers[next].iov_base = static_cast<char *>(buffers[next].iov_base) + remaining;
+            buffers[next].iov_len -= remaining;
+        }
+    }
+}
+
+}
+
+/**
+ * Returns the format matching the extension of path.
+ */
+ExportFormat exportFormatFor(const std::string &path) {
+    const std::size_t dot = path.rfind('.');
+    std::string extension = dot == std::string::npos ? std::string() : path.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+                   [](char c) { return char(std::tolower((unsigned char) c)); });
+    if (extension == "vtk") {
+        return ExportFormat::Vtk;
+    }
+    if (extension == "vtu") {
+        return ExportFormat::Vtu;
+    }
+    if (extension == "ply") {
+        return ExportFormat::Ply;
+    }
+    throw std::runtime_error("ERROR::EXPORT::UNKNOWN_EXTENSION " + path);
+}
+
+/**
+ * Writes particles to an export file, encoding chunks of particles in parallel.
+ * @param path The file to write.
+ * @param particleCount The number of particles.
+ * @param columns The particle attributes in host byte order.
+ * @param options The format and the attributes to store.
+ * @param pool Threads to encode with, or null.
+ */
+void exportParticles(const std::string &path, uint64_t particleCount, const std::vector<SnapshotColumn> &columns,
+                     const ExportOptions &options, ThreadPool *pool) {
+    const Attributes attributes = chooseAttributes(columns, options.attributes);
+    const std::size_t count = std::size_t(particleCount);
+
+    std::vector<Section> sections;
+    Encoding encoding{options.doublePrecision, !hostIsLittleEndian()};
+    switch (options.format) {
+        case ExportFormat::Vtk:
+            encoding.bigEndian = true;
+            sections = legacySections(particleCount, attributes, encoding);
+            break;
+        case ExportFormat::Vtu:
+            sections = vtuSections(particleCount, attributes, encoding);
+            break;
+        case ExportFormat::Ply:
+            sections = plySections(particleCount, attributes, encoding);
+            break;
+    }
+
+    // Every section with per-particle data gets one buffer per chunk of particles.
+    const std::size_t chunkCount = (count + kExportGrain - 1) / kExportGrain;
+    std::vector<std::vector<std::vector<unsigned char> > > buffers(sections.size());
+    std::vector<std::pair<std::size_t, std::size_t> > jobs;
+    for (std::size_t s = 0; s < sections.size(); ++s) {
+        if (sections[s].elementBytes > 0) {
+            buffers[s].resize(chunkCount);
+            for (std::size_t c = 0; c < chunkCount; ++c) {
+                jobs.emplace_back(s, c);
+            }
+        }
+    }
+    parallelFor(pool, jobs.size(), 1, [&](std::size_t first, std::size_t last, unsigned) {
+        for (std::size_t j = first; j < last; ++j) {
+            const Section &part = sections[jobs[j].first];
+            const std::size_t begin = jobs[j].second * kExportGrain;
+            const std::size_t end = std::min(count, begin + kExportGrain);
+            std::vector<unsigned char> &buffer = buffers[jobs[j].first][jobs[j].second];
+            buffer.resize((end - begin) * part.elementBytes);
+            unsigned char *out = buffer.data();
+            for (std::size_t i = begin; i < end; ++i) {
+                for (const Property &property : part.properties) {
+                    out = encodeProperty(property, i, encoding, out);
+                }
+            }
+        }
+    });
+
+    std::vector<struct iovec> gathered;
+    for (std::size_t s = 0; s < sections.size(); ++s) {
+        if (!sections[s].text.empty()) {
+            gathered.push_back({const_cast<char *>(sections[s].text.data()), sections[s].text.size()});
+        }
+        for (std::vector<unsigned char> &buffer : buffers[s]) {
+            gathered.push_back({buffer.data(), buffer.size()});
+        }
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::EXPORT::CANNOT_OPEN_FOR_WRITING " + path);
+    }
+    try {
+        writeGathered(fd, gathered, path);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::close(fd) != 0) {
+        throw std::runtime_error("ERROR::EXPORT::WRITE_FAILED " + path);
+    }
+}
+
+/**
+ * @param directory Where the frames and the index go.
+ * @param prefix The name of the index and the start of the frame names.
+ * @param options The attributes to store; the format is always VTU.
+ * @param stride Export after every stride-th call to simulate().
+ */
+ExportSeries::ExportSeries(const std::string &directory, const std::string &prefix, const ExportOptions &options,
+                           unsigned stride)
+        : directory(directory), prefix(prefix), options(options), stride(stride) {
+    this->options.format = ExportFormat::Vtu;
+}
+
+/**
+ * Writes one frame and rewrites the index to include it.
+ * @return The path of the frame.
+ */
+std::string ExportSeries::write(uint64_t step, double time, uint64_t particleCount,
+                                const std::vector<SnapshotColumn> &columns, ThreadPool *pool) {
+    char name[64];
+    std::snprintf(name, sizeof(name), "_%010llu.vtu", (unsigned long long) step);
+    const std::string file = prefix + name;
+    const std::string path = directory + "/" + file;
+    exportParticles(path, particleCount, columns, options, pool);
+    frames.emplace_back(time, file);
+    writeIndex();
+    return path;
+}
+
+/**
+ * Writes the .pvd index of every frame so far, replacing the previous one atomically.
+ */
+void ExportSeries::writeIndex() const {
+    const std::string path = getIndexPath();
+    const std::string temporary = path + ".tmp";
+    {
+        std::ofstream index(temporary, std::ios::trunc);
+        if (!index) {
+            throw std::runtime_error("ERROR::EXPORT::CANNOT_OPEN_FOR_WRITING " + temporary);
+        }
+        index.precision(17);
+        index << "<?xml version=\"1.0\"?>\n"
+              << "<VTKFile type=\"Collection\" version=\"0.1\">\n"
+              << "  <Collection>\n";
+        for (const std::pair<double, std::string> &frame : frames) {
+            index << "    <DataSet timestep=\"" << frame.first << "\" part=\"0\" file=\"" << frame.second << "\"/>\n";
+        }
+        index << "  </Collection>\n"
+              << "</VTKFile>\n";
+        if (!index) {
+            throw std::runtime_error("ERROR::EXPORT::WRITE_FAILED " + temporary);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("ERROR::EXPORT::WRITE_FAILED " + path);
+    }
+}
@@ -0,0 +1,315 @@
+//
+// In-window performance overlay: frame-time graph, timing split and simulation statistics.
+//
+
+#include "Hud.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <glm/glm/gtc/matrix_transform.hpp>
+
+namespace {
+
+/**
+ * 5x7 glyphs of ASCII 32 to 126, one byte per column from the left, bit 0 at the top.
+ */
+const uint8_t kFont[95][5] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x5F, 0x00, 0x00}, {0x00, 0x07, 0x00, 0x07, 0x00},
+    {0x14, 0x7F, 0x14, 0x7F, 0x14}, {0x24, 0x2A, 0x7F, 0x2A, 0x12}, {0x23, 0x13, 0x08, 0x64, 0x62},
+    {0x36, 0x49, 0x56, 0x20, 0x50}, {0x00, 0x05, 0x03, 0x00, 0x00}, {0x00, 0x1C, 0x22, 0x41, 0x00},
+    {0x00, 0x41, 0x22, 0x1C, 0x00}, {0x2A, 0x1C, 0x7F, 0x1C, 0x2A}, {0x08, 0x08, 0x3E, 0x08, 0x08},
+    {0x00, 0x50, 0x30, 0x00, 0x00}, {0x08, 0x08, 0x08, 0x08, 0x08}, {0x00, 0x60, 0x60, 0x00, 0x00},
+    {0x20, 0x10, 0x08, 0x04, 0x02}, {0x3E, 0x51, 0x49, 0x45, 0x3E}, {0x00, 0x42, 0x7F, 0x40, 0x00},
+    {0x42, 0x61, 0x51, 0x49, 0x46}, {0x21, 0x41, 0x45, 0x4B, 0x31}, {0x18, 0x14, 0x12, 0x7F, 0x10},
+    {0x27, 0x45, 0x45, 0x45, 0x39}, {0x3C, 0x4A, 0x49, 0x49, 0x30}, {0x01, 0x71, 0x09, 0x05, 0x03},
+    {0x36, 0x49, 0x49, 0x49, 0x36}, {0x06, 0x49, 0x49, 0x29, 0x1E}, {0x00, 0x36, 0x36, 0x00, 0x00},
+    {0x00, 0x56, 0x36, 0x00, 0x00}, {0x08, 0x14, 0x22, 0x41, 0x00}, {0x14, 0x14, 0x14, 0x14, 0x14},
+    {0x00, 0x41, 0x22, 0x14, 0x08}, {0x02, 0x01, 0x51, 0x09, 0x06}, {0x32, 0x49, 0x79, 0x41, 0x3E},
+    {0x7E, 0x11, 0x11, 0x11, 0x7E}, {0x7F, 0x49, 0x49, 0x49, 0x36}, {0x3E, 0x41, 0x41, 0x41, 0x22},
+    {0x7F, 0x41, 0x41, 0x22, 0x1C}, {0x7F, 0x49, 0x49, 0x49, 0x41}, {0x7F, 0x09, 0x09, 0x09, 0x01},
+    {0x3E, 0x41, 0x49, 0x49, 0x7A}, {0x7F, 0x08, 0x08, 0x08, 0x7F}, {0x00, 0x41, 0x7F, 0x41, 0x00},
+    {0x20, 0x40, 0x41, 0x3F, 0x01}, {0x7F, 0x08, 0x14, 0x22, 0x41}, {0x7F, 0x40, 0x40, 0x40, 0x40},
+    {0x7F, 0x02, 0x0C, 0x02, 0x7F}, {0x7F, 0x04, 0x08, 0x10, 0x7F}, {0x3E, 0x41, 0x41, 0x41, 0x3E},
+    {0x7F, 0x09, 0x09, 0x09, 0x06}, {0x3E, 0x41, 0x51, 0x21, 0x5E}, {0x7F, 0x09, 0x19, 0x29, 0x46},
+    {0x46, 0x49, 0x49, 0x49, 0x31}, {0x01, 0x01, 0x7F, 0x01, 0x01}, {0x3F, 0x40, 0x40, 0x40, 0x3F},
+    {0x1F, 0x20, 0x40, 0x20, 0x1F}, {0x3F, 0x40, 0x38, 0x40, 0x3F}, {0x63, 0x14, 0x08, 0x14, 0x63},
+    {0x07, 0x08, 0x70, 0x08, 0x07}, {0x61, 0x51, 0x49, 0x45, 0x43}, {0x00, 0x7F, 0x41, 0x41, 0x00},
+    {0x02, 0x04, 0x08, 0x10, 0x20}, {0x00, 0x41, 0x41, 0x7F, 0x00}, {0x04, 0x02, 0x01, 0x02, 0x04},
+    {0x40, 0x40, 0x40, 0x40, 0x40}, {0x00, 0x01, 0x02, 0x04, 0x00}, {0x20, 0x54, 0x54, 0x54, 0x78},
+    {0x7F, 0x48, 0x44, 0x44, 0x38}, {0x38, 0x44, 0x44, 0x44, 0x20}, {0x38, 0x44, 0x44, 0x48, 0x7F},
+    {0x38, 0x54, 0x54, 0x54, 0x18}, {0x08, 0x7E, 0x09, 0x01, 0x02}, {0x0C, 0x52, 0x52, 0x52, 0x3E},
+    {0x7F, 0x08, 0x04, 0x04, 0x78}, {0x00, 0x44, 0x7D, 0x40, 0x00}, {0x20, 0x40, 0x44, 0x3D, 0x00},
+    {0x7F, 0x10, 0x28, 0x44, 0x00}, {0x00, 0x41, 0x7F, 0x40, 0x00}, {0x7C, 0x04, 0x18, 0x04, 0x78},
+    {0x7C, 0x08, 0x04, 0x04, 0x78}, {0x38, 0x44, 0x44, 0x44, 0x38}, {0x7C, 0x14, 0x14, 0x14, 0x08},
+    {0x08, 0x14, 0x14, 0x18, 0x7C}, {0x7C, 0x08, 0x04, 0x04, 0x08}, {0x48, 0x54, 0x54, 0x54, 0x20},
+    {0x04, 0x3F, 0x44, 0x40, 0x20}, {0x3C, 0x40, 0x40, 0x20, 0x7C}, {0x1C, 0x20, 0x40, 0x20, 0x1C},
+    {0x3C, 0x40, 0x30, 0x40, 0x3C}, {0x44, 0x28, 0x10, 0x28, 0x44}, {0x0C, 0x50, 0x50, 0x50, 0x3C},
+    {0x44, 0x64, 0x54, 0x4C, 0x44}, {0x00, 0x08, 0x36, 0x41, 0x00}, {0x00, 0x00, 0x7F, 0x00, 0x00},
+    {0x00, 0x41, 0x36, 0x08, 0x00}, {0x08, 0x04, 0x08, 0x10, 0x08}
+};
+
+// The atlas is a grid of 6x8 cells, the glyphs in ASCII order and an opaque cell last.
+const int kCellWidth = 6;
+const int kCellHeight = 8;
+const int kAtlasColumns = 16;
+const int kAtlasRows = 6;
+const int kAtlasWidth = kAtlasColumns * kCellWidth;
+const int kAtlasHeight = kAtlasRows * kCellHeight;
+const int kSolidCell = 95;
+
+const float kScale = 2.0f; // Screen pixels per atlas texel
+const float kLineHeight = (kCellHeight + 1) * kScale;
+const float kMargin = 8.0f;
+const float kPadding = 6.0f;
+const float kBarWidth = 2.0f;
+const float kGraphHeight = 80.0f;
+const double kGraphSeconds = 0.050; // Frame time at the top of the graph
+const int kAveragedFrames = 60;
+
+const uint32_t kBackground = 0x000000B0;
+const uint32_t kTextColor = 0xE0E0E0FF;
+const uint32_t kSimulateColor = 0xF0A030FF;
+const uint32_t kRenderColor = 0x60D060FF;
+const uint32_t kSwapColor = 0x6090E0FF;
+const uint32_t kGuideColor = 0xFFFFFF50;
+
+glm::vec2 cellCorner(int cell) {
+    return glm::vec2(float(cell % kAtlasColumns * kCellWidth) / kAtlasWidth,
+                     float(cell / kAtlasColumns * kCellHeight) / kAtlasHeight);
+}
+
+// Samples the middle of the opaque cell so filtering never reaches a glyph
+glm::vec2 solidTexel() {
+    return cellCorner(kSolidCell) + glm::vec2(0.5f * kCellWidth / kAtlasWidth, 0.5f * kCellHeight / kAtlasHeight);
+}
+
+/**
+ * Writes the four corners of a quad, clockwise from the top left.
+ */
+void fillQuad(HudVertex *corners, float x0, float y0, float x1, float y1, glm::vec2 uv0, glm::vec2 uv1,
+              uint32_t color) {
+    HudVertex vertex;
+    for (int c = 0; c < 4; ++c) {
+        vertex.color[c] = uint8_t(color >> (24 - 8 * c));
+    }
+    const float xs[4] = {x0, x1, x1, x0};
+    const float ys[4] = {y0, y0, y1, y1};
+    const float us[4] = {uv0.x, uv1.x, uv1.x, uv0.x};
+    const float vs[4] = {uv0.y, uv0.y, uv1.y, uv1.y};
+    for (int corner = 0; corner < 4; ++corner) {
+        vertex.position = glm::vec2(xs[corner], ys[corner]);
+        vertex.uv = glm::vec2(us[corner], vs[corner]);
+        corners[corner] = vertex;
+    }
+}
+
+}
+
+/**
+ * Constructor: compiles the overlay shader, rasterizes the font into a one-channel atlas and
+ * allocates a vertex buffer for kMaxQuads quads with a fixed index buffer.
+ */
+Hud::Hud(const char *vertexPath, const char *fragmentPath) : shader(vertexPath, fragmentPath) {
+    std::vector<uint8_t> texels(kAtlasWidth * kAtlasHeight, 0);
+    for (int glyph = 0; glyph <= kSolidCell; ++glyph) {
+        const int left = glyph % kAtlasColumns * kCellWidth;
+        const int top = glyph / kAtlasColumns * kCellHeight;
+        for (int y = 0; y < kCellHeight; ++y) {
+            for (int x = 0; x < kCellWidth; ++x) {
+                const bool lit = glyph == kSolidCell || (x < 5 && ((kFont[glyph][x] >> y) & 1));
+                texels[(top + y) * kAtlasWidth + left + x] = lit ? 255 : 0;
+            }
+        }
+    }
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, kAtlasWidth, kAtlasHeight, 0, GL_RED, GL_UNSIGNED_BYTE, texels.data());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    std::vector<uint16_t> indices(kMaxQuads * 6);
+    for (int q = 0; q < kMaxQuads; ++q) {
+        const uint16_t first = uint16_t(q * 4);
+        const uint16_t corners[6] = {0, 1, 2, 2, 3, 0};
+        for (int i = 0; i < 6; ++i) {
+            indices[q * 6 + i] = uint16_t(first + corners[i]);
+        }
+    }
+
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, kMaxQuads * 4 * sizeof(HudVertex), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, position));
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(HudVertex), (void*)offsetof(HudVertex, uv));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(HudVertex), (void*)offsetof(HudVertex, color));
+    glEnableVertexAttribArray(2);
+    // The element buffer binding is part of the VAO, so unbind the VAO first
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    vertices.reserve(kMaxQuads * 4);
+}
+
+/**
+ * Destructor: deletes the atlas, buffers and shader program.
+ */
+Hud::~Hud() {
+    glDeleteTextures(1, &atlas);
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    glDeleteProgram(shader.ID);
+}
+
+void Hud::recordFrame(const FrameTimes &times) {
+    history[next] = times;
+    next = (next + 1) % kHistory;
+    recorded = std::min(recorded + 1, kHistory);
+}
+
+void Hud::quad(float x0, float y0, float x1, float y1, glm::vec2 uv0, glm::vec2 uv1, uint32_t color) {
+    if (vertices.size() + 4 > std::size_t(kMaxQuads) * 4) {
+        return;
+    }
+    vertices.resize(vertices.size() + 4);
+    fillQuad(&vertices[vertices.size() - 4], x0, y0, x1, y1, uv0, uv1, color);
+}
+
+void Hud::rect(float x0, float y0, float x1, float y1, uint32_t color) {
+    quad(x0, y0, x1, y1, solidTexel(), solidTexel(), color);
+}
+
+float Hud::text(float x, float y, const char *line, uint32_t color) {
+    const glm::vec2 cellSize(float(kCellWidth) / kAtlasWidth, float(kCellHeight) / kAtlasHeight);
+    for (const char *c = line; *c != '\0'; ++c, x += kCellWidth * kScale) {
+        if (*c <= ' ' || *c > '~') {
+            continue;
+        }
+        const glm::vec2 corner = cellCorner(*c - ' ');
+        quad(x, y, x + kCellWidth * kScale, y + kCellHeight * kScale, corner, corner + cellSize, color);
+    }
+    return x;
+}
+
+/**
+ * Rebuilds the overlay, uploads it into the orphaned vertex buffer and draws it with one call,
+ * blended over the scene with depth testing off.
+ */
+void Hud::draw(const HudStats &stats) {
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    // Averages over the recent frames, extremes over the whole graph
+    FrameTimes average;
+    const int averaged = std::min(recorded, kAveragedFrames);
+    for (int n = 0; n < averaged; ++n) {
+        average.simulate += ago(n).simulate / averaged;
+        average.render += ago(n).render / averaged;
+        average.swap += ago(n).swap / averaged;
+    }
+    double fastest = recorded > 0 ? ago(0).total() : 0.0;
+    double slowest = fastest;
+    for (int n = 1; n < recorded; ++n) {
+        fastest = std::min(fastest, ago(n).total());
+        slowest = std::max(slowest, ago(n).total());
+    }
+
+    vertices.clear();
+    rect(0, 0, 0, 0, kBackground); // Placeholder, sized once the content is laid out
+    const float left = kMargin + kPadding;
+    float y = kMargin + kPadding;
+    float right = left + kHistory * kBarWidth;
+    char line[96];
+
+    std::snprintf(line, sizeof(line), "%6.1f fps %7.2f ms  min %.2f  max %.2f", average.total() > 0.0 ? 1.0 / average.total() : 0.0,
+                  average.total() * 1e3, fastest * 1e3, slowest * 1e3);
+    right = std::max(right, text(left, y, line, kTextColor));
+    y += kLineHeight;
+
+    float x = left;
+    std::snprintf(line, sizeof(line), "sim %.2f", average.simulate * 1e3);
+    x = text(x, y, line, kSimulateColor);
+    std::snprintf(line, sizeof(line), "  render %.2f", average.render * 1e3);
+    x = text(x, y, line, kRenderColor);
+    std::snprintf(line, sizeof(line), "  swap %.2f ms", average.swap * 1e3);
+    right = std::max(right, text(x, y, line, kSwapColor));
+    y += kLineHeight;
+
+    std::snprintf(line, sizeof(line), "particles %zu  contacts %zu", stats.particles, stats.contacts);
+    right = std::max(right, text(left, y, line, kTextColor));
+    y += kLineHeight;
+
+    if (stats.gridCells > 0) {
+        std::snprintf(line, sizeof(line), "grid %zu cells of %.3g  %.2f/cell  %d searched", stats.gridCells,
+                      stats.cellSize, double(stats.particles) / double(stats.gridCells), stats.searchedCells);
+        right = std::max(right, text(left, y, line, kTextColor));
+        y += kLineHeight;
+    }
+
+    // Stacked bars, oldest on the left, with guides at 60 and 30 frames per second
+    y += kPadding;
+    const float bottom = y + kGraphHeight;
+    const float pixelsPerSecond = float(kGraphHeight / kGraphSeconds);
+    for (int n = 0; n < recorded; ++n) {
+        const FrameTimes &frame = ago(n);
+        const float x1 = left + (kHistory - n) * kBarWidth;
+        const float x0 = x1 - kBarWidth;
+        const double parts[3] = {frame.simulate, frame.render, frame.swap};
+        const uint32_t colors[3] = {kSimulateColor, kRenderColor, kSwapColor};
+        float top = bottom;
+        for (int p = 0; p < 3; ++p) {
+            const float height = std::min(float(parts[p]) * pixelsPerSecond, top - y);
+            if (height > 0.0f) {
+                rect(x0, top - height, x1, top, colors[p]);
+                top -= height;
+            }
+        }
+    }
+    rect(left, bottom - float(1.0 / 60.0) * pixelsPerSecond, left + kHistory * kBarWidth,
+         bottom - float(1.0 / 60.0) * pixelsPerSecond + 1.0f, kGuideColor);
+    rect(left, bottom - float(1.0 / 30.0) * pixelsPerSecond, left + kHistory * kBarWidth,
+         bottom - float(1.0 / 30.0) * pixelsPerSecond + 1.0f, kGuideColor);
+
+    // Now that the extent is known, size the background quad reserved at the start; it is written
+    // in place, so it is kept even when the content filled every other quad
+    fillQuad(vertices.data(), kMargin, kMargin, right + kPadding, bottom + kPadding, solidTexel(), solidTexel(),
+             kBackground);
+
+    const bool depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    shader.use();
+    shader.setMat4("projection", glm::ortho(0.0f, float(viewport[2]), float(viewport[3]), 0.0f));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    // Orphan last frame's storage so the upload never waits for the GPU to finish reading it
+    glBufferData(GL_ARRAY_BUFFER, kMaxQuads * 4 * sizeof(HudVertex), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(HudVertex), vertices.data());
+    glDrawElements(GL_TRIANGLES, GLsizei(vertices.size() / 4 * 6), GL_UNSIGNED_SHORT, (void*)0);
+
+    // unbind
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisable(GL_BLEND);
+    if (depthTest) {
+        glEnable(GL_DEPTH_TEST);
+    }
+}
@@ -0,0 +1,405 @@
+//
+// Loading initial conditions from CSV and raw binary files.
+//
+
+#include "Import.hpp"
+#include "ByteOrder.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+// Attributes a file can hold, one value each.
+enum Field { X, Y, Z, VX, VY, VZ, Mass, R, G, B, Ignored };
+
+// Bytes of text parsed as one unit of parallel work, at least.
+const std::size_t kMinChunkBytes = std::size_t(1) << 20;
+// Records converted as one unit of parallel work in raw files.
+const std::size_t kRawGrain = 65536;
+
+const double kPowersOfTen[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                               1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/**
+ * A whole file mapped read-only.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("ERROR::IMPORT::CANNOT_OPEN " + path);
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0) {
+            ::close(fd);
+            throw std::runtime_error("ERROR::IMPORT::CANNOT_OPEN " + path);
+        }
+        size = std::size_t(status.st_size);
+        if (size > 0) {
+            void *mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("ERROR::IMPORT::CANNOT_MAP " + path);
+            }
+            data = static_cast<const char *>(mapped);
+            ::madvise(mapped, size, MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    ~MappedFile() {
+        if (data != nullptr) {
+            ::munmap(const_cast<char *>(data), size);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data = nullptr;
+    std::size_t size = 0;
+};
+
+Field fieldNamed(std::string name) {
+    std::transform(name.begin(), name.end(), name.begin(), [](char c) { return char(std::tolower((unsigned char) c)); });
+    static const char *const names[] = {"x", "y", "z", "vx", "vy", "vz", "mass", "r", "g", "b"};
+    for (int f = X; f < Ignored; ++f) {
+        if (name == names[f]) {
+            return Field(f);
+        }
+    }
+    return Ignored;
+}
+
+bool isSeparator(char c) {
+    return c == ' ' || c == '\t' || c == ',' || c == ';' || c == '\r';
+}
+
+const char *skipSeparators(const char *p, const char *end) {
+    while (p < end && isSeparator(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+// Splits a field list such as "x,y,z" or a header line into names.
+std::vector<Field> parseFieldNames(const char *p, const char *end) {
+    std::vector<Field> fields;
+    for (p = skipSeparators(p, end); p < end; p = skipSeparators(p, end)) {
+        const char *start = p;
+        while (p < end && !isSeparator(*p)) {
+            ++p;
+        }
+        fields.push_back(fieldNamed(std::string(start, p)));
+    }
+    return fields;
+}
+
+// Returns the end of the line starting at p, not including the newline.
+const char *lineEnd(const char *p, const char *end) {
+    const char *newline = static_cast<const char *>(std::memchr(p, '\n', std::size_t(end - p)));
+    return newline != nullptr ? newline : end;
+}
+
+// Returns true if the line holds a record rather than being blank or a comment.
+bool isRecord(const char *p, const char *end) {
+    p = skipSeparators(p, end);
+    return p < end && *p != '#';
+}
+
+bool has(const std::vector<Field> &fields, Field field) {
+    return std::find(fields.begin(), fields.end(), field) != fields.end();
+}
+
+/**
+ * Allocates the arrays of the attributes present among fields, once, at their final size.
+ */
+template <typename Real>
+void allocate(ParticleTable<Real> &table, const std::vector<Field> &fields, std::size_t count) {
+    if (!has(fields, X) || !has(fields, Y)) {
+        throw std::runtime_error("ERROR::IMPORT::MISSING_POSITION_FIELDS");
+    }
+    table.positions.assign(count, glm::vec<3, Real>(Real(0)));
+    if (has(fields, VX) || has(fields, VY) || has(fields, VZ)) {
+        table.velocities.assign(count, glm::vec<3, Real>(Real(0)));
+    }
+    if (has(fields, Mass)) {
+        table.masses.assign(count, Real(1));
+    }
+    if (has(fields, R) || has(fields, G) || has(fields, B)) {
+        table.colors.assign(count, glm::vec3(0.0f));
+    }
+}
+
+template <typename Real>
+void store(ParticleTable<Real> &table, std::size_t i, Field field, double value) {
+    switch (field) {
+        case X: table.positions[i].x = Real(value); break;
+        case Y: table.positions[i].y = Real(value); break;
+        case Z: table.positions[i].z = Real(value); break;
+        case VX: table.velocities[i].x = Real(value); break;
+        case VY: table.velocities[i].y = Real(value); break;
+        case VZ: table.velocities[i].z = Real(value); break;
+        case Mass: table.masses[i] = Real(value); break;
+        case R: table.colors[i].r = float(value); break;
+        case G: table.colors[i].g = float(value); break;
+        case B: table.colors[i].b = float(value); break;
+        case Ignored: break;
+    }
+}
+
+// A range of the text parsed by one task, and what the first pass learned about it.
+struct Chunk {
+    const char *begin;
+    const char *end;
+    std::size_t records = 0;
+    std::size_t lines = 0;
+    std::size_t firstRecord = 0; // Index of the chunk's first record in the table
+    std::size_t firstLine = 0; // Line number of the chunk's first line, from 1
+    std::size_t errorLine = 0; // Line of the first malformed record, or 0
+};
+
+}
+
+/**
+ * Parses a decimal floating-point number at p, stopping at end, and advances p past it.
+ * @return False, leaving p unchanged, if no number starts at p.
+ */
+bool parseNumber(const char *&p, const char *end, double &value) {
+    const char *s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = *s == '-';
+        ++s;
+    }
+
+    uint64_t mantissa = 0;
+    int digits = 0; // Significant digits in mantissa
+    int exponent = 0;
+    bool truncated = false;
+    bool any = false;
+    for (; s < end && *s >= '0' && *s <= '9'; ++s) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + uint64_t(*s - '0');
+            digits += mantissa != 0;
+        } else {
+            ++exponent;
+            truncated = true;
+        }
+    }
+    if (s < end && *s == '.') {
+        for (++s; s < end && *s >= '0' && *s <= '9'; ++s) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + uint64_t(*s - '0');
+                digits += mantissa != 0;
+                --exponent;
+            } else {
+                truncated = true;
+            }
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool negativeExponent = false;
+        if (e < end && (*e == '-' || *e == '+')) {
+            negativeExponent = *e == '-';
+            ++e;
+        }
+        if (e < end && *e >= '0' && *e <= '9') {
+            int written = 0;
+            for (; e < end && *e >= '0' && *e <= '9'; ++e) {
+                written = std::min(written * 10 + (*e - '0'), 100000);
+            }
+            exponent += negativeExponent ? -written : written;
+            s = e;
+        }
+    }
+
+    if (!truncated && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+        // Both operands are exact, so one IEEE operation gives the correctly rounded result.
+        double magnitude = exponent < 0 ? double(mantissa) / kPowersOfTen[-exponent]
+                                        : double(mantissa) * kPowersOfTen[exponent];
+        value = negative ? -magnitude : magnitude;
+    } else {
+        value = std::strtod(std::string(p, s).c_str(), nullptr);
+    }
+    p = s;
+    return true;
+}
+
+/**
+ * Loads particles from a text file with one particle per line.
+ * @param path The file.
+ * @param pool Threads to parse with, or null to parse on the calling thread.
+ */
+template <typename Real>
+ParticleTable<Real> importCsv(const std::string &path, ThreadPool *pool) {
+    MappedFile file(path);
+    const char *begin = file.data;
+    const char *end = file.data + file.size;
+    ParticleTable<Real> table;
+
+    // The first record or header decides the fields.
+    std::size_t headerLines = 0;
+    const char *line = begin;
+    while (line < end && !isRecord(line, lineEnd(line, end))) {
+        line = lineEnd(line, end) + 1;
+        ++headerLines;
+    }
+    if (line >= end) {
+        return table;
+    }
+    const char *first = skipSeparators(line, end);
+    std::vector<Field> fields;
+    if (std::isalpha((unsigned char) *first)) {
+        fields = parseFieldNames(line, lineEnd(line, end));
+        begin = std::min(end, lineEnd(line, end) + 1);
+        ++headerLines;
+    } else {
+        static const Field defaults[] = {X, Y, Z, VX, VY, VZ, Mass};
+        const char *p = first;
+        const char *stop = lineEnd(line, end);
+        double value;
+        for (std::size_t f = 0; f < 7 && (p = skipSeparators(p, stop)) < stop && parseNumber(p, stop, value); ++f) {
+            fields.push_back(defaults[f]);
+        }
+        begin = line;
+    }
+
+    // Split at line boundaries into a few chunks per thread.
+    const std::size_t threads = pool != nullptr ? pool->size() : 1;
+    const std::size_t bytes = std::size_t(end - begin);
+    const std::size_t chunkCount = std::max<std::size_t>(1, std::min(threads * 8, bytes / kMinChunkBytes));
+    std::vector<Chunk> chunks(chunkCount);
+    const char *cut = begin;
+    for (std::size_t c = 0; c < chunkCount; ++c) {
+        chunks[c].begin = cut;
+        const char *target = c + 1 == chunkCount ? end : std::max(cut, begin + bytes / chunkCount * (c + 1));
+        cut = target >= end ? end : std::min(end, lineEnd(target, end) + 1);
+        chunks[c].end = cut;
+    }
+
+    parallelFor(pool, chunkCount, 1, [&](std::size_t firstChunk, std::size_t lastChunk, unsigned) {
+        for (std::size_t c = firstChunk; c < lastChunk; ++c) {
+            Chunk &chunk = chunks[c];
+            for (const char *p = chunk.begin; p < chunk.end;) {
+                const char *stop = lineEnd(p, chunk.end);
+                chunk.records += isRecord(p, stop);
+                ++chunk.lines;
+                p = stop + 1;
+            }
+        }
+    });
+
+    std::size_t records = 0;
+    std::size_t lines = headerLines + 1;
+    for (Chunk &chunk : chunks) {
+        chunk.firstRecord = records;
+        chunk.firstLine = lines;
+        records += chunk.records;
+        lines += chunk.lines;
+    }
+    allocate(table, fields, records);
+
+    parallelFor(pool, chunkCount, 1, [&](std::size_t firstChunk, std::size_t lastChunk, unsigned) {
+        for (std::size_t c = firstChunk; c < lastChunk; ++c) {
+            Chunk &chunk = chunks[c];
+            std::size_t record = chunk.firstRecord;
+            std::size_t lineNumber = chunk.firstLine;
+            for (const char *p = chunk.begin; p < chunk.end && chunk.errorLine == 0; ++lineNumber) {
+                const char *stop = lineEnd(p, chunk.end);
+                if (isRecord(p, stop)) {
+                    const char *q = p;
+                    for (Field field : fields) {
+                        double value;
+                        q = skipSeparators(q, stop);
+                        if (field == Ignored) {
+                            while (q < stop && !isSeparator(*q)) {
+                                ++q;
+                            }
+                            continue;
+                        }
+                        if (!parseNumber(q, stop, value)) {
+                            chunk.errorLine = lineNumber;
+                            break;
+                        }
+                        store(table, record, field, value);
+                    }
+                    ++record;
+                }
+                p = stop + 1;
+            }
+        }
+    });
+
+    for (const Chunk &chunk : chunks) {
+        if (chunk.errorLine != 0) {
+            throw std::runtime_error("ERROR::IMPORT::MALFORMED_RECORD " + path + ":" + std::to_string(chunk.errorLine));
+        }
+    }
+    return table;
+}
+
+/**
+ * Loads particles from a headerless binary file of fixed-size little-endian records.
+ * @param path The file.
+ * @param fields The fields of a record in order; "_" skips one value.
+ * @param scalar Float32 or Float64, the type of every value.
+ * @param pool Threads to convert with, or null to convert on the calling thread.
+ */
+template <typename Real>
+ParticleTable<Real> importRaw(const std::string &path, const std::string &fields, ScalarCode scalar, ThreadPool *pool) {
+    if (scalar != ScalarCode::Float32 && scalar != ScalarCode::Float64) {
+        throw std::runtime_error("ERROR::IMPORT::UNSUPPORTED_SCALAR");
+    }
+    const std::vector<Field> layout = parseFieldNames(fields.data(), fields.data() + fields.size());
+    const std::size_t width = scalar == ScalarCode::Float64 ? 8 : 4;
+    const std::size_t recordBytes = layout.size() * width;
+
+    MappedFile file(path);
+    if (recordBytes == 0 || file.size % recordBytes != 0) {
+        throw std::runtime_error("ERROR::IMPORT::PARTIAL_RECORD " + path);
+    }
+    const std::size_t count = file.size / recordBytes;
+
+    ParticleTable<Real> table;
+    allocate(table, layout, count);
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(file.data);
+    parallelFor(pool, count, kRawGrain, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; ++i) {
+            const unsigned char *record = data + i * recordBytes;
+            for (std::size_t f = 0; f < layout.size(); ++f) {
+                double value;
+                if (width == 8) {
+                    value = getDouble(record + 8 * f);
+                } else {
+                    uint32_t bits = get32(record + 4 * f);
+                    float single;
+                    std::memcpy(&single, &bits, sizeof(single));
+                    value = single;
+                }
+                store(table, i, layout[f], value);
+            }
+        }
+    });
+    return table;
+}
+
+template ParticleTable<float> importCsv<float>(const std::string &, ThreadPool *);
+template ParticleTable<double> importCsv<double>(const std::string &, ThreadPool *);
+template ParticleTable<float> importRaw<float>(const std::string &, const std::string &, ScalarCode, ThreadPool *);
+template ParticleTable<double> importRaw<double>(const std::string &, const std::string &, ScalarCode, ThreadPool *);
@@ -0,0 +1,410 @@
+//
+// Live metrics in the Prometheus text exposition format, served over HTTP on localhost.
+//
+
+#include "Metrics.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+enum MetricKind { CounterKind, GaugeKind, HistogramKind, CallbackKind };
+
+const std::size_t kMaxRequestBytes = 8192;
+const int kRequestTimeoutMs = 2000; // A client that stalls this long while sending or receiving is dropped
+
+uint64_t toBits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double fromBits(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Adds to a double kept as bits with a compare-and-swap loop.
+ */
+void addBits(std::atomic<uint64_t> &bits, double amount) {
+    uint64_t expected = bits.load(std::memory_order_relaxed);
+    while (!bits.compare_exchange_weak(expected, toBits(fromBits(expected) + amount), std::memory_order_relaxed)) {
+    }
+}
+
+bool validName(const std::string &name) {
+    if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+        return false;
+    }
+    return std::all_of(name.begin(), name.end(), [](char c) {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == ':';
+    });
+}
+
+/**
+ * Formats a sample value the way Prometheus parses it.
+ */
+std::string number(double value) {
+    if (std::isnan(value)) {
+        return "NaN";
+    }
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    // The shortest digits that read back as the same double, so bounds print as written.
+    char text[32];
+    for (int digits = 6; digits <= 17; ++digits) {
+        std::snprintf(text, sizeof(text), "%.*g", digits, value);
+        if (std::strtod(text, nullptr) == value) {
+            break;
+        }
+    }
+    return text;
+}
+
+/**
+ * Escapes help text: backslashes and line breaks.
+ */
+std::string escapedHelp(const std::string &help) {
+    std::string out;
+    for (char c : help) {
+        if (c == '\\') {
+            out += "\\\\";
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+void setNonBlocking(int fd) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+/**
+ * Sends data on a non-blocking socket, waiting at most kRequestTimeoutMs for the client to make
+ * room each time. Gives up when the client stalls or the wake pipe becomes readable.
+ */
+bool sendAll(int fd, int wake, const std::string &data) {
+    std::size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            sent += std::size_t(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return false;
+        }
+        pollfd polled[2] = {pollfd{wake, POLLIN, 0}, pollfd{fd, POLLOUT, 0}};
+        if (::poll(polled, 2, kRequestTimeoutMs) <= 0 || polled[0].revents != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+void MetricGauge::set(double value) {
+    bits.store(toBits(value), std::memory_order_relaxed);
+}
+
+void MetricGauge::add(double amount) {
+    addBits(bits, amount);
+}
+
+double MetricGauge::get() const {
+    return fromBits(bits.load(std::memory_order_relaxed));
+}
+
+MetricHistogram::MetricHistogram(const std::vector<double> &upperBounds)
+        : bounds(upperBounds), buckets(new std::atomic<uint64_t>[upperBounds.size() + 1]) {
+    if (!std::is_sorted(bounds.begin(), bounds.end())) {
+        throw std::runtime_error("ERROR::METRICS::UNSORTED_BUCKETS");
+    }
+    for (std::size_t b = 0; b <= bounds.size(); ++b) {
+        buckets[b].store(0, std::memory_order_relaxed);
+    }
+}
+
+void MetricHistogram::observe(double value) {
+    const std::size_t b = std::size_t(std::lower_bound(bounds.begin(), bounds.end(), value) - bounds.begin());
+    buckets[b].fetch_add(1, std::memory_order_relaxed);
+    addBits(sumBits, value);
+}
+
+double MetricHistogram::sum() const {
+    return fromBits(sumBits.load(std::memory_order_relaxed));
+}
+
+struct MetricsRegistry::Family {
+    std::string name;
+    std::string help;
+    int kind;
+    std::unique_ptr<MetricCounter> counter;
+    std::unique_ptr<MetricGauge> gauge;
+    std::unique_ptr<MetricHistogram> histogram;
+    std::function<double()> read;
+};
+
+MetricsRegistry::MetricsRegistry() = default;
+
+MetricsRegistry::~MetricsRegistry() = default;
+
+/**
+ * Finds or adds the family of a name; the caller holds the lock.
+ */
+MetricsRegistry::Family &MetricsRegistry::family(const std::string &name, const std::string &help, int kind) {
+    if (!validName(name)) {
+        throw std::runtime_error("ERROR::METRICS::BAD_NAME " + name);
+    }
+    for (const std::unique_ptr<Family> &existing : families) {
+        if (existing->name == name) {
+            if (existing->kind != kind) {
+                throw std::runtime_error("ERROR::METRICS::KIND_MISMATCH " + name);
+            }
+            return *existing;
+        }
+    }
+    families.emplace_back(new Family());
+    Family &added = *families.back();
+    added.name = name;
+    added.help = help;
+    added.kind = kind;
+    return added;
+}
+
+MetricCounter &MetricsRegistry::counter(const std::string &name, const std::string &help) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Family &found = family(name, help, CounterKind);
+    if (!found.counter) {
+        found.counter.reset(new MetricCounter());
+    }
+    return *found.counter;
+}
+
+MetricGauge &MetricsRegistry::gauge(const std::string &name, const std::string &help) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Family &found = family(name, help, GaugeKind);
+    if (!found.gauge) {
+        found.gauge.reset(new MetricGauge());
+    }
+    return *found.gauge;
+}
+
+MetricHistogram &MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                                            const std::vector<double> &upperBounds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Family &found = family(name, help, HistogramKind);
+    if (!found.histogram) {
+        found.histogram.reset(new MetricHistogram(upperBounds));
+    } else if (found.histogram->getBounds() != upperBounds) {
+        throw std::runtime_error("ERROR::METRICS::BUCKET_MISMATCH " + name);
+    }
+    return *found.histogram;
+}
+
+void MetricsRegistry::callbackGauge(const std::string &name, const std::string &help, std::function<double()> read) {
+    std::lock_guard<std::mutex> lock(mutex);
+    family(name, help, CallbackKind).read = std::move(read);
+}
+
+std::string MetricsRegistry::expose() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::ostringstream out;
+    for (const std::unique_ptr<Family> &family : families) {
+        const std::string &name = family->name;
+        static const char *const types[] = {"counter", "gauge", "histogram", "gauge"};
+        out << "# HELP " << name << ' ' << escapedHelp(family->help) << '\n';
+        out << "# TYPE " << name << ' ' << types[family->kind] << '\n';
+        switch (family->kind) {
+            case CounterKind:
+                out << name << ' ' << family->counter->get() << '\n';
+                break;
+            case GaugeKind:
+                out << name << ' ' << number(family->gauge->get()) << '\n';
+                break;
+            case CallbackKind:
+                out << name << ' ' << number(family->read()) << '\n';
+                break;
+            case HistogramKind: {
+                // Buckets are read one at a time while observations go on, so the count is the
+                // sum of the buckets as read rather than a separate total that could disagree.
+                const MetricHistogram &histogram = *family->histogram;
+                uint64_t cumulative = 0;
+                for (std::size_t b = 0; b < histogram.getBounds().size(); ++b) {
+                    cumulative += histogram.bucket(b);
+                    out << name << "_bucket{le=\"" << number(histogram.getBounds()[b]) << "\"} " << cumulative << '\n';
+                }
+                cumulative += histogram.bucket(histogram.getBounds().size());
+                out << name << "_bucket{le=\"+Inf\"} " << cumulative << '\n';
+                out << name << "_sum " << number(histogram.sum()) << '\n';
+                out << name << "_count " << cumulative << '\n';
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return out.str();
+}
+
+MetricsServer::MetricsServer(const MetricsRegistry &registry, uint16_t port, const std::string &address)
+        : registry(registry) {
+    sockaddr_in bound;
+    std::memset(&bound, 0, sizeof(bound));
+    bound.sin_family = AF_INET;
+    bound.sin_port = htons(port);
+    if (::inet_pton(AF_INET, address.c_str(), &bound.sin_addr) != 1) {
+        throw std::runtime_error("ERROR::METRICS::BAD_ADDRESS " + address);
+    }
+    if (::pipe(wake) != 0) {
+        throw std::runtime_error("ERROR::METRICS::CANNOT_CREATE_PIPE");
+    }
+    listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    const int reuse = 1;
+    socklen_t length = sizeof(bound);
+    if (listener < 0 || ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        ::bind(listener, reinterpret_cast<const sockaddr *>(&bound), sizeof(bound)) != 0 ||
+        ::listen(listener, 16) != 0 ||
+        ::getsockname(listener, reinterpret_cast<sockaddr *>(&bound), &length) != 0) {
+        if (listener >= 0) {
+            ::close(listener);
+        }
+        ::close(wake[0]);
+        ::close(wake[1]);
+        throw std::runtime_error("ERROR::METRICS::CANNOT_LISTEN " + address + ":" + std::to_string(port));
+    }
+    this->port = ntohs(bound.sin_port);
+    setNonBlocking(listener);
+    thread = std::thread([this]() { serve(); });
+}
+
+MetricsServer::~MetricsServer() {
+    const char byte = 1;
+    ssize_t ignored = ::write(wake[1], &byte, 1);
+    (void) ignored;
+    thread.join();
+    ::close(listener);
+    ::close(wake[0]);
+    ::close(wake[1]);
+}
+
+/**
+ * Accepts and answers clients one at a time until the destructor writes to the pipe.
+ */
+void MetricsServer::serve() {
+    for (;;) {
+        pollfd polled[2] = {pollfd{wake[0], POLLIN, 0}, pollfd{listener, POLLIN, 0}};
+        if (::poll(polled, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        if (polled[0].revents != 0) {
+            return;
+        }
+        const int client = ::accept(listener, nullptr, nullptr);
+        if (client >= 0) {
+            // Non-blocking, so a scraper that stops reading cannot hold up the destructor
+            setNonBlocking(client);
+            answer(client);
+            ::close(client);
+        }
+    }
+}
+
+/**
+ * Reads one request and writes one response; the connection is closed afterwards.
+ */
+void MetricsServer::answer(int client) {
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos) {
+        pollfd polled[2] = {pollfd{wake[0], POLLIN, 0}, pollfd{client, POLLIN, 0}};
+        if (::poll(polled, 2, kRequestTimeoutMs) <= 0 || polled[0].revents != 0) {
+            return;
+        }
+        const ssize_t n = ::recv(client, buffer, sizeof(buffer), 0);
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        }
+        if (n <= 0 || request.size() + std::size_t(n) > kMaxRequestBytes) {
+            return;
+        }
+        request.append(buffer, std::size_t(n));
+    }
+
+    const std::size_t lineEnd = request.find_first_of("\r\n");
+    std::istringstream line(request.substr(0, lineEnd));
+    std::string method, target;
+    line >> method >> target;
+    const std::string path = target.substr(0, target.find('?'));
+    std::string status = "200 OK";
+    std::string type = "text/plain; version=0.0.4; charset=utf-8";
+    std::string body;
+    if (method != "GET" && method != "HEAD") {
+        status = "405 Method Not Allowed";
+        type = "text/plain";
+        body = "Only GET is supported\n";
+    } else if (path == "/metrics") {
+        body = registry.expose();
+    } else {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Metrics are at /metrics\n";
+    }
+    std::ostringstream response;
+    response << "HTTP/1.1 " << status << "\r\nContent-Type: " << type << "\r\nContent-Length: " << body.size()
+             << "\r\nConnection: close\r\n\r\n";
+    if (method != "HEAD") {
+        response << body;
+    }
+    sendAll(client, wake[0], response.str());
+}
+
+SimulationMetrics::SimulationMetrics(MetricsRegistry &registry)
+        : steps(registry.counter("psim_steps_total", "Calls to simulate()")),
+          iterations(registry.counter("psim_solver_iterations_total", "Collision and integration passes")),
+          contacts(registry.counter("psim_contacts_total", "Contacts resolved")),
+          stepSeconds(registry.histogram("psim_step_seconds", "Wall time of one call to simulate()",
+                                         {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+                                          0.25, 0.5, 1.0, 2.5})),
+          particles(registry.gauge("psim_particles", "Particles in the simulation")),
+          stepContacts(registry.gauge("psim_step_contacts", "Contacts resolved by the last call to simulate()")),
+          restingFraction(registry.gauge("psim_resting_fraction", "Share of particles slower than the rest speed")),
+          particleBytes(registry.gauge("psim_particle_bytes", "Memory of the particle arrays, in bytes")) {
+    registry.callbackGauge("process_resident_memory_bytes", "Resident set size of the process, in bytes", []() -> double {
+        long pages = 0, resident = 0;
+        FILE *statm = std::fopen("/proc/self/statm", "r");
+        if (statm == nullptr) {
+            return NAN;
+        }
+        const int read = std::fscanf(statm, "%ld %ld", &pages, &resident);
+        std::fclose(statm);
+        return read == 2 ? double(resident) * double(::sysconf(_SC_PAGESIZE)) : NAN;
+    });
+}
@@ -0,0 +1,460 @@
+//
+// Simulation of more particles than fit in memory, streamed tile by tile through mapped files.
+//
+
+#include "OutOfCore.hpp"
+#include "ByteOrder.hpp"
+#include "Collision.hpp"
+#include "Integrator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+/*
+ * Tile file layout: a 32-byte header, then one fixed-size record per particle.
+ *
+ *   0   char[8]  magic "PSIMTILE"
+ *   8   u32      format version
+ *   12  u32      dimension
+ *   16  u32      record size in bytes
+ *   20  u32      reserved, zero
+ *   24  u64      reserved, zero
+ *
+ * A record is the particle's position, velocity, acceleration, color and mass, in that order and
+ * in host byte order, as stored in BasicParticleStorage.
+ */
+const char kTileMagic[8] = {'P', 'S', 'I', 'M', 'T', 'I', 'L', 'E'};
+const uint32_t kTileVersion = 1;
+const std::size_t kTileHeaderBytes = 32;
+
+// Number of particles integrated as one unit of parallel work.
+const std::size_t kIntegrationGrain = 4096;
+
+/**
+ * Writes all of size bytes at offset, retrying short writes.
+ */
+bool writeFully(int fd, const unsigned char *data, std::size_t size, off_t offset) {
+    while (size > 0) {
+        ssize_t written = ::pwrite(fd, data, size, offset);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        size -= std::size_t(written);
+        offset += written;
+    }
+    return true;
+}
+
+}
+
+/**
+ * Creates empty tile files in the options' directory, replacing any there.
+ * @param options How to split and stream the domain.
+ * @param particleRadius The radius shared by all particles.
+ * @param boundary Half-extent of the box the particles are kept in.
+ */
+template <int Dim, typename Scalar>
+BasicOutOfCoreSimulation<Dim, Scalar>::BasicOutOfCoreSimulation(const OutOfCoreOptions& options, Real particleRadius,
+                                                                 Real boundary)
+        : options(options), particleRadius(particleRadius), boundary(boundary), cache(options.cachedTiles) {
+    if (options.tilesPerAxis == 0) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::NO_TILES");
+    }
+    if (!(double(boundary) < PositionRange<Scalar>::limit())) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::BOUNDARY_OUT_OF_RANGE");
+    }
+    tileSize = Real(2) * boundary / Real(options.tilesPerAxis);
+    halo = options.haloWidth > 0.0 ? Real(options.haloWidth) : Real(4) * particleRadius;
+    if (tileSize < halo) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::TILES_NARROWER_THAN_HALO");
+    }
+
+    // A row-major sweep needs a tile again until the sweep has moved one slab of tiles past it,
+    // so keeping three slabs plus the prefetched neighbourhoods maps every tile only once.
+    if (options.cachedTiles == 0) {
+        std::size_t slab = 1;
+        std::size_t neighbourhood = 1;
+        for (int d = 1; d < Dim; ++d) {
+            slab *= options.tilesPerAxis;
+        }
+        for (int d = 0; d < Dim; ++d) {
+            neighbourhood *= 3;
+        }
+        cache.setCapacity(3 * slab + neighbourhood * (options.prefetchDepth + 1));
+    }
+
+    for (std::size_t tile = 0; tile < getTileCount(); ++tile) {
+        writeTile(current, tile, nullptr, 0, false);
+    }
+}
+
+template <int Dim, typename Scalar>
+std::size_t BasicOutOfCoreSimulation<Dim, Scalar>::getTileCount() const {
+    std::size_t count = 1;
+    for (int d = 0; d < Dim; ++d) {
+        count *= options.tilesPerAxis;
+    }
+    return count;
+}
+
+template <int Dim, typename Scalar>
+std::string BasicOutOfCoreSimulation<Dim, Scalar>::tilePath(unsigned set, std::size_t tile) const {
+    char name[64];
+    std::snprintf(name, sizeof(name), "/tile-%c-%08zu.bin", set == 0 ? 'a' : 'b', tile);
+    return options.directory + name;
+}
+
+template <int Dim, typename Scalar>
+std::size_t BasicOutOfCoreSimulation<Dim, Scalar>::tileIndex(const Tile& tile) const {
+    std::size_t index = 0;
+    for (int d = Dim - 1; d >= 0; --d) {
+        index = index * options.tilesPerAxis + std::size_t(tile[d]);
+    }
+    return index;
+}
+
+template <int Dim, typename Scalar>
+typename BasicOutOfCoreSimulation<Dim, Scalar>::Tile
+BasicOutOfCoreSimulation<Dim, Scalar>::tileCoordinates(std::size_t tile) const {
+    Tile coordinates;
+    for (int d = 0; d < Dim; ++d) {
+        coordinates[d] = int(tile % options.tilesPerAxis);
+        tile /= options.tilesPerAxis;
+    }
+    return coordinates;
+}
+
+/**
+ * Returns the tile a position lies in; positions outside the box belong to the nearest edge tile,
+ * and NaN coordinates to the first tile along their axis.
+ */
+template <int Dim, typename Scalar>
+std::size_t BasicOutOfCoreSimulation<Dim, Scalar>::tileOf(const Position& position) const {
+    const Vec p = Vec(asVector(position));
+    Tile tile;
+    for (int d = 0; d < Dim; ++d) {
+        // Compared before converting, so that NaN lands in the first tile and nothing overflows
+        const double index = std::floor((double(p[d]) + double(boundary)) / double(tileSize));
+        tile[d] = index > 0.0 ? int(std::min(index, double(options.tilesPerAxis - 1))) : 0;
+    }
+    return tileIndex(tile);
+}
+
+/**
+ * Calls visit(index) for every tile sharing a face, edge or corner with the given one.
+ */
+template <int Dim, typename Scalar>
+template <typename Visitor>
+void BasicOutOfCoreSimulation<Dim, Scalar>::forEachNeighbour(std::size_t tile, Visitor&& visit) const {
+    const Tile centre = tileCoordinates(tile);
+    int neighbours = 1;
+    for (int d = 0; d < Dim; ++d) {
+        neighbours *= 3;
+    }
+    for (int n = 0; n < neighbours; ++n) {
+        Tile neighbour;
+        bool inside = true;
+        bool self = true;
+        for (int d = 0, code = n; d < Dim; ++d, code /= 3) {
+            int offset = code % 3 - 1;
+            neighbour[d] = centre[d] + offset;
+            inside = inside && neighbour[d] >= 0 && neighbour[d] < int(options.tilesPerAxis);
+            self = self && offset == 0;
+        }
+        if (inside && !self) {
+            visit(tileIndex(neighbour));
+        }
+    }
+}
+
+/**
+ * Validates a mapped tile file and returns its first record.
+ * @param count Receives the number of records.
+ */
+template <int Dim, typename Scalar>
+const unsigned char* BasicOutOfCoreSimulation<Dim, Scalar>::tileRecords(const MappedTile& file, std::size_t tile,
+                                                                        std::size_t& count) const {
+    const std::size_t recordBytes = Storage::bytesPerParticle();
+    const unsigned char* data = file.data();
+    if (file.size() < kTileHeaderBytes || std::memcmp(data, kTileMagic, sizeof(kTileMagic)) != 0 ||
+        get32(data + 8) != kTileVersion || get32(data + 12) != uint32_t(Dim) || get32(data + 16) != recordBytes ||
+        (file.size() - kTileHeaderBytes) % recordBytes != 0) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::CORRUPT_TILE " + tilePath(current, tile));
+    }
+    count = (file.size() - kTileHeaderBytes) / recordBytes;
+    return data + kTileHeaderBytes;
+}
+
+/**
+ * Appends the particles of the given records to a storage.
+ */
+template <int Dim, typename Scalar>
+void BasicOutOfCoreSimulation<Dim, Scalar>::appendRecords(Storage& to, const unsigned char* const* records,
+                                                          std::size_t count) {
+    const std::size_t first = to.size();
+    to.resize(first + count);
+    for (std::size_t r = 0; r < count; ++r) {
+        const unsigned char* in = records[r];
+        const std::size_t i = first + r;
+        std::memcpy(&to.positions[i], in, sizeof(Position));
+        in += sizeof(Position);
+        std::memcpy(&to.velocities[i], in, sizeof(Vec));
+        in += sizeof(Vec);
+        std::memcpy(&to.accelerations[i], in, sizeof(Vec));
+        in += sizeof(Vec);
+        std::memcpy(&to.colors[i], in, sizeof(glm::vec3));
+        in += sizeof(glm::vec3);
+        std::memcpy(&to.masses[i], in, sizeof(Real));
+    }
+}
+
+template <int Dim, typename Scalar>
+void BasicOutOfCoreSimulation<Dim, Scalar>::packRecord(const Position& position, const Vec& velocity,
+                                                       const Vec& acceleration, const glm::vec3& color, Real mass,
+                                                       unsigned char* out) {
+    std::memcpy(out, &position, sizeof(Position));
+    out += sizeof(Position);
+    std::memcpy(out, &velocity, sizeof(Vec));
+    out += sizeof(Vec);
+    std::memcpy(out, &acceleration, sizeof(Vec));
+    out += sizeof(Vec);
+    std::memcpy(out, &color, sizeof(glm::vec3));
+    out += sizeof(glm::vec3);
+    std::memcpy(out, &mass, sizeof(Real));
+}
+
+/**
+ * Writes records to a tile file: replacing it, with a fresh header, or appending to it.
+ */
+template <int Dim, typename Scalar>
+void BasicOutOfCoreSimulation<Dim, Scalar>::writeTile(unsigned set, std::size_t tile, const unsigned char* records,
+                                                      std::size_t count, bool append) {
+    const std::string path = tilePath(set, tile);
+    const std::size_t bytes = count * Storage::bytesPerParticle();
+    int fd = ::open(path.c_str(), append ? O_WRONLY : O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::CANNOT_OPEN_FOR_WRITING " + path);
+    }
+
+    bool written;
+    if (append) {
+        struct stat status;
+        written = ::fstat(fd, &status) == 0 && writeFully(fd, records, bytes, status.st_size);
+    } else {
+        unsigned char header[kTileHeaderBytes] = {};
+        std::memcpy(header, kTileMagic, sizeof(kTileMagic));
+        put32(header + 8, kTileVersion);
+        put32(header + 12, uint32_t(Dim));
+        put32(header + 16, uint32_t(Storage::bytesPerParticle()));
+        struct iovec parts[2] = {{header, sizeof(header)}, {const_cast<unsigned char*>(records), bytes}};
+        ssize_t total = ::pwritev(fd, parts, bytes > 0 ? 2 : 1, 0);
+        written = total >= 0 && (std::size_t(total) == sizeof(header) + bytes ||
+                                 (std::size_t(total) >= sizeof(header) &&
+                                  writeFully(fd, records + (std::size_t(total) - sizeof(header)),
+                                             bytes - (std::size_t(total) - sizeof(header)), total)));
+    }
+    if (::close(fd) != 0 || !written) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::WRITE_FAILED " + path);
+    }
+    stats.bytesWritten += bytes + (append ? 0 : kTileHeaderBytes);
+}
+
+/**
+ * Adds particles, appending each to the file of the tile it lies in.
+ * @param arrays The attributes of the new particles.
+ * @return The number of particles added.
+ */
+template <int Dim, typename Scalar>
+std::size_t BasicOutOfCoreSimulation<Dim, Scalar>::addParticles(const ParticleArrays<Real>& arrays) {
+    if (arrays.count > 0 && arrays.positions == nullptr) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::MISSING_POSITIONS");
+    }
+    const std::size_t recordBytes = Storage::bytesPerParticle();
+    migrants.resize(getTileCount());
+    for (std::vector<unsigned char>& bucket : migrants) {
+        bucket.clear();
+    }
+
+    for (std::size_t i = 0; i < arrays.count; ++i) {
+        Position position = Position(fromVec3<Dim>(arrays.positions[i]));
+        Vec velocity = arrays.velocities != nullptr ? fromVec3<Dim>(arrays.velocities[i]) : Vec(Real(0));
+        Vec acceleration;
+        primeAcceleration(position, acceleration, UniformField<Vec>{gravity});
+        std::vector<unsigned char>& bucket = migrants[tileOf(position)];
+        bucket.resize(bucket.size() + recordBytes);
+        packRecord(position, velocity, acceleration, arrays.colors != nullptr ? arrays.colors[i] : glm::vec3(0.0f),
+                   arrays.masses != nullptr ? arrays.masses[i] : Real(1), &bucket[bucket.size() - recordBytes]);
+    }
+
+    cache.clear();
+    for (std::size_t tile = 0; tile < migrants.size(); ++tile) {
+        if (!migrants[tile].empty()) {
+            writeTile(current, tile, migrants[tile].data(), migrants[tile].size() / recordBytes, true);
+        }
+    }
+    particleCount += arrays.count;
+    return arrays.count;
+}
+
+/**
+ * Simulates one tile with its ghosts and writes its particles to the other file set; particles
+ * that left the tile are set aside for their new tile.
+ */
+template <int Dim, typename Scalar>
+void BasicOutOfCoreSimulation<Dim, Scalar>::simulateTile(std::size_t tile, Real dt) {
+    const std::size_t recordBytes = Storage::bytesPerParticle();
+    std::vector<const unsigned char*> pending;
+
+    // The tile's own particles.
+    std::shared_ptr<const MappedTile> own = cache.acquire(tilePath(current, tile));
+    std::size_t ownCount;
+    const unsigned char* ownRecords = tileRecords(*own, tile, ownCount);
+    for (std::size_t r = 0; r < ownCount; ++r) {
+        pending.push_back(ownRecords + r * recordBytes);
+    }
+
+    // Ghosts: particles of the neighbours within the halo around the tile.
+    const Tile coordinates = tileCoordinates(tile);
+    Vec lower;
+    Vec upper;
+    for (int d = 0; d < Dim; ++d) {
+        lower[d] = -boundary + Real(coordinates[d]) * tileSize - halo;
+        upper[d] = lower[d] + tileSize + Real(2) * halo;
+    }
+    std::vector<std::shared_ptr<const MappedTile> > neighbours;
+    forEachNeighbour(tile, [&](std::size_t neighbour) {
+        neighbours.push_back(cache.acquire(tilePath(current, neighbour)));
+        std::size_t count;
+        const unsigned char* records = tileRecords(*neighbours.back(), neighbour, count);
+        for (std::size_t r = 0; r < count; ++r) {
+            Position position;
+            std::memcpy(&position, records + r * recordBytes, sizeof(Position));
+            const Vec p = Vec(asVector(position));
+            bool inside = true;
+            for (int d = 0; d < Dim; ++d) {
+                inside = inside && p[d] >= lower[d] && p[d] < upper[d];
+            }
+            if (inside) {
+                pending.push_back(records + r * recordBytes);
+            }
+        }
+    });
+    stats.ghostsLoaded += pending.size() - ownCount;
+
+    working.resize(0);
+    appendRecords(working, pending.data(), pending.size());
+    neighbours.clear();
+    own.reset();
+
+    const auto start = std::chrono::steady_clock::now();
+    Position* positions = working.positions.data();
+    Vec* velocities = working.velocities.data();
+    const Real* masses = working.masses.data();
+    const Real radius = particleRadius;
+    for (int iteration = 0; iteration < numIterations; ++iteration) {
+        grid.build(positions, working.size(), 2.0 * radius);
+        grid.forEachCandidatePair([=](uint32_t i, uint32_t j) {
+            resolveContact(positions, velocities, masses, i, j, radius);
+        });
+        parallelFor(pool, working.size(), kIntegrationGrain, [&](std::size_t begin, std::size_t end, unsigned) {
+            integrateParticles<ActiveIntegrator>(positions + begin, velocities + begin,
+                                                 working.accelerations.data() + begin, end - begin,
+                                                 dt, boundary, UniformField<Vec>{gravity});
+        });
+    }
+    stats.computeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Only the tile's own particles are kept; the ghosts are written by their own tiles.
+    records.resize(ownCount * recordBytes);
+    std::size_t staying = 0;
+    for (std::size_t i = 0; i < ownCount; ++i) {
+        const std::size_t destination = tileOf(working.positions[i]);
+        unsigned char* out;
+        if (destination == tile) {
+            out = &records[staying++ * recordBytes];
+        } else {
+            std::vector<unsigned char>& bucket = migrants[destination];
+            bucket.resize(bucket.size() + recordBytes);
+            out = &bucket[bucket.size() - recordBytes];
+            ++stats.particlesMigrated;
+        }
+        packRecord(working.positions[i], working.velocities[i], working.accelerations[i], working.colors[i],
+                   working.masses[i], out);
+    }
+    writeTile(1 - current, tile, records.data(), staying, false);
+    ++stats.tilesProcessed;
+}
+
+/**
+ * Sweeps every tile once, then makes the written file set the current one.
+ * @param dt The time interval of one pass, in seconds.
+ */
+template <int Dim, typename Scalar>
+void BasicOutOfCoreSimulation<Dim, Scalar>::simulate(Real dt) {
+    const std::size_t tiles = getTileCount();
+    const std::size_t recordBytes = Storage::bytesPerParticle();
+    migrants.resize(tiles);
+    for (std::vector<unsigned char>& bucket : migrants) {
+        bucket.clear();
+    }
+
+    for (std::size_t tile = 0; tile < tiles; ++tile) {
+        for (std::size_t ahead = tile + 1; ahead <= tile + options.prefetchDepth && ahead < tiles; ++ahead) {
+            cache.prefetch(tilePath(current, ahead));
+            forEachNeighbour(ahead, [&](std::size_t neighbour) { cache.prefetch(tilePath(current, neighbour)); });
+        }
+        simulateTile(tile, dt);
+    }
+
+    const unsigned next = 1 - current;
+    for (std::size_t tile = 0; tile < tiles; ++tile) {
+        if (!migrants[tile].empty()) {
+            writeTile(next, tile, migrants[tile].data(), migrants[tile].size() / recordBytes, true);
+        }
+    }
+
+    // The old set is rewritten by the next sweep, so none of its mappings may outlive this one.
+    cache.clear();
+    current = next;
+    time += double(dt) * numIterations;
+    ++stepCount;
+}
+
+/**
+ * Appends the particles of one tile to out.
+ * @param tile The tile, in [0, getTileCount()).
+ * @return The number of particles appended.
+ */
+template <int Dim, typename Scalar>
+std::size_t BasicOutOfCoreSimulation<Dim, Scalar>::readTile(std::size_t tile, Storage& out) {
+    if (tile >= getTileCount()) {
+        throw std::runtime_error("ERROR::OUT_OF_CORE::NO_SUCH_TILE");
+    }
+    std::shared_ptr<const MappedTile> file = cache.acquire(tilePath(current, tile));
+    std::size_t count;
+    const unsigned char* first = tileRecords(*file, tile, count);
+    std::vector<const unsigned char*> pending(count);
+    for (std::size_t r = 0; r < count; ++r) {
+        pending[r] = first + r * Storage::bytesPerParticle();
+    }
+    appendRecords(out, pending.data(), count);
+    return count;
+}
+
+template class BasicOutOfCoreSimulation<2, float>;
+template class BasicOutOfCoreSimulation<3, float>;
+template class BasicOutOfCoreSimulation<2, double>;
+template class BasicOutOfCoreSimulation<3, double>;
+template class BasicOutOfCoreSimulation<2, FixedPoint32<> >;
+template class BasicOutOfCoreSimulation<3, FixedPoint32<> >;
@@ -12,7 +12,8 @@
  * @param color The color of the particle.
  * @param mass The mass of the particle.
  */
-Particle::Particle(glm::vec3 position, glm::vec3 velocity, glm::vec3 color, float mass)
+template <typename Real>
+BasicParticle<Real>::BasicParticle(Vec position, Vec velocity, glm::vec3 color, Real mass)
         : position(position), velocity(velocity), color(color), mass(mass) {}
 
 
@@ -21,7 +22,8 @@ Particle::Particle(glm::vec3 position, glm::vec3 velocity, glm::vec3 color, floa
 *
 * @param dt The time elapsed since the last update, in seconds.
 */
-void Particle::update(float dt) {
+template <typename Real>
+void BasicParticle<Real>::update(Real dt) {
     position += velocity * dt;
 }
 
@@ -32,14 +34,15 @@ void Particle::update(float dt) {
  * @param renderer The renderer to use for drawing the particle.
  * @param shader The shader to use for coloring the particle.
  */
-void Particle::render(Render& renderer, Shader& shader) const {
+template <typename Real>
+void BasicParticle<Real>::render(Render& renderer, Shader& shader) const {
     VertexData data;
-    data.position = position;
-    data.velocity = glm::length(velocity);
-    data.mass = mass;
+    data.position = glm::vec3(position);
+    data.velocity = float(glm::length(velocity));
+    data.mass = float(mass);
     data.color = color;
     renderer.draw(shader, {data});
 }
 
-
-
+template class BasicParticle<float>;
+template class BasicParticle<double>;
@@ -0,0 +1,276 @@
+//
+// Hardware performance counters per simulation phase and thread, through Linux perf_event.
+//
+
+#include "PerfCounters.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char *const kEventNames[kCounterEvents] = {
+    "cycles", "instructions", "llc_misses", "branch_misses", "stalled_cycles", "task_clock_ns"
+};
+
+#if defined(__linux__)
+const uint64_t kHardwareEvents[kCounterEvents - 1] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_STALLED_CYCLES_BACKEND
+};
+
+/**
+ * Opens a counter of the calling thread in user space, or returns -1.
+ */
+int openEvent(uint32_t type, uint64_t config, int groupLeader, bool grouped) {
+    perf_event_attr attributes;
+    std::memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = type;
+    attributes.config = config;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING |
+                             (grouped ? PERF_FORMAT_GROUP : 0);
+    return int(syscall(SYS_perf_event_open, &attributes, 0, -1, groupLeader, PERF_FLAG_FD_CLOEXEC));
+}
+
+/**
+ * Scales a count to the whole enabled time when the event was multiplexed with others.
+ */
+double scaled(uint64_t count, uint64_t enabled, uint64_t running) {
+    return running > 0 && running < enabled ? double(count) * double(enabled) / double(running) : double(count);
+}
+#endif
+
+/**
+ * Writes a number, or null when it is not finite.
+ */
+void writeNumber(std::ostream &out, double value) {
+    if (std::isfinite(value)) {
+        out << value;
+    } else {
+        out << "null";
+    }
+}
+
+double ratio(const CounterValues &values, CounterEvent numerator, CounterEvent denominator, double scale) {
+    if (!values.has(numerator) || !values.has(denominator) || values[denominator] <= 0.0) {
+        return NAN;
+    }
+    return scale * values[numerator] / values[denominator];
+}
+
+double instructionsPerCycle(const CounterValues &values) {
+    return ratio(values, CounterEvent::Instructions, CounterEvent::Cycles, 1.0);
+}
+
+double llcMissesPerKilo(const CounterValues &values) {
+    return ratio(values, CounterEvent::LlcMisses, CounterEvent::Instructions, 1000.0);
+}
+
+double branchMissesPerKilo(const CounterValues &values) {
+    return ratio(values, CounterEvent::BranchMisses, CounterEvent::Instructions, 1000.0);
+}
+
+double stalledFraction(const CounterValues &values) {
+    return ratio(values, CounterEvent::StalledCycles, CounterEvent::Cycles, 1.0);
+}
+
+void writeValues(std::ostream &out, const CounterValues &values) {
+    for (int e = 0; e < kCounterEvents; ++e) {
+        out << (e == 0 ? "" : ", ") << '"' << kEventNames[e] << "\": ";
+        writeNumber(out, values.has(CounterEvent(e)) ? values.counts[e] : NAN);
+    }
+    out << ", \"ipc\": ";
+    writeNumber(out, instructionsPerCycle(values));
+    out << ", \"llc_misses_per_kilo_instruction\": ";
+    writeNumber(out, llcMissesPerKilo(values));
+    out << ", \"branch_misses_per_kilo_instruction\": ";
+    writeNumber(out, branchMissesPerKilo(values));
+    out << ", \"stalled_cycle_fraction\": ";
+    writeNumber(out, stalledFraction(values));
+}
+
+}
+
+CounterValues &CounterValues::operator+=(const CounterValues &other) {
+    for (int e = 0; e < kCounterEvents; ++e) {
+        counts[e] += other.counts[e];
+    }
+    available |= other.available;
+    return *this;
+}
+
+ThreadCounters::ThreadCounters() {
+    for (int e = 0; e < kCounterEvents; ++e) {
+        members[e] = -1;
+        order[e] = -1;
+    }
+#if defined(__linux__)
+    // Cycles lead the group; a member the machine lacks is left out rather than failing it.
+    for (int e = 0; e < kCounterEvents - 1; ++e) {
+        const int fd = openEvent(PERF_TYPE_HARDWARE, kHardwareEvents[e], group, true);
+        if (fd < 0) {
+            if (group < 0) {
+                break;
+            }
+            continue;
+        }
+        if (group < 0) {
+            group = fd;
+        }
+        members[e] = fd;
+        order[groupSize++] = e;
+    }
+    clock = openEvent(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1, false);
+    members[int(CounterEvent::TaskClock)] = clock;
+#endif
+}
+
+ThreadCounters::~ThreadCounters() {
+#if defined(__linux__)
+    for (int e = 0; e < kCounterEvents; ++e) {
+        if (members[e] >= 0) {
+            close(members[e]);
+        }
+    }
+#endif
+}
+
+ThreadCounters &ThreadCounters::current() {
+    thread_local std::unique_ptr<ThreadCounters> counters;
+    if (!counters) {
+        counters.reset(new ThreadCounters());
+    }
+    return *counters;
+}
+
+CounterValues ThreadCounters::read() const {
+    CounterValues values;
+#if defined(__linux__)
+    if (group >= 0) {
+        uint64_t buffer[3 + kCounterEvents]; // Number of events, enabled and running time, counts
+        const ssize_t bytes = ::read(group, buffer, sizeof(buffer));
+        if (bytes >= ssize_t(3 * sizeof(uint64_t)) && buffer[0] == uint64_t(groupSize)) {
+            for (int m = 0; m < groupSize; ++m) {
+                values.counts[order[m]] = scaled(buffer[3 + m], buffer[1], buffer[2]);
+                values.available |= 1u << order[m];
+            }
+        }
+    }
+    if (clock >= 0) {
+        uint64_t buffer[3]; // Count, enabled and running time
+        if (::read(clock, buffer, sizeof(buffer)) == ssize_t(sizeof(buffer))) {
+            values.counts[int(CounterEvent::TaskClock)] = scaled(buffer[0], buffer[1], buffer[2]);
+            values.available |= 1u << int(CounterEvent::TaskClock);
+        }
+    }
+#endif
+    return values;
+}
+
+const char *phaseName(SimulationPhase phase) {
+    switch (phase) {
+        case SimulationPhase::BuildGrid: return "build_grid";
+        case SimulationPhase::FindContacts: return "find_contacts";
+        case SimulationPhase::ResolveContacts: return "resolve_contacts";
+        case SimulationPhase::Integrate: return "integrate";
+    }
+    return "unknown";
+}
+
+PhaseCounters::Scope::Scope(PhaseCounters *counters, SimulationPhase phase, unsigned thread)
+        : counters(counters), phase(phase), thread(thread) {
+    if (counters != nullptr) {
+        start = ThreadCounters::current().read();
+    }
+}
+
+PhaseCounters::Scope::~Scope() {
+    if (counters == nullptr) {
+        return;
+    }
+    const CounterValues end = ThreadCounters::current().read();
+    CounterValues &totals = counters->perThread[thread].phases[int(phase)];
+    for (int e = 0; e < kCounterEvents; ++e) {
+        totals.counts[e] += end.counts[e] - start.counts[e];
+    }
+    totals.available |= end.available & start.available;
+}
+
+void PhaseCounters::prepare(unsigned threadCount) {
+    if (perThread.size() < threadCount) {
+        perThread.resize(threadCount);
+    }
+}
+
+void PhaseCounters::reset() {
+    perThread.assign(perThread.size(), ThreadTotals());
+}
+
+bool PhaseCounters::supported() {
+    return ThreadCounters::current().read().available != 0;
+}
+
+const CounterValues &PhaseCounters::get(SimulationPhase phase, unsigned thread) const {
+    return perThread[thread].phases[int(phase)];
+}
+
+CounterValues PhaseCounters::total(SimulationPhase phase) const {
+    CounterValues sum;
+    for (const ThreadTotals &totals : perThread) {
+        sum += totals.phases[int(phase)];
+    }
+    return sum;
+}
+
+void PhaseCounters::writeJson(std::ostream &out) const {
+    out << "{\"phases\": [";
+    for (int p = 0; p < kSimulationPhases; ++p) {
+        const SimulationPhase phase = SimulationPhase(p);
+        out << (p == 0 ? "" : ", ") << "{\"phase\": \"" << phaseName(phase) << "\", ";
+        writeValues(out, total(phase));
+        out << ", \"threads\": [";
+        for (unsigned t = 0; t < threadCount(); ++t) {
+            out << (t == 0 ? "{" : ", {");
+            writeValues(out, get(phase, t));
+            out << "}";
+        }
+        out << "]}";
+    }
+    out << "]}";
+}
+
+void PhaseCounters::writeTable(std::ostream &out) const {
+    auto cell = [](double value, const char *format) {
+        char text[32];
+        if (std::isfinite(value)) {
+            std::snprintf(text, sizeof(text), format, value);
+        } else {
+            std::snprintf(text, sizeof(text), "%s", "-");
+        }
+        return std::string(text);
+    };
+    char line[160];
+    std::snprintf(line, sizeof(line), "  %-18s %12s %14s %6s %9s %9s %8s\n", "phase", "cpu ms", "instructions", "ipc",
+                  "llc mpki", "br mpki", "stalled");
+    out << line;
+    for (int p = 0; p < kSimulationPhases; ++p) {
+        const CounterValues values = total(SimulationPhase(p));
+        std::snprintf(line, sizeof(line), "  %-18s %12s %14s %6s %9s %9s %8s\n", phaseName(SimulationPhase(p)),
+                      cell(values.has(CounterEvent::TaskClock) ? values[CounterEvent::TaskClock] * 1e-6 : NAN, "%.2f").c_str(),
+                      cell(values.has(CounterEvent::Instructions) ? values[CounterEvent::Instructions] : NAN, "%.4g").c_str(),
+                      cell(instructionsPerCycle(values), "%.2f").c_str(), cell(llcMissesPerKilo(values), "%.2f").c_str(),
+                      cell(branchMissesPerKilo(values), "%.2f").c_str(), cell(stalledFraction(values), "%.2f").c_str());
+        out << line;
+    }
+}
@@ -71,6 +71,10 @@ Render::Render() {
  * @param vertices The list of vertices to draw.
  */
 void Render::draw(Shader& shader, const std::vector<VertexData>& vertices) {
+    if (vertices.empty()) {
+        return;
+    }
+
     shader.use();
     shader.setMat4("view", viewMatrix);
     shader.setMat4("projection", projectionMatrix);
@@ -88,6 +92,29 @@ void Render::draw(Shader& shader, const std::vector<VertexData>& vertices) {
     glBindVertexArray(0);
 }
 
+/**
+ * Creates the overlay on first enabling and destroys it on disabling, which also clears its history.
+ */
+void Render::setHudEnabled(bool enabled) {
+    if (enabled && !hud) {
+        hud.reset(new Hud());
+    } else if (!enabled) {
+        hud.reset();
+    }
+}
+
+void Render::recordFrame(const FrameTimes &times) {
+    if (hud) {
+        hud->recordFrame(times);
+    }
+}
+
+void Render::drawHud(const HudStats &stats) {
+    if (hud) {
+        hud->draw(stats);
+    }
+}
+
 /**
  * Destructor: Clean up by deleting the VAO and VBO.
  */
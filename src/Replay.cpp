@@ -0,0 +1,278 @@
+//
+// Plays recorded trajectories back through the render path without simulating.
+//
+
+#include "Replay.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Opens a trajectory and starts prefetching from its first frame.
+ * @param path The trajectory file.
+ * @param readAhead The number of decoded frames kept ready.
+ */
+ReplaySource::ReplaySource(const std::string &path, std::size_t readAhead)
+        : reader(path), readAhead(std::max<std::size_t>(1, readAhead)) {
+    if (reader.getFrameCount() > 0) {
+        clock = reader.getFrameInfo(0).time;
+    }
+    prefetcher = std::thread(&ReplaySource::prefetchLoop, this);
+}
+
+/**
+ * Stops the prefetch thread.
+ */
+ReplaySource::~ReplaySource() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    prefetcher.join();
+}
+
+/**
+ * Continues playback from the given frame; prefetched frames are discarded.
+ * @param frame The index of the frame next() returns next.
+ */
+void ReplaySource::seek(std::size_t frame) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        frame = std::min(frame, reader.getFrameCount());
+        ++generation;
+        while (!ready.empty()) {
+            spare.push_back(std::move(ready.front()));
+            ready.pop_front();
+        }
+        cursor = frame;
+        if (frame < reader.getFrameCount()) {
+            clock = reader.getFrameInfo(frame).time;
+        }
+    }
+    changed.notify_all();
+}
+
+/**
+ * Returns the next frame in file order, waiting for the prefetch thread if necessary.
+ * @param out Receives the frame; its previous contents are recycled as a prefetch buffer.
+ * @return False at the end of the trajectory.
+ */
+bool ReplaySource::next(TrajectoryFrame &out) {
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        changed.wait(guard, [this] { return !ready.empty() || cursor >= reader.getFrameCount(); });
+        if (ready.empty()) {
+            return false;
+        }
+        if (!out.bytes.empty()) {
+            spare.push_back(std::move(out));
+        }
+        out = std::move(ready.front());
+        ready.pop_front();
+        clock = out.time;
+    }
+    changed.notify_all();
+    deliver(out);
+    return true;
+}
+
+/**
+ * Advances the playback clock and returns the newest frame recorded up to it.
+ * @param wallSeconds Wall time since the previous call.
+ * @param out Receives the frame, if there is a new one.
+ * @return False if no new frame is due yet or the trajectory has ended.
+ */
+bool ReplaySource::advance(double wallSeconds, TrajectoryFrame &out) {
+    if (playbackRate <= 0.0) {
+        return next(out);
+    }
+
+    std::unique_lock<std::mutex> guard(lock);
+    clock += wallSeconds * playbackRate;
+    bool found = false;
+    while (!ready.empty() && ready.front().time <= clock) {
+        TrajectoryFrame frame = std::move(ready.front());
+        ready.pop_front();
+        guard.unlock();
+        changed.notify_all();
+        deliver(frame);
+        guard.lock();
+        if (!out.bytes.empty()) {
+            spare.push_back(std::move(out));
+        }
+        out = std::move(frame);
+        found = true;
+    }
+    return found;
+}
+
+/**
+ * Returns true once every frame has been handed out.
+ */
+bool ReplaySource::finished() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return ready.empty() && cursor >= reader.getFrameCount();
+}
+
+/**
+ * Throws std::runtime_error unless every column of a decoded frame holds an element per particle,
+ * so that frameVertices() never reads past a column.
+ */
+static void checkColumns(const TrajectoryFrame &frame) {
+    for (const SnapshotColumn &column : frame.columns) {
+        const std::size_t elementBytes = column.elementBytes();
+        if (elementBytes == 0 || frame.particleCount > column.bytes / elementBytes) {
+            throw std::runtime_error("ERROR::REPLAY::SHORT_COLUMN in frame " + std::to_string(frame.index));
+        }
+    }
+}
+
+/**
+ * Decodes frames in order into the ready queue, up to readAhead frames ahead of playback.
+ * Decoding happens outside the lock; a seek in the meantime makes the result stale and it is
+ * recycled. A corrupt frame, or one with a column shorter than its particle count, ends the
+ * trajectory there.
+ */
+void ReplaySource::prefetchLoop() {
+    TrajectoryFrame work; // Running decode state, so consecutive frames decode one delta at a time
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        changed.wait(guard, [this] {
+            return stopping || (cursor < reader.getFrameCount() && ready.size() < readAhead);
+        });
+        if (stopping) {
+            return;
+        }
+
+        const std::size_t frame = cursor;
+        const unsigned started = generation;
+        TrajectoryFrame slot;
+        if (!spare.empty()) {
+            slot = std::move(spare.back());
+            spare.pop_back();
+        }
+        guard.unlock();
+
+        bool decoded = true;
+        try {
+            reader.willNeed(frame + 1, frame + 1 + readAhead);
+            reader.read(frame, work);
+            checkColumns(work);
+            slot.layout(work.columns);
+            std::memcpy(slot.bytes.data(), work.bytes.data(), work.bytes.size());
+            slot.index = work.index;
+            slot.step = work.step;
+            slot.time = work.time;
+            slot.particleCount = work.particleCount;
+            slot.keyframe = work.keyframe;
+        } catch (const std::runtime_error &) {
+            decoded = false;
+        }
+
+        guard.lock();
+        if (started != generation) {
+            spare.push_back(std::move(slot));
+            continue;
+        }
+        if (decoded) {
+            ready.push_back(std::move(slot));
+            cursor = frame + 1;
+        } else {
+            cursor = reader.getFrameCount();
+        }
+        changed.notify_all();
+    }
+}
+
+/**
+ * Shows a frame to the analysis hooks.
+ */
+void ReplaySource::deliver(TrajectoryFrame &frame) {
+    for (const AnalysisHook &hook : hooks) {
+        hook(frame);
+    }
+}
+
+/**
+ * Reads component k of element i of a decoded column, which is in host byte order.
+ */
+static float hostComponent(const SnapshotColumn &column, std::size_t i, uint32_t k) {
+    const unsigned char *p = static_cast<const unsigned char *>(column.data) + i * column.elementBytes();
+    switch (column.scalar) {
+        case ScalarCode::Float32: {
+            float value;
+            std::memcpy(&value, p + 4 * k, sizeof(value));
+            return value;
+        }
+        case ScalarCode::Float64: {
+            double value;
+            std::memcpy(&value, p + 8 * k, sizeof(value));
+            return float(value);
+        }
+        case ScalarCode::Fixed32: {
+            int32_t value;
+            std::memcpy(&value, p + 4 * k, sizeof(value));
+            return float(double(value) / double(uint64_t(1) << column.fractionBits));
+        }
+    }
+    return 0.0f;
+}
+
+/**
+ * Converts a frame to the vertices Render::draw takes; attributes the frame lacks are zero.
+ */
+void frameVertices(const TrajectoryFrame &frame, std::vector<VertexData> &vertices) {
+    frameVertices(frame.particleCount, frame.columns, vertices);
+}
+
+/**
+ * Converts particle columns in host byte order to the vertices Render::draw takes.
+ */
+void frameVertices(uint64_t particleCount, const std::vector<SnapshotColumn> &columns, std::vector<VertexData> &vertices) {
+    const std::size_t count = std::size_t(particleCount);
+    vertices.assign(count, VertexData{glm::vec3(0.0f), 0.0f, 0.0f, glm::vec3(0.0f)});
+    auto find = [&](SnapshotColumnId id) -> const SnapshotColumn * {
+        for (const SnapshotColumn &column : columns) {
+            if (column.id == id) {
+                return &column;
+            }
+        }
+        return nullptr;
+    };
+
+    if (const SnapshotColumn *positions = find(SnapshotColumnId::Position)) {
+        const uint32_t axes = std::min(positions->components, 3u);
+        for (std::size_t i = 0; i < count; ++i) {
+            for (uint32_t k = 0; k < axes; ++k) {
+                vertices[i].position[k] = hostComponent(*positions, i, k);
+            }
+        }
+    }
+    if (const SnapshotColumn *velocities = find(SnapshotColumnId::Velocity)) {
+        for (std::size_t i = 0; i < count; ++i) {
+            float squared = 0.0f;
+            for (uint32_t k = 0; k < velocities->components; ++k) {
+                float v = hostComponent(*velocities, i, k);
+                squared += v * v;
+            }
+            vertices[i].velocity = std::sqrt(squared);
+        }
+    }
+    if (const SnapshotColumn *masses = find(SnapshotColumnId::Mass)) {
+        for (std::size_t i = 0; i < count; ++i) {
+            vertices[i].mass = hostComponent(*masses, i, 0);
+        }
+    }
+    if (const SnapshotColumn *colors = find(SnapshotColumnId::Color)) {
+        const uint32_t channels = std::min(colors->components, 3u);
+        for (std::size_t i = 0; i < count; ++i) {
+            for (uint32_t k = 0; k < channels; ++k) {
+                vertices[i].color[k] = hostComponent(*colors, i, k);
+            }
+        }
+    }
+}
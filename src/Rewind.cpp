@@ -0,0 +1,250 @@
+//
+// In-memory history of recent simulation states for rewinding and scrubbing.
+//
+
+#include "Rewind.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+void appendVarint(std::vector<unsigned char> &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((unsigned char) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char) value);
+}
+
+uint64_t readVarint(const unsigned char *&in) {
+    uint64_t value = 0;
+    int shift = 0;
+    while (*in & 0x80) {
+        value |= uint64_t(*in++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= uint64_t(*in++) << shift;
+    return value;
+}
+
+bool sameLayout(const std::vector<SnapshotColumn> &a, const std::vector<SnapshotColumn> &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (std::size_t c = 0; c < a.size(); ++c) {
+        if (a[c].id != b[c].id || a[c].scalar != b[c].scalar || a[c].components != b[c].components ||
+            a[c].fractionBits != b[c].fractionBits || a[c].bytes != b[c].bytes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Copies the state described by columns into frame, which must already have their layout.
+void copyColumns(const std::vector<SnapshotColumn> &columns, TrajectoryFrame &frame) {
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+        std::memcpy(const_cast<void *>(frame.columns[c].data), columns[c].data, std::size_t(columns[c].bytes));
+    }
+}
+
+}
+
+/**
+ * @param options The memory budget and keyframe spacing.
+ */
+RewindBuffer::RewindBuffer(const RewindOptions &options) : options(options) {
+    this->options.keyframeInterval = std::max(1u, options.keyframeInterval);
+    this->options.stride = std::max(1u, options.stride);
+}
+
+/**
+ * Adds a state to the history.
+ * @param step The number of calls to simulate() so far.
+ * @param time The simulated time.
+ * @param particleCount The number of particles.
+ * @param columns Every particle attribute; their data is copied.
+ */
+void RewindBuffer::record(uint64_t step, double time, uint64_t particleCount, const std::vector<SnapshotColumn> &columns) {
+    if (!segments.empty() && step <= newestStep) {
+        truncateFrom(step);
+    }
+
+    const bool continues = latestValid && !segments.empty() && latest.particleCount == particleCount &&
+                           sameLayout(latest.columns, columns);
+    bool keyframe = !continues || segments.back().deltas.size() + 1 >= options.keyframeInterval;
+
+    Delta delta;
+    if (!keyframe) {
+        delta.step = step;
+        delta.time = time;
+        encodeDelta(columns, particleCount, delta);
+        keyframe = segments.back().deltaBytes + delta.bytes.size() > segments.back().keyframe.bytes.size();
+    }
+
+    if (keyframe) {
+        segments.emplace_back();
+        TrajectoryFrame &frame = segments.back().keyframe;
+        frame.layout(columns);
+        copyColumns(columns, frame);
+        frame.step = step;
+        frame.time = time;
+        frame.particleCount = particleCount;
+        frame.keyframe = true;
+        memoryUsed += frame.bytes.size();
+    } else {
+        delta.bytes.shrink_to_fit();
+        segments.back().deltaBytes += delta.bytes.size();
+        memoryUsed += delta.bytes.size();
+        segments.back().deltas.push_back(std::move(delta));
+    }
+
+    if (!continues) {
+        latest.layout(columns);
+    }
+    copyColumns(columns, latest);
+    latest.step = step;
+    latest.time = time;
+    latest.particleCount = particleCount;
+    latestValid = true;
+    newestStep = step;
+
+    enforceBudget();
+}
+
+/**
+ * Reconstructs the newest recorded state at or before the given step: one keyframe copy and at
+ * most keyframeInterval - 1 deltas.
+ * @param step The step to go back to.
+ * @param out Receives the state.
+ * @return False if the step is older than the history kept.
+ */
+bool RewindBuffer::seek(uint64_t step, TrajectoryFrame &out) const {
+    if (segments.empty() || step < segments.front().keyframe.step) {
+        return false;
+    }
+
+    auto after = std::upper_bound(segments.begin(), segments.end(), step, [](uint64_t value, const Segment &segment) {
+        return value < segment.keyframe.step;
+    });
+    const Segment &segment = *(after - 1);
+
+    out.layout(segment.keyframe.columns);
+    std::memcpy(out.bytes.data(), segment.keyframe.bytes.data(), segment.keyframe.bytes.size());
+    out.step = segment.keyframe.step;
+    out.time = segment.keyframe.time;
+    out.particleCount = segment.keyframe.particleCount;
+    out.keyframe = true;
+    for (const Delta &delta : segment.deltas) {
+        if (delta.step > step) {
+            break;
+        }
+        applyDelta(delta, out);
+        out.step = delta.step;
+        out.time = delta.time;
+        out.keyframe = false;
+    }
+    return true;
+}
+
+/**
+ * Returns the number of states in the history.
+ */
+std::size_t RewindBuffer::getFrameCount() const {
+    std::size_t frames = 0;
+    for (const Segment &segment : segments) {
+        frames += 1 + segment.deltas.size();
+    }
+    return frames;
+}
+
+/**
+ * Drops every recorded state from the given step on. The next state recorded is a keyframe.
+ */
+void RewindBuffer::truncateFrom(uint64_t step) {
+    while (!segments.empty() && segments.back().keyframe.step >= step) {
+        memoryUsed -= segments.back().keyframe.bytes.size() + segments.back().deltaBytes;
+        segments.pop_back();
+    }
+    newestStep = 0;
+    if (!segments.empty()) {
+        Segment &segment = segments.back();
+        while (!segment.deltas.empty() && segment.deltas.back().step >= step) {
+            segment.deltaBytes -= segment.deltas.back().bytes.size();
+            memoryUsed -= segment.deltas.back().bytes.size();
+            segment.deltas.pop_back();
+        }
+        newestStep = segment.deltas.empty() ? segment.keyframe.step : segment.deltas.back().step;
+    }
+    latestValid = false;
+}
+
+/**
+ * Encodes the particles whose elements differ from the newest recorded state in any column.
+ * Columns are compared one at a time, in the order they are stored.
+ */
+void RewindBuffer::encodeDelta(const std::vector<SnapshotColumn> &columns, uint64_t particleCount, Delta &delta) const {
+    const std::size_t count = std::size_t(particleCount);
+    std::vector<unsigned char> changed(count, 0);
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+        const std::size_t width = columns[c].elementBytes();
+        const unsigned char *now = static_cast<const unsigned char *>(columns[c].data);
+        const unsigned char *before = static_cast<const unsigned char *>(latest.columns[c].data);
+        for (std::size_t i = 0; i < count; ++i) {
+            changed[i] |= std::memcmp(now + i * width, before + i * width, width) != 0;
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    for (std::size_t i = 0; i < count; ++i) {
+        if (changed[i]) {
+            indices.push_back(uint32_t(i));
+        }
+    }
+
+    appendVarint(delta.bytes, indices.size());
+    uint32_t next = 0;
+    for (uint32_t index : indices) {
+        appendVarint(delta.bytes, index - next);
+        next = index + 1;
+    }
+    for (const SnapshotColumn &column : columns) {
+        const std::size_t width = column.elementBytes();
+        const unsigned char *now = static_cast<const unsigned char *>(column.data);
+        for (uint32_t index : indices) {
+            delta.bytes.insert(delta.bytes.end(), now + index * width, now + (index + 1) * width);
+        }
+    }
+}
+
+/**
+ * Writes the changed particles of a delta into a frame holding the state before it.
+ */
+void RewindBuffer::applyDelta(const Delta &delta, TrajectoryFrame &frame) {
+    const unsigned char *in = delta.bytes.data();
+    std::vector<uint32_t> indices(std::size_t(readVarint(in)));
+    uint32_t next = 0;
+    for (uint32_t &index : indices) {
+        index = next + uint32_t(readVarint(in));
+        next = index + 1;
+    }
+    for (const SnapshotColumn &column : frame.columns) {
+        const std::size_t width = column.elementBytes();
+        unsigned char *out = static_cast<unsigned char *>(const_cast<void *>(column.data));
+        for (uint32_t index : indices) {
+            std::memcpy(out + index * width, in, width);
+            in += width;
+        }
+    }
+}
+
+/**
+ * Drops the oldest keyframes and their deltas until the history fits the memory budget. The
+ * newest keyframe is always kept.
+ */
+void RewindBuffer::enforceBudget() {
+    while (memoryUsed > options.memoryBudget && segments.size() > 1) {
+        memoryUsed -= segments.front().keyframe.bytes.size() + segments.front().deltaBytes;
+        segments.pop_front();
+    }
+}
@@ -0,0 +1,267 @@
+//
+// Built-in parametric scenes, for comparing releases on the same representative workloads.
+//
+
+#include "Scenario.hpp"
+#include "Placement.hpp"
+#include "Random.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+const double kPi = 3.141592653589793;
+const double kRadius = 0.05;
+
+struct ScenarioInfo {
+    ScenarioKind kind;
+    const char *name;
+};
+
+const ScenarioInfo kScenarios[] = {
+    {ScenarioKind::DiluteGas, "dilute_gas"},
+    {ScenarioKind::DensePackedBox, "dense_packed_box"},
+    {ScenarioKind::CollapsingCluster, "collapsing_cluster"},
+    {ScenarioKind::TwoStream, "two_stream"},
+    {ScenarioKind::MixedMasses, "mixed_masses"},
+    {ScenarioKind::SparseHalo, "sparse_halo"},
+};
+
+/**
+ * Draws of one scene: channel c of particle i is counter c * count + i of the scenario stream, so
+ * every value depends only on the seed, the count, its channel and its particle.
+ */
+template <typename Real>
+class Draws {
+public:
+    Draws(uint64_t seed, std::size_t count) : seed(seed), count(count) {}
+
+    std::vector<Real> uniform(int channel, double low, double high) const {
+        std::vector<Real> values(count);
+        fillUniform<Real>(seed, ScenarioStream, uint64_t(channel) * count, values.data(), count, Real(low), Real(high));
+        return values;
+    }
+
+    std::vector<Real> normal(int channel, double deviation) const {
+        std::vector<Real> values(count);
+        fillNormal<Real>(seed, ScenarioStream, uint64_t(channel) * count, values.data(), count, Real(0), Real(deviation));
+        return values;
+    }
+
+private:
+    uint64_t seed;
+    std::size_t count;
+};
+
+/**
+ * Half-extent of a square box in which count particles cover the given share of the area.
+ */
+double halfExtentFor(std::size_t count, double areaFraction) {
+    return std::sqrt(double(count) * kPi * kRadius * kRadius / areaFraction) / 2.0;
+}
+
+template <typename Real>
+void resizeTable(ParticleTable<Real> &table, std::size_t count, const glm::vec3 &color) {
+    table.positions.assign(count, glm::vec<3, Real>(Real(0)));
+    table.velocities.assign(count, glm::vec<3, Real>(Real(0)));
+    table.masses.assign(count, Real(1));
+    table.colors.assign(count, color);
+}
+
+/**
+ * Uniform positions in the box, thermal velocities.
+ */
+template <typename Real>
+void fillGas(ScenarioSetup<Real> &setup, const Draws<Real> &draws, double speed) {
+    const double inner = double(setup.boundary) - kRadius;
+    const std::vector<Real> x = draws.uniform(0, -inner, inner);
+    const std::vector<Real> y = draws.uniform(1, -inner, inner);
+    const std::vector<Real> vx = draws.normal(2, speed);
+    const std::vector<Real> vy = draws.normal(3, speed);
+    for (std::size_t i = 0; i < setup.particles.size(); ++i) {
+        setup.particles.positions[i] = glm::vec<3, Real>(x[i], y[i], Real(0));
+        setup.particles.velocities[i] = glm::vec<3, Real>(vx[i], vy[i], Real(0));
+    }
+}
+
+template <typename Real>
+void diluteGas(ScenarioSetup<Real> &setup, const Draws<Real> &draws, std::size_t count) {
+    setup.boundary = Real(halfExtentFor(count, 0.02));
+    resizeTable(setup.particles, count, glm::vec3(0.55f, 0.75f, 1.0f));
+    fillGas(setup, draws, 1.0);
+}
+
+/**
+ * A lattice at half coverage over the lower 60% of the box, at rest, settling under gravity.
+ */
+template <typename Real>
+void densePackedBox(ScenarioSetup<Real> &setup, uint64_t seed, std::size_t count) {
+    const double boundary = std::sqrt(double(count) * kPi * kRadius * kRadius / 0.5 / 2.4);
+    setup.boundary = Real(boundary);
+    setup.gravity = glm::vec<3, Real>(Real(0), Real(-1), Real(0));
+    const glm::vec<2, Real> lower(Real(-boundary + kRadius), Real(-boundary + kRadius));
+    const glm::vec<2, Real> upper(Real(boundary - kRadius), Real(0.2 * boundary));
+    const std::vector<glm::vec<2, Real> > sites =
+            jitteredLattice<2, Real>(nullptr, mix64(seed), count, lower, upper, Real(2.02 * kRadius));
+    resizeTable(setup.particles, sites.size(), glm::vec3(0.9f, 0.7f, 0.3f));
+    for (std::size_t i = 0; i < sites.size(); ++i) {
+        setup.particles.positions[i] = glm::vec<3, Real>(sites[i], Real(0));
+    }
+}
+
+/**
+ * A uniform disc covering a tenth of its area, every particle moving towards the centre at a
+ * speed proportional to its distance, in a box three times as wide.
+ */
+template <typename Real>
+void collapsingCluster(ScenarioSetup<Real> &setup, const Draws<Real> &draws, std::size_t count) {
+    const double radius = std::sqrt(double(count) / 0.1) * kRadius;
+    setup.boundary = Real(3.0 * radius);
+    resizeTable(setup.particles, count, glm::vec3(1.0f, 0.5f, 0.4f));
+    const std::vector<Real> distance = draws.uniform(0, 0.0, 1.0);
+    const std::vector<Real> angle = draws.uniform(1, 0.0, 2.0 * kPi);
+    const std::vector<Real> jitter = draws.normal(2, 0.05);
+    for (std::size_t i = 0; i < count; ++i) {
+        const double r = std::sqrt(double(distance[i]));
+        const double x = r * std::cos(double(angle[i]));
+        const double y = r * std::sin(double(angle[i]));
+        setup.particles.positions[i] = glm::vec<3, Real>(Real(radius * x), Real(radius * y), Real(0));
+        setup.particles.velocities[i] = glm::vec<3, Real>(Real(-x) + jitter[i], Real(-y) - jitter[i], Real(0));
+    }
+}
+
+/**
+ * Two cold blocks of gas, one in each half of the box, flying into each other.
+ */
+template <typename Real>
+void twoStream(ScenarioSetup<Real> &setup, const Draws<Real> &draws, std::size_t count) {
+    const double boundary = halfExtentFor(count, 0.05);
+    setup.boundary = Real(boundary);
+    resizeTable(setup.particles, count, glm::vec3(0.0f));
+    const double inner = boundary - kRadius;
+    const std::vector<Real> x = draws.uniform(0, 0.1 * boundary, inner);
+    const std::vector<Real> y = draws.uniform(1, -inner, inner);
+    const std::vector<Real> vx = draws.normal(2, 0.05);
+    const std::vector<Real> vy = draws.normal(3, 0.05);
+    for (std::size_t i = 0; i < count; ++i) {
+        const Real side = i % 2 == 0 ? Real(-1) : Real(1);
+        setup.particles.positions[i] = glm::vec<3, Real>(side * x[i], y[i], Real(0));
+        setup.particles.velocities[i] = glm::vec<3, Real>(vx[i] - side, vy[i], Real(0));
+        setup.particles.colors[i] = i % 2 == 0 ? glm::vec3(1.0f, 0.35f, 0.3f) : glm::vec3(0.3f, 0.5f, 1.0f);
+    }
+}
+
+/**
+ * Gas at a tenth coverage with log-uniform masses from 1 to 100 and equal mean kinetic energy per
+ * particle, so light particles are fast and heavy ones slow.
+ */
+template <typename Real>
+void mixedMasses(ScenarioSetup<Real> &setup, const Draws<Real> &draws, std::size_t count) {
+    setup.boundary = Real(halfExtentFor(count, 0.1));
+    resizeTable(setup.particles, count, glm::vec3(0.0f));
+    fillGas(setup, draws, 1.0);
+    const std::vector<Real> exponent = draws.uniform(4, 0.0, std::log(100.0));
+    for (std::size_t i = 0; i < count; ++i) {
+        const double mass = std::exp(double(exponent[i]));
+        const float shade = float(exponent[i] / std::log(100.0));
+        setup.particles.masses[i] = Real(mass);
+        setup.particles.velocities[i] *= Real(1.0 / std::sqrt(mass));
+        setup.particles.colors[i] = glm::vec3(0.3f + 0.7f * shade, 0.8f - 0.5f * shade, 0.4f);
+    }
+}
+
+/**
+ * 70% of the particles in a core disc at 30% coverage, the rest spread over a halo ten times as
+ * wide. A grid sized for the core holds mostly empty cells. When the halo would reach maxBoundary
+ * (about 7 million particles in fixed point) both discs shrink and the core gets denser.
+ */
+template <typename Real>
+void sparseHalo(ScenarioSetup<Real> &setup, const Draws<Real> &draws, std::size_t count, double maxBoundary) {
+    const std::size_t core = count - count * 3 / 10;
+    const double haloRadius = std::min(10.0 * std::sqrt(double(core) / 0.3) * kRadius, 0.999 * maxBoundary);
+    const double coreRadius = haloRadius / 10.0;
+    if (double(core) * kRadius * kRadius > 0.9 * coreRadius * coreRadius) {
+        throw std::runtime_error("ERROR::SCENARIO::TOO_LARGE_FOR_BOUNDARY sparse_halo");
+    }
+    setup.boundary = Real(haloRadius);
+    resizeTable(setup.particles, count, glm::vec3(0.0f));
+    const std::vector<Real> distance = draws.uniform(0, 0.0, 1.0);
+    const std::vector<Real> angle = draws.uniform(1, 0.0, 2.0 * kPi);
+    const std::vector<Real> vx = draws.normal(2, 0.5);
+    const std::vector<Real> vy = draws.normal(3, 0.5);
+    const double outer = haloRadius - kRadius;
+    for (std::size_t i = 0; i < count; ++i) {
+        // Uniform over the area of the core disc or the halo annulus.
+        const bool inCore = i < core;
+        const double low = inCore ? 0.0 : coreRadius * coreRadius;
+        const double high = inCore ? coreRadius * coreRadius : outer * outer;
+        const double r = std::sqrt(low + (high - low) * double(distance[i]));
+        setup.particles.positions[i] = glm::vec<3, Real>(Real(r * std::cos(double(angle[i]))),
+                                                         Real(r * std::sin(double(angle[i]))), Real(0));
+        setup.particles.velocities[i] = glm::vec<3, Real>(vx[i], vy[i], Real(0));
+        setup.particles.colors[i] = inCore ? glm::vec3(1.0f, 0.9f, 0.5f) : glm::vec3(0.5f, 0.5f, 0.8f);
+    }
+}
+
+}
+
+std::vector<ScenarioKind> allScenarios() {
+    std::vector<ScenarioKind> kinds;
+    for (const ScenarioInfo &info : kScenarios) {
+        kinds.push_back(info.kind);
+    }
+    return kinds;
+}
+
+const char *scenarioName(ScenarioKind kind) {
+    for (const ScenarioInfo &info : kScenarios) {
+        if (info.kind == kind) {
+            return info.name;
+        }
+    }
+    return "unknown";
+}
+
+ScenarioKind scenarioNamed(const std::string &name) {
+    for (const ScenarioInfo &info : kScenarios) {
+        if (name == info.name) {
+            return info.kind;
+        }
+    }
+    throw std::runtime_error("ERROR::SCENARIO::UNKNOWN_SCENARIO " + name);
+}
+
+/**
+ * Builds a scenario. All scenes use particles of radius 0.05 and the same suggested timestep;
+ * their boxes are sized from the particle count, and only SparseHalo outgrows fixed point below
+ * ten million particles, so only it adapts to maxBoundary.
+ */
+template <typename Real>
+ScenarioSetup<Real> buildScenario(ScenarioKind kind, std::size_t count, uint64_t seed, double maxBoundary) {
+    ScenarioSetup<Real> setup;
+    setup.name = scenarioName(kind);
+    setup.particleRadius = Real(kRadius);
+    setup.gravity = glm::vec<3, Real>(Real(0));
+    setup.dt = Real(0.001);
+    // A different seed per kind, so that scenes built from one seed are not correlated.
+    const Draws<Real> draws(mix64(seed ^ (uint64_t(kind) + 1)), count);
+    switch (kind) {
+        case ScenarioKind::DiluteGas: diluteGas(setup, draws, count); break;
+        case ScenarioKind::DensePackedBox: densePackedBox(setup, seed, count); break;
+        case ScenarioKind::CollapsingCluster: collapsingCluster(setup, draws, count); break;
+        case ScenarioKind::TwoStream: twoStream(setup, draws, count); break;
+        case ScenarioKind::MixedMasses: mixedMasses(setup, draws, count); break;
+        case ScenarioKind::SparseHalo: sparseHalo(setup, draws, count, maxBoundary); break;
+        default: throw std::runtime_error("ERROR::SCENARIO::UNKNOWN_SCENARIO");
+    }
+    setup.boundary = std::max(setup.boundary, Real(4.0 * kRadius));
+    if (!(double(setup.boundary) < maxBoundary)) {
+        throw std::runtime_error("ERROR::SCENARIO::TOO_LARGE_FOR_BOUNDARY " + setup.name);
+    }
+    return setup;
+}
+
+template ScenarioSetup<float> buildScenario<float>(ScenarioKind, std::size_t, uint64_t, double);
+template ScenarioSetup<double> buildScenario<double>(ScenarioKind, std::size_t, uint64_t, double);
@@ -0,0 +1,221 @@
+//
+// Many tiny scenes simulated in lockstep, one scene per SIMD lane.
+//
+
+#include "SceneBatch.hpp"
+#include "Determinism.hpp"
+#include "Integrator.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+/**
+ * @param capacity The largest number of particles a scene can have.
+ */
+template <int Dim, typename Real, int Lanes>
+BasicSceneBatch<Dim, Real, Lanes>::BasicSceneBatch(std::size_t capacity)
+        : capacity(capacity),
+          positions(Dim * capacity, Pack::broadcast(Real(0))),
+          velocities(Dim * capacity, Pack::broadcast(Real(0))),
+          accelerations(Dim * capacity, Pack::broadcast(Real(0))),
+          masses(capacity, Pack::broadcast(Real(0))),
+          present(capacity, Pack::broadcast(Real(0))),
+          radius(Pack::broadcast(Real(0.05))),
+          boundary(Pack::broadcast(Real(1.2))) {
+    std::fill(counts, counts + Lanes, std::size_t(0));
+    for (int c = 0; c < Dim; ++c) {
+        gravity[c] = Pack::broadcast(Real(0));
+    }
+}
+
+/**
+ * Puts a scene into a lane, replacing what it held.
+ */
+template <int Dim, typename Real, int Lanes>
+void BasicSceneBatch<Dim, Real, Lanes>::setScene(int lane, const ParticleArrays<Real> &particles, Real particleRadius,
+                                                 Real halfExtent, const glm::vec<3, Real> &acceleration) {
+    if (particles.count > capacity) {
+        throw std::runtime_error("ERROR::SCENE_BATCH::SCENE_TOO_LARGE");
+    }
+    if (particles.count > 0 && particles.positions == nullptr) {
+        throw std::runtime_error("ERROR::SCENE_BATCH::MISSING_POSITIONS");
+    }
+    clearScene(lane);
+    radius.lane[lane] = particleRadius;
+    boundary.lane[lane] = halfExtent;
+    for (int c = 0; c < Dim; ++c) {
+        gravity[c].lane[lane] = acceleration[c];
+    }
+    for (std::size_t i = 0; i < particles.count; ++i) {
+        for (int c = 0; c < Dim; ++c) {
+            positions[c * capacity + i].lane[lane] = particles.positions[i][c];
+            velocities[c * capacity + i].lane[lane] = particles.velocities != nullptr ? particles.velocities[i][c] : Real(0);
+            accelerations[c * capacity + i].lane[lane] = acceleration[c]; // primeAcceleration of a uniform field
+        }
+        masses[i].lane[lane] = particles.masses != nullptr ? particles.masses[i] : Real(1);
+        present[i].lane[lane] = Real(1);
+    }
+    counts[lane] = particles.count;
+    active = *std::max_element(counts, counts + Lanes);
+}
+
+/**
+ * Empties a lane.
+ */
+template <int Dim, typename Real, int Lanes>
+void BasicSceneBatch<Dim, Real, Lanes>::clearScene(int lane) {
+    for (std::size_t i = 0; i < capacity; ++i) {
+        for (int c = 0; c < Dim; ++c) {
+            positions[c * capacity + i].lane[lane] = Real(0);
+            velocities[c * capacity + i].lane[lane] = Real(0);
+            accelerations[c * capacity + i].lane[lane] = Real(0);
+        }
+        masses[i].lane[lane] = Real(0);
+        present[i].lane[lane] = Real(0);
+    }
+    counts[lane] = 0;
+    active = *std::max_element(counts, counts + Lanes);
+}
+
+/**
+ * Resolves every overlapping, approaching pair of every scene, as resolveContact does, with the
+ * decision made per lane by masks so all lanes run the same instructions.
+ */
+template <int Dim, typename Real, int Lanes>
+void BasicSceneBatch<Dim, Real, Lanes>::handleCollisions() {
+    Pack *x = positions.data();
+    Pack *v = velocities.data();
+    const std::size_t stride = capacity;
+
+    Pack reachSquared;
+    for (int l = 0; l < Lanes; ++l) {
+        reachSquared.lane[l] = Real(4) * radius.lane[l] * radius.lane[l];
+    }
+
+    for (std::size_t i = 0; i < active; ++i) {
+        for (std::size_t j = i + 1; j < active; ++j) {
+            // Most pairs are apart in every lane; a cheap distance test skips the response for them.
+            int near = 0;
+            for (int l = 0; l < Lanes; ++l) {
+                Real distanceSquared = Real(0);
+                for (int c = 0; c < Dim; ++c) {
+                    const Real d = x[c * stride + i].lane[l] - x[c * stride + j].lane[l];
+                    distanceSquared += d * d;
+                }
+                near |= int(distanceSquared < reachSquared.lane[l] && present[i].lane[l] * present[j].lane[l] > Real(0));
+            }
+            if (near == 0) {
+                continue;
+            }
+
+            for (int l = 0; l < Lanes; ++l) {
+                Real diff[Dim];
+                Real distanceSquared = Real(0);
+                for (int c = 0; c < Dim; ++c) {
+                    diff[c] = x[c * stride + i].lane[l] - x[c * stride + j].lane[l];
+                    distanceSquared += diff[c] * diff[c];
+                }
+                const Real distance = std::sqrt(distanceSquared);
+                const Real reach = Real(2) * radius.lane[l];
+                const bool overlapping = present[i].lane[l] * present[j].lane[l] > Real(0) &&
+                                         distance < reach && distance > Real(0);
+                const Real inverse = Real(1) / (overlapping ? distance : Real(1));
+
+                Real normal[Dim];
+                Real impulse = Real(0);
+                for (int c = 0; c < Dim; ++c) {
+                    normal[c] = diff[c] * inverse;
+                    impulse += (v[c * stride + i].lane[l] - v[c * stride + j].lane[l]) * normal[c];
+                }
+                const bool contact = overlapping && impulse < Real(0);
+
+                const Real massI = masses[i].lane[l];
+                const Real massJ = masses[j].lane[l];
+                const Real total = contact ? massI + massJ : Real(1);
+                const Real push = contact ? (reach - distance) / Real(2) : Real(0);
+                const Real kickI = contact ? Real(2) * massJ / total * impulse : Real(0);
+                const Real kickJ = contact ? Real(2) * massI / total * impulse : Real(0);
+                for (int c = 0; c < Dim; ++c) {
+                    x[c * stride + i].lane[l] += push * normal[c];
+                    x[c * stride + j].lane[l] -= push * normal[c];
+                    v[c * stride + i].lane[l] -= kickI * normal[c];
+                    v[c * stride + j].lane[l] += kickJ * normal[c];
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Advances every scene over the time interval, in the same passes as Simulation::simulate.
+ */
+template <int Dim, typename Real, int Lanes>
+void BasicSceneBatch<Dim, Real, Lanes>::simulate(Real dt) {
+    for (int iteration = 0; iteration < numIterations; ++iteration) {
+        handleCollisions();
+        // The boundary reflection of integrateParticles, then the integrator one component at a
+        // time: with a uniform field the components are independent.
+        for (std::size_t i = 0; i < active; ++i) {
+            for (int c = 0; c < Dim; ++c) {
+                Pack &x = positions[c * capacity + i];
+                Pack &v = velocities[c * capacity + i];
+                for (int l = 0; l < Lanes; ++l) {
+                    v.lane[l] = std::abs(x.lane[l]) > boundary.lane[l] ? -v.lane[l] : v.lane[l];
+                }
+                ActiveIntegrator::step(x, v, accelerations[c * capacity + i], UniformField<Pack>{gravity[c]}, dt);
+            }
+        }
+    }
+    time += double(dt) * numIterations;
+    ++stepCount;
+}
+
+template <int Dim, typename Real, int Lanes>
+Real BasicSceneBatch<Dim, Real, Lanes>::kineticEnergy(int lane) const {
+    Real energy = Real(0);
+    for (std::size_t i = 0; i < counts[lane]; ++i) {
+        Real speedSquared = Real(0);
+        for (int c = 0; c < Dim; ++c) {
+            const Real component = velocities[c * capacity + i].lane[lane];
+            speedSquared += component * component;
+        }
+        energy += Real(0.5) * masses[i].lane[lane] * speedSquared;
+    }
+    return energy;
+}
+
+/**
+ * Copies a scene's positions and velocities out.
+ */
+template <int Dim, typename Real, int Lanes>
+void BasicSceneBatch<Dim, Real, Lanes>::getState(int lane, Vec *outPositions, Vec *outVelocities) const {
+    for (std::size_t i = 0; i < counts[lane]; ++i) {
+        for (int c = 0; c < Dim; ++c) {
+            outPositions[i][c] = positions[c * capacity + i].lane[lane];
+            outVelocities[i][c] = velocities[c * capacity + i].lane[lane];
+        }
+    }
+}
+
+/**
+ * Returns a hash of a scene's positions and velocities, equal to Simulation::stateHash for the
+ * same state.
+ */
+template <int Dim, typename Real, int Lanes>
+uint64_t BasicSceneBatch<Dim, Real, Lanes>::stateHash(int lane) const {
+    std::vector<Vec> laneX(counts[lane]);
+    std::vector<Vec> laneV(counts[lane]);
+    getState(lane, laneX.data(), laneV.data());
+    const uint64_t hash = hashBytes(laneX.data(), laneX.size() * sizeof(Vec));
+    return hashBytes(laneV.data(), laneV.size() * sizeof(Vec), hash);
+}
+
+template class BasicSceneBatch<2, float, 8>;
+template class BasicSceneBatch<3, float, 8>;
+template class BasicSceneBatch<2, double, 8>;
+template class BasicSceneBatch<3, double, 8>;
+template class BasicSceneBatch<2, float, 16>;
+template class BasicSceneBatch<3, float, 16>;
+template class BasicSceneBatch<2, double, 16>;
+template class BasicSceneBatch<3, double, 16>;
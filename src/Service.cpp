@@ -0,0 +1,904 @@
+//
+// A simulation daemon on a Unix domain socket, and the client side of its protocol.
+//
+
+#include "Service.hpp"
+#include "ByteOrder.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const char kRequestMagic[4] = {'P', 'S', 'R', 'Q'};
+const char kReplyMagic[4] = {'P', 'S', 'R', 'S'};
+const std::size_t kHeaderBytes = 16; // Batches, commands and replies all start with 16 bytes
+const uint64_t kMaxBatchBytes = uint64_t(1) << 30;
+const std::size_t kMaxPendingOutput = std::size_t(64) << 20; // Replies queued before execution pauses
+const std::size_t kMaxPendingInput = std::size_t(64) << 20; // Input buffered beyond the batch being received
+const std::size_t kReadChunk = std::size_t(256) << 10;
+
+typedef Simulation::Real Real;
+
+/**
+ * A command that cannot be carried out; becomes a reply with the given status.
+ */
+struct CommandError {
+    ServiceStatus status;
+    std::string message;
+};
+
+void append32(std::vector<unsigned char> &out, uint32_t value) {
+    const std::size_t at = out.size();
+    out.resize(at + 4);
+    put32(&out[at], value);
+}
+
+void append64(std::vector<unsigned char> &out, uint64_t value) {
+    const std::size_t at = out.size();
+    out.resize(at + 8);
+    put64(&out[at], value);
+}
+
+void appendDouble(std::vector<unsigned char> &out, double value) {
+    const std::size_t at = out.size();
+    out.resize(at + 8);
+    putDouble(&out[at], value);
+}
+
+void appendBytes(std::vector<unsigned char> &out, const void *data, std::size_t bytes) {
+    const std::size_t at = out.size();
+    out.resize(at + bytes);
+    if (bytes > 0) {
+        std::memcpy(&out[at], data, bytes);
+    }
+}
+
+void appendFloat(std::vector<unsigned char> &out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    append32(out, bits);
+}
+
+float getFloat(const unsigned char *in) {
+    const uint32_t bits = get32(in);
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+uint32_t read32(ServiceCursor &body) {
+    uint32_t value;
+    if (!body.u32(value)) {
+        throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::SHORT_COMMAND"};
+    }
+    return value;
+}
+
+uint64_t read64(ServiceCursor &body) {
+    uint64_t value;
+    if (!body.u64(value)) {
+        throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::SHORT_COMMAND"};
+    }
+    return value;
+}
+
+double readDouble(ServiceCursor &body) {
+    double value;
+    if (!body.f64(value)) {
+        throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::SHORT_COMMAND"};
+    }
+    return value;
+}
+
+/**
+ * Reads count vectors of three floats, or count floats when width is 1.
+ */
+const unsigned char *readFloats(ServiceCursor &body, uint64_t count, uint64_t width) {
+    const unsigned char *data = nullptr;
+    if (count > body.remaining() / (4 * width) || !body.bytes(count * 4 * width, data)) {
+        throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::SHORT_COMMAND"};
+    }
+    return data;
+}
+
+bool hasField(uint32_t fields, SnapshotColumnId id) {
+    return (fields & trajectoryAttribute(id)) != 0;
+}
+
+void setNonBlocking(int fd) {
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+sockaddr_un socketAddress(const std::string &path) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("ERROR::SERVICE::BAD_SOCKET_PATH " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+}
+
+bool ServiceCursor::u32(uint32_t &value) {
+    if (remaining() < 4) {
+        at = end;
+        return false;
+    }
+    value = get32(at);
+    at += 4;
+    return true;
+}
+
+bool ServiceCursor::u64(uint64_t &value) {
+    if (remaining() < 8) {
+        at = end;
+        return false;
+    }
+    value = get64(at);
+    at += 8;
+    return true;
+}
+
+bool ServiceCursor::f64(double &value) {
+    if (remaining() < 8) {
+        at = end;
+        return false;
+    }
+    value = getDouble(at);
+    at += 8;
+    return true;
+}
+
+/**
+ * Points data at the next count bytes and skips them.
+ */
+bool ServiceCursor::bytes(uint64_t count, const unsigned char *&data) {
+    if (remaining() < count) {
+        at = end;
+        return false;
+    }
+    data = at;
+    at += count;
+    return true;
+}
+
+ServiceRequest::ServiceRequest() {
+    clear();
+}
+
+void ServiceRequest::clear() {
+    buffer.assign(kHeaderBytes, 0);
+    std::memcpy(buffer.data(), kRequestMagic, sizeof(kRequestMagic));
+    count = 0;
+}
+
+/**
+ * Starts a command and returns its offset in the buffer.
+ */
+std::size_t ServiceRequest::begin(ServiceOp op) {
+    const std::size_t command = buffer.size();
+    append32(buffer, uint32_t(op));
+    append32(buffer, 0);
+    append64(buffer, 0);
+    return command;
+}
+
+/**
+ * Fills in the sizes of a finished command and of the batch.
+ */
+void ServiceRequest::end(std::size_t command) {
+    put64(&buffer[command + 8], buffer.size() - command - kHeaderBytes);
+    ++count;
+    put32(&buffer[4], count);
+    put64(&buffer[8], buffer.size() - kHeaderBytes);
+}
+
+void ServiceRequest::createScene(double radius, double boundary, uint32_t iterations, const glm::dvec3 &gravity,
+                                 uint64_t seed) {
+    const std::size_t command = begin(ServiceOp::CreateScene);
+    appendDouble(buffer, radius);
+    appendDouble(buffer, boundary);
+    append32(buffer, iterations);
+    append32(buffer, 0);
+    for (int axis = 0; axis < 3; ++axis) {
+        appendDouble(buffer, gravity[axis]);
+    }
+    append64(buffer, seed);
+    end(command);
+}
+
+void ServiceRequest::destroyScene(uint32_t scene) {
+    const std::size_t command = begin(ServiceOp::DestroyScene);
+    append32(buffer, scene);
+    end(command);
+}
+
+void ServiceRequest::spawnRandom(uint32_t scene, uint64_t particles) {
+    const std::size_t command = begin(ServiceOp::SpawnRandom);
+    append32(buffer, scene);
+    append32(buffer, 0);
+    append64(buffer, particles);
+    end(command);
+}
+
+/**
+ * Adds particles with the attributes the arrays have; the others take their defaults.
+ */
+void ServiceRequest::spawnParticles(uint32_t scene, const ParticleArrays<float> &arrays) {
+    uint32_t fields = 0;
+    if (arrays.velocities != nullptr) {
+        fields |= trajectoryAttribute(SnapshotColumnId::Velocity);
+    }
+    if (arrays.masses != nullptr) {
+        fields |= trajectoryAttribute(SnapshotColumnId::Mass);
+    }
+    if (arrays.colors != nullptr) {
+        fields |= trajectoryAttribute(SnapshotColumnId::Color);
+    }
+    const std::size_t command = begin(ServiceOp::SpawnParticles);
+    append32(buffer, scene);
+    append32(buffer, fields);
+    append64(buffer, arrays.count);
+    buffer.reserve(buffer.size() + arrays.count * 4 * 10);
+    for (std::size_t i = 0; i < arrays.count; ++i) {
+        for (int axis = 0; axis < 3; ++axis) {
+            appendFloat(buffer, arrays.positions[i][axis]);
+        }
+    }
+    if (arrays.velocities != nullptr) {
+        for (std::size_t i = 0; i < arrays.count; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                appendFloat(buffer, arrays.velocities[i][axis]);
+            }
+        }
+    }
+    if (arrays.masses != nullptr) {
+        for (std::size_t i = 0; i < arrays.count; ++i) {
+            appendFloat(buffer, arrays.masses[i]);
+        }
+    }
+    if (arrays.colors != nullptr) {
+        for (std::size_t i = 0; i < arrays.count; ++i) {
+            for (int axis = 0; axis < 3; ++axis) {
+                appendFloat(buffer, arrays.colors[i][axis]);
+            }
+        }
+    }
+    end(command);
+}
+
+void ServiceRequest::step(uint32_t scene, uint32_t steps, double dt) {
+    const std::size_t command = begin(ServiceOp::Step);
+    append32(buffer, scene);
+    append32(buffer, steps);
+    appendDouble(buffer, dt);
+    end(command);
+}
+
+void ServiceRequest::queryRegion(uint32_t scene, const glm::dvec3 &lower, const glm::dvec3 &upper,
+                                 uint32_t maxResults) {
+    const std::size_t command = begin(ServiceOp::QueryRegion);
+    append32(buffer, scene);
+    append32(buffer, maxResults);
+    for (int axis = 0; axis < 3; ++axis) {
+        appendDouble(buffer, lower[axis]);
+    }
+    for (int axis = 0; axis < 3; ++axis) {
+        appendDouble(buffer, upper[axis]);
+    }
+    end(command);
+}
+
+/**
+ * Asks for particle attributes, inline or through a shared memory region.
+ */
+void ServiceRequest::fetchState(uint32_t scene, uint32_t attributes, bool sharedMemory) {
+    const std::size_t command = begin(ServiceOp::FetchState);
+    append32(buffer, scene);
+    append32(buffer, attributes);
+    append32(buffer, sharedMemory ? 1 : 0);
+    append32(buffer, 0);
+    end(command);
+}
+
+void ServiceRequest::sceneInfo(uint32_t scene) {
+    const std::size_t command = begin(ServiceOp::SceneInfo);
+    append32(buffer, scene);
+    end(command);
+}
+
+/**
+ * Connects to the service.
+ * @param path The socket path the service listens on.
+ */
+ServiceClient::ServiceClient(const std::string &path) {
+    const sockaddr_un address = socketAddress(path);
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::SERVICE::CANNOT_CREATE_SOCKET");
+    }
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("ERROR::SERVICE::CANNOT_CONNECT " + path);
+    }
+}
+
+ServiceClient::~ServiceClient() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+}
+
+/**
+ * Sends a batch without waiting for its replies.
+ */
+void ServiceClient::send(const ServiceRequest &request) {
+    const unsigned char *data = request.bytes().data();
+    std::size_t left = request.bytes().size();
+    while (left > 0) {
+        const ssize_t sent = ::send(fd, data, left, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("ERROR::SERVICE::SEND_FAILED");
+        }
+        data += sent;
+        left -= std::size_t(sent);
+    }
+}
+
+/**
+ * Waits for the replies to the oldest batch not yet received.
+ */
+void ServiceClient::receive(ServiceReplies &out) {
+    auto readFully = [this](unsigned char *data, std::size_t bytes) {
+        while (bytes > 0) {
+            const ssize_t got = ::recv(fd, data, bytes, 0);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                throw std::runtime_error("ERROR::SERVICE::CONNECTION_CLOSED");
+            }
+            data += got;
+            bytes -= std::size_t(got);
+        }
+    };
+
+    unsigned char header[kHeaderBytes];
+    readFully(header, sizeof(header));
+    if (std::memcmp(header, kReplyMagic, sizeof(kReplyMagic)) != 0) {
+        throw std::runtime_error("ERROR::SERVICE::MALFORMED_REPLY");
+    }
+    const uint32_t count = get32(header + 4);
+    const uint64_t bytes = get64(header + 8);
+    out.buffer.resize(std::size_t(bytes));
+    readFully(out.buffer.data(), out.buffer.size());
+
+    out.replies.clear();
+    out.replies.reserve(count);
+    ServiceCursor cursor(out.buffer.data(), bytes);
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t op = 0;
+        uint32_t status = 0;
+        ServiceReply reply;
+        if (!cursor.u32(op) || !cursor.u32(status) || !cursor.u64(reply.bodyBytes) ||
+            !cursor.bytes(reply.bodyBytes, reply.body)) {
+            throw std::runtime_error("ERROR::SERVICE::MALFORMED_REPLY");
+        }
+        reply.op = ServiceOp(op);
+        reply.status = ServiceStatus(status);
+        out.replies.push_back(reply);
+    }
+}
+
+/**
+ * Maps the shared memory region a FetchState reply names and points frame at the state.
+ */
+bool ServiceClient::sharedState(const ServiceReply &reply, SharedFrame &frame) {
+    if (reply.op != ServiceOp::FetchState || !reply.ok()) {
+        return false;
+    }
+    ServiceCursor body = reply.cursor();
+    uint64_t step, particleCount, published;
+    double time;
+    uint32_t columns, shared, nameBytes;
+    const unsigned char *name = nullptr;
+    if (!body.u64(step) || !body.f64(time) || !body.u64(particleCount) || !body.u32(columns) ||
+        !body.u32(shared) || shared == 0 || !body.u32(nameBytes) || !body.bytes(nameBytes, name) ||
+        !body.u64(published)) {
+        return false;
+    }
+
+    const std::string object(reinterpret_cast<const char *>(name), nameBytes);
+    std::unique_ptr<SharedStateReader> &reader = readers[object];
+    if (!reader) {
+        reader.reset(new SharedStateReader(object));
+    }
+    // Only the latest frame can be found; one fetched before it has been superseded.
+    SharedFrame read;
+    if (!reader->latest(read) || read.frame != published) {
+        return false;
+    }
+    frame = std::move(read);
+    return true;
+}
+
+/**
+ * Creates the socket, replacing a stale one at path.
+ * @param path The socket path.
+ * @param pool Threads the scenes simulate on, or null.
+ */
+SimulationService::SimulationService(const std::string &path, ThreadPool *pool) : path(path), pool(pool) {
+    const sockaddr_un address = socketAddress(path);
+    if (::pipe(wake) != 0) {
+        throw std::runtime_error("ERROR::SERVICE::CANNOT_CREATE_PIPE");
+    }
+    setNonBlocking(wake[0]);
+    setNonBlocking(wake[1]);
+
+    listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        ::close(wake[0]);
+        ::close(wake[1]);
+        throw std::runtime_error("ERROR::SERVICE::CANNOT_CREATE_SOCKET");
+    }
+    ::unlink(path.c_str());
+    if (::bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0 ||
+        ::listen(listener, SOMAXCONN) != 0) {
+        ::close(listener);
+        ::close(wake[0]);
+        ::close(wake[1]);
+        throw std::runtime_error("ERROR::SERVICE::CANNOT_LISTEN " + path);
+    }
+    setNonBlocking(listener);
+}
+
+/**
+ * Closes every connection and removes the socket.
+ */
+SimulationService::~SimulationService() {
+    for (const std::unique_ptr<Connection> &connection : connections) {
+        ::close(connection->fd);
+    }
+    ::close(listener);
+    ::unlink(path.c_str());
+    ::close(wake[0]);
+    ::close(wake[1]);
+}
+
+/**
+ * Makes run() return; only writes to a pipe, so it is async-signal-safe.
+ */
+void SimulationService::stop() {
+    const char byte = 1;
+    ssize_t ignored = ::write(wake[1], &byte, 1);
+    (void) ignored;
+}
+
+/**
+ * Serves until stop() is called.
+ */
+void SimulationService::run() {
+    std::vector<pollfd> polled;
+    for (;;) {
+        polled.clear();
+        polled.push_back(pollfd{wake[0], POLLIN, 0});
+        polled.push_back(pollfd{listener, POLLIN, 0});
+        for (const std::unique_ptr<Connection> &connection : connections) {
+            const short events = short((wantsInput(*connection) ? POLLIN : 0) |
+                                       (connection->written < connection->output.size() ? POLLOUT : 0));
+            polled.push_back(pollfd{connection->fd, events, 0});
+        }
+        if (::poll(polled.data(), polled.size(), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("ERROR::SERVICE::POLL_FAILED");
+        }
+        if (polled[0].revents != 0) {
+            char drained[64];
+            while (::read(wake[0], drained, sizeof(drained)) > 0) {
+            }
+            return;
+        }
+
+        for (std::size_t c = 0; c < connections.size(); ++c) {
+            Connection &connection = *connections[c];
+            const short events = polled[2 + c].revents;
+            bool open = true;
+            if ((events & (POLLIN | POLLHUP | POLLERR)) != 0) {
+                open = readInput(connection);
+            }
+            // Alternate between executing and sending, so that a client that has pipelined many
+            // batches gets its replies while the output stays bounded.
+            bool executed = false;
+            while (open) {
+                executed = executeBatches(connection);
+                open = writeOutput(connection);
+                if (!executed || connection.output.size() - connection.written >= kMaxPendingOutput) {
+                    break;
+                }
+            }
+            // A client that has stopped sending is closed once every batch it completed is answered
+            if (open && connection.inputClosed && !executed && connection.output.empty()) {
+                open = false;
+            }
+            if (!open) {
+                ::close(connection.fd);
+                connection.fd = -1;
+            }
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                         [](const std::unique_ptr<Connection> &connection) { return connection->fd < 0; }),
+                          connections.end());
+
+        if ((polled[1].revents & POLLIN) != 0) {
+            for (;;) {
+                const int fd = ::accept(listener, nullptr, nullptr);
+                if (fd < 0) {
+                    break;
+                }
+                setNonBlocking(fd);
+                std::unique_ptr<Connection> connection(new Connection());
+                connection->fd = fd;
+                connection->id = nextConnection++;
+                connections.push_back(std::move(connection));
+            }
+        }
+    }
+}
+
+/**
+ * Returns whether to read more from a client: until it shuts down its side, and while the
+ * buffered input is below kMaxPendingInput or short of the first batch. A client that sends
+ * without reading its replies therefore stalls once execution pauses on the output bound.
+ */
+bool SimulationService::wantsInput(const Connection &connection) const {
+    if (connection.inputClosed) {
+        return false;
+    }
+    std::size_t limit = kMaxPendingInput;
+    if (connection.input.size() >= kHeaderBytes) {
+        const uint64_t batch = std::min<uint64_t>(get64(&connection.input[8]), kMaxBatchBytes);
+        limit = std::max(limit, kHeaderBytes + std::size_t(batch));
+    }
+    return connection.input.size() < limit;
+}
+
+/**
+ * Reads what has arrived, up to the input bound. Returns false on a broken connection; the end
+ * of the client's stream only marks the input closed, so batches already received still run.
+ */
+bool SimulationService::readInput(Connection &connection) {
+    while (wantsInput(connection)) {
+        const std::size_t at = connection.input.size();
+        connection.input.resize(at + kReadChunk);
+        const ssize_t got = ::recv(connection.fd, &connection.input[at], kReadChunk, 0);
+        connection.input.resize(at + std::size_t(std::max<ssize_t>(got, 0)));
+        if (got > 0) {
+            continue;
+        }
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got == 0) {
+            connection.inputClosed = true;
+            return true;
+        }
+        return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    return true;
+}
+
+/**
+ * Sends as much of the queued output as the socket takes. Returns false on a broken connection.
+ */
+bool SimulationService::writeOutput(Connection &connection) {
+    while (connection.written < connection.output.size()) {
+        const ssize_t sent = ::send(connection.fd, &connection.output[connection.written],
+                                    connection.output.size() - connection.written, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection.written += std::size_t(sent);
+    }
+    connection.output.clear();
+    connection.written = 0;
+    return true;
+}
+
+/**
+ * Executes the complete batches that have arrived, queueing their replies, until the queued
+ * output reaches its bound. Returns false if nothing was executed; closes a connection that breaks
+ * the framing by throwing its fd away. A command that runs past the end of its batch ends the
+ * batch: it is answered with an error and the entries after it are not answered at all.
+ */
+bool SimulationService::executeBatches(Connection &connection) {
+    std::size_t consumed = 0;
+    bool executed = false;
+    while (connection.input.size() - consumed >= kHeaderBytes &&
+           connection.output.size() - connection.written < kMaxPendingOutput) {
+        const unsigned char *batch = &connection.input[consumed];
+        const uint32_t count = get32(batch + 4);
+        const uint64_t bytes = get64(batch + 8);
+        // Every entry takes at least a header, so a count the bytes cannot hold breaks the framing
+        if (std::memcmp(batch, kRequestMagic, sizeof(kRequestMagic)) != 0 || bytes > kMaxBatchBytes ||
+            count > bytes / kHeaderBytes) {
+            // The stream cannot be resynchronised; drop the client.
+            ::shutdown(connection.fd, SHUT_RDWR);
+            connection.input.clear();
+            return false;
+        }
+        if (connection.input.size() - consumed - kHeaderBytes < bytes) {
+            break;
+        }
+
+        std::vector<unsigned char> &out = connection.output;
+        const std::size_t replies = out.size();
+        appendBytes(out, kReplyMagic, sizeof(kReplyMagic));
+        append32(out, count);
+        append64(out, 0);
+        ServiceCursor commands(batch + kHeaderBytes, bytes);
+        uint32_t answered = 0;
+        for (bool framed = true; framed && answered < count; ++answered) {
+            uint32_t op = 0;
+            uint32_t reserved = 0;
+            uint64_t bodyBytes = 0;
+            const unsigned char *body = nullptr;
+            framed = commands.u32(op) && commands.u32(reserved) && commands.u64(bodyBytes) &&
+                     commands.bytes(bodyBytes, body);
+
+            const std::size_t reply = out.size();
+            append32(out, op);
+            append32(out, uint32_t(ServiceStatus::Ok));
+            append64(out, 0);
+            ServiceStatus status = ServiceStatus::Ok;
+            std::string message;
+            try {
+                if (!framed) {
+                    throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::TRUNCATED_BATCH"};
+                }
+                ServiceCursor cursor(body, bodyBytes);
+                execute(ServiceOp(op), cursor, connection);
+            } catch (const CommandError &error) {
+                status = error.status;
+                message = error.message;
+            } catch (const std::exception &error) {
+                status = ServiceStatus::Failed;
+                message = error.what();
+            }
+            if (status != ServiceStatus::Ok) {
+                out.resize(reply + kHeaderBytes);
+                appendBytes(out, message.data(), message.size());
+                put32(&out[reply + 4], uint32_t(status));
+            }
+            put64(&out[reply + 8], out.size() - reply - kHeaderBytes);
+        }
+        put32(&out[replies + 4], answered);
+        put64(&out[replies + 8], out.size() - replies - kHeaderBytes);
+
+        consumed += kHeaderBytes + std::size_t(bytes);
+        executed = true;
+    }
+    connection.input.erase(connection.input.begin(), connection.input.begin() + std::ptrdiff_t(consumed));
+    return executed;
+}
+
+/**
+ * Carries out one command and appends its reply body to the connection's output.
+ * Throws CommandError, or whatever the simulation throws, if it cannot.
+ */
+void SimulationService::execute(ServiceOp op, ServiceCursor &body, Connection &connection) {
+    std::vector<unsigned char> &out = connection.output;
+    if (op == ServiceOp::CreateScene) {
+        const double radius = readDouble(body);
+        const double boundary = readDouble(body);
+        const uint32_t iterations = read32(body);
+        read32(body);
+        glm::vec<3, Real> gravity;
+        for (int axis = 0; axis < 3; ++axis) {
+            gravity[axis] = Real(readDouble(body));
+        }
+        const uint64_t seed = read64(body);
+        if (!(radius > 0.0) || !(boundary > radius) || iterations == 0 || iterations > uint32_t(INT_MAX)) {
+            throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::BAD_SCENE_PARAMETERS"};
+        }
+        if (!(boundary < Simulation::maxBoundary())) {
+            throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::BOUNDARY_OUT_OF_RANGE"};
+        }
+        std::unique_ptr<Simulation> scene(new Simulation());
+        scene->setParticleRadius(Real(radius));
+        scene->setBoundary(Real(boundary));
+        scene->setIterations(int(iterations));
+        scene->setGravity(gravity);
+        scene->setSeed(seed);
+        scene->setThreadPool(pool);
+        const uint32_t id = nextScene++;
+        scenes[id] = std::move(scene);
+        append32(out, id);
+        return;
+    }
+
+    if (uint32_t(op) < uint32_t(ServiceOp::DestroyScene) || uint32_t(op) > uint32_t(ServiceOp::SceneInfo)) {
+        throw CommandError{ServiceStatus::UnknownCommand,
+                           "ERROR::SERVICE::UNKNOWN_COMMAND " + std::to_string(uint32_t(op))};
+    }
+    const uint32_t id = read32(body);
+    const auto found = scenes.find(id);
+    if (found == scenes.end()) {
+        throw CommandError{ServiceStatus::UnknownScene, "ERROR::SERVICE::UNKNOWN_SCENE " + std::to_string(id)};
+    }
+    Simulation &scene = *found->second;
+
+    switch (op) {
+        case ServiceOp::DestroyScene:
+            scenes.erase(found);
+            return;
+
+        case ServiceOp::SpawnRandom: {
+            read32(body);
+            const uint64_t count = read64(body);
+            if (count > uint64_t(INT_MAX)) {
+                throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::TOO_MANY_PARTICLES"};
+            }
+            scene.addRandomParticles(int(count));
+            append64(out, scene.getParticleCount());
+            return;
+        }
+
+        case ServiceOp::SpawnParticles: {
+            const uint32_t fields = read32(body);
+            const uint64_t count = read64(body);
+            // Check the body holds every column before allocating anything for an untrusted count
+            const uint64_t width = 3 + (hasField(fields, SnapshotColumnId::Velocity) ? 3 : 0) +
+                                   (hasField(fields, SnapshotColumnId::Mass) ? 1 : 0) +
+                                   (hasField(fields, SnapshotColumnId::Color) ? 3 : 0);
+            if (count > body.remaining() / (4 * width)) {
+                throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::SHORT_COMMAND"};
+            }
+            const std::size_t n = std::size_t(count);
+            std::vector<glm::vec<3, Real> > positions(n);
+            std::vector<glm::vec<3, Real> > velocities;
+            std::vector<Real> masses;
+            std::vector<glm::vec3> colors;
+            ParticleArrays<Real> arrays;
+            arrays.count = n;
+
+            const unsigned char *data = readFloats(body, count, 3);
+            for (std::size_t i = 0; i < n; ++i, data += 12) {
+                positions[i] = glm::vec<3, Real>(Real(getFloat(data)), Real(getFloat(data + 4)), Real(getFloat(data + 8)));
+            }
+            arrays.positions = positions.data();
+            if (hasField(fields, SnapshotColumnId::Velocity)) {
+                data = readFloats(body, count, 3);
+                velocities.resize(n);
+                for (std::size_t i = 0; i < n; ++i, data += 12) {
+                    velocities[i] = glm::vec<3, Real>(Real(getFloat(data)), Real(getFloat(data + 4)), Real(getFloat(data + 8)));
+                }
+                arrays.velocities = velocities.data();
+            }
+            if (hasField(fields, SnapshotColumnId::Mass)) {
+                data = readFloats(body, count, 1);
+                masses.resize(n);
+                for (std::size_t i = 0; i < n; ++i, data += 4) {
+                    masses[i] = Real(getFloat(data));
+                }
+                arrays.masses = masses.data();
+            }
+            if (hasField(fields, SnapshotColumnId::Color)) {
+                data = readFloats(body, count, 3);
+                colors.resize(n);
+                for (std::size_t i = 0; i < n; ++i, data += 12) {
+                    colors[i] = glm::vec3(getFloat(data), getFloat(data + 4), getFloat(data + 8));
+                }
+                arrays.colors = colors.data();
+            }
+            scene.addParticles(arrays);
+            append64(out, scene.getParticleCount());
+            return;
+        }
+
+        case ServiceOp::Step: {
+            const uint32_t steps = read32(body);
+            const double dt = readDouble(body);
+            if (!(dt > 0.0)) {
+                throw CommandError{ServiceStatus::Malformed, "ERROR::SERVICE::BAD_TIMESTEP"};
+            }
+            for (uint32_t s = 0; s < steps; ++s) {
+                scene.simulate(Real(dt));
+            }
+            append64(out, scene.getStepCount());
+            appendDouble(out, scene.getTime());
+            return;
+        }
+
+        case ServiceOp::QueryRegion: {
+            const uint32_t maxResults = read32(body);
+            glm::dvec3 lower, upper;
+            for (int axis = 0; axis < 3; ++axis) {
+                lower[axis] = readDouble(body);
+            }
+            for (int axis = 0; axis < 3; ++axis) {
+                upper[axis] = readDouble(body);
+            }
+            const std::size_t header = out.size();
+            append64(out, 0);
+            append32(out, 0);
+            const auto &positions = scene.getParticles().positions;
+            uint64_t matches = 0;
+            uint32_t returned = 0;
+            for (std::size_t i = 0; i < positions.size(); ++i) {
+                const glm::dvec3 p(toVec3(asVector(positions[i])));
+                if (glm::all(glm::greaterThanEqual(p, lower)) && glm::all(glm::lessThanEqual(p, upper))) {
+                    if (returned < maxResults && i <= UINT32_MAX) {
+                        append32(out, uint32_t(i));
+                        ++returned;
+                    }
+                    ++matches;
+                }
+            }
+            put64(&out[header], matches);
+            put32(&out[header + 8], returned);
+            return;
+        }
+
+        case ServiceOp::FetchState: {
+            const uint32_t attributes = read32(body);
+            const bool sharedMemory = read32(body) != 0;
+            const std::vector<SnapshotColumn> columns = scene.describeParticles(attributes);
+            append64(out, scene.getStepCount());
+            appendDouble(out, scene.getTime());
+            append64(out, scene.getParticleCount());
+            append32(out, uint32_t(columns.size()));
+            append32(out, sharedMemory ? 1 : 0);
+            if (sharedMemory) {
+                const std::string name = "/psim-service-" + std::to_string(::getpid()) + "-" +
+                                         std::to_string(connection.id);
+                if (!connection.sharedState) {
+                    connection.sharedState.reset(new SharedStateWriter(name, SIM_DIMENSION));
+                }
+                connection.sharedState->publish(scene.getStepCount(), scene.getTime(), scene.getParticleCount(), columns);
+                append32(out, uint32_t(name.size()));
+                appendBytes(out, name.data(), name.size());
+                append64(out, connection.sharedState->getPublished());
+                return;
+            }
+            for (const SnapshotColumn &column : columns) {
+                append32(out, uint32_t(column.id));
+                append32(out, uint32_t(column.scalar));
+                append32(out, column.components);
+                append32(out, column.fractionBits);
+                append64(out, column.bytes);
+                appendBytes(out, column.data, std::size_t(column.bytes));
+            }
+            return;
+        }
+
+        case ServiceOp::SceneInfo:
+            append64(out, scene.getParticleCount());
+            append64(out, scene.getStepCount());
+            appendDouble(out, scene.getTime());
+            return;
+
+        default:
+            throw CommandError{ServiceStatus::UnknownCommand,
+                               "ERROR::SERVICE::UNKNOWN_COMMAND " + std::to_string(uint32_t(op))};
+    }
+}
@@ -0,0 +1,313 @@
+//
+// Live particle state in POSIX shared memory, for viewers and analysis tools in other processes.
+//
+
+#include "SharedState.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'P', 'S', 'I', 'M', 'S', 'H', 'M', '1'};
+const uint32_t kVersion = 1;
+const std::size_t kRegionHeaderBytes = 4096;
+const std::size_t kSlotHeaderBytes = 4096;
+const std::size_t kColumnTableOffset = 64;
+const std::size_t kColumnEntryBytes = 32;
+const std::size_t kMaxColumns = (kSlotHeaderBytes - kColumnTableOffset) / kColumnEntryBytes;
+const std::size_t kPublishedOffset = 64;
+const std::size_t kSequenceOffset = 128;
+const std::size_t kCacheLine = 64;
+const std::size_t kPage = 4096;
+
+static_assert(sizeof(std::atomic<uint64_t>) == 8 && sizeof(std::atomic<uint32_t>) == 4,
+              "shared counters must have the size of their integers");
+
+std::size_t alignUp(std::size_t value, std::size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+std::string objectName(const std::string &name) {
+    return !name.empty() && name[0] == '/' ? name : "/" + name;
+}
+
+template <typename T>
+T load(const unsigned char *at) {
+    T value;
+    std::memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+template <typename T>
+void store(unsigned char *at, T value) {
+    std::memcpy(at, &value, sizeof(value));
+}
+
+// The shared counters, which live inside the mapped region.
+std::atomic<uint32_t> *retiredFlag(const unsigned char *region) {
+    return reinterpret_cast<std::atomic<uint32_t> *>(const_cast<unsigned char *>(region) + 20);
+}
+
+std::atomic<uint64_t> *publishedCounter(const unsigned char *region) {
+    return reinterpret_cast<std::atomic<uint64_t> *>(const_cast<unsigned char *>(region) + kPublishedOffset);
+}
+
+std::atomic<uint64_t> *slotSequence(const unsigned char *region, uint32_t slot) {
+    return reinterpret_cast<std::atomic<uint64_t> *>(const_cast<unsigned char *>(region) + kSequenceOffset +
+                                                     kCacheLine * slot);
+}
+
+}
+
+/**
+ * Creates the shared memory object, replacing any left over under the same name.
+ * @param name The object's name.
+ * @param dimension The dimension of the published positions.
+ * @param options The number of slots and what to publish.
+ */
+SharedStateWriter::SharedStateWriter(const std::string &name, uint32_t dimension, const SharedStateOptions &options)
+        : name(objectName(name)), dimension(dimension), options(options) {
+    this->options.slots = std::max(2u, std::min<unsigned>(options.slots, unsigned((kRegionHeaderBytes - kSequenceOffset) / kCacheLine)));
+    create(kSlotHeaderBytes + kPage);
+}
+
+/**
+ * Unmaps and removes the shared memory object.
+ */
+SharedStateWriter::~SharedStateWriter() {
+    release(true);
+}
+
+/**
+ * Creates and maps a region of the configured number of slots of the given size.
+ */
+void SharedStateWriter::create(std::size_t bytesPerSlot) {
+    slotBytes = alignUp(bytesPerSlot, kPage);
+    regionBytes = kRegionHeaderBytes + options.slots * slotBytes;
+
+    ::shm_unlink(name.c_str());
+    int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::SHARED_STATE::CANNOT_CREATE " + name);
+    }
+    if (::ftruncate(fd, off_t(regionBytes)) != 0) {
+        ::close(fd);
+        ::shm_unlink(name.c_str());
+        throw std::runtime_error("ERROR::SHARED_STATE::CANNOT_RESIZE " + name);
+    }
+    void *mapped = ::mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        ::shm_unlink(name.c_str());
+        throw std::runtime_error("ERROR::SHARED_STATE::CANNOT_MAP " + name);
+    }
+    region = static_cast<unsigned char *>(mapped);
+
+    store<uint32_t>(region + 8, kVersion);
+    store<uint32_t>(region + 12, dimension);
+    store<uint32_t>(region + 16, options.slots);
+    new (retiredFlag(region)) std::atomic<uint32_t>(0);
+    store<uint64_t>(region + 24, slotBytes);
+    store<uint64_t>(region + 32, regionBytes);
+    new (publishedCounter(region)) std::atomic<uint64_t>(0);
+    for (uint32_t slot = 0; slot < options.slots; ++slot) {
+        new (slotSequence(region, slot)) std::atomic<uint64_t>(0);
+    }
+    // Readers check the magic last, so they never see a half-initialised header.
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(region, kMagic, sizeof(kMagic));
+}
+
+/**
+ * Unmaps the region and removes its name; when retiring, readers are told to reopen the name.
+ */
+void SharedStateWriter::release(bool retire) {
+    if (region == nullptr) {
+        return;
+    }
+    if (retire) {
+        retiredFlag(region)->store(1, std::memory_order_release);
+    }
+    ::munmap(region, regionBytes);
+    ::shm_unlink(name.c_str());
+    region = nullptr;
+}
+
+/**
+ * Copies a frame into the next slot and makes it the latest.
+ */
+void SharedStateWriter::publish(uint64_t step, double time, uint64_t particleCount,
+                                const std::vector<SnapshotColumn> &columns) {
+    if (columns.size() > kMaxColumns) {
+        throw std::runtime_error("ERROR::SHARED_STATE::TOO_MANY_COLUMNS");
+    }
+    std::size_t needed = kSlotHeaderBytes;
+    for (const SnapshotColumn &column : columns) {
+        needed = alignUp(needed, kCacheLine) + std::size_t(column.bytes);
+    }
+    if (needed > slotBytes) {
+        // Grow with headroom so a slowly growing scene does not recreate the region every frame.
+        release(true);
+        create(needed + needed / 2);
+    }
+
+    const uint64_t frame = ++published;
+    const uint32_t slot = uint32_t(frame % options.slots);
+    std::atomic<uint64_t> *sequence = slotSequence(region, slot);
+    const uint64_t before = sequence->load(std::memory_order_relaxed);
+    sequence->store(before + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    unsigned char *base = region + kRegionHeaderBytes + slot * slotBytes;
+    store<uint64_t>(base, frame);
+    store<uint64_t>(base + 8, step);
+    store<double>(base + 16, time);
+    store<uint64_t>(base + 24, particleCount);
+    store<uint32_t>(base + 32, uint32_t(columns.size()));
+    std::size_t offset = kSlotHeaderBytes;
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+        const SnapshotColumn &column = columns[c];
+        offset = alignUp(offset, kCacheLine);
+        unsigned char *entry = base + kColumnTableOffset + kColumnEntryBytes * c;
+        store<uint32_t>(entry, uint32_t(column.id));
+        store<uint32_t>(entry + 4, uint32_t(column.scalar));
+        store<uint32_t>(entry + 8, column.components);
+        store<uint32_t>(entry + 12, column.fractionBits);
+        store<uint64_t>(entry + 16, offset);
+        store<uint64_t>(entry + 24, column.bytes);
+        std::memcpy(base + offset, column.data, std::size_t(column.bytes));
+        offset += std::size_t(column.bytes);
+    }
+
+    sequence->store(before + 2, std::memory_order_release);
+    publishedCounter(region)->store(frame, std::memory_order_release);
+}
+
+/**
+ * @param name The object's name, as given to the writer.
+ */
+SharedStateReader::SharedStateReader(const std::string &name) : name(objectName(name)) {
+}
+
+SharedStateReader::~SharedStateReader() {
+    close();
+}
+
+/**
+ * Maps the region if the writer has created and initialised it.
+ */
+bool SharedStateReader::open() {
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || std::size_t(status.st_size) < kRegionHeaderBytes) {
+        ::close(fd);
+        return false;
+    }
+    regionBytes = std::size_t(status.st_size);
+    void *mapped = ::mmap(nullptr, regionBytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    region = static_cast<const unsigned char *>(mapped);
+    if (std::memcmp(region, kMagic, sizeof(kMagic)) != 0 || load<uint32_t>(region + 8) != kVersion ||
+        load<uint64_t>(region + 32) != regionBytes) {
+        close();
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return true;
+}
+
+void SharedStateReader::close() {
+    if (region != nullptr) {
+        ::munmap(const_cast<unsigned char *>(region), regionBytes);
+        region = nullptr;
+    }
+}
+
+uint32_t SharedStateReader::getDimension() const {
+    return region != nullptr ? load<uint32_t>(region + 12) : 0;
+}
+
+/**
+ * Points out at the latest complete frame if it is newer than the frame out holds.
+ */
+bool SharedStateReader::latest(SharedFrame &out) {
+    if (region != nullptr && retiredFlag(region)->load(std::memory_order_acquire) != 0) {
+        // The frame out holds points into the old region, so it goes with it.
+        close();
+        out = SharedFrame();
+    }
+    if (region == nullptr && !open()) {
+        return false;
+    }
+
+    const uint64_t frame = publishedCounter(region)->load(std::memory_order_acquire);
+    if (frame == 0 || frame == out.frame) {
+        return false;
+    }
+    const uint32_t slots = load<uint32_t>(region + 16);
+    const std::size_t slotBytes = std::size_t(load<uint64_t>(region + 24));
+    const uint32_t slot = uint32_t(frame % slots);
+    const uint64_t sequence = slotSequence(region, slot)->load(std::memory_order_acquire);
+    if (sequence % 2 != 0) {
+        return false; // The writer has already lapped round to this slot
+    }
+
+    const unsigned char *base = region + kRegionHeaderBytes + slot * slotBytes;
+    const uint32_t columnCount = load<uint32_t>(base + 32);
+    if (load<uint64_t>(base) != frame || columnCount > kMaxColumns) {
+        return false;
+    }
+    SharedFrame read;
+    read.frame = frame;
+    read.step = load<uint64_t>(base + 8);
+    read.time = load<double>(base + 16);
+    read.particleCount = load<uint64_t>(base + 24);
+    read.slot = slot;
+    read.sequence = sequence;
+    for (uint32_t c = 0; c < columnCount; ++c) {
+        const unsigned char *entry = base + kColumnTableOffset + kColumnEntryBytes * c;
+        SnapshotColumn column;
+        column.id = SnapshotColumnId(load<uint32_t>(entry));
+        column.scalar = ScalarCode(load<uint32_t>(entry + 4));
+        column.components = load<uint32_t>(entry + 8);
+        column.fractionBits = load<uint32_t>(entry + 12);
+        const uint64_t offset = load<uint64_t>(entry + 16);
+        column.bytes = load<uint64_t>(entry + 24);
+        if (offset > slotBytes || column.bytes > slotBytes - offset) {
+            return false;
+        }
+        column.data = base + offset;
+        read.columns.push_back(column);
+    }
+
+    if (!valid(read)) {
+        return false;
+    }
+    out = std::move(read);
+    return true;
+}
+
+/**
+ * Returns true if the frame's slot has not been written since the frame was read.
+ */
+bool SharedStateReader::valid(const SharedFrame &frame) const {
+    if (region == nullptr || frame.frame == 0) {
+        return false;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slotSequence(region, frame.slot)->load(std::memory_order_relaxed) == frame.sequence;
+}
@@ -1,60 +1,123 @@
 // Created by Aaron Li on 6/9/23.
 //
 #include "Simulation.hpp"
+#include "Collision.hpp"
+#include "Integrator.hpp"
+#include "Placement.hpp"
+#include "ByteOrder.hpp"
+#include "Random.hpp"
+#include "Snapshot.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
 #include <random>
+#include <stdexcept>
+
+// Number of grid cells searched as one unit of parallel contact detection.
+static const std::size_t kCellsPerBlock = 256;
+// Number of particles integrated as one unit of parallel work.
+static const std::size_t kIntegrationGrain = 4096;
+// Number of particles spawned as one unit of parallel work (a multiple of kRandomLanes).
+static const std::size_t kSpawnGrain = 16384;
 
 /**
  * Constructs a new simulation.
  * @param renderer The renderer to use for drawing the particles.
  * @param shader The shader to use for the particles.
  */
-Simulation::Simulation(Render& renderer, Shader& shader)
-        : renderer(renderer), shader(shader) {
+template <int Dim, typename Scalar>
+BasicSimulation<Dim, Scalar>::BasicSimulation(Render& renderer, Shader& shader)
+        : renderer(&renderer), shader(&shader), seed(std::random_device()()) {
 }
 
 /**
- * Handles the collisions between the particles in the simulation.
+ * Constructs a headless simulation, for which render() does nothing.
  */
-void Simulation::handleCollisions() {
-    for (size_t i = 0; i < particles.size(); ++i) {
-        for (size_t j = i + 1; j < particles.size(); ++j) {
-            glm::vec3 diff = particles[i].getPosition() - particles[j].getPosition();
-            float distance = glm::length(diff);
-            if (distance < 2.0f * particleRadius) {
-
-                float overlap = 2.0f * particleRadius - distance;
-
-
-                glm::vec3 normal = glm::normalize(diff);
-                glm::vec3 relativeVelocity = particles[i].getVelocity() - particles[j].getVelocity();
-                float impulse = glm::dot(relativeVelocity, normal);
+template <int Dim, typename Scalar>
+BasicSimulation<Dim, Scalar>::BasicSimulation()
+        : renderer(nullptr), shader(nullptr), seed(std::random_device()()) {
+}
 
-                if (impulse < 0.0f) {
+/**
+ * Handles the collisions between the particles in the simulation.
+ *
+ * Without threads in fast mode every candidate pair is resolved as the grid is walked. Otherwise
+ * contacts are first found in parallel, one block of cells at a time, and then resolved on this
+ * thread. In deterministic mode each block keeps its own list and the lists are resolved in block
+ * order, which is the same canonical order whatever the number of threads.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::handleCollisions() {
+    Position* positions = particles.positions.data();
+    Vec* velocities = particles.velocities.data();
+    const Real* masses = particles.masses.data();
+    const Real radius = particleRadius;
 
-                    particles[i].setPosition(particles[i].getPosition() + overlap / 2.0f * normal);
-                    particles[j].setPosition(particles[j].getPosition() - overlap / 2.0f * normal);
+    {
+        PhaseCounters::Scope counting(phaseCounters, SimulationPhase::BuildGrid, 0);
+        grid.build(positions, particles.size(), 2.0 * radius);
+    }
 
+    if (mode == ExecutionMode::Fast && (pool == nullptr || pool->size() == 1)) {
+        PhaseCounters::Scope counting(phaseCounters, SimulationPhase::FindContacts, 0);
+        std::size_t resolved = 0;
+        grid.forEachCandidatePair([=, &resolved](uint32_t i, uint32_t j) {
+            resolved += resolveContact(positions, velocities, masses, i, j, radius) ? 1 : 0;
+        });
+        contactCount += resolved;
+        return;
+    }
 
-                    float totalMass = particles[i].getMass() + particles[j].getMass();
-                    float impulseI = 2.0f * particles[j].getMass() / totalMass * impulse;
-                    float impulseJ = 2.0f * particles[i].getMass() / totalMass * impulse;
+    const std::size_t cells = grid.cellCount();
+    const std::size_t blocks = (cells + kCellsPerBlock - 1) / kCellsPerBlock;
+    const bool canonical = mode == ExecutionMode::Deterministic;
+    const std::size_t lists = canonical ? blocks : pool->size();
+    if (contactLists.size() < lists) {
+        contactLists.resize(lists);
+    }
+    for (std::size_t l = 0; l < lists; ++l) {
+        contactLists[l].clear();
+    }
 
-                    particles[i].setVelocity(particles[i].getVelocity() - impulseI * normal);
-                    particles[j].setVelocity(particles[j].getVelocity() + impulseJ * normal);
+    const Real reach = Real(4) * radius * radius;
+    parallelFor(pool, blocks, 1, [&](std::size_t first, std::size_t last, unsigned thread) {
+        PhaseCounters::Scope counting(phaseCounters, SimulationPhase::FindContacts, thread);
+        for (std::size_t block = first; block < last; ++block) {
+            std::vector<Contact>& found = contactLists[canonical ? block : thread];
+            grid.forEachCandidatePair(block * kCellsPerBlock, std::min(cells, (block + 1) * kCellsPerBlock),
+                                      [&](uint32_t i, uint32_t j) {
+                Vec diff = Vec(positions[i] - positions[j]);
+                if (glm::dot(diff, diff) < reach) {
+                    found.push_back(Contact{i, j});
                 }
-            }
+            });
+        }
+    });
+
+    PhaseCounters::Scope counting(phaseCounters, SimulationPhase::ResolveContacts, 0);
+    std::size_t resolved = 0;
+    for (std::size_t l = 0; l < lists; ++l) {
+        for (const Contact& contact : contactLists[l]) {
+            resolved += resolveContact(positions, velocities, masses, contact.i, contact.j, radius) ? 1 : 0;
         }
     }
+    contactCount += resolved;
 }
 
 
-
 /**
  * Adds a particle to the simulation.
  * @param particle The particle to add.
  */
-void Simulation::addParticle(const Particle& particle) {
-    particles.push_back(particle);
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::addParticle(const ParticleType& particle) {
+    Position position(fromVec3<Dim>(particle.getPosition()));
+    Vec acceleration;
+    primeAcceleration(position, acceleration, UniformField<Vec>{gravity});
+    particles.add(position, fromVec3<Dim>(particle.getVelocity()), acceleration,
+                  particle.getColor(), particle.getMass());
 }
 
 
@@ -62,59 +125,502 @@ void Simulation::addParticle(const Particle& particle) {
  * Updates the state of the simulation over the specified time interval.
  * @param dt The time interval to simulate, in seconds.
  */
-void Simulation::simulate(float dt) {
-    float boundary = 1.2f;
-    int numIterations = 5;
-
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::simulate(Real dt) {
+    const auto started = metrics != nullptr ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    contactCount = 0;
+    if (phaseCounters != nullptr) {
+        phaseCounters->prepare(pool != nullptr ? pool->size() : 1);
+    }
+    // With metrics attached, the last pass counts resting particles per chunk while the
+    // velocities it has just written are still in cache.
+    std::atomic<std::size_t> resting(0);
+    const Real restSquared = metrics != nullptr ? Real(metrics->restSpeed * metrics->restSpeed) : Real(0);
     for (int iteration = 0; iteration < numIterations; ++iteration) {
         handleCollisions();
-        for (Particle& particle : particles) {
-            glm::vec3 pos = particle.getPosition();
-
-            for (int i = 0; i < 3; ++i) {
-                if (std::abs(pos[i]) > boundary) {
-                    glm::vec3 velocity = particle.getVelocity();
-                    velocity[i] = -velocity[i];
-                    particle.setVelocity(velocity);
+        const bool countResting = metrics != nullptr && iteration == numIterations - 1;
+        parallelFor(pool, particles.size(), kIntegrationGrain, [&](std::size_t begin, std::size_t end, unsigned thread) {
+            PhaseCounters::Scope counting(phaseCounters, SimulationPhase::Integrate, thread);
+            integrateParticles<ActiveIntegrator>(particles.positions.data() + begin, particles.velocities.data() + begin,
+                                                 particles.accelerations.data() + begin, end - begin,
+                                                 dt, boundary, UniformField<Vec>{gravity});
+            if (countResting) {
+                std::size_t chunk = 0;
+                for (std::size_t i = begin; i < end; ++i) {
+                    chunk += glm::dot(particles.velocities[i], particles.velocities[i]) < restSquared ? 1 : 0;
                 }
+                resting.fetch_add(chunk, std::memory_order_relaxed);
             }
+        });
+    }
+    time += double(dt) * numIterations;
+    ++stepCount;
+
+    if (metrics != nullptr) {
+        updateMetrics(std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count(), resting.load());
+    }
 
-            particle.update(dt);
+    if (recorder != nullptr && recorder->wants(stepCount)) {
+        recorder->capture(stepCount, time, particles.size(), describeParticles(recorder->getAttributes()));
+    }
+    if (rewind != nullptr && rewind->wants(stepCount)) {
+        rewind->record(stepCount, time, particles.size(), describeParticles(~0u));
+    }
+    if (exporter != nullptr && exporter->wants(stepCount)) {
+        exporter->write(stepCount, time, particles.size(), describeParticles(exporter->getAttributes()), pool);
+    }
+    if (sharedState != nullptr && sharedState->wants(stepCount)) {
+        sharedState->publish(stepCount, time, particles.size(), describeParticles(sharedState->getAttributes()));
+    }
+    if (checkpointer != nullptr) {
+        checkpointer->poll();
+        if (checkpointer->due(stepCount)) {
+            checkpointer->checkpoint(stepCount, [this](const std::string& path) { saveSnapshot(path); });
         }
     }
 }
 
 
+/**
+ * Publishes the state after a call to simulate() to the attached metrics.
+ * @param stepSeconds The wall time of the call.
+ * @param resting The particles slower than the rest speed, counted by the last integration pass.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::updateMetrics(double stepSeconds, std::size_t resting) {
+    const std::size_t count = particles.size();
+    metrics->steps.add();
+    metrics->iterations.add(uint64_t(numIterations));
+    metrics->contacts.add(contactCount);
+    metrics->stepSeconds.observe(stepSeconds);
+    metrics->particles.set(double(count));
+    metrics->stepContacts.set(double(contactCount));
+    metrics->restingFraction.set(count > 0 ? double(resting) / double(count) : 0.0);
+    metrics->particleBytes.set(double(count) * double(Storage::bytesPerParticle()));
+}
+
+
 /**
   * Renders the particles in the simulation.
   */
-void Simulation::render() {
-    for (Particle& particle : particles) {
-        particle.render(renderer, shader);
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::render() {
+    if (renderer == nullptr) {
+        return;
+    }
+
+    std::vector<VertexData> vertices(particles.size());
+    for (size_t i = 0; i < particles.size(); ++i) {
+        vertices[i].position = glm::vec3(toVec3(asVector(particles.positions[i])));
+        vertices[i].velocity = float(glm::length(particles.velocities[i]));
+        vertices[i].mass = float(particles.masses[i]);
+        vertices[i].color = particles.colors[i];
     }
+    renderer->draw(*shader, vertices);
 }
 
 /**
  * Adds a specified number of randomly placed and colored particles to the simulation.
  * @param num The number of particles to add.
  */
-void Simulation::addRandomParticles(int numParticles) {
-    std::random_device rd;
-    std::default_random_engine generator(rd());
-    std::uniform_real_distribution<float> positionDistribution(-1.0f, 1.0f);
-    std::uniform_real_distribution<float> velocityDistribution(-0.01f, 0.01f);
-    std::uniform_real_distribution<float> massDistribution(0.1f, 1.0f);
-    std::uniform_real_distribution<float> colorDistribution(0.0f, 1.0f);
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::addRandomParticles(int numParticles) {
+    if (numParticles > 0) {
+        spawnParticles(std::size_t(numParticles), nullptr);
+    }
+}
+
+/**
+ * Places points in the box [lower, upper] with the given placement, in the plane z = lower.z when
+ * the box is flat in z.
+ */
+template <typename Real>
+static std::vector<glm::vec<3, Real> > placePoints(ThreadPool* pool, uint64_t seed, std::size_t count, PlacementMode mode,
+                                                   const glm::vec<3, Real>& lower, const glm::vec<3, Real>& upper,
+                                                   Real spacing, bool planar) {
+    std::vector<glm::vec<3, Real> > placed;
+    if (planar) {
+        glm::vec<2, Real> low(lower), high(upper);
+        std::vector<glm::vec<2, Real> > points = mode == PlacementMode::PoissonDisk
+                ? poissonDisk<2, Real>(pool, seed, count, low, high, spacing)
+                : jitteredLattice<2, Real>(pool, seed, count, low, high, spacing);
+        placed.reserve(points.size());
+        for (const glm::vec<2, Real>& point : points) {
+            placed.push_back(glm::vec<3, Real>(point, lower.z));
+        }
+    } else {
+        placed = mode == PlacementMode::PoissonDisk
+                ? poissonDisk<3, Real>(pool, seed, count, lower, upper, spacing)
+                : jitteredLattice<3, Real>(pool, seed, count, lower, upper, spacing);
+    }
+    return placed;
+}
+
+/**
+ * Adds particles whose positions are at least one particle diameter apart, so the first frames
+ * do not have to push overlapping particles apart. Velocities, masses and colors are drawn as
+ * in addRandomParticles.
+ * @param num The number of particles to add.
+ * @param placement How to place them; Uniform is the same as addRandomParticles.
+ * @param lower The lower corner of the box to fill; a box flat in z gives a planar scene.
+ * @param upper The upper corner of the box to fill.
+ * @return The number of particles added, less than num if the box cannot hold them.
+ */
+template <int Dim, typename Scalar>
+std::size_t BasicSimulation<Dim, Scalar>::addPlacedParticles(int numParticles, PlacementMode placement,
+                                                           const glm::vec<3, Real>& lower, const glm::vec<3, Real>& upper) {
+    if (numParticles <= 0) {
+        return 0;
+    }
+    if (placement == PlacementMode::Uniform) {
+        addRandomParticles(numParticles);
+        return std::size_t(numParticles);
+    }
+
+    // Keep a hair of clearance so rounding never turns touching particles into a contact.
+    const Real spacing = Real(2) * particleRadius * Real(1.0001);
+    const bool planar = Dim == 2 || lower.z == upper.z;
+    std::vector<glm::vec<3, Real> > placed = placePoints(pool, seed, std::size_t(numParticles), placement,
+                                                         lower, upper, spacing, planar);
+    spawnParticles(placed.size(), placed.data());
+    return placed.size();
+}
+
+/**
+ * Appends count particles with velocities, masses and colors drawn from the counter-based
+ * generator: the state of particle i depends only on (seed, i), so particles are created in
+ * parallel, 16 at a time, and a seed reproduces the same scene on any number of threads.
+ * @param count The number of particles to add.
+ * @param placed Their positions, or null for uniform random positions in the z = 0 plane.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::spawnParticles(std::size_t count, const glm::vec<3, Real>* placed) {
+    const std::size_t first = particles.size();
+    particles.resize(first + count);
+
+    parallelFor(pool, count, kSpawnGrain, [&](std::size_t begin, std::size_t end, unsigned) {
+        // Position x, y; velocity x, y; mass. Particles stay in the z = 0 plane.
+        Real unit[5][kRandomLanes];
+        for (std::size_t base = begin; base < end; base += kRandomLanes) {
+            itemUniforms<Real, 5>(seed, SpawnStream, first + base, unit);
+            std::size_t lanes = std::min(kRandomLanes, end - base);
+            for (std::size_t lane = 0; lane < lanes; ++lane) {
+                std::size_t i = first + base + lane;
+                Vec position(Real(0));
+                Vec velocity(Real(0));
+                if (placed != nullptr) {
+                    position = fromVec3<Dim>(placed[base + lane]);
+                } else {
+                    position[0] = Real(-1) + Real(2) * unit[0][lane];
+                    position[1] = Real(-1) + Real(2) * unit[1][lane];
+                }
+                velocity[0] = Real(-0.01) + Real(0.02) * unit[2][lane];
+                velocity[1] = Real(-0.01) + Real(0.02) * unit[3][lane];
+
+                particles.positions[i] = Position(position);
+                particles.velocities[i] = velocity;
+                primeAcceleration(particles.positions[i], particles.accelerations[i], UniformField<Vec>{gravity});
+                particles.colors[i] = glm::vec3(0.0f, 0.0f, 0.0f);
+                particles.masses[i] = Real(0.1) + Real(0.9) * unit[4][lane];
+            }
+        }
+    });
+}
+
+/**
+ * Adds many particles at once: the arrays grow once and are filled in parallel. Missing
+ * velocities default to zero, masses to 1 and colors to black.
+ * @param arrays The attributes of the new particles.
+ * @return The number of particles added.
+ */
+template <int Dim, typename Scalar>
+std::size_t BasicSimulation<Dim, Scalar>::addParticles(const ParticleArrays<Real>& arrays) {
+    if (arrays.count > 0 && arrays.positions == nullptr) {
+        throw std::runtime_error("ERROR::SIMULATION::MISSING_POSITIONS");
+    }
+    const std::size_t first = particles.size();
+    particles.resize(first + arrays.count);
+
+    parallelFor(pool, arrays.count, kSpawnGrain, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t j = begin; j < end; ++j) {
+            std::size_t i = first + j;
+            particles.positions[i] = Position(fromVec3<Dim>(arrays.positions[j]));
+            particles.velocities[i] = arrays.velocities != nullptr ? fromVec3<Dim>(arrays.velocities[j]) : Vec(Real(0));
+            primeAcceleration(particles.positions[i], particles.accelerations[i], UniformField<Vec>{gravity});
+            particles.colors[i] = arrays.colors != nullptr ? arrays.colors[j] : glm::vec3(0.0f);
+            particles.masses[i] = arrays.masses != nullptr ? arrays.masses[j] : Real(1);
+        }
+    });
+    return arrays.count;
+}
+
+/**
+ * Sets the uniform acceleration (e.g. gravity) applied to every particle.
+ * @param acceleration The acceleration, in units per second squared.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::setGravity(const glm::vec<3, Real>& acceleration) {
+    gravity = fromVec3<Dim>(acceleration);
+    for (size_t i = 0; i < particles.size(); ++i) {
+        primeAcceleration(particles.positions[i], particles.accelerations[i], UniformField<Vec>{gravity});
+    }
+}
+
+/**
+ * Returns the total kinetic energy, reduced according to the execution mode.
+ */
+template <int Dim, typename Scalar>
+typename BasicSimulation<Dim, Scalar>::Real BasicSimulation<Dim, Scalar>::kineticEnergy() const {
+    const Vec* velocities = particles.velocities.data();
+    const Real* masses = particles.masses.data();
+    return reduceSum<Real>(pool, particles.size(), mode, [=](std::size_t i) {
+        return Real(0.5) * masses[i] * glm::dot(velocities[i], velocities[i]);
+    });
+}
+
+/**
+ * Returns a hash of the bits of all positions and velocities, for comparing runs.
+ */
+template <int Dim, typename Scalar>
+uint64_t BasicSimulation<Dim, Scalar>::stateHash() const {
+    uint64_t hash = hashBytes(particles.positions.data(), particles.size() * sizeof(Position));
+    return hashBytes(particles.velocities.data(), particles.size() * sizeof(Vec), hash);
+}
+
+/**
+ * How the elements of a particle array are encoded in a snapshot column.
+ */
+template <typename T>
+struct SnapshotLayout;
+
+template <>
+struct SnapshotLayout<float> {
+    static const uint32_t components = 1;
+    static const uint32_t fractionBits = 0;
+    static ScalarCode scalar() { return ScalarCode::Float32; }
+    static float decode(const SnapshotColumn& column, std::size_t i) { return float(column.component(i, 0)); }
+};
+
+template <>
+struct SnapshotLayout<double> {
+    static const uint32_t components = 1;
+    static const uint32_t fractionBits = 0;
+    static ScalarCode scalar() { return ScalarCode::Float64; }
+    static double decode(const SnapshotColumn& column, std::size_t i) { return column.component(i, 0); }
+};
+
+template <int N, typename R>
+struct SnapshotLayout<glm::vec<N, R> > {
+    static const uint32_t components = N;
+    static const uint32_t fractionBits = 0;
+    static ScalarCode scalar() { return SnapshotLayout<R>::scalar(); }
+
+    // Components the column does not have are zero, so 2D snapshots load into 3D simulations.
+    static glm::vec<N, R> decode(const SnapshotColumn& column, std::size_t i) {
+        glm::vec<N, R> value(R(0));
+        for (uint32_t k = 0; k < uint32_t(N) && k < column.components; ++k) {
+            value[k] = R(column.component(i, k));
+        }
+        return value;
+    }
+};
+
+template <int N, int F>
+struct SnapshotLayout<FixedVec<N, F> > {
+    static const uint32_t components = N;
+    static const uint32_t fractionBits = F;
+    static ScalarCode scalar() { return ScalarCode::Fixed32; }
+
+    static FixedVec<N, F> decode(const SnapshotColumn& column, std::size_t i) {
+        return FixedVec<N, F>(SnapshotLayout<typename FixedVec<N, F>::Vec>::decode(column, i));
+    }
+};
+
+/**
+ * Describes a particle array as a snapshot column.
+ */
+template <typename T>
+static SnapshotColumn describeColumn(SnapshotColumnId id, const Column<T>& column) {
+    typedef SnapshotLayout<T> Layout;
+    return SnapshotColumn{id, Layout::scalar(), Layout::components, Layout::fractionBits,
+                          column.data(), uint64_t(column.size()) * sizeof(T)};
+}
+
+/**
+ * Fills a particle array from a snapshot column: in place when the column has exactly the
+ * layout of T, otherwise by converting every element.
+ * @return False if the snapshot has no such column.
+ */
+template <typename T>
+static bool restoreColumn(Column<T>& column, const std::shared_ptr<MappedSnapshot>& snapshot, SnapshotColumnId id,
+                          ThreadPool* pool) {
+    typedef SnapshotLayout<T> Layout;
+    const SnapshotColumn* stored = snapshot->find(id);
+    if (stored == nullptr) {
+        return false;
+    }
+
+    // Borrowing needs a column aligned for T; a foreign or crafted file may not be, so it is copied
+    const std::size_t count = std::size_t(snapshot->getHeader().particleCount);
+    if (hostIsLittleEndian() && stored->scalar == Layout::scalar() &&
+        stored->components == Layout::components && stored->fractionBits == Layout::fractionBits &&
+        stored->elementBytes() == sizeof(T) && reinterpret_cast<std::uintptr_t>(stored->data) % alignof(T) == 0) {
+        column.borrow(static_cast<T*>(snapshot->mutableData(*stored)), count, snapshot);
+        return true;
+    }
+
+    column.clear();
+    column.resize(count);
+    parallelFor(pool, count, kIntegrationGrain, [&](std::size_t begin, std::size_t end, unsigned) {
+        for (std::size_t i = begin; i < end; ++i) {
+            column[i] = Layout::decode(*stored, i);
+        }
+    });
+    return true;
+}
 
-    for(int i = 0; i < numParticles; ++i) {
-        glm::vec3 position(positionDistribution(generator), positionDistribution(generator), 0.0f); // set z to 0
-        glm::vec3 velocity(velocityDistribution(generator), velocityDistribution(generator), 0.0f); // set z to 0
-        glm::vec3 color(0.0f, 0.0f, 0.0f);
-        float mass = massDistribution(generator);
-        addParticle(Particle(position, velocity, color, mass));
+/**
+ * Copies a column of a recorded frame back into a particle array of the same layout.
+ * @return False if the frame does not have the column.
+ */
+template <typename T>
+static bool restoreColumn(Column<T>& column, const TrajectoryFrame& frame, SnapshotColumnId id) {
+    typedef SnapshotLayout<T> Layout;
+    const SnapshotColumn* stored = frame.find(id);
+    if (stored == nullptr) {
+        return false;
     }
+    if (stored->scalar != Layout::scalar() || stored->components != Layout::components ||
+        stored->fractionBits != Layout::fractionBits || stored->elementBytes() != sizeof(T)) {
+        throw std::runtime_error("ERROR::REWIND::LAYOUT_MISMATCH");
+    }
+    column.resize(std::size_t(frame.particleCount));
+    std::memcpy(column.data(), stored->data, std::size_t(stored->bytes));
+    return true;
 }
 
+/**
+ * Describes the chosen particle arrays as columns, in column id order.
+ * @param attributes A mask of trajectoryAttribute bits; ~0u for every attribute.
+ */
+template <int Dim, typename Scalar>
+std::vector<SnapshotColumn> BasicSimulation<Dim, Scalar>::describeParticles(uint32_t attributes) const {
+    std::vector<SnapshotColumn> columns;
+    if (attributes & trajectoryAttribute(SnapshotColumnId::Position)) {
+        columns.push_back(describeColumn(SnapshotColumnId::Position, particles.positions));
+    }
+    if (attributes & trajectoryAttribute(SnapshotColumnId::Velocity)) {
+        columns.push_back(describeColumn(SnapshotColumnId::Velocity, particles.velocities));
+    }
+    if (attributes & trajectoryAttribute(SnapshotColumnId::Acceleration)) {
+        columns.push_back(describeColumn(SnapshotColumnId::Acceleration, particles.accelerations));
+    }
+    if (attributes & trajectoryAttribute(SnapshotColumnId::Color)) {
+        columns.push_back(describeColumn(SnapshotColumnId::Color, particles.colors));
+    }
+    if (attributes & trajectoryAttribute(SnapshotColumnId::Mass)) {
+        columns.push_back(describeColumn(SnapshotColumnId::Mass, particles.masses));
+    }
+    return columns;
+}
 
+/**
+ * Restores the newest state in the rewind history at or before the given step. Simulating on from
+ * there discards the history after it.
+ * @param step The step to go back to.
+ * @return False if there is no rewind buffer or the step is older than its history.
+ */
+template <int Dim, typename Scalar>
+bool BasicSimulation<Dim, Scalar>::rewindTo(uint64_t step) {
+    TrajectoryFrame frame;
+    if (rewind == nullptr || !rewind->seek(step, frame)) {
+        return false;
+    }
+    restoreColumn(particles.positions, frame, SnapshotColumnId::Position);
+    restoreColumn(particles.velocities, frame, SnapshotColumnId::Velocity);
+    restoreColumn(particles.accelerations, frame, SnapshotColumnId::Acceleration);
+    restoreColumn(particles.colors, frame, SnapshotColumnId::Color);
+    restoreColumn(particles.masses, frame, SnapshotColumnId::Mass);
+    stepCount = frame.step;
+    time = frame.time;
+    return true;
+}
 
+/**
+ * Writes the particles to a binary VTK, VTU or PLY file, encoded in parallel.
+ * @param path The file to write.
+ * @param options The format and the attributes to store.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::exportParticles(const std::string& path, const ExportOptions& options) const {
+    ::exportParticles(path, particles.size(),
+                      describeParticles(options.attributes | trajectoryAttribute(SnapshotColumnId::Position)),
+                      options, pool);
+}
+
+/**
+ * Writes every particle attribute and the simulation parameters to a snapshot file.
+ * @param path The file to write.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::saveSnapshot(const std::string& path) const {
+    SnapshotHeader header;
+    header.dimension = Dim;
+    header.particleCount = particles.size();
+    header.particleRadius = double(particleRadius);
+    header.boundary = double(boundary);
+    header.time = time;
+    header.iterations = uint32_t(numIterations);
+    header.seed = seed;
+    header.gravity = glm::dvec3(toVec3(gravity));
+    header.stepCount = stepCount;
+
+    writeSnapshot(path, header, describeParticles(~0u));
+}
+
+/**
+ * Replaces the particles and parameters with those of a snapshot file, using the mapped file in
+ * place as the particle arrays wherever its layout allows.
+ * @param path The file to read.
+ */
+template <int Dim, typename Scalar>
+void BasicSimulation<Dim, Scalar>::loadSnapshot(const std::string& path) {
+    std::shared_ptr<MappedSnapshot> snapshot = std::make_shared<MappedSnapshot>(path);
+    const SnapshotHeader& header = snapshot->getHeader();
+    if (!(header.boundary < maxBoundary())) {
+        throw std::runtime_error("ERROR::SNAPSHOT::BOUNDARY_OUT_OF_RANGE " + path);
+    }
+
+    Storage restored;
+    if (!restoreColumn(restored.positions, snapshot, SnapshotColumnId::Position, pool) ||
+        !restoreColumn(restored.velocities, snapshot, SnapshotColumnId::Velocity, pool) ||
+        !restoreColumn(restored.masses, snapshot, SnapshotColumnId::Mass, pool)) {
+        throw std::runtime_error("ERROR::SNAPSHOT::MISSING_COLUMN " + path);
+    }
+    const Vec restoredGravity = fromVec3<Dim>(glm::vec<3, Real>(header.gravity));
+    if (!restoreColumn(restored.accelerations, snapshot, SnapshotColumnId::Acceleration, pool)) {
+        restored.accelerations.resize(restored.size());
+        for (std::size_t i = 0; i < restored.size(); ++i) {
+            primeAcceleration(restored.positions[i], restored.accelerations[i], UniformField<Vec>{restoredGravity});
+        }
+    }
+    if (!restoreColumn(restored.colors, snapshot, SnapshotColumnId::Color, pool)) {
+        restored.colors.resize(restored.size(), glm::vec3(0.0f));
+    }
+
+    particles = std::move(restored);
+    particleRadius = Real(header.particleRadius);
+    boundary = Real(header.boundary);
+    numIterations = int(header.iterations);
+    time = header.time;
+    stepCount = header.stepCount;
+    seed = header.seed;
+    gravity = restoredGravity;
+}
 
+template class BasicSimulation<2, float>;
+template class BasicSimulation<3, float>;
+template class BasicSimulation<2, double>;
+template class BasicSimulation<3, double>;
+template class BasicSimulation<2, FixedPoint32<> >;
+template class BasicSimulation<3, FixedPoint32<> >;
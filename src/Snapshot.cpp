@@ -0,0 +1,236 @@
+//
+// Binary snapshot files of a simulation's particle state.
+//
+
+#include "Snapshot.hpp"
+#include "ByteOrder.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'P', 'S', 'I', 'M', 'S', 'N', 'A', 'P'};
+const uint32_t kVersion = 2;
+const std::size_t kFixedHeaderBytes = 104;
+const std::size_t kVersion1HeaderBytes = 96; // Before the step count
+const std::size_t kColumnEntryBytes = 32;
+const uint64_t kColumnAlignment = 4096;
+
+uint64_t alignUp(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Returns the most components a column of the given attribute can have, or 0 for unknown ones.
+ */
+uint32_t maxComponents(SnapshotColumnId id) {
+    switch (id) {
+        case SnapshotColumnId::Position:
+        case SnapshotColumnId::Velocity:
+        case SnapshotColumnId::Acceleration:
+        case SnapshotColumnId::Color:
+            return 3;
+        case SnapshotColumnId::Mass:
+            return 1;
+    }
+    return 0;
+}
+
+}
+
+/**
+ * Returns component `component` of element `index` as a double.
+ */
+double SnapshotColumn::component(std::size_t index, uint32_t component) const {
+    const unsigned char *p = static_cast<const unsigned char *>(data) + index * elementBytes();
+    switch (scalar) {
+        case ScalarCode::Float32: {
+            uint32_t bits = get32(p + 4 * component);
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        case ScalarCode::Float64:
+            return getDouble(p + 8 * component);
+        case ScalarCode::Fixed32:
+            return double(int32_t(get32(p + 4 * component))) / double(uint64_t(1) << fractionBits);
+    }
+    return 0.0;
+}
+
+/**
+ * Writes a snapshot file to path + ".tmp" and renames it over path, so that the old file is never
+ * truncated under a snapshot still mapping it.
+ * @param path Where to write the snapshot.
+ * @param header The simulation parameters; particleCount must match the columns.
+ * @param columns The columns to store.
+ */
+void writeSnapshot(const std::string &path, const SnapshotHeader &header, const std::vector<SnapshotColumn> &columns) {
+    const std::size_t headerBytes = kFixedHeaderBytes + kColumnEntryBytes * columns.size();
+    std::vector<unsigned char> head(headerBytes, 0);
+
+    std::memcpy(head.data(), kMagic, sizeof(kMagic));
+    put32(&head[8], kVersion);
+    put32(&head[12], header.dimension);
+    put32(&head[16], uint32_t(headerBytes));
+    put32(&head[20], uint32_t(columns.size()));
+    put64(&head[24], header.particleCount);
+    putDouble(&head[32], header.particleRadius);
+    putDouble(&head[40], header.boundary);
+    putDouble(&head[48], header.time);
+    put32(&head[56], header.iterations);
+    put64(&head[64], header.seed);
+    for (int i = 0; i < 3; ++i) {
+        putDouble(&head[72 + 8 * i], header.gravity[i]);
+    }
+    put64(&head[96], header.stepCount);
+
+    uint64_t offset = alignUp(headerBytes, kColumnAlignment);
+    std::vector<uint64_t> offsets;
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+        unsigned char *entry = &head[kFixedHeaderBytes + kColumnEntryBytes * c];
+        put32(entry, uint32_t(columns[c].id));
+        put32(entry + 4, uint32_t(columns[c].scalar));
+        put32(entry + 8, columns[c].components);
+        put32(entry + 12, columns[c].fractionBits);
+        put64(entry + 16, offset);
+        put64(entry + 24, columns[c].bytes);
+        offsets.push_back(offset);
+        offset = alignUp(offset + columns[c].bytes, kColumnAlignment);
+    }
+
+    const std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("ERROR::SNAPSHOT::CANNOT_OPEN_FOR_WRITING " + temporary);
+    }
+    file.write(reinterpret_cast<const char *>(head.data()), std::streamsize(head.size()));
+
+    const bool swap = !hostIsLittleEndian();
+    std::vector<char> swapped;
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+        file.seekp(std::streamoff(offsets[c]));
+        const char *bytes = static_cast<const char *>(columns[c].data);
+        if (swap) {
+            std::size_t width = columns[c].scalar == ScalarCode::Float64 ? 8 : 4;
+            swapped.assign(bytes, bytes + columns[c].bytes);
+            for (std::size_t i = 0; i + width <= swapped.size(); i += width) {
+                std::reverse(swapped.begin() + i, swapped.begin() + i + width);
+            }
+            bytes = swapped.data();
+        }
+        file.write(bytes, std::streamsize(columns[c].bytes));
+    }
+
+    // Pad the file to a whole page so the last column can be mapped like the others.
+    if (offset > 0) {
+        file.seekp(std::streamoff(offset - 1));
+        file.put('\0');
+    }
+    file.close();
+    if (!file) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("ERROR::SNAPSHOT::WRITE_FAILED " + path);
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("ERROR::SNAPSHOT::CANNOT_REPLACE " + path);
+    }
+}
+
+/**
+ * Maps and validates a snapshot file.
+ * @param path The snapshot file.
+ */
+MappedSnapshot::MappedSnapshot(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::SNAPSHOT::CANNOT_OPEN " + path);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || std::size_t(status.st_size) < kVersion1HeaderBytes) {
+        ::close(fd);
+        throw std::runtime_error("ERROR::SNAPSHOT::TRUNCATED " + path);
+    }
+    mappingSize = std::size_t(status.st_size);
+    mapping = ::mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw std::runtime_error("ERROR::SNAPSHOT::CANNOT_MAP " + path);
+    }
+
+    const unsigned char *head = static_cast<const unsigned char *>(mapping);
+    const uint32_t version = get32(head + 8);
+    const std::size_t fixedBytes = version == 1 ? kVersion1HeaderBytes : kFixedHeaderBytes;
+    const uint32_t headerBytes = get32(head + 16);
+    const uint32_t columnCount = get32(head + 20);
+    if (std::memcmp(head, kMagic, sizeof(kMagic)) != 0 || (version != 1 && version != kVersion) ||
+        headerBytes < fixedBytes + kColumnEntryBytes * std::size_t(columnCount) || headerBytes > mappingSize) {
+        ::munmap(mapping, mappingSize);
+        mapping = nullptr;
+        throw std::runtime_error("ERROR::SNAPSHOT::NOT_A_SNAPSHOT " + path);
+    }
+
+    header.dimension = get32(head + 12);
+    header.particleCount = get64(head + 24);
+    header.particleRadius = getDouble(head + 32);
+    header.boundary = getDouble(head + 40);
+    header.time = getDouble(head + 48);
+    header.iterations = get32(head + 56);
+    header.seed = get64(head + 64);
+    for (int i = 0; i < 3; ++i) {
+        header.gravity[i] = getDouble(head + 72 + 8 * i);
+    }
+    header.stepCount = version == 1 ? 0 : get64(head + 96);
+
+    for (uint32_t c = 0; c < columnCount; ++c) {
+        const unsigned char *entry = head + fixedBytes + kColumnEntryBytes * c;
+        SnapshotColumn column;
+        column.id = SnapshotColumnId(get32(entry));
+        column.scalar = ScalarCode(get32(entry + 4));
+        column.components = get32(entry + 8);
+        column.fractionBits = get32(entry + 12);
+        uint64_t offset = get64(entry + 16);
+        column.bytes = get64(entry + 24);
+        column.data = head + offset;
+
+        bool known = column.scalar == ScalarCode::Float32 || column.scalar == ScalarCode::Float64 ||
+                     (column.scalar == ScalarCode::Fixed32 && column.fractionBits < 31);
+        // Divide rather than multiply, so that no product can wrap around
+        if (!known || column.components == 0 || column.components > maxComponents(column.id) ||
+            offset > mappingSize || column.bytes > mappingSize - offset ||
+            column.bytes % column.elementBytes() != 0 || column.bytes / column.elementBytes() != header.particleCount) {
+            ::munmap(mapping, mappingSize);
+            mapping = nullptr;
+            throw std::runtime_error("ERROR::SNAPSHOT::CORRUPT_COLUMN " + path);
+        }
+        columns.push_back(column);
+    }
+}
+
+MappedSnapshot::~MappedSnapshot() {
+    if (mapping != nullptr) {
+        ::munmap(mapping, mappingSize);
+    }
+}
+
+/**
+ * Returns the column with the given id, or null if the snapshot does not have it.
+ */
+const SnapshotColumn *MappedSnapshot::find(SnapshotColumnId id) const {
+    for (const SnapshotColumn &column : columns) {
+        if (column.id == id) {
+            return &column;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,86 @@
+//
+// Parameter sweeps: runs an ensemble of headless simulations and writes their results.
+//
+
+#include "Ensemble.hpp"
+#include "ThreadPool.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+template <typename T>
+static std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream stream(text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        std::stringstream parsed(item);
+        T value;
+        if (parsed >> value) {
+            values.push_back(value);
+        }
+    }
+    return values;
+}
+
+// Usage: part1_sweep [--particles 17,100] [--dt 0.01,0.005] [--mass-ratio 1,4] [--seeds 8]
+//                    [--steps 1000] [--threads N] [--lockstep 1] [--out sweep.csv]
+// Writes one row per member to the output and one per parameter combination to <output>.summary.csv.
+int main(int argc, char** argv) {
+    EnsembleMember base;
+    std::vector<std::size_t> particleCounts{base.particles};
+    std::vector<double> timesteps{base.dt};
+    std::vector<double> massRatios{base.massRatio};
+    unsigned seeds = 8;
+    unsigned threads = 0;
+    bool lockstep = false;
+    std::string output = "sweep.csv";
+    for (int a = 1; a + 1 < argc; a += 2) {
+        const std::string option = argv[a];
+        const std::string value = argv[a + 1];
+        if (option == "--particles") {
+            particleCounts = parseList<std::size_t>(value);
+        } else if (option == "--dt") {
+            timesteps = parseList<double>(value);
+        } else if (option == "--mass-ratio") {
+            massRatios = parseList<double>(value);
+        } else if (option == "--seeds") {
+            seeds = unsigned(std::atoi(value.c_str()));
+        } else if (option == "--steps") {
+            base.steps = uint32_t(std::atoi(value.c_str()));
+        } else if (option == "--threads") {
+            threads = unsigned(std::atoi(value.c_str()));
+        } else if (option == "--lockstep") {
+            lockstep = std::atoi(value.c_str()) != 0;
+        } else if (option == "--out") {
+            output = value;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 1;
+        }
+    }
+
+    ThreadPool pool(threads);
+    const std::vector<EnsembleMember> members = ensembleGrid(base, particleCounts, timesteps, massRatios, seeds);
+    const auto start = std::chrono::steady_clock::now();
+    const std::vector<EnsembleResult> results = runEnsemble(members, &pool, lockstep);
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double particleSteps = 0.0;
+    for (const EnsembleResult& result : results) {
+        particleSteps += double(result.particleCount) * double(result.steps);
+    }
+    try {
+        writeEnsembleResults(output, results);
+        writeEnsembleSummary(output + ".summary.csv", results);
+    } catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    std::cout << members.size() << " members on " << pool.size() << " threads in " << seconds << " s, "
+              << particleSteps / seconds << " particle-steps/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,161 @@
+//
+// A small fixed-size pool of worker threads for data-parallel loops.
+//
+
+#include "ThreadPool.hpp"
+
+namespace {
+
+/**
+ * The pool whose task the current thread is running, and its index there; set while a chunk runs
+ * so that a nested run() on the same pool can tell it would wait for itself.
+ */
+struct PoolContext {
+    const ThreadPool *pool = nullptr;
+    unsigned thread = 0;
+};
+
+thread_local PoolContext currentContext;
+
+/**
+ * Marks the current thread as running a chunk of a pool until it goes out of scope.
+ */
+class ContextScope {
+public:
+    ContextScope(const ThreadPool *pool, unsigned thread) : saved(currentContext) {
+        currentContext.pool = pool;
+        currentContext.thread = thread;
+    }
+    ~ContextScope() { currentContext = saved; }
+
+private:
+    PoolContext saved;
+};
+
+}
+
+/**
+ * Starts the pool.
+ * @param threadCount Number of threads including the caller; 0 picks the hardware concurrency.
+ */
+ThreadPool::ThreadPool(unsigned threadCount) {
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned thread = 1; thread < threadCount; ++thread) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, thread);
+    }
+}
+
+/**
+ * Stops and joins the worker threads.
+ */
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * Calls task(chunk, thread) once for every chunk in [0, chunkCount) and waits for all of them.
+ * A call from inside one of this pool's tasks runs its chunks inline on the calling thread.
+ * @param chunkCount Number of chunks.
+ * @param task The work for one chunk.
+ */
+void ThreadPool::run(std::size_t chunkCount, const std::function<void(std::size_t, unsigned)> &task) {
+    if (chunkCount == 0) {
+        return;
+    }
+
+    if (currentContext.pool == this) {
+        const unsigned thread = currentContext.thread;
+        for (std::size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            task(chunk, thread);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+    if (workers.empty() || chunkCount == 1) {
+        ContextScope scope(this, 0);
+        for (std::size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            task(chunk, 0);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        currentTask = &task;
+        currentChunks = chunkCount;
+        nextChunk.store(0, std::memory_order_relaxed);
+        busyWorkers = unsigned(workers.size());
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(stateMutex);
+    finished.wait(lock, [this] { return busyWorkers == 0; });
+    currentTask = nullptr;
+    if (failure) {
+        std::exception_ptr thrown = failure;
+        failure = nullptr;
+        std::rethrow_exception(thrown);
+    }
+}
+
+/**
+ * Claims and runs chunks of the current task until none are left. The first exception a chunk
+ * throws is kept for run() to rethrow, and no further chunks are started after it.
+ * @param thread Index of the calling thread.
+ */
+void ThreadPool::drain(unsigned thread) {
+    ContextScope scope(this, thread);
+    for (;;) {
+        std::size_t chunk = nextChunk.fetch_add(1, std::memory_order_relaxed);
+        if (chunk >= currentChunks) {
+            return;
+        }
+        try {
+            (*currentTask)(chunk, thread);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            if (!failure) {
+                failure = std::current_exception();
+            }
+            nextChunk.store(currentChunks, std::memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * Body of every worker thread: wait for a new task, help drain it, report completion.
+ * @param thread Index of the worker, in [1, size()).
+ */
+void ThreadPool::workerLoop(unsigned thread) {
+    unsigned seenGeneration = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            wake.wait(lock, [&] { return stopping || generation != seenGeneration; });
+            if (stopping) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        drain(thread);
+
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (--busyWorkers == 0) {
+            finished.notify_one();
+        }
+    }
+}
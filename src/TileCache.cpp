@@ -0,0 +1,191 @@
+//
+// Least-recently-used cache of memory-mapped tile files with a background prefetcher.
+//
+
+#include "TileCache.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+/**
+ * Maps a file, reading its pages in if asked to.
+ * @param path The file.
+ * @param populate Whether to read every page in now.
+ */
+MappedTile::MappedTile(const std::string &path, bool populate) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::TILE_CACHE::CANNOT_OPEN " + path);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0) {
+        ::close(fd);
+        throw std::runtime_error("ERROR::TILE_CACHE::CANNOT_OPEN " + path);
+    }
+    length = std::size_t(status.st_size);
+    if (length > 0) {
+        void *mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE | (populate ? MAP_POPULATE : 0), fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("ERROR::TILE_CACHE::CANNOT_MAP " + path);
+        }
+        bytes = static_cast<const unsigned char *>(mapped);
+    }
+    ::close(fd);
+}
+
+MappedTile::~MappedTile() {
+    if (bytes != nullptr) {
+        ::munmap(const_cast<unsigned char *>(bytes), length);
+    }
+}
+
+/**
+ * @param capacity The number of tiles kept mapped.
+ */
+TileCache::TileCache(std::size_t capacity) : capacity(std::max<std::size_t>(1, capacity)) {
+    prefetcher = std::thread(&TileCache::prefetchLoop, this);
+}
+
+/**
+ * Stops the prefetch thread.
+ */
+TileCache::~TileCache() {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    prefetcher.join();
+}
+
+/**
+ * Returns the mapped file at path, mapping it if necessary.
+ */
+std::shared_ptr<const MappedTile> TileCache::acquire(const std::string &path) {
+    const auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> guard(lock);
+    changed.wait(guard, [&] { return loading.count(path) == 0; });
+
+    auto found = entries.find(path);
+    if (found != entries.end()) {
+        ++stats.hits;
+        recency.splice(recency.begin(), recency, found->second.use);
+        stats.waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return found->second.tile;
+    }
+
+    ++stats.misses;
+    guard.unlock();
+    std::shared_ptr<const MappedTile> tile = std::make_shared<MappedTile>(path);
+    guard.lock();
+    insert(path, tile);
+    stats.waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return tile;
+}
+
+/**
+ * Asks the prefetch thread to map the file at path unless it is cached already.
+ */
+void TileCache::prefetch(const std::string &path) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (entries.count(path) != 0 || loading.count(path) != 0) {
+            return;
+        }
+        requests.push_back(path);
+    }
+    changed.notify_all();
+}
+
+/**
+ * Discards pending prefetches and every cached tile.
+ */
+void TileCache::clear() {
+    std::unique_lock<std::mutex> guard(lock);
+    requests.clear();
+    changed.wait(guard, [&] { return loading.empty(); });
+    entries.clear();
+    recency.clear();
+}
+
+/**
+ * Changes the number of tiles kept mapped, evicting tiles beyond the new capacity.
+ */
+void TileCache::setCapacity(std::size_t tiles) {
+    std::lock_guard<std::mutex> guard(lock);
+    capacity = std::max<std::size_t>(1, tiles);
+    while (recency.size() > capacity) {
+        entries.erase(recency.back());
+        recency.pop_back();
+        ++stats.evicted;
+    }
+}
+
+TileCacheStats TileCache::getStats() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return stats;
+}
+
+/**
+ * Adds a tile as the most recently used, evicting the least recently used beyond capacity.
+ * The lock must be held.
+ */
+void TileCache::insert(const std::string &path, const std::shared_ptr<const MappedTile> &tile) {
+    auto found = entries.find(path);
+    if (found != entries.end()) {
+        recency.splice(recency.begin(), recency, found->second.use);
+        return;
+    }
+    recency.push_front(path);
+    entries[path] = Entry{tile, recency.begin()};
+    stats.bytesMapped += tile->size();
+    while (recency.size() > capacity) {
+        entries.erase(recency.back());
+        recency.pop_back();
+        ++stats.evicted;
+    }
+}
+
+/**
+ * Maps requested tiles ahead of acquire(), one at a time and in request order.
+ */
+void TileCache::prefetchLoop() {
+    std::unique_lock<std::mutex> guard(lock);
+    for (;;) {
+        changed.wait(guard, [&] { return stopping || !requests.empty(); });
+        if (stopping) {
+            return;
+        }
+        std::string path = requests.front();
+        requests.pop_front();
+        if (entries.count(path) != 0 || loading.count(path) != 0) {
+            continue;
+        }
+
+        loading.insert(path);
+        guard.unlock();
+        std::shared_ptr<const MappedTile> tile;
+        try {
+            tile = std::make_shared<MappedTile>(path, true);
+        } catch (const std::exception &) {
+            // Left for acquire() to report.
+        }
+        guard.lock();
+        loading.erase(path);
+        if (tile) {
+            insert(path, tile);
+            ++stats.prefetched;
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,491 @@
+//
+// Compressed trajectory files, written in the background while a simulation runs.
+//
+
+#include "Trajectory.hpp"
+#include "ByteOrder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char kMagic[8] = {'P', 'S', 'I', 'M', 'T', 'R', 'A', 'J'};
+const char kFrameMarker[4] = {'F', 'R', 'M', 'E'};
+const uint32_t kVersion = 1;
+const std::size_t kFileHeaderBytes = 32;
+const std::size_t kFrameHeaderBytes = 48;
+const std::size_t kColumnEntryBytes = 32;
+const uint32_t kKeyframeFlag = 1;
+
+// Run-length tokens: 0..127 are followed by token + 1 literal bytes, 128..255 stand for
+// token - 127 zero bytes.
+const std::size_t kMaxLiteralRun = 128;
+const std::size_t kMaxZeroRun = 128;
+
+template <typename Word>
+Word loadWord(const unsigned char *p) {
+    Word word;
+    std::memcpy(&word, p, sizeof(Word));
+    return word;
+}
+
+/**
+ * Replaces each word by its residual against the previous frame, in byte planes.
+ */
+template <typename Word>
+void predictAndShuffle(const unsigned char *current, const unsigned char *previous, std::size_t words,
+                       bool fixedPoint, unsigned char *planes) {
+    for (std::size_t i = 0; i < words; ++i) {
+        Word word = loadWord<Word>(current + i * sizeof(Word));
+        Word residual = word;
+        if (previous != nullptr) {
+            Word before = loadWord<Word>(previous + i * sizeof(Word));
+            if (fixedPoint) {
+                Word delta = Word(word - before);
+                residual = Word(delta << 1) ^ Word(Word(0) - (delta >> (8 * sizeof(Word) - 1)));
+            } else {
+                residual = word ^ before;
+            }
+        }
+        for (std::size_t b = 0; b < sizeof(Word); ++b) {
+            planes[b * words + i] = (unsigned char) (residual >> (8 * b));
+        }
+    }
+}
+
+/**
+ * Inverse of predictAndShuffle.
+ */
+template <typename Word>
+void unshuffleAndReconstruct(const unsigned char *planes, std::size_t words, bool fixedPoint,
+                             const unsigned char *previous, unsigned char *out) {
+    for (std::size_t i = 0; i < words; ++i) {
+        Word residual = 0;
+        for (std::size_t b = 0; b < sizeof(Word); ++b) {
+            residual |= Word(planes[b * words + i]) << (8 * b);
+        }
+        Word word = residual;
+        if (previous != nullptr) {
+            Word before = loadWord<Word>(previous + i * sizeof(Word));
+            if (fixedPoint) {
+                Word delta = Word(residual >> 1) ^ Word(Word(0) - (residual & 1));
+                word = Word(before + delta);
+            } else {
+                word = residual ^ before;
+            }
+        }
+        std::memcpy(out + i * sizeof(Word), &word, sizeof(Word));
+    }
+}
+
+void appendRuns(const unsigned char *bytes, std::size_t size, std::vector<unsigned char> &out) {
+    std::size_t i = 0;
+    while (i < size) {
+        std::size_t zeros = 0;
+        while (i + zeros < size && zeros < kMaxZeroRun && bytes[i + zeros] == 0) {
+            ++zeros;
+        }
+        if (zeros >= 2) {
+            out.push_back((unsigned char) (127 + zeros));
+            i += zeros;
+            continue;
+        }
+
+        // Literal run up to the next pair of zero bytes.
+        std::size_t literal = 0;
+        while (i + literal < size && literal < kMaxLiteralRun &&
+               !(bytes[i + literal] == 0 && i + literal + 1 < size && bytes[i + literal + 1] == 0)) {
+            ++literal;
+        }
+        out.push_back((unsigned char) (literal - 1));
+        out.insert(out.end(), bytes + i, bytes + i + literal);
+        i += literal;
+    }
+}
+
+bool expandRuns(const unsigned char *in, std::size_t size, unsigned char *out, std::size_t expected) {
+    std::size_t written = 0;
+    std::size_t i = 0;
+    while (i < size) {
+        unsigned token = in[i++];
+        if (token >= 128) {
+            std::size_t zeros = token - 127;
+            if (written + zeros > expected) {
+                return false;
+            }
+            std::memset(out + written, 0, zeros);
+            written += zeros;
+        } else {
+            std::size_t literal = token + 1;
+            if (i + literal > size || written + literal > expected) {
+                return false;
+            }
+            std::memcpy(out + written, in + i, literal);
+            written += literal;
+            i += literal;
+        }
+    }
+    return written == expected;
+}
+
+}
+
+/**
+ * Appends the lossless encoding of a column to out.
+ * @param column The column to encode; data holds its elements in host byte order.
+ * @param previous The same column in the previous frame, or null to encode a keyframe.
+ * @param out Receives the encoded bytes.
+ */
+void encodeTrajectoryColumn(const SnapshotColumn &column, const void *previous, std::vector<unsigned char> &out) {
+    const std::size_t size = std::size_t(column.bytes);
+    const bool fixedPoint = column.scalar == ScalarCode::Fixed32;
+    const unsigned char *current = static_cast<const unsigned char *>(column.data);
+    const unsigned char *before = static_cast<const unsigned char *>(previous);
+
+    std::vector<unsigned char> planes(size);
+    if (column.scalar == ScalarCode::Float64) {
+        predictAndShuffle<uint64_t>(current, before, size / 8, fixedPoint, planes.data());
+    } else {
+        predictAndShuffle<uint32_t>(current, before, size / 4, fixedPoint, planes.data());
+    }
+    appendRuns(planes.data(), size, out);
+}
+
+/**
+ * Decodes a column written by encodeTrajectoryColumn.
+ * @param column The layout and decoded size of the column; data is ignored.
+ * @param encoded The encoded bytes.
+ * @param encodedBytes The number of encoded bytes.
+ * @param previous The decoded column of the previous frame, or null for a keyframe.
+ * @param out Receives column.bytes bytes in host byte order; may be the same memory as previous.
+ */
+void decodeTrajectoryColumn(const SnapshotColumn &column, const unsigned char *encoded, std::size_t encodedBytes,
+                            const void *previous, void *out) {
+    const std::size_t size = std::size_t(column.bytes);
+    std::vector<unsigned char> planes(size);
+    if (!expandRuns(encoded, encodedBytes, planes.data(), size)) {
+        throw std::runtime_error("ERROR::TRAJECTORY::CORRUPT_COLUMN");
+    }
+
+    const bool fixedPoint = column.scalar == ScalarCode::Fixed32;
+    const unsigned char *before = static_cast<const unsigned char *>(previous);
+    unsigned char *decoded = static_cast<unsigned char *>(out);
+    if (column.scalar == ScalarCode::Float64) {
+        unshuffleAndReconstruct<uint64_t>(planes.data(), size / 8, fixedPoint, before, decoded);
+    } else {
+        unshuffleAndReconstruct<uint32_t>(planes.data(), size / 4, fixedPoint, before, decoded);
+    }
+}
+
+/**
+ * Creates the trajectory file and starts the writer thread.
+ * @param path The file to write.
+ * @param dimension The dimension of the recorded simulation.
+ * @param options What to record.
+ */
+TrajectoryRecorder::TrajectoryRecorder(const std::string &path, uint32_t dimension, const TrajectoryOptions &options)
+        : options(options), freeFrames(std::max(1u, options.queueDepth)), fullFrames(std::max(1u, options.queueDepth)) {
+    this->options.stride = std::max(1u, options.stride);
+    this->options.framesPerChunk = std::max(1u, options.framesPerChunk);
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        throw std::runtime_error("ERROR::TRAJECTORY::CANNOT_OPEN_FOR_WRITING " + path);
+    }
+    unsigned char header[kFileHeaderBytes] = {};
+    std::memcpy(header, kMagic, sizeof(kMagic));
+    put32(header + 8, kVersion);
+    put32(header + 12, dimension);
+    put32(header + 16, this->options.stride);
+    put32(header + 20, this->options.framesPerChunk);
+    put32(header + 24, this->options.attributes);
+    file.write(reinterpret_cast<const char *>(header), sizeof(header));
+    bytesWritten.store(sizeof(header), std::memory_order_relaxed);
+
+    for (unsigned f = 0; f < std::max(1u, options.queueDepth); ++f) {
+        frames.emplace_back(new TrajectoryFrame());
+        freeFrames.push(frames.back().get());
+    }
+    writer = std::thread(&TrajectoryRecorder::writerLoop, this);
+}
+
+/**
+ * Writes all captured frames and closes the file.
+ */
+TrajectoryRecorder::~TrajectoryRecorder() {
+    finish();
+}
+
+/**
+ * Queues a frame without blocking.
+ * @param step The number of calls to simulate() so far.
+ * @param time The simulated time.
+ * @param particleCount The number of particles.
+ * @param columns The recorded attributes; their data is copied before capture returns.
+ * @return False if the frame was dropped because the writer is behind or has failed.
+ */
+bool TrajectoryRecorder::capture(uint64_t step, double time, uint64_t particleCount,
+                                 const std::vector<SnapshotColumn> &columns) {
+    TrajectoryFrame *frame = nullptr;
+    if (stopping.load(std::memory_order_relaxed) || failed.load(std::memory_order_relaxed) || !freeFrames.pop(frame)) {
+        framesDropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    frame->step = step;
+    frame->time = time;
+    frame->particleCount = particleCount;
+    frame->layout(columns);
+    for (std::size_t c = 0; c < columns.size(); ++c) {
+        std::memcpy(const_cast<void *>(frame->columns[c].data), columns[c].data, std::size_t(columns[c].bytes));
+    }
+
+    fullFrames.push(frame); // Cannot fail: there are only as many frames as slots
+    wake.notify_one();
+    return true;
+}
+
+/**
+ * Waits until every captured frame is written, then closes the file.
+ */
+void TrajectoryRecorder::finish() {
+    if (!writer.joinable()) {
+        return;
+    }
+    stopping.store(true, std::memory_order_release);
+    wake.notify_one();
+    writer.join();
+    file.close();
+}
+
+/**
+ * Writes queued frames until the recorder stops. Waits are bounded so a wake-up that races with
+ * the check of the queue only delays the writer briefly.
+ */
+void TrajectoryRecorder::writerLoop() {
+    for (;;) {
+        TrajectoryFrame *frame = nullptr;
+        if (fullFrames.pop(frame)) {
+            if (!failed.load(std::memory_order_relaxed)) {
+                writeFrame(*frame);
+            }
+            freeFrames.push(frame);
+            continue;
+        }
+        if (stopping.load(std::memory_order_acquire)) {
+            if (fullFrames.empty()) {
+                return;
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wake.wait_for(lock, std::chrono::milliseconds(2));
+    }
+}
+
+/**
+ * Encodes a frame against the previous one, or as a keyframe, and appends it to the file.
+ * The frame's buffers are swapped with the previous frame's, so nothing is copied.
+ */
+void TrajectoryRecorder::writeFrame(TrajectoryFrame &frame) {
+    bool keyframe = framesSinceKeyframe == 0 || frame.particleCount != previous.particleCount ||
+                    frame.columns.size() != previous.columns.size();
+    for (std::size_t c = 0; c < frame.columns.size() && !keyframe; ++c) {
+        const SnapshotColumn &now = frame.columns[c];
+        const SnapshotColumn &before = previous.columns[c];
+        keyframe = now.id != before.id || now.scalar != before.scalar || now.components != before.components ||
+                   now.fractionBits != before.fractionBits || now.bytes != before.bytes;
+    }
+
+    encoded.clear();
+    encoded.resize(kFrameHeaderBytes + kColumnEntryBytes * frame.columns.size());
+    uint64_t raw = 0;
+    for (std::size_t c = 0; c < frame.columns.size(); ++c) {
+        const SnapshotColumn &column = frame.columns[c];
+        std::size_t start = encoded.size();
+        encodeTrajectoryColumn(column, keyframe ? nullptr : previous.columns[c].data, encoded);
+
+        unsigned char *entry = &encoded[kFrameHeaderBytes + kColumnEntryBytes * c];
+        put32(entry, uint32_t(column.id));
+        put32(entry + 4, uint32_t(column.scalar));
+        put32(entry + 8, column.components);
+        put32(entry + 12, column.fractionBits);
+        put64(entry + 16, column.bytes);
+        put64(entry + 24, encoded.size() - start);
+        raw += column.bytes;
+    }
+
+    unsigned char *head = encoded.data();
+    std::memcpy(head, kFrameMarker, sizeof(kFrameMarker));
+    put32(head + 4, keyframe ? kKeyframeFlag : 0);
+    put64(head + 8, frame.step);
+    putDouble(head + 16, frame.time);
+    put64(head + 24, frame.particleCount);
+    put32(head + 32, uint32_t(frame.columns.size()));
+    put64(head + 40, encoded.size());
+
+    file.write(reinterpret_cast<const char *>(encoded.data()), std::streamsize(encoded.size()));
+    if (!file) {
+        failed.store(true, std::memory_order_relaxed);
+        return;
+    }
+
+    std::swap(previous, frame);
+    framesSinceKeyframe = (keyframe ? 1 : framesSinceKeyframe + 1) % options.framesPerChunk;
+    framesWritten.fetch_add(1, std::memory_order_relaxed);
+    rawBytes.fetch_add(raw, std::memory_order_relaxed);
+    bytesWritten.fetch_add(encoded.size(), std::memory_order_relaxed);
+}
+
+/**
+ * Maps a trajectory file and indexes its frames.
+ * @param path The trajectory file.
+ */
+TrajectoryReader::TrajectoryReader(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("ERROR::TRAJECTORY::CANNOT_OPEN " + path);
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0 || std::size_t(status.st_size) < kFileHeaderBytes) {
+        ::close(fd);
+        throw std::runtime_error("ERROR::TRAJECTORY::TRUNCATED " + path);
+    }
+    mappingSize = std::size_t(status.st_size);
+    void *mapped = ::mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("ERROR::TRAJECTORY::CANNOT_MAP " + path);
+    }
+    mapping = static_cast<unsigned char *>(mapped);
+
+    if (std::memcmp(mapping, kMagic, sizeof(kMagic)) != 0 || get32(mapping + 8) != kVersion) {
+        ::munmap(mapping, mappingSize);
+        throw std::runtime_error("ERROR::TRAJECTORY::NOT_A_TRAJECTORY " + path);
+    }
+    dimension = get32(mapping + 12);
+    attributes = get32(mapping + 24);
+
+    std::size_t keyframe = 0;
+    uint64_t offset = kFileHeaderBytes;
+    while (offset + kFrameHeaderBytes <= mappingSize) {
+        const unsigned char *head = mapping + offset;
+        const uint64_t frameBytes = get64(head + 40);
+        if (std::memcmp(head, kFrameMarker, sizeof(kFrameMarker)) != 0 || frameBytes < kFrameHeaderBytes ||
+            frameBytes > mappingSize - offset) {
+            break;
+        }
+        const bool isKeyframe = (get32(head + 4) & kKeyframeFlag) != 0;
+        if (isKeyframe) {
+            keyframe = index.size();
+        } else if (index.empty()) {
+            break; // A delta frame with nothing to apply it to
+        }
+        index.push_back(TrajectoryFrameInfo{offset, get64(head + 8), getDouble(head + 16), keyframe});
+        offset += frameBytes;
+    }
+}
+
+TrajectoryReader::~TrajectoryReader() {
+    ::munmap(mapping, mappingSize);
+}
+
+/**
+ * Returns the last frame recorded at or before the given time, or 0 if there is none.
+ */
+std::size_t TrajectoryReader::findFrame(double time) const {
+    std::size_t low = 0;
+    std::size_t high = index.size();
+    while (low < high) {
+        std::size_t middle = (low + high) / 2;
+        if (index[middle].time <= time) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low > 0 ? low - 1 : 0;
+}
+
+/**
+ * Decodes a frame.
+ * @param frame The index of the frame, less than getFrameCount().
+ * @param out Receives the frame; if it holds frame - 1 of this file, only one frame is decoded.
+ */
+void TrajectoryReader::read(std::size_t frame, TrajectoryFrame &out) const {
+    const std::size_t keyframe = index[frame].keyframe;
+    std::size_t start = keyframe;
+    if (!out.columns.empty() && out.index + 1 == frame && frame != keyframe) {
+        start = frame;
+    } else if (!out.columns.empty() && out.index == frame) {
+        return;
+    }
+    for (std::size_t f = start; f <= frame; ++f) {
+        decodeInto(f, out);
+    }
+}
+
+/**
+ * Decodes the frame at the given index into out, using out as the previous frame unless it is a
+ * keyframe.
+ */
+void TrajectoryReader::decodeInto(std::size_t frame, TrajectoryFrame &out) const {
+    const unsigned char *head = mapping + index[frame].offset;
+    const uint64_t frameBytes = get64(head + 40);
+    const uint32_t columnCount = get32(head + 32);
+    const bool isKeyframe = (get32(head + 4) & kKeyframeFlag) != 0;
+    if (kFrameHeaderBytes + kColumnEntryBytes * uint64_t(columnCount) > frameBytes) {
+        throw std::runtime_error("ERROR::TRAJECTORY::CORRUPT_FRAME");
+    }
+
+    std::vector<SnapshotColumn> layouts(columnCount);
+    for (uint32_t c = 0; c < columnCount; ++c) {
+        const unsigned char *entry = head + kFrameHeaderBytes + kColumnEntryBytes * c;
+        layouts[c] = SnapshotColumn{SnapshotColumnId(get32(entry)), ScalarCode(get32(entry + 4)), get32(entry + 8),
+                                    get32(entry + 12), nullptr, get64(entry + 16)};
+    }
+    if (isKeyframe) {
+        out.layout(layouts);
+    } else if (out.columns.size() != columnCount) {
+        throw std::runtime_error("ERROR::TRAJECTORY::CORRUPT_FRAME");
+    }
+
+    uint64_t position = kFrameHeaderBytes + kColumnEntryBytes * uint64_t(columnCount);
+    for (uint32_t c = 0; c < columnCount; ++c) {
+        const unsigned char *entry = head + kFrameHeaderBytes + kColumnEntryBytes * c;
+        const uint64_t encodedBytes = get64(entry + 24);
+        if (encodedBytes > frameBytes - position || out.columns[c].bytes != layouts[c].bytes) {
+            throw std::runtime_error("ERROR::TRAJECTORY::CORRUPT_FRAME");
+        }
+        void *column = const_cast<void *>(out.columns[c].data);
+        decodeTrajectoryColumn(layouts[c], head + position, std::size_t(encodedBytes),
+                               isKeyframe ? nullptr : column, column);
+        position += encodedBytes;
+    }
+
+    out.index = frame;
+    out.step = get64(head + 8);
+    out.time = getDouble(head + 16);
+    out.particleCount = get64(head + 24);
+    out.keyframe = isKeyframe;
+}
+
+/**
+ * Asks the kernel to read the bytes of frames [first, last) into the page cache.
+ */
+void TrajectoryReader::willNeed(std::size_t first, std::size_t last) const {
+    if (first >= last || first >= index.size()) {
+        return;
+    }
+    const long pageSize = ::sysconf(_SC_PAGESIZE);
+    uint64_t begin = index[first].offset / uint64_t(pageSize) * uint64_t(pageSize);
+    uint64_t end = last < index.size() ? index[last].offset : mappingSize;
+    ::madvise(mapping + begin, std::size_t(end - begin), MADV_WILLNEED);
+}
@@ -0,0 +1,71 @@
+//
+// Renders the particle state a simulation publishes to shared memory, in a separate process.
+//
+
+#include <SDL2/SDL.h>
+#include "glad/glad.h"
+#include "Shader.hpp"
+#include "Render.hpp"
+#include "Replay.hpp"
+#include "SharedState.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Usage: part1_viewer [name], where name is the shared memory object given to part1 --share.
+int main(int argc, char** argv) {
+    const std::string name = argc >= 2 ? argv[1] : "psim";
+
+    Render render;
+    SDL_Window* window = render.getWindow();
+    SDL_GLContext context = render.getContext();
+    if (window == nullptr || context == nullptr) {
+        std::cerr << "Failed to create window: " << SDL_GetError() << std::endl;
+        SDL_Quit();
+        return -1;
+    }
+    if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
+        std::cerr << "Failed to initialize OpenGL context" << std::endl;
+        SDL_GL_DeleteContext(context);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return -1;
+    }
+
+    Shader shader("./shaders/vert.glsl", "./shaders/frag.glsl");
+    SharedStateReader reader(name);
+    SharedFrame frame;
+    std::vector<VertexData> vertices;
+    std::vector<VertexData> converted;
+
+    bool running = true;
+    while (running) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_WINDOWEVENT && event.window.event == SDL_WINDOWEVENT_CLOSE)) {
+                running = false;
+            }
+        }
+
+        // Convert the latest frame straight out of shared memory; keep the previous vertices if
+        // the simulation overwrote the frame while it was being read.
+        if (reader.latest(frame)) {
+            frameVertices(frame.particleCount, frame.columns, converted);
+            if (reader.valid(frame)) {
+                vertices.swap(converted);
+            }
+        }
+
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glEnable(GL_DEPTH_TEST);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        render.draw(shader, vertices);
+        SDL_GL_SwapWindow(window);
+    }
+
+    SDL_GL_DeleteContext(context);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 0;
+}
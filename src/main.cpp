@@ -8,7 +8,12 @@
 #include "Particle.hpp"
 #include "Render.hpp"
 #include "Simulation.hpp"
+#include "Replay.hpp"
 #include "iostream"
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <memory>
 
 void checkGLError(const std::string& checkpoint) {
     GLenum err;
@@ -62,12 +67,67 @@ int main(int argc, char** argv) {
 
 
     // Add some particles to the simulation
-    simulation.addParticle(Particle(glm::vec3(-0.5f, 1.0f, 0.0f), glm::vec3(0.009f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), 1.0f));
-    simulation.addParticle(Particle(glm::vec3(0.5f, 1.0f, 0.0f), glm::vec3(-0.001f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), 0.2f));
+    simulation.addParticle(Simulation::ParticleType(glm::vec3(-0.5f, 1.0f, 0.0f), glm::vec3(0.009f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), 1.0f));
+    simulation.addParticle(Simulation::ParticleType(glm::vec3(0.5f, 1.0f, 0.0f), glm::vec3(-0.001f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), 0.2f));
 
     // Random particles
     simulation.addRandomParticles(15);
 
+    // Play a recorded trajectory instead of simulating: part1 --replay <file> [rate]
+    std::unique_ptr<ReplaySource> replay;
+    TrajectoryFrame frame;
+    std::vector<VertexData> vertices;
+    Uint32 lastTicks = SDL_GetTicks();
+    if (argc >= 3 && std::string(argv[1]) == "--replay") {
+        try {
+            replay.reset(new ReplaySource(argv[2]));
+        } catch (const std::exception &error) {
+            std::cerr << "Failed to open trajectory: " << error.what() << std::endl;
+            SDL_GL_DeleteContext(context);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return -1;
+        }
+        replay->setPlaybackRate(argc >= 4 ? std::atof(argv[3]) : 1.0);
+    }
+
+    // Publish every frame for part1_viewer or other readers: part1 --share <name>
+    std::unique_ptr<SharedStateWriter> shared;
+    if (argc >= 3 && std::string(argv[1]) == "--share") {
+        try {
+            shared.reset(new SharedStateWriter(argv[2], SIM_DIMENSION));
+        } catch (const std::exception &error) {
+            std::cerr << "Failed to create shared state: " << error.what() << std::endl;
+            SDL_GL_DeleteContext(context);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return -1;
+        }
+        simulation.setSharedState(shared.get());
+    }
+
+    // Serve live metrics in the Prometheus format on localhost: part1 --metrics <port>
+    MetricsRegistry registry;
+    SimulationMetrics metrics(registry);
+    std::unique_ptr<MetricsServer> metricsServer;
+    if (argc >= 3 && std::string(argv[1]) == "--metrics") {
+        try {
+            metricsServer.reset(new MetricsServer(registry, uint16_t(std::atoi(argv[2]))));
+        } catch (const std::runtime_error &error) {
+            std::cerr << "Failed to start the metrics server: " << error.what() << std::endl;
+            SDL_GL_DeleteContext(context);
+            SDL_DestroyWindow(window);
+            SDL_Quit();
+            return -1;
+        }
+        simulation.setMetrics(&metrics);
+        std::cout << "Metrics at http://127.0.0.1:" << metricsServer->getPort() << "/metrics" << std::endl;
+    }
+
+    // The performance overlay is toggled with F1; frames are only timed while it is shown
+    std::cout << "Press F1 to show or hide the performance overlay" << std::endl;
+    const double ticksPerSecond = double(SDL_GetPerformanceFrequency());
+
 
     bool running = true;
     while (running) {
@@ -82,6 +142,11 @@ int main(int argc, char** argv) {
                         running = false;
                     }
                     break;
+                case SDL_KEYDOWN:
+                    if (event.key.keysym.sym == SDLK_F1) {
+                        render.setHudEnabled(!render.isHudEnabled());
+                    }
+                    break;
                 default:
                     break;
             }
@@ -93,12 +158,46 @@ int main(int argc, char** argv) {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         checkGLError("After clearing the screen");
 
-        // Simulate and render
-        simulation.simulate(0.01f);
-        simulation.render();
+        // Simulate and render, or show the next due frame of the replay
+        const bool timed = render.isHudEnabled();
+        const Uint64 frameStart = timed ? SDL_GetPerformanceCounter() : 0;
+        if (replay) {
+            Uint32 ticks = SDL_GetTicks();
+            if (replay->advance((ticks - lastTicks) / 1000.0, frame)) {
+                frameVertices(frame, vertices);
+            }
+            lastTicks = ticks;
+        } else {
+            simulation.simulate(0.01f);
+        }
+        const Uint64 simulated = timed ? SDL_GetPerformanceCounter() : 0;
+        if (replay) {
+            render.draw(shader, vertices);
+        } else {
+            simulation.render();
+        }
+        if (timed) {
+            HudStats stats;
+            stats.particles = replay ? vertices.size() : simulation.getParticleCount();
+            if (!replay) {
+                stats.contacts = simulation.getContactCount();
+                stats.gridCells = simulation.getGrid().cellCount();
+                stats.cellSize = simulation.getGrid().getCellSize();
+                stats.searchedCells = UniformGrid<SIM_DIMENSION, Simulation::Position>::neighbourhoodSize();
+            }
+            render.drawHud(stats);
+        }
         checkGLError("After simulating and rendering");
+        const Uint64 rendered = timed ? SDL_GetPerformanceCounter() : 0;
 
         SDL_GL_SwapWindow(window);
+        if (timed) {
+            FrameTimes times;
+            times.simulate = double(simulated - frameStart) / ticksPerSecond;
+            times.render = double(rendered - simulated) / ticksPerSecond;
+            times.swap = double(SDL_GetPerformanceCounter() - rendered) / ticksPerSecond;
+            render.recordFrame(times);
+        }
         checkGLError("After swapping the window");
     }
 